@@ -0,0 +1,343 @@
+#include "JobSystem.h"
+
+#include <iostream>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <algorithm>
+#include <cstdio>
+
+namespace {
+
+	// queue of the calling thread, set once by each worker
+	thread_local int currentThread = 0;
+
+	// name of the job or scope running on this thread, inherited by unnamed jobs
+	thread_local const char * currentName = nullptr;
+
+	// job names may be file paths, quotes and backslashes are escaped
+	std::string escapeJson(const std::string & text) {
+		std::string escaped;
+		for (char c : text) {
+			if (c == '"' || c == '\\') {
+				escaped += '\\';
+				escaped += c;
+			} else if ((unsigned char)c < 0x20) {
+				char code[8];
+				snprintf(code, sizeof(code), "\\u%04x", (unsigned char)c);
+				escaped += code;
+			} else {
+				escaped += c;
+			}
+		}
+		return escaped;
+	}
+
+	// chrome trace event format, complete events in microseconds
+	void writeTrace(const std::vector<JobSystem::JobRecord> & records, const char * tracePath) {
+		std::ofstream file(tracePath, std::ios::trunc);
+		if (!file.is_open()) {
+			return;
+		}
+		file << "{\"traceEvents\":[\n";
+		for (size_t i = 0; i < records.size(); ++i) {
+			file << "{\"name\":\"" << escapeJson(records[i].name) << "\",\"ph\":\"X\",\"pid\":0,\"tid\":" << records[i].thread
+				<< ",\"ts\":" << records[i].begin * 1000.0f << ",\"dur\":" << (records[i].end - records[i].begin) * 1000.0f << "}"
+				<< (i + 1 < records.size() ? ",\n" : "\n");
+		}
+		file << "]}\n";
+	}
+
+	std::vector<JobSystem::JobRecord> sortedByBegin(std::vector<JobSystem::JobRecord> records) {
+		std::sort(records.begin(), records.end(), [](const JobSystem::JobRecord & a, const JobSystem::JobRecord & b) {
+			return a.begin < b.begin;
+		});
+		return records;
+	}
+}
+
+JobSystem::JobSystem(int numWorkers) {
+	if (numWorkers <= 0) {
+		numWorkers = std::max(1, (int)std::thread::hardware_concurrency() - 1);
+	}
+
+	frameStart = std::chrono::high_resolution_clock::now();
+	for (int i = 0; i <= numWorkers; ++i) {
+		queues.push_back(new Queue());
+	}
+	for (int i = 1; i <= numWorkers; ++i) {
+		workers.emplace_back(&JobSystem::workerLoop, this, i);
+	}
+}
+
+JobSystem::~JobSystem() {
+	{
+		std::lock_guard<std::mutex> lock(sleepMutex);
+		stop = true;
+	}
+	wakeUp.notify_all();
+	for (auto & worker : workers) {
+		worker.join();
+	}
+	for (auto queue : queues) {
+		delete queue;
+	}
+}
+
+JobSystem & JobSystem::shared() {
+	static JobSystem jobSystem;
+	return jobSystem;
+}
+
+int JobSystem::threadIndex() {
+	return currentThread;
+}
+
+void JobSystem::run(const char * name, std::function<void()> func, Counter * counter, Counter * after) {
+	if (counter) {
+		++counter->pending;
+	}
+	Job job = { std::move(func), counter, name ? name : currentName };
+
+	if (after) {
+		// pending only drops to zero under the lock, so the continuation is
+		// either queued here or picked up by the job that finishes after
+		std::unique_lock<std::mutex> lock(after->mutex);
+		if (after->pending > 0) {
+			auto shared = std::make_shared<Job>(std::move(job));
+			after->continuations.push_back([this, shared] { push(std::move(*shared)); });
+			return;
+		}
+	}
+	push(std::move(job));
+}
+
+void JobSystem::push(Job job) {
+	++queuedJobs;
+	{
+		Queue & queue = *queues[currentThread];
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		queue.jobs.push_back(std::move(job));
+	}
+	{
+		std::lock_guard<std::mutex> lock(sleepMutex);
+	}
+	wakeUp.notify_one();
+}
+
+bool JobSystem::runOne(int thread) {
+	Job job;
+	bool found = false;
+
+	// own jobs newest first, they are likely still in cache
+	{
+		Queue & queue = *queues[thread];
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		if (!queue.jobs.empty()) {
+			job = std::move(queue.jobs.back());
+			queue.jobs.pop_back();
+			found = true;
+		}
+	}
+
+	// steal the oldest job of another thread, usually the largest piece of work left
+	for (size_t i = 1; !found && i < queues.size(); ++i) {
+		Queue & queue = *queues[(thread + i) % queues.size()];
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		if (!queue.jobs.empty()) {
+			job = std::move(queue.jobs.front());
+			queue.jobs.pop_front();
+			found = true;
+		}
+	}
+
+	if (!found) {
+		return false;
+	}
+	--queuedJobs;
+	execute(job, thread);
+	return true;
+}
+
+void JobSystem::execute(Job & job, int thread) {
+	const char * outerName = currentName;
+	currentName = job.name;
+
+	// errors of counted jobs go to whoever waits on the counter
+	std::exception_ptr error;
+	auto begin = std::chrono::high_resolution_clock::now();
+	try {
+		job.func();
+	}
+	catch (...) {
+		if (!job.counter) {
+			currentName = outerName;
+			throw;
+		}
+		error = std::current_exception();
+	}
+	auto end = std::chrono::high_resolution_clock::now();
+
+	currentName = outerName;
+	{
+		std::lock_guard<std::mutex> lock(recordMutex);
+		frameRecords.push_back({ job.name ? job.name : "job", thread,
+			std::chrono::duration<float, std::milli>(begin - frameStart).count(),
+			std::chrono::duration<float, std::milli>(end - frameStart).count() });
+	}
+
+	if (job.counter) {
+		std::vector<std::function<void()>> continuations;
+		{
+			std::lock_guard<std::mutex> lock(job.counter->mutex);
+			if (error && !job.counter->error) {
+				job.counter->error = error;
+			}
+			if (--job.counter->pending == 0) {
+				continuations.swap(job.counter->continuations);
+			}
+		}
+		// the counter may be gone once it reached zero, only the copies are used here
+		for (auto & continuation : continuations) {
+			continuation();
+		}
+	}
+}
+
+void JobSystem::wait(Counter & counter) {
+	while (counter.pending > 0) {
+		if (!runOne(currentThread)) {
+			std::this_thread::yield();
+		}
+	}
+	// the last job may still hold the lock while it collects the continuations
+	std::lock_guard<std::mutex> lock(counter.mutex);
+	if (counter.error) {
+		std::exception_ptr error = counter.error;
+		counter.error = nullptr;
+		std::rethrow_exception(error);
+	}
+}
+
+void JobSystem::parallelFor(const char * name, size_t count, const std::function<void(size_t begin, size_t end)> & func, size_t minItemsPerJob) {
+	size_t numJobs = std::min((size_t)numThreads(), (count + minItemsPerJob - 1) / minItemsPerJob); // not worth a job for a few items
+
+	if (numJobs <= 1) {
+		func(0, count);
+		return;
+	}
+
+	// the calling thread takes the first range and then helps with the rest
+	Counter counter;
+	size_t chunk = (count + numJobs - 1) / numJobs;
+	for (size_t begin = chunk; begin < count; begin += chunk) {
+		size_t end = std::min(count, begin + chunk);
+		run(name, [&func, begin, end] { func(begin, end); }, &counter);
+	}
+	try {
+		func(0, std::min(count, chunk));
+	} catch (...) {
+		// the queued ranges still reference func and the counter
+		try {
+			wait(counter);
+		} catch (...) {
+		}
+		throw;
+	}
+	wait(counter);
+}
+
+void JobSystem::scope(const char * name, const std::function<void()> & func) {
+	Job job = { func, nullptr, name };
+	execute(job, currentThread);
+}
+
+void JobSystem::workerLoop(int thread) {
+	currentThread = thread;
+	while (true) {
+		if (runOne(thread)) {
+			continue;
+		}
+
+		std::unique_lock<std::mutex> lock(sleepMutex);
+		wakeUp.wait(lock, [this] { return stop || queuedJobs > 0; });
+		if (stop) {
+			return;
+		}
+	}
+}
+
+void JobSystem::beginFrame() {
+	std::lock_guard<std::mutex> lock(recordMutex);
+	lastFrameRecords.swap(frameRecords);
+	frameRecords.clear();
+	frameStart = std::chrono::high_resolution_clock::now();
+}
+
+void JobSystem::printLastFrame(const char * tracePath) const {
+	std::vector<JobRecord> records = sortedByBegin(lastFrameRecords);
+
+	struct Summary {
+		int count = 0;
+		float totalMs = 0.0f;
+		float maxMs = 0.0f;
+	};
+	std::map<std::string, Summary> summaries;
+	std::vector<float> busyMs(queues.size(), 0.0f);
+	float frameMs = 0.0f;
+	for (const auto & record : records) {
+		Summary & summary = summaries[record.name];
+		summary.count++;
+		summary.totalMs += record.end - record.begin;
+		summary.maxMs = std::max(summary.maxMs, record.end - record.begin);
+		frameMs = std::max(frameMs, record.end);
+		if (record.thread > 0) {
+			busyMs[record.thread] += record.end - record.begin;
+		}
+	}
+
+	std::cout
+		<< "=================================================================================\n"
+		<< "Jobs of the last frame (" << records.size() << " jobs, " << frameMs << " ms, "
+		<< numThreads() << " threads): \n";
+	for (const auto & summary : summaries) {
+		std::cout << summary.first << ": " << summary.second.count << " jobs, " << summary.second.totalMs
+			<< " ms total, " << summary.second.maxMs << " ms max" << std::endl;
+	}
+	for (size_t t = 1; t < busyMs.size(); ++t) {
+		std::cout << "worker " << t << " busy " << busyMs[t] << " ms" << std::endl;
+	}
+	std::cout
+		<< "=================================================================================\n";
+
+	writeTrace(records, tracePath);
+}
+
+void JobSystem::printTimeline(const std::string & title, const char * tracePath) const {
+	std::vector<JobRecord> records = sortedByBegin(lastFrameRecords);
+
+	float totalMs = 0.0f;
+	std::vector<float> busyMs(queues.size(), 0.0f);
+	for (const auto & record : records) {
+		totalMs = std::max(totalMs, record.end);
+		if (record.thread > 0) {
+			busyMs[record.thread] += record.end - record.begin;
+		}
+	}
+
+	// spans of the main thread may contain the jobs it ran while waiting
+	std::cout
+		<< "=================================================================================\n"
+		<< title << " (" << totalMs << " ms, " << records.size() << " jobs, " << numThreads() << " threads): \n";
+	for (const auto & record : records) {
+		std::cout << "thread " << record.thread << " [" << record.begin << ", " << record.end << "] ms "
+			<< record.name << " = " << record.end - record.begin << " ms" << std::endl;
+	}
+	for (size_t t = 1; t < busyMs.size(); ++t) {
+		std::cout << "worker " << t << " busy " << busyMs[t] << " ms" << std::endl;
+	}
+	std::cout
+		<< "=================================================================================\n";
+
+	writeTrace(records, tracePath);
+}
@@ -0,0 +1,113 @@
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <string>
+#include <functional>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <chrono>
+#include <exception>
+#include <cstddef>
+
+/************************************************************/
+//			Work stealing job scheduler with a frame profiler
+/************************************************************/
+
+// every thread owns a deque: it pushes and pops its own jobs at the back, idle
+// threads steal the oldest job from the front of another deque. Dependencies
+// are counters, a job can run after a counter reaches zero (continuation) and
+// a waiting thread keeps running jobs instead of blocking
+class JobSystem {
+public:
+	// number of unfinished jobs of a group, safe to reuse once it is zero
+	struct Counter {
+		std::atomic<int> pending{ 0 };
+		std::mutex mutex;
+		std::vector<std::function<void()>> continuations; // pushed when pending hits zero
+		std::exception_ptr error; // first exception of a job, rethrown by wait
+
+		bool done() const { return pending.load() == 0; }
+	};
+
+	// one finished job of the current or last frame
+	struct JobRecord {
+		std::string name;
+		int thread; // 0 = main thread, workers from 1
+		float begin; // ms since the frame began
+		float end;
+	};
+
+	// numWorkers 0 = one per hardware thread besides the main thread
+	explicit JobSystem(int numWorkers = 0);
+	~JobSystem();
+
+	// shared by the application and MeshTools::parallelFor
+	static JobSystem & shared();
+
+	// queue func on the calling thread's deque. counter (optional) is raised now
+	// and lowered when func returns. With after, func is only queued once after
+	// reaches zero. A null name takes the name of the enclosing job or scope
+	void run(const char * name, std::function<void()> func, Counter * counter = nullptr, Counter * after = nullptr);
+
+	// run queued jobs until counter reaches zero. Jobs without a counter must not throw
+	void wait(Counter & counter);
+
+	// split [0, count) into ranges of at least minItemsPerJob, one job each, and wait
+	void parallelFor(const char * name, size_t count, const std::function<void(size_t begin, size_t end)> & func, size_t minItemsPerJob = 1024);
+
+	// run func on the calling thread as a named span of the timeline, jobs
+	// queued inside without a name are attributed to it
+	void scope(const char * name, const std::function<void()> & func);
+
+	// threads that run jobs, main thread included
+	int numThreads() const { return (int)queues.size(); }
+
+	// index of the calling thread, 0 for the main thread and unknown threads
+	static int threadIndex();
+
+	// the records of the frame that ends here become lastFrame()
+	void beginFrame();
+
+	const std::vector<JobRecord> & lastFrame() const { return lastFrameRecords; }
+
+	// print the jobs of the last frame grouped by name and write them as a
+	// chrome://tracing timeline
+	void printLastFrame(const char * tracePath) const;
+
+	// print every job of the last frame in start order with its thread, for
+	// one-off timelines such as startup, and write the same trace
+	void printTimeline(const std::string & title, const char * tracePath) const;
+
+private:
+	struct Job {
+		std::function<void()> func;
+		Counter * counter;
+		const char * name;
+	};
+
+	struct Queue {
+		std::deque<Job> jobs;
+		std::mutex mutex;
+	};
+
+	void push(Job job);
+	bool runOne(int thread);
+	void execute(Job & job, int thread);
+	void workerLoop(int thread);
+
+	std::vector<Queue *> queues; // [0] = main thread
+	std::vector<std::thread> workers;
+	std::atomic<int> queuedJobs{ 0 };
+	std::atomic<bool> stop{ false };
+	std::mutex sleepMutex;
+	std::condition_variable wakeUp;
+
+	// profiler
+	std::chrono::high_resolution_clock::time_point frameStart;
+	std::vector<JobRecord> frameRecords;
+	std::vector<JobRecord> lastFrameRecords;
+	std::mutex recordMutex;
+};
@@ -0,0 +1,640 @@
+#include "LightCulling.h"
+#include "MeshTools.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace {
+
+	// spread the low 10 bits so that there are 2 zero bits between each of them
+	uint32_t expandBits(uint32_t v) {
+		v = (v * 0x00010001u) & 0xFF0000FFu;
+		v = (v * 0x00000101u) & 0x0F00F00Fu;
+		v = (v * 0x00000011u) & 0xC30C30C3u;
+		v = (v * 0x00000005u) & 0x49249249u;
+		return v;
+	}
+
+	// 30 bit morton code of a point in [0, 1]^3
+	uint32_t mortonCode(const glm::vec3 & p) {
+		glm::uvec3 q = glm::uvec3(glm::clamp(p * 1024.0f, 0.0f, 1023.0f));
+		return (expandBits(q.x) << 2) | (expandBits(q.y) << 1) | expandBits(q.z);
+	}
+
+	// lsd radix sort on the morton code in the upper 32 bits, 3 passes of 10 bits.
+	// Stable, so equal codes keep the light order
+	void radixSortMorton(std::vector<uint64_t> & keys) {
+		std::vector<uint64_t> temp(keys.size());
+		for (int shift = 32; shift < 62; shift += 10) {
+			size_t counts[1025] = {};
+			for (uint64_t key : keys) {
+				counts[((key >> shift) & 1023) + 1]++;
+			}
+			for (int i = 0; i < 1024; ++i) {
+				counts[i + 1] += counts[i];
+			}
+			for (uint64_t key : keys) {
+				temp[counts[(key >> shift) & 1023]++] = key;
+			}
+			keys.swap(temp);
+		}
+	}
+
+	// world space aabb of a node while building
+	struct Bounds {
+		glm::vec3 min = glm::vec3(std::numeric_limits<float>::max());
+		glm::vec3 max = glm::vec3(-std::numeric_limits<float>::max());
+
+		void grow(const Bounds & b) {
+			min = glm::min(min, b.min);
+			max = glm::max(max, b.max);
+		}
+	};
+
+	// same as SphereInsideFrustum in computeLightList.comp
+	bool sphereInsideFrustum(const glm::vec3 & c, float r, const TileFrustum & frustum, float zNear, float zFar) {
+		if (c.z - r > zNear || c.z + r < zFar) {
+			return false;
+		}
+
+		for (int i = 0; i < 4; ++i) {
+			if (glm::dot(glm::vec3(frustum.planes[i]), c) - frustum.planes[i].w < -r) {
+				return false;
+			}
+		}
+		return true;
+	}
+}
+
+namespace LightCulling {
+
+	glm::vec3 animatedPosition(const glm::vec3 & beginPos, const glm::vec3 & endPos, float time, float seed) {
+		float t = std::sin(time * seed * .001f);
+		return (1 - t) * beginPos + t * endPos;
+	}
+
+	float animatedPositionError(const glm::vec3 & beginPos, const glm::vec3 & endPos, float time, float seed) {
+		// gpu sin is only accurate to 2^-11 on [-pi, pi], larger arguments also
+		// lose a few ulps of the argument in the range reduction. t stays in [-1, 1]
+		float argument = std::abs(time * seed * .001f);
+		float sinError = std::min(std::ldexp(1.0f, -11) + argument * std::ldexp(1.0f, -21), 2.0f);
+
+		// the lerp and the view transform round to a few ulps of the coordinates
+		float coordinateScale = std::max(glm::length(beginPos), glm::length(endPos));
+		return sinError * glm::length(endPos - beginPos) + coordinateScale * std::ldexp(1.0f, -20);
+	}
+
+	LightCullShape computeCullShape(int type, const glm::vec3 & position, float radius, const glm::vec4 & direction, const glm::vec4 & shape, const glm::mat4 & viewMat) {
+		LightCullShape light;
+		light.type = type;
+		light.axis = glm::vec4(0.0f);
+		light.extent = glm::vec4(0.0f);
+
+		glm::vec3 center = glm::vec3(viewMat * glm::vec4(position, 1.0f));
+		glm::mat3 rotation = glm::mat3(viewMat);
+
+		switch (type) {
+		case LIGHT_SPOT: {
+			glm::vec3 axis = rotation * glm::vec3(direction);
+			float cosTheta = shape.x;
+			float sinTheta = std::sqrt(std::max(0.0f, 1.0f - cosTheta * cosTheta));
+			light.axis = glm::vec4(axis, cosTheta);
+			light.extent = glm::vec4(center, radius);
+
+			// smallest sphere around the cone, wide cones are bounded by the base circle
+			if (cosTheta < 0.70710678f) {
+				light.sphere = glm::vec4(center + axis * radius * cosTheta, radius * sinTheta);
+			}
+			else {
+				float r = radius / (2.0f * cosTheta);
+				light.sphere = glm::vec4(center + axis * r, r);
+			}
+			break;
+		}
+		case LIGHT_TUBE: {
+			glm::vec3 halfSegment = rotation * glm::vec3(direction);
+			light.axis = glm::vec4(halfSegment, radius);
+			light.sphere = glm::vec4(center, glm::length(halfSegment) + radius);
+			break;
+		}
+		case LIGHT_RECT: {
+			// one sided, lit volume is the box of depth = range in front of the rect
+			glm::vec3 normal = rotation * glm::vec3(direction);
+			glm::vec3 tangent = rotation * glm::vec3(shape);
+			float halfWidth = glm::length(tangent);
+			float halfHeight = shape.w;
+			light.axis = glm::vec4(normal, radius * 0.5f);
+			light.extent = glm::vec4(tangent / halfWidth * (halfWidth + radius), halfHeight + radius);
+			light.sphere = glm::vec4(center + normal * radius * 0.5f,
+				glm::length(glm::vec3(halfWidth + radius, halfHeight + radius, radius * 0.5f)));
+			break;
+		}
+		default:
+			light.sphere = glm::vec4(center, radius);
+			break;
+		}
+
+		return light;
+	}
+
+	float maxSignedDistance(const LightCullShape & light, const glm::vec3 & normal, float distance) {
+		switch (light.type) {
+		case LIGHT_SPOT: {
+			// apex, or the point of the spherical cap closest to the plane normal
+			float apex = glm::dot(normal, glm::vec3(light.extent)) - distance;
+			float cosNormalAxis = glm::dot(normal, glm::vec3(light.axis));
+			float cosTheta = light.axis.w;
+			float cap = 1.0f;
+			if (cosNormalAxis < cosTheta) {
+				cap = cosNormalAxis * cosTheta
+					+ std::sqrt(std::max(0.0f, 1.0f - cosNormalAxis * cosNormalAxis)) * std::sqrt(std::max(0.0f, 1.0f - cosTheta * cosTheta));
+			}
+			return std::max(apex, apex + light.extent.w * cap);
+		}
+		case LIGHT_TUBE:
+			return glm::dot(normal, glm::vec3(light.sphere)) - distance
+				+ std::abs(glm::dot(normal, glm::vec3(light.axis))) + light.axis.w;
+		case LIGHT_RECT: {
+			glm::vec3 depthAxis = glm::vec3(light.axis) * light.axis.w;
+			glm::vec3 widthAxis = glm::vec3(light.extent);
+			glm::vec3 heightAxis = glm::normalize(glm::cross(glm::vec3(light.axis), widthAxis)) * light.extent.w;
+			return glm::dot(normal, glm::vec3(light.sphere)) - distance
+				+ std::abs(glm::dot(normal, depthAxis)) + std::abs(glm::dot(normal, widthAxis)) + std::abs(glm::dot(normal, heightAxis));
+		}
+		default:
+			return glm::dot(normal, glm::vec3(light.sphere)) - distance + light.sphere.w;
+		}
+	}
+
+	bool lightInsideFrustum(const LightCullShape & light, const TileFrustum & frustum, float zNear, float zFar) {
+		// bounding sphere first, exact for point lights
+		if (!sphereInsideFrustum(glm::vec3(light.sphere), light.sphere.w, frustum, zNear, zFar)) {
+			return false;
+		}
+		if (light.type == LIGHT_POINT) {
+			return true;
+		}
+		return shapeInsideFrustum(light, frustum, zNear, zFar);
+	}
+
+	bool shapeInsideFrustum(const LightCullShape & light, const TileFrustum & frustum, float zNear, float zFar) {
+		for (int i = 0; i < 4; ++i) {
+			if (maxSignedDistance(light, glm::vec3(frustum.planes[i]), frustum.planes[i].w) < 0.0f) {
+				return false;
+			}
+		}
+		return maxSignedDistance(light, glm::vec3(0.0f, 0.0f, -1.0f), -zNear) >= 0.0f
+			&& maxSignedDistance(light, glm::vec3(0.0f, 0.0f, 1.0f), zFar) >= 0.0f;
+	}
+
+	void buildLightBvh(const std::vector<glm::vec4> & worldSpheres, const glm::mat4 & viewMat, LightBvh & bvh) {
+		size_t numLights = worldSpheres.size();
+		bvh.sortedLights.resize(numLights);
+		bvh.nodes.clear();
+		bvh.levelOffsets.clear();
+		bvh.levelCounts.clear();
+		if (numLights == 0) {
+			return;
+		}
+
+		// morton order of the light centers inside their bounds
+		Bounds sceneBounds;
+		for (const glm::vec4 & sphere : worldSpheres) {
+			sceneBounds.min = glm::min(sceneBounds.min, glm::vec3(sphere));
+			sceneBounds.max = glm::max(sceneBounds.max, glm::vec3(sphere));
+		}
+		glm::vec3 invSize = 1.0f / glm::max(sceneBounds.max - sceneBounds.min, glm::vec3(1e-6f));
+
+		std::vector<uint64_t> keys(numLights);
+		MeshTools::parallelFor(numLights, [&](size_t begin, size_t end) {
+			for (size_t i = begin; i < end; ++i) {
+				uint64_t code = mortonCode((glm::vec3(worldSpheres[i]) - sceneBounds.min) * invSize);
+				keys[i] = (code << 32) | uint64_t(i);
+			}
+		});
+		radixSortMorton(keys);
+		for (size_t i = 0; i < numLights; ++i) {
+			bvh.sortedLights[i] = int(keys[i] & 0xFFFFFFFFu);
+		}
+
+		// level layout, leaves first, same as computeLightList.comp
+		int count = int((numLights + LIGHT_BVH_BRANCHING - 1) / LIGHT_BVH_BRANCHING);
+		int offset = 0;
+		while (true) {
+			bvh.levelOffsets.push_back(offset);
+			bvh.levelCounts.push_back(count);
+			offset += count;
+			if (count == 1) {
+				break;
+			}
+			count = (count + LIGHT_BVH_BRANCHING - 1) / LIGHT_BVH_BRANCHING;
+		}
+
+		// leaves from the light spheres, then every level from its children
+		std::vector<Bounds> bounds(offset);
+		MeshTools::parallelFor(bvh.levelCounts[0], [&](size_t begin, size_t end) {
+			for (size_t node = begin; node < end; ++node) {
+				size_t first = node * LIGHT_BVH_BRANCHING;
+				size_t last = std::min(first + LIGHT_BVH_BRANCHING, numLights);
+				for (size_t i = first; i < last; ++i) {
+					const glm::vec4 & sphere = worldSpheres[bvh.sortedLights[i]];
+					float r = sphere.w;
+					bounds[node].min = glm::min(bounds[node].min, glm::vec3(sphere) - r);
+					bounds[node].max = glm::max(bounds[node].max, glm::vec3(sphere) + r);
+				}
+			}
+		}, 256);
+
+		for (size_t level = 1; level < bvh.levelOffsets.size(); ++level) {
+			int childOffset = bvh.levelOffsets[level - 1];
+			int childCount = bvh.levelCounts[level - 1];
+			for (int node = 0; node < bvh.levelCounts[level]; ++node) {
+				int first = node * LIGHT_BVH_BRANCHING;
+				int last = std::min(first + LIGHT_BVH_BRANCHING, childCount);
+				for (int child = first; child < last; ++child) {
+					bounds[bvh.levelOffsets[level] + node].grow(bounds[childOffset + child]);
+				}
+			}
+		}
+
+		// view space boxes around the rotated world boxes
+		glm::mat3 rotation = glm::mat3(viewMat);
+		glm::mat3 absRotation;
+		for (int i = 0; i < 3; ++i) {
+			absRotation[i] = glm::abs(rotation[i]);
+		}
+
+		bvh.nodes.resize(offset);
+		for (int node = 0; node < offset; ++node) {
+			glm::vec3 center = (bounds[node].min + bounds[node].max) * 0.5f;
+			glm::vec3 extent = (bounds[node].max - bounds[node].min) * 0.5f;
+			bvh.nodes[node].center = viewMat * glm::vec4(center, 1.0f);
+			bvh.nodes[node].extent = glm::vec4(absRotation * extent, 0.0f);
+		}
+	}
+
+	bool nodeInsideFrustum(const LightBvhNode & node, const TileFrustum & frustum, float zNear, float zFar) {
+		glm::vec3 c = glm::vec3(node.center);
+		glm::vec3 e = glm::vec3(node.extent);
+		if (c.z - e.z > zNear || c.z + e.z < zFar) {
+			return false;
+		}
+
+		for (int i = 0; i < 4; ++i) {
+			glm::vec3 n = glm::vec3(frustum.planes[i]);
+			if (glm::dot(n, c) - frustum.planes[i].w + glm::dot(glm::abs(n), e) < 0.0f) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	void cullTilesBvh(const std::vector<LightCullShape> & lights, const LightBvh & bvh, const std::vector<TileFrustum> & frustums, const std::vector<glm::vec2> & depthRanges, int maxLightsPerTile, std::vector<int> & lightIndex, std::vector<int> & lightGrid, const std::vector<TileDepthMask> * depthMasks) {
+		lightGrid.assign(frustums.size(), 0);
+		lightIndex.assign(frustums.size() * maxLightsPerTile, 0);
+		if (bvh.nodes.empty()) {
+			return;
+		}
+
+		int numLevels = (int)bvh.levelOffsets.size();
+		int numLights = (int)lights.size();
+
+		MeshTools::parallelFor(frustums.size(), [&](size_t begin, size_t end) {
+			for (size_t index = begin; index < end; ++index) {
+				const TileFrustum & frustum = frustums[index];
+				float zNear = depthRanges[index].x;
+				float zFar = depthRanges[index].y;
+				int numLightsInTile = 0;
+				size_t lightIndexBegin = index * maxLightsPerTile;
+
+				// stackless depth first traversal of the implicit tree
+				int level = numLevels - 1;
+				int node = 0;
+				bool full = false;
+				while (!full) {
+					if (nodeInsideFrustum(bvh.nodes[bvh.levelOffsets[level] + node], frustum, zNear, zFar)) {
+						if (level > 0) {
+							level--;
+							node *= LIGHT_BVH_BRANCHING;
+							continue;
+						}
+
+						int last = std::min((node + 1) * LIGHT_BVH_BRANCHING, numLights);
+						for (int s = node * LIGHT_BVH_BRANCHING; s < last && !full; ++s) {
+							int i = bvh.sortedLights[s];
+							if (depthMasks && !lightInsideDepthMask(lights[i], (*depthMasks)[index])) {
+								continue;
+							}
+							if (lightInsideFrustum(lights[i], frustum, zNear, zFar)) {
+								lightIndex[lightIndexBegin + numLightsInTile] = i;
+								numLightsInTile += 1;
+								full = numLightsInTile >= maxLightsPerTile;
+							}
+						}
+					}
+
+					// next sibling, go up once the last child of a parent is done
+					while (level < numLevels - 1 && ((node + 1) % LIGHT_BVH_BRANCHING == 0 || node + 1 >= bvh.levelCounts[level])) {
+						level++;
+						node /= LIGHT_BVH_BRANCHING;
+					}
+					if (level == numLevels - 1) {
+						break;
+					}
+					node++;
+				}
+
+				lightGrid[index] = numLightsInTile;
+			}
+		}, 16);
+	}
+
+	void computeTileDepthRanges(const std::vector<float> & depth, int width, int height, const glm::mat4 & inverseProj, const glm::ivec2 & numTiles, int pixelsPerTile, std::vector<glm::vec2> & depthRanges, std::vector<TileDepthMask> * depthMasks) {
+		depthRanges.resize(numTiles.x * numTiles.y);
+		if (depthMasks) {
+			depthMasks->resize(depthRanges.size());
+		}
+		glm::vec2 screenDimensions = glm::vec2(width, height);
+		glm::vec2 texcoordUnit = 1.0f / screenDimensions;
+
+		MeshTools::parallelFor(depthRanges.size(), [&](size_t begin, size_t end) {
+			std::vector<float> sampleDepths(pixelsPerTile * pixelsPerTile);
+
+			for (size_t index = begin; index < end; ++index) {
+				glm::vec2 tile = glm::vec2(float(index % numTiles.x), float(index / numTiles.x));
+				float zNear = -1000000.0f;
+				float zFar = 1000000.0f;
+
+				for (int i = 0; i < pixelsPerTile; ++i) {
+					for (int j = 0; j < pixelsPerTile; ++j) {
+						glm::vec2 texcoord = (tile * float(pixelsPerTile) + glm::vec2(i + 0.5f, j + 0.5f)) * texcoordUnit;
+						texcoord.y = 1.0f - texcoord.y;
+
+						// clamp to edge sampler
+						int x = glm::clamp(int(std::floor(texcoord.x * width)), 0, width - 1);
+						int y = glm::clamp(int(std::floor(texcoord.y * height)), 0, height - 1);
+
+						// ScreenToView of computeLightList.comp takes the texcoord as screen position
+						glm::vec4 clip = glm::vec4(texcoord / screenDimensions * 2.0f - 1.0f, depth[y * width + x], 1.0f);
+						glm::vec4 view = inverseProj * clip;
+						float z = view.z / view.w;
+						sampleDepths[i * pixelsPerTile + j] = z;
+
+						zNear = std::max(zNear, z);
+						zFar = std::min(zFar, z);
+					}
+				}
+
+				float diff = zNear - zFar;
+				depthRanges[index] = glm::vec2(zNear + diff, zFar - diff);
+
+				if (depthMasks) {
+					TileDepthMask & tileMask = (*depthMasks)[index];
+					tileMask.zFar = zFar;
+					tileMask.zNear = zNear;
+					tileMask.binScale = float(DEPTH_MASK_BINS) / std::max(diff, 0.0001f);
+					tileMask.mask = 0;
+					for (float z : sampleDepths) {
+						int bin = glm::clamp(int((z - zFar) * tileMask.binScale), 0, DEPTH_MASK_BINS - 1);
+						tileMask.mask |= 1u << bin;
+					}
+				}
+			}
+		}, 16);
+	}
+
+	void computeTileFrustums(const glm::mat4 & inverseProj, const glm::vec2 & screenDimensions, const glm::ivec2 & numTiles, int pixelsPerTile, std::vector<TileFrustum> & frustums) {
+		frustums.resize(numTiles.x * numTiles.y);
+
+		// corner on the near plane (clip z = -1 like the shader), screen y points down
+		auto screenToView = [&](int x, int y) {
+			glm::vec2 texcoord = glm::vec2(x, y) * float(pixelsPerTile) / screenDimensions;
+			glm::vec4 view = inverseProj * glm::vec4(texcoord.x * 2.0f - 1.0f, (1.0f - texcoord.y) * 2.0f - 1.0f, -1.0f, 1.0f);
+			return glm::vec3(view) / view.w;
+		};
+		auto computePlane = [](const glm::vec3 & p1, const glm::vec3 & p2) {
+			glm::vec3 normal = glm::normalize(glm::cross(p1, p2));
+			return glm::vec4(normal, 0.0f); // every plane goes through the eye
+		};
+
+		for (int y = 0; y < numTiles.y; ++y) {
+			for (int x = 0; x < numTiles.x; ++x) {
+				glm::vec3 topLeft = screenToView(x, y);
+				glm::vec3 topRight = screenToView(x + 1, y);
+				glm::vec3 bottomLeft = screenToView(x, y + 1);
+				glm::vec3 bottomRight = screenToView(x + 1, y + 1);
+
+				// reverse winding for the flipped y of the projection
+				TileFrustum & frustum = frustums[y * numTiles.x + x];
+				frustum.planes[0] = computePlane(topLeft, bottomLeft);
+				frustum.planes[1] = computePlane(bottomRight, topRight);
+				frustum.planes[2] = computePlane(topRight, topLeft);
+				frustum.planes[3] = computePlane(bottomLeft, bottomRight);
+			}
+		}
+	}
+
+	uint32_t lightDepthMask(const LightCullShape & light, const TileDepthMask & tileMask) {
+		float lightFar = light.sphere.z - light.sphere.w;
+		float lightNear = light.sphere.z + light.sphere.w;
+		if (lightNear < tileMask.zFar || lightFar > tileMask.zNear) {
+			return 0;
+		}
+
+		int first = glm::clamp(int((lightFar - tileMask.zFar) * tileMask.binScale), 0, DEPTH_MASK_BINS - 1);
+		int last = glm::clamp(int((lightNear - tileMask.zFar) * tileMask.binScale), 0, DEPTH_MASK_BINS - 1);
+		uint32_t upTo = last == DEPTH_MASK_BINS - 1 ? 0xFFFFFFFFu : (1u << (last + 1)) - 1u;
+		return upTo & ~((1u << first) - 1u);
+	}
+
+	bool lightInsideDepthMask(const LightCullShape & light, const TileDepthMask & tileMask) {
+		return (lightDepthMask(light, tileMask) & tileMask.mask) != 0;
+	}
+
+	bool projectSphereToTiles(const glm::vec4 & sphere, const glm::mat4 & inverseProj, const glm::vec2 & screenDimensions, const glm::ivec2 & numTiles, int pixelsPerTile, glm::ivec4 & tileRect) {
+		float depth = -sphere.z;
+		float r = sphere.w;
+
+		// eye inside or behind, covers the whole screen
+		if (depth <= r) {
+			tileRect = glm::ivec4(0, 0, numTiles.x - 1, numTiles.y - 1);
+			return true;
+		}
+
+		// slopes (x / depth) of the two tangent lines in the xz and yz planes
+		glm::vec2 c = glm::vec2(sphere.x, sphere.y);
+		glm::vec2 t = glm::sqrt(c * c + depth * depth - r * r);
+		glm::vec2 slopeMin = (c * t - depth * r) / (depth * t + c * r);
+		glm::vec2 slopeMax = (c * t + depth * r) / (depth * t - c * r);
+
+		// to ndc, proj[1][1] is negative (flipped y)
+		glm::vec2 scale = glm::vec2(1.0f / inverseProj[0][0], 1.0f / inverseProj[1][1]);
+		glm::vec2 ndcA = slopeMin * scale;
+		glm::vec2 ndcB = slopeMax * scale;
+		glm::vec2 ndcMin = glm::min(ndcA, ndcB);
+		glm::vec2 ndcMax = glm::max(ndcA, ndcB);
+
+		// pixel columns from the left, rows from the bottom (ndc y = 1 is row 0)
+		float tileSize = float(pixelsPerTile);
+		glm::ivec2 tileMin = glm::ivec2(glm::floor(glm::vec2(ndcMin.x + 1.0f, 1.0f - ndcMax.y) * 0.5f * screenDimensions / tileSize));
+		glm::ivec2 tileMax = glm::ivec2(glm::floor(glm::vec2(ndcMax.x + 1.0f, 1.0f - ndcMin.y) * 0.5f * screenDimensions / tileSize));
+		if (tileMax.x < 0 || tileMax.y < 0 || tileMin.x >= numTiles.x || tileMin.y >= numTiles.y) {
+			return false;
+		}
+
+		tileMin = glm::max(tileMin, glm::ivec2(0));
+		tileMax = glm::min(tileMax, numTiles - 1);
+		tileRect = glm::ivec4(tileMin, tileMax);
+		return true;
+	}
+
+	void cullTilesBinned(const std::vector<LightCullShape> & lights, const std::vector<TileFrustum> & frustums, const std::vector<glm::vec2> & depthRanges, const glm::mat4 & inverseProj, const glm::vec2 & screenDimensions, const glm::ivec2 & numTiles, int pixelsPerTile, int maxLightsPerTile, std::vector<int> & lightIndex, std::vector<int> & lightGrid, const std::vector<TileDepthMask> * depthMasks) {
+		lightGrid.assign(frustums.size(), 0);
+		lightIndex.assign(frustums.size() * maxLightsPerTile, 0);
+
+		// serial scatter, the gpu appends with atomics in any order
+		for (int i = 0; i < (int)lights.size(); ++i) {
+			const LightCullShape & light = lights[i];
+			glm::ivec4 tileRect;
+			if (!projectSphereToTiles(light.sphere, inverseProj, screenDimensions, numTiles, pixelsPerTile, tileRect)) {
+				continue;
+			}
+
+			for (int y = tileRect.y; y <= tileRect.w; ++y) {
+				for (int x = tileRect.x; x <= tileRect.z; ++x) {
+					size_t index = y * numTiles.x + x;
+					float zNear = depthRanges[index].x;
+					float zFar = depthRanges[index].y;
+					if (lightGrid[index] >= maxLightsPerTile
+						|| light.sphere.z - light.sphere.w > zNear || light.sphere.z + light.sphere.w < zFar) {
+						continue;
+					}
+					if (depthMasks && !lightInsideDepthMask(light, (*depthMasks)[index])) {
+						continue;
+					}
+					if (light.type != LIGHT_POINT && !shapeInsideFrustum(light, frustums[index], zNear, zFar)) {
+						continue;
+					}
+
+					lightIndex[index * maxLightsPerTile + lightGrid[index]] = i;
+					lightGrid[index] += 1;
+				}
+			}
+		}
+	}
+
+	void cullTilesSupertile(const std::vector<LightCullShape> & lights, const std::vector<TileFrustum> & frustums, const std::vector<glm::vec2> & depthRanges, const glm::ivec2 & numTiles, int tilesPerSupertile, int maxLightsPerTile, std::vector<int> & lightIndex, std::vector<int> & lightGrid, const std::vector<TileDepthMask> * depthMasks) {
+		lightGrid.assign(frustums.size(), 0);
+		lightIndex.assign(frustums.size() * maxLightsPerTile, 0);
+
+		glm::ivec2 numSupertiles = (numTiles + tilesPerSupertile - 1) / tilesPerSupertile;
+
+		MeshTools::parallelFor(numSupertiles.x * numSupertiles.y, [&](size_t begin, size_t end) {
+			std::vector<int> survivors;
+			survivors.reserve(MAX_SUPERTILE_LIGHTS);
+
+			for (size_t supertile = begin; supertile < end; ++supertile) {
+				glm::ivec2 firstTile = glm::ivec2(int(supertile) % numSupertiles.x, int(supertile) / numSupertiles.x) * tilesPerSupertile;
+				glm::ivec2 lastTile = glm::min(firstTile + tilesPerSupertile, numTiles) - 1;
+
+				// outer planes of the edge tiles, union of the tile depth ranges
+				TileFrustum frustum;
+				frustum.planes[0] = frustums[firstTile.y * numTiles.x + firstTile.x].planes[0];
+				frustum.planes[1] = frustums[firstTile.y * numTiles.x + lastTile.x].planes[1];
+				frustum.planes[2] = frustums[firstTile.y * numTiles.x + firstTile.x].planes[2];
+				frustum.planes[3] = frustums[lastTile.y * numTiles.x + firstTile.x].planes[3];
+
+				float zNear = -1000000.0f;
+				float zFar = 1000000.0f;
+				for (int y = firstTile.y; y <= lastTile.y; ++y) {
+					for (int x = firstTile.x; x <= lastTile.x; ++x) {
+						zNear = std::max(zNear, depthRanges[y * numTiles.x + x].x);
+						zFar = std::min(zFar, depthRanges[y * numTiles.x + x].y);
+					}
+				}
+
+				// pre-cull in light order, all lights once the list is full
+				survivors.clear();
+				bool overflow = false;
+				for (int i = 0; i < (int)lights.size() && !overflow; ++i) {
+					if (lightInsideFrustum(lights[i], frustum, zNear, zFar)) {
+						overflow = survivors.size() >= MAX_SUPERTILE_LIGHTS;
+						survivors.push_back(i);
+					}
+				}
+
+				for (int y = firstTile.y; y <= lastTile.y; ++y) {
+					for (int x = firstTile.x; x <= lastTile.x; ++x) {
+						size_t index = y * numTiles.x + x;
+						int numLightsInTile = 0;
+						size_t lightIndexBegin = index * maxLightsPerTile;
+						int numCandidates = overflow ? (int)lights.size() : (int)survivors.size();
+
+						for (int c = 0; c < numCandidates; ++c) {
+							int i = overflow ? c : survivors[c];
+							if (depthMasks && !lightInsideDepthMask(lights[i], (*depthMasks)[index])) {
+								continue;
+							}
+							if (lightInsideFrustum(lights[i], frustums[index], depthRanges[index].x, depthRanges[index].y)) {
+								lightIndex[lightIndexBegin + numLightsInTile] = i;
+								numLightsInTile += 1;
+								if (numLightsInTile >= maxLightsPerTile) {
+									break;
+								}
+							}
+						}
+
+						lightGrid[index] = numLightsInTile;
+					}
+				}
+			}
+		}, 1);
+	}
+
+	void cullTiles(const std::vector<LightCullShape> & lights, const std::vector<TileFrustum> & frustums, const std::vector<glm::vec2> & depthRanges, int maxLightsPerTile, std::vector<int> & lightIndex, std::vector<int> & lightGrid, const std::vector<TileDepthMask> * depthMasks) {
+		lightGrid.assign(frustums.size(), 0);
+		lightIndex.assign(frustums.size() * maxLightsPerTile, 0);
+
+		MeshTools::parallelFor(frustums.size(), [&](size_t begin, size_t end) {
+			for (size_t index = begin; index < end; ++index) {
+				int numLightsInTile = 0;
+				size_t lightIndexBegin = index * maxLightsPerTile;
+
+				for (int i = 0; i < (int)lights.size(); ++i) {
+					if (depthMasks && !lightInsideDepthMask(lights[i], (*depthMasks)[index])) {
+						continue;
+					}
+					if (lightInsideFrustum(lights[i], frustums[index], depthRanges[index].x, depthRanges[index].y)) {
+						lightIndex[lightIndexBegin + numLightsInTile] = i;
+						numLightsInTile += 1;
+						if (numLightsInTile >= maxLightsPerTile) {
+							break;
+						}
+					}
+				}
+
+				lightGrid[index] = numLightsInTile;
+			}
+		}, 16);
+	}
+
+	LightListStats computeListStats(const std::vector<int> & lightGrid, int maxLightsPerTile) {
+		LightListStats stats;
+		stats.indexCapacity = uint64_t(lightGrid.size()) * maxLightsPerTile;
+		for (int count : lightGrid) {
+			stats.usedIndices += count;
+			stats.maxLights = std::max(stats.maxLights, count);
+			if (count >= maxLightsPerTile) {
+				stats.fullTiles++;
+				stats.histogram[LIGHT_LIST_HISTOGRAM_BINS - 1]++;
+			} else {
+				stats.histogram[count * (LIGHT_LIST_HISTOGRAM_BINS - 1) / maxLightsPerTile]++;
+			}
+		}
+		if (!lightGrid.empty()) {
+			stats.meanLights = float(stats.usedIndices) / lightGrid.size();
+		}
+		return stats;
+	}
+}
@@ -0,0 +1,167 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <cstdint>
+
+/************************************************************/
+//			CPU reference of the light culling shaders
+/************************************************************/
+
+// keep in sync with the LIGHT_* defines in the shaders
+enum LightType {
+	LIGHT_POINT = 0,
+	LIGHT_SPOT = 1,
+	LIGHT_TUBE = 2,
+	LIGHT_RECT = 3
+};
+
+// keep in sync with the LIGHT_CULL_* defines in computeLightList.comp
+enum LightCullMode {
+	LIGHT_CULL_LINEAR = 0, // every tile tests every light
+	LIGHT_CULL_BVH = 1, // every tile walks the light bvh
+	LIGHT_CULL_SUPERTILE = 2, // workgroup pre-culls against its supertile, tiles test the survivors
+	LIGHT_CULL_COOPERATIVE = 3, // computeLightListCooperative.comp, one workgroup per tile
+	LIGHT_CULL_BINNING = 4 // binLights.comp scatters every light into the tiles of its screen rect
+};
+
+// survivors of the supertile pre-cull kept in shared memory, a supertile with
+// more lights falls back to testing all of them
+#define MAX_SUPERTILE_LIGHTS 1024
+
+// view space culling primitive of one light, same data as the cull streams
+// written by updateLights.comp
+//   point: sphere only
+//   spot:  axis = (direction, cos outer angle), extent = (apex, range)
+//   tube:  axis = (half segment, radius), sphere center = segment center
+//   rect:  axis = (normal, half depth), extent = (half width axis, half height) grown by the range,
+//          sphere center = center of the box in front of the rect (range deep)
+struct LightCullShape {
+	int type;
+	glm::vec4 sphere; // bounding sphere, w = radius
+	glm::vec4 axis;
+	glm::vec4 extent;
+};
+
+// 4 side planes of a tile, xyz is normal, w is distance
+struct TileFrustum {
+	glm::vec4 planes[4];
+};
+
+// 2.5D culling (Harada): the unexpanded depth range of a tile split into 32 bins,
+// bit n set when a sample falls into bin n. Same as computeLightList.comp
+#define DEPTH_MASK_BINS 32
+
+struct TileDepthMask {
+	float zFar; // farthest sample, bin 0 starts here
+	float zNear; // closest sample
+	float binScale; // bins per view space unit
+	uint32_t mask;
+};
+
+// per tile depth written by computeLightList.comp for binLights.comp in
+// LIGHT_CULL_BINNING mode, std430 compatible
+struct TileDepthBounds {
+	glm::vec2 range; // x = near, y = far, expanded
+	TileDepthMask mask;
+};
+
+// implicit light bvh over morton sorted lights, LIGHT_BVH_BRANCHING children
+// per node. Levels are stored leaves first, leaf n covers sorted lights
+// [n * LIGHT_BVH_BRANCHING, (n + 1) * LIGHT_BVH_BRANCHING). Keep in sync with computeLightList.comp
+#define LIGHT_BVH_BRANCHING 8
+#define LIGHT_BVH_MAX_LEVELS 8
+
+// view space aabb, std430 compatible
+struct LightBvhNode {
+	glm::vec4 center;
+	glm::vec4 extent;
+};
+
+struct LightBvh {
+	std::vector<int> sortedLights; // light indices in morton order
+	std::vector<LightBvhNode> nodes;
+	std::vector<int> levelOffsets; // first node of every level, leaves first
+	std::vector<int> levelCounts;
+};
+
+// lights per tile histogram, LIGHT_LIST_HISTOGRAM_BINS - 1 equal bins below
+// maxLightsPerTile and a last bin for the full tiles
+#define LIGHT_LIST_HISTOGRAM_BINS 9
+
+// light list usage of one frame, from the light grid counts
+struct LightListStats {
+	float meanLights = 0.0f;
+	int maxLights = 0;
+	int fullTiles = 0; // reached maxLightsPerTile, lights were dropped
+	uint64_t usedIndices = 0; // light index entries in use
+	uint64_t indexCapacity = 0;
+	int histogram[LIGHT_LIST_HISTOGRAM_BINS] = {};
+};
+
+namespace LightCulling {
+
+	// animated world position, same as updateLights.comp. seed is the per light
+	// animation phase kept in endPos.w
+	glm::vec3 animatedPosition(const glm::vec3 & beginPos, const glm::vec3 & endPos, float time, float seed);
+
+	// bound on the distance between animatedPosition and the position updateLights.comp
+	// computes for the same light, from the precision of sin on the gpu
+	float animatedPositionError(const glm::vec3 & beginPos, const glm::vec3 & endPos, float time, float seed);
+
+	// direction/shape are the per type world space streams of SBO_lights
+	LightCullShape computeCullShape(int type, const glm::vec3 & position, float radius, const glm::vec4 & direction, const glm::vec4 & shape, const glm::mat4 & viewMat);
+
+	// largest signed distance of the light volume to a plane,
+	// negative means the whole volume is behind it
+	float maxSignedDistance(const LightCullShape & light, const glm::vec3 & normal, float distance);
+
+	bool lightInsideFrustum(const LightCullShape & light, const TileFrustum & frustum, float zNear, float zFar);
+
+	// exact test of spot, tube and rect lights, without the bounding sphere
+	bool shapeInsideFrustum(const LightCullShape & light, const TileFrustum & frustum, float zNear, float zFar);
+
+	// tiles (x0, y0, x1, y1 inclusive) covered by the screen rect of a view space
+	// sphere, from the tangent lines of the sphere through the eye. Tile rows count
+	// from the bottom like the light grid. False when the rect is off screen
+	bool projectSphereToTiles(const glm::vec4 & sphere, const glm::mat4 & inverseProj, const glm::vec2 & screenDimensions, const glm::ivec2 & numTiles, int pixelsPerTile, glm::ivec4 & tileRect);
+
+	// view space depth range of every tile (x = near, y = far, expanded like
+	// computeLightList.comp), depth rows are top to bottom as in the image.
+	// Also builds the depth masks when depthMasks is given
+	void computeTileDepthRanges(const std::vector<float> & depth, int width, int height, const glm::mat4 & inverseProj, const glm::ivec2 & numTiles, int pixelsPerTile, std::vector<glm::vec2> & depthRanges, std::vector<TileDepthMask> * depthMasks = nullptr);
+
+	// side planes of every tile, same as computeFrustumGrid.comp
+	void computeTileFrustums(const glm::mat4 & inverseProj, const glm::vec2 & screenDimensions, const glm::ivec2 & numTiles, int pixelsPerTile, std::vector<TileFrustum> & frustums);
+
+	// bins covered by the depth extent of the bounding sphere, 0 outside the range
+	uint32_t lightDepthMask(const LightCullShape & light, const TileDepthMask & tileMask);
+
+	bool lightInsideDepthMask(const LightCullShape & light, const TileDepthMask & tileMask);
+
+	// rebuild the bvh from the world space bounding spheres of the lights
+	// (computeCullShape with an identity view), node boxes end up in view space.
+	// The spheres must also cover the gpu positions, see animatedPositionError
+	void buildLightBvh(const std::vector<glm::vec4> & worldSpheres, const glm::mat4 & viewMat, LightBvh & bvh);
+
+	bool nodeInsideFrustum(const LightBvhNode & node, const TileFrustum & frustum, float zNear, float zFar);
+
+	// bvh traversal, same order of lights as computeLightList.comp with the bvh enabled
+	void cullTilesBvh(const std::vector<LightCullShape> & lights, const LightBvh & bvh, const std::vector<TileFrustum> & frustums, const std::vector<glm::vec2> & depthRanges, int maxLightsPerTile, std::vector<int> & lightIndex, std::vector<int> & lightGrid, const std::vector<TileDepthMask> * depthMasks = nullptr);
+
+	// two level culling, same as computeLightList.comp in LIGHT_CULL_SUPERTILE mode.
+	// A supertile is tilesPerSupertile^2 tiles (one workgroup), its frustum is made
+	// of the outer planes of its edge tiles and its depth range covers all of its tiles
+	void cullTilesSupertile(const std::vector<LightCullShape> & lights, const std::vector<TileFrustum> & frustums, const std::vector<glm::vec2> & depthRanges, const glm::ivec2 & numTiles, int tilesPerSupertile, int maxLightsPerTile, std::vector<int> & lightIndex, std::vector<int> & lightGrid, const std::vector<TileDepthMask> * depthMasks = nullptr);
+
+	// scatter every light into the tiles of its screen rect, then test the tile depth
+	// (and the exact shape of non point lights), same as binLights.comp in light order
+	void cullTilesBinned(const std::vector<LightCullShape> & lights, const std::vector<TileFrustum> & frustums, const std::vector<glm::vec2> & depthRanges, const glm::mat4 & inverseProj, const glm::vec2 & screenDimensions, const glm::ivec2 & numTiles, int pixelsPerTile, int maxLightsPerTile, std::vector<int> & lightIndex, std::vector<int> & lightGrid, const std::vector<TileDepthMask> * depthMasks = nullptr);
+
+	// same output layout as computeLightList.comp, the per tile tests also check
+	// the depth masks when they are given
+	void cullTiles(const std::vector<LightCullShape> & lights, const std::vector<TileFrustum> & frustums, const std::vector<glm::vec2> & depthRanges, int maxLightsPerTile, std::vector<int> & lightIndex, std::vector<int> & lightGrid, const std::vector<TileDepthMask> * depthMasks = nullptr);
+
+	LightListStats computeListStats(const std::vector<int> & lightGrid, int maxLightsPerTile);
+}
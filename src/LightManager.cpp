@@ -0,0 +1,97 @@
+#include "LightManager.h"
+
+#include <algorithm>
+
+LightHandle LightManager::add() {
+	LightHandle handle;
+	if (count() >= capacity) {
+		return handle;
+	}
+
+	if (!freeHandles.empty()) {
+		handle.index = freeHandles.back();
+		freeHandles.pop_back();
+	} else {
+		handle.index = (uint32_t)handles.size();
+		handles.push_back(HandleEntry());
+	}
+
+	uint32_t slot = count();
+	handles[handle.index].slot = slot;
+	handle.generation = handles[handle.index].generation;
+	slotHandles.push_back(handle.index);
+	markDirty(slot);
+	return handle;
+}
+
+bool LightManager::remove(LightHandle handle, uint32_t & movedFrom, uint32_t & movedTo) {
+	int slot = this->slot(handle);
+	if (slot < 0) {
+		return false;
+	}
+
+	// free the handle entry, the generation invalidates copies of the handle
+	HandleEntry & entry = handles[handle.index];
+	entry.slot = UINT32_MAX;
+	entry.generation++;
+	freeHandles.push_back(handle.index);
+
+	// move the last light into the hole
+	uint32_t last = count() - 1;
+	bool moved = (uint32_t)slot != last;
+	if (moved) {
+		uint32_t lastHandle = slotHandles[last];
+		slotHandles[slot] = lastHandle;
+		handles[lastHandle].slot = slot;
+		markDirty(slot);
+		movedFrom = last;
+		movedTo = slot;
+	}
+	slotHandles.pop_back();
+	return moved;
+}
+
+int LightManager::slot(LightHandle handle) const {
+	if (handle.index >= handles.size() || handles[handle.index].generation != handle.generation) {
+		return -1;
+	}
+	uint32_t slot = handles[handle.index].slot;
+	return slot == UINT32_MAX ? -1 : (int)slot;
+}
+
+LightHandle LightManager::handleAt(uint32_t slot) const {
+	LightHandle handle;
+	handle.index = slotHandles[slot];
+	handle.generation = handles[handle.index].generation;
+	return handle;
+}
+
+void LightManager::markDirty(uint32_t slot) {
+	if (slot >= isDirty.size()) {
+		isDirty.resize(std::max<size_t>(slot + 1, isDirty.size() * 2), 0);
+	}
+	if (!isDirty[slot]) {
+		isDirty[slot] = 1;
+		dirtySlots.push_back(slot);
+	}
+}
+
+void LightManager::takeDirtyRanges(std::vector<glm::uvec2> & ranges, uint32_t maxGap) {
+	ranges.clear();
+	std::sort(dirtySlots.begin(), dirtySlots.end());
+	for (uint32_t slot : dirtySlots) {
+		isDirty[slot] = 0;
+
+		// slots past the end were removed, nothing to upload
+		if (slot >= count()) {
+			continue;
+		}
+
+		if (!ranges.empty() && slot <= ranges.back().x + ranges.back().y + maxGap) {
+			ranges.back().y = slot - ranges.back().x + 1;
+		} else {
+			ranges.push_back(glm::uvec2(slot, 1));
+		}
+	}
+	dirtySlots.clear();
+}
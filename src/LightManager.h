@@ -0,0 +1,77 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <cstdint>
+
+/************************************************************/
+//			Light slot bookkeeping for runtime light edits
+/************************************************************/
+
+// one light as stored in SBO_lights, see VulkanBaseApplication::addLight
+struct LightDesc {
+	int type = 0; // LightType
+	glm::vec3 beginPos = glm::vec3(0.0f); // animated between begin and end
+	glm::vec3 endPos = glm::vec3(0.0f);
+	float radius = 0.0f;
+	glm::vec4 color = glm::vec4(0.0f); // w = intensity
+	glm::vec4 direction = glm::vec4(0.0f); // spot axis, tube half segment, rect normal
+	glm::vec4 shape = glm::vec4(0.0f); // spot (cos outer, cos inner), rect (half width tangent, half height)
+};
+
+// stable reference to a light, survives the light moving to another slot.
+// generation tells a reused handle entry from a removed light
+struct LightHandle {
+	uint32_t index = UINT32_MAX;
+	uint32_t generation = 0;
+
+	bool valid() const { return index != UINT32_MAX; }
+};
+
+// the lights stay densely packed in slots [0, count) so culling never sees a
+// hole: removing a light moves the last one into its slot. Handles map to slots
+// through a table whose free entries are reused. Changed slots are collected
+// and merged into ranges for the upload
+class LightManager {
+public:
+	explicit LightManager(uint32_t capacity = 0) : capacity(capacity) {}
+
+	void setCapacity(uint32_t maxLights) { capacity = maxLights; }
+
+	uint32_t count() const { return (uint32_t)slotHandles.size(); }
+
+	// new light in slot count() - 1, invalid handle when full
+	LightHandle add();
+
+	// frees the handle. When another light was moved into the hole, returns
+	// true with its old and new slot so the caller moves its data too
+	bool remove(LightHandle handle, uint32_t & movedFrom, uint32_t & movedTo);
+
+	// current slot, -1 for a removed or invalid handle
+	int slot(LightHandle handle) const;
+
+	// handle of the light in a slot
+	LightHandle handleAt(uint32_t slot) const;
+
+	// upload the slot again
+	void markDirty(uint32_t slot);
+
+	// dirty slots below count() merged into (first, count) ranges, ranges less than
+	// maxGap slots apart are joined to keep the number of copies down. Clears them
+	void takeDirtyRanges(std::vector<glm::uvec2> & ranges, uint32_t maxGap = 0);
+
+private:
+	struct HandleEntry {
+		uint32_t slot = UINT32_MAX; // UINT32_MAX while on the free list
+		uint32_t generation = 0;
+	};
+
+	uint32_t capacity;
+	std::vector<HandleEntry> handles;
+	std::vector<uint32_t> freeHandles;
+	std::vector<uint32_t> slotHandles; // slot -> handle index
+
+	std::vector<uint32_t> dirtySlots;
+	std::vector<uint8_t> isDirty; // per slot, no duplicates in dirtySlots
+};
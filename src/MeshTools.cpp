@@ -0,0 +1,634 @@
+#include "MeshTools.h"
+#include "JobSystem.h"
+
+#include <glm/gtx/hash.hpp>
+
+#include <fstream>
+#include <unordered_map>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace {
+
+	const uint32_t MESH_CACHE_MAGIC = 0x434d5046; // "FPMC"
+	const uint32_t MESH_CACHE_VERSION = 3;
+
+	// vertex -> triangle adjacency in compressed rows,
+	// triangles of key k are tris[offsets[k] .. offsets[k + 1])
+	struct Adjacency {
+		std::vector<uint32_t> offsets;
+		std::vector<uint32_t> tris;
+	};
+
+	void buildAdjacency(const std::vector<uint32_t> & cornerKeys, size_t numKeys, Adjacency & adj) {
+		adj.offsets.assign(numKeys + 1, 0);
+		for (uint32_t key : cornerKeys) {
+			adj.offsets[key + 1]++;
+		}
+		for (size_t k = 0; k < numKeys; ++k) {
+			adj.offsets[k + 1] += adj.offsets[k];
+		}
+
+		std::vector<uint32_t> cursor(adj.offsets.begin(), adj.offsets.end() - 1);
+		adj.tris.resize(cornerKeys.size());
+		for (size_t c = 0; c < cornerKeys.size(); ++c) {
+			adj.tris[cursor[cornerKeys[c]]++] = uint32_t(c / 3);
+		}
+	}
+
+	// symmetric 4x4 plane quadric, upper triangle only
+	struct Quadric {
+		double m[10] = {};
+
+		void addPlane(const glm::dvec4 & p) {
+			m[0] += p.x * p.x; m[1] += p.x * p.y; m[2] += p.x * p.z; m[3] += p.x * p.w;
+			m[4] += p.y * p.y; m[5] += p.y * p.z; m[6] += p.y * p.w;
+			m[7] += p.z * p.z; m[8] += p.z * p.w;
+			m[9] += p.w * p.w;
+		}
+
+		void add(const Quadric & q) {
+			for (int i = 0; i < 10; ++i) {
+				m[i] += q.m[i];
+			}
+		}
+
+		// sum of squared distances to the accumulated planes
+		double error(const glm::vec3 & v) const {
+			double x = v.x, y = v.y, z = v.z;
+			return m[0] * x * x + 2.0 * m[1] * x * y + 2.0 * m[2] * x * z + 2.0 * m[3] * x
+				+ m[4] * y * y + 2.0 * m[5] * y * z + 2.0 * m[6] * y
+				+ m[7] * z * z + 2.0 * m[8] * z
+				+ m[9];
+		}
+	};
+
+	template <typename T>
+	void writeArray(std::ofstream & file, const std::vector<T> & data) {
+		uint64_t count = data.size();
+		file.write((const char*)&count, sizeof(count));
+		file.write((const char*)data.data(), sizeof(T) * count);
+	}
+
+	template <typename T>
+	bool readArray(std::ifstream & file, std::vector<T> & data) {
+		uint64_t count = 0;
+		file.read((char*)&count, sizeof(count));
+		if (!file) {
+			return false;
+		}
+		data.resize(size_t(count));
+		file.read((char*)data.data(), sizeof(T) * count);
+		return bool(file);
+	}
+}
+
+void MeshTools::parallelFor(size_t count, const std::function<void(size_t begin, size_t end)> & func, size_t minItemsPerThread) {
+	// unnamed, the jobs show up under the job or scope that called this
+	JobSystem::shared().parallelFor(nullptr, count, func, minItemsPerThread);
+}
+
+void MeshTools::computeSmoothNormals(MeshData & mesh) {
+	const size_t numVerts = mesh.positions.size();
+	const size_t numTris = mesh.indices.size() / 3;
+
+	// weld vertices by position, uv seams must not split the normal
+	std::unordered_map<glm::vec3, uint32_t> uniquePositions;
+	std::vector<uint32_t> posIds(numVerts);
+	for (size_t v = 0; v < numVerts; ++v) {
+		auto it = uniquePositions.emplace(mesh.positions[v], (uint32_t)uniquePositions.size()).first;
+		posIds[v] = it->second;
+	}
+
+	std::vector<uint32_t> cornerKeys(mesh.indices.size());
+	for (size_t c = 0; c < mesh.indices.size(); ++c) {
+		cornerKeys[c] = posIds[mesh.indices[c]];
+	}
+
+	Adjacency adj;
+	buildAdjacency(cornerKeys, uniquePositions.size(), adj);
+
+	// un-normalized cross product, so larger triangles weigh more
+	std::vector<glm::vec3> faceNormals(numTris);
+	parallelFor(numTris, [&](size_t begin, size_t end) {
+		for (size_t t = begin; t < end; ++t) {
+			const glm::vec3 & P1 = mesh.positions[mesh.indices[3 * t + 0]];
+			const glm::vec3 & P2 = mesh.positions[mesh.indices[3 * t + 1]];
+			const glm::vec3 & P3 = mesh.positions[mesh.indices[3 * t + 2]];
+			faceNormals[t] = glm::cross(P2 - P1, P3 - P1);
+		}
+	});
+
+	std::vector<glm::vec3> posNormals(uniquePositions.size());
+	parallelFor(posNormals.size(), [&](size_t begin, size_t end) {
+		for (size_t p = begin; p < end; ++p) {
+			glm::vec3 N(0.0f);
+			for (uint32_t i = adj.offsets[p]; i < adj.offsets[p + 1]; ++i) {
+				N += faceNormals[adj.tris[i]];
+			}
+			float len = glm::length(N);
+			posNormals[p] = len > 0.0f ? N / len : glm::vec3(0.0f, 1.0f, 0.0f);
+		}
+	});
+
+	mesh.normals.resize(numVerts);
+	parallelFor(numVerts, [&](size_t begin, size_t end) {
+		for (size_t v = begin; v < end; ++v) {
+			mesh.normals[v] = posNormals[posIds[v]];
+		}
+	});
+}
+
+void MeshTools::computeTangents(MeshData & mesh) {
+	const size_t numVerts = mesh.positions.size();
+	const size_t numTris = mesh.indices.size() / 3;
+
+	Adjacency adj;
+	buildAdjacency(mesh.indices, numVerts, adj);
+
+	// per-triangle tangent and bitangent from uv derivatives
+	std::vector<glm::vec3> faceTangents(numTris);
+	std::vector<glm::vec3> faceBitangents(numTris);
+	parallelFor(numTris, [&](size_t begin, size_t end) {
+		for (size_t t = begin; t < end; ++t) {
+			uint32_t i0 = mesh.indices[3 * t + 0];
+			uint32_t i1 = mesh.indices[3 * t + 1];
+			uint32_t i2 = mesh.indices[3 * t + 2];
+
+			glm::vec3 E1 = mesh.positions[i1] - mesh.positions[i0];
+			glm::vec3 E2 = mesh.positions[i2] - mesh.positions[i0];
+			glm::vec2 dUV1 = mesh.texCoords[i1] - mesh.texCoords[i0];
+			glm::vec2 dUV2 = mesh.texCoords[i2] - mesh.texCoords[i0];
+
+			float det = dUV1.x * dUV2.y - dUV2.x * dUV1.y;
+			if (std::abs(det) < 1e-12f) {
+				faceTangents[t] = glm::vec3(0.0f);
+				faceBitangents[t] = glm::vec3(0.0f);
+				continue;
+			}
+
+			// keep the area weighting of the position edges
+			float sign = det > 0.0f ? 1.0f : -1.0f;
+			faceTangents[t] = (E1 * dUV2.y - E2 * dUV1.y) * sign;
+			faceBitangents[t] = (E2 * dUV1.x - E1 * dUV2.x) * sign;
+		}
+	});
+
+	mesh.tangents.resize(numVerts);
+	parallelFor(numVerts, [&](size_t begin, size_t end) {
+		for (size_t v = begin; v < end; ++v) {
+			glm::vec3 T(0.0f);
+			glm::vec3 B(0.0f);
+			for (uint32_t i = adj.offsets[v]; i < adj.offsets[v + 1]; ++i) {
+				T += faceTangents[adj.tris[i]];
+				B += faceBitangents[adj.tris[i]];
+			}
+
+			// Gram-Schmidt against the vertex normal
+			const glm::vec3 & N = mesh.normals[v];
+			T -= N * glm::dot(N, T);
+			float len = glm::length(T);
+			if (len < 1e-6f) {
+				// no usable uv gradient, pick any direction perpendicular to N
+				glm::vec3 axis = std::abs(N.x) < 0.9f ? glm::vec3(1.0f, 0.0f, 0.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+				T = glm::normalize(glm::cross(axis, N));
+			}
+			else {
+				T /= len;
+			}
+
+			float w = glm::dot(glm::cross(N, T), B) < 0.0f ? -1.0f : 1.0f;
+			mesh.tangents[v] = glm::vec4(T, w);
+		}
+	});
+}
+
+float MeshTools::simplifyMesh(const std::vector<glm::vec3> & positions, const std::vector<uint32_t> & indices, size_t targetIndexCount, std::vector<uint32_t> & result) {
+	const size_t numVerts = positions.size();
+	result = indices;
+
+	// weld by position, vertices on uv / normal seams are locked
+	std::unordered_map<glm::vec3, uint32_t> uniquePositions;
+	std::vector<uint32_t> posIds(numVerts, UINT32_MAX);
+	std::vector<uint32_t> posUsers;
+	for (uint32_t index : indices) {
+		if (posIds[index] != UINT32_MAX) {
+			continue;
+		}
+		auto inserted = uniquePositions.emplace(positions[index], (uint32_t)uniquePositions.size());
+		if (inserted.second) {
+			posUsers.push_back(0);
+		}
+		posIds[index] = inserted.first->second;
+		posUsers[posIds[index]]++;
+	}
+
+	std::vector<char> locked(numVerts, 0);
+	for (uint32_t index : indices) {
+		locked[index] = posUsers[posIds[index]] > 1;
+	}
+
+	// open border edges (used by a single triangle) are locked too
+	auto edgeKey = [&](uint32_t a, uint32_t b) {
+		uint64_t pa = posIds[a], pb = posIds[b];
+		return pa < pb ? (pa << 32) | pb : (pb << 32) | pa;
+	};
+	std::unordered_map<uint64_t, uint32_t> edgeUsers;
+	for (size_t c = 0; c < indices.size(); ++c) {
+		edgeUsers[edgeKey(indices[c], indices[c - c % 3 + (c + 1) % 3])]++;
+	}
+	for (size_t c = 0; c < indices.size(); ++c) {
+		uint32_t a = indices[c], b = indices[c - c % 3 + (c + 1) % 3];
+		if (edgeUsers[edgeKey(a, b)] == 1) {
+			locked[a] = locked[b] = 1;
+		}
+	}
+
+	std::vector<Quadric> quadrics(numVerts);
+	for (size_t t = 0; t + 2 < indices.size(); t += 3) {
+		const glm::vec3 & P1 = positions[indices[t + 0]];
+		const glm::vec3 & P2 = positions[indices[t + 1]];
+		const glm::vec3 & P3 = positions[indices[t + 2]];
+		glm::vec3 N = glm::cross(P2 - P1, P3 - P1);
+		float len = glm::length(N);
+		if (len <= 0.0f) {
+			continue;
+		}
+		N /= len;
+
+		glm::dvec4 plane(N, -glm::dot(N, P1));
+		for (int k = 0; k < 3; ++k) {
+			quadrics[indices[t + k]].addPlane(plane);
+		}
+	}
+
+	struct Collapse {
+		uint32_t from;
+		uint32_t to;
+		double cost;
+	};
+
+	std::vector<uint32_t> remap(numVerts);
+	double maxError = 0.0;
+
+	// greedy passes, each collapses the cheapest independent edges
+	for (int pass = 0; pass < 32 && result.size() > targetIndexCount; ++pass) {
+		Adjacency adj;
+		buildAdjacency(result, numVerts, adj);
+
+		std::vector<Collapse> collapses;
+		collapses.reserve(result.size() * 2);
+		for (size_t c = 0; c < result.size(); ++c) {
+			uint32_t a = result[c], b = result[c - c % 3 + (c + 1) % 3];
+			if (!locked[a]) {
+				collapses.push_back({ a, b, quadrics[a].error(positions[b]) + quadrics[b].error(positions[b]) });
+			}
+			if (!locked[b]) {
+				collapses.push_back({ b, a, quadrics[a].error(positions[a]) + quadrics[b].error(positions[a]) });
+			}
+		}
+		std::sort(collapses.begin(), collapses.end(), [](const Collapse & l, const Collapse & r) {
+			return l.cost < r.cost;
+		});
+
+		// moving "from" onto "to" must not flip any remaining triangle
+		auto flips = [&](uint32_t from, uint32_t to) {
+			for (uint32_t i = adj.offsets[from]; i < adj.offsets[from + 1]; ++i) {
+				const uint32_t * tri = &result[3 * adj.tris[i]];
+				if (tri[0] == to || tri[1] == to || tri[2] == to) {
+					continue;
+				}
+
+				glm::vec3 P[3] = { positions[tri[0]], positions[tri[1]], positions[tri[2]] };
+				glm::vec3 before = glm::cross(P[1] - P[0], P[2] - P[0]);
+				for (int k = 0; k < 3; ++k) {
+					if (tri[k] == from) {
+						P[k] = positions[to];
+					}
+				}
+				glm::vec3 after = glm::cross(P[1] - P[0], P[2] - P[0]);
+				if (glm::dot(before, after) <= 0.0f) {
+					return true;
+				}
+			}
+			return false;
+		};
+
+		for (uint32_t v = 0; v < numVerts; ++v) {
+			remap[v] = v;
+		}
+
+		std::vector<char> touched(numVerts, 0);
+		const size_t trianglesToRemove = (result.size() - targetIndexCount) / 3;
+		size_t removed = 0;
+		for (const Collapse & collapse : collapses) {
+			if (removed >= trianglesToRemove) {
+				break;
+			}
+			if (touched[collapse.from] || touched[collapse.to] || flips(collapse.from, collapse.to)) {
+				continue;
+			}
+
+			remap[collapse.from] = collapse.to;
+			quadrics[collapse.to].add(quadrics[collapse.from]);
+			maxError = std::max(maxError, collapse.cost);
+
+			// freeze both one-rings, keeps the adjacency and flip test valid for this pass
+			for (uint32_t v : { collapse.from, collapse.to }) {
+				for (uint32_t i = adj.offsets[v]; i < adj.offsets[v + 1]; ++i) {
+					const uint32_t * tri = &result[3 * adj.tris[i]];
+					touched[tri[0]] = touched[tri[1]] = touched[tri[2]] = 1;
+					if (v == collapse.from && (tri[0] == collapse.to || tri[1] == collapse.to || tri[2] == collapse.to)) {
+						removed++;
+					}
+				}
+			}
+		}
+
+		if (removed == 0) {
+			break; // everything left is locked
+		}
+
+		size_t write = 0;
+		for (size_t t = 0; t + 2 < result.size(); t += 3) {
+			uint32_t a = remap[result[t + 0]];
+			uint32_t b = remap[result[t + 1]];
+			uint32_t c = remap[result[t + 2]];
+			if (a == b || b == c || a == c) {
+				continue;
+			}
+			result[write++] = a;
+			result[write++] = b;
+			result[write++] = c;
+		}
+		result.resize(write);
+	}
+
+	return (float)std::sqrt(std::max(maxError, 0.0));
+}
+
+void MeshTools::buildLodChains(MeshData & mesh) {
+	const size_t numTris = mesh.indices.size() / 3;
+
+	// sort triangles by (material, object), one draw item per run
+	std::vector<uint32_t> order(numTris);
+	for (uint32_t t = 0; t < numTris; ++t) {
+		order[t] = t;
+	}
+	std::stable_sort(order.begin(), order.end(), [&](uint32_t l, uint32_t r) {
+		if (mesh.materialIds[l] != mesh.materialIds[r]) {
+			return mesh.materialIds[l] < mesh.materialIds[r];
+		}
+		return mesh.objectIds[l] < mesh.objectIds[r];
+	});
+
+	std::vector<size_t> runBegin;
+	for (size_t i = 0; i < numTris; ++i) {
+		if (i == 0 || mesh.materialIds[order[i]] != mesh.materialIds[order[i - 1]]
+				|| mesh.objectIds[order[i]] != mesh.objectIds[order[i - 1]]) {
+			runBegin.push_back(i);
+		}
+	}
+	runBegin.push_back(numTris);
+
+	const size_t numItems = runBegin.size() - 1;
+	std::vector<std::vector<uint32_t>> lods(numItems * MAX_LOD_LEVELS);
+	mesh.drawItems.assign(numItems, MeshDrawItem());
+
+	// draw items are independent, simplify them in parallel
+	parallelFor(numItems, [&](size_t begin, size_t end) {
+		for (size_t d = begin; d < end; ++d) {
+			MeshDrawItem & item = mesh.drawItems[d];
+			std::vector<uint32_t> & lod0 = lods[d * MAX_LOD_LEVELS];
+			for (size_t i = runBegin[d]; i < runBegin[d + 1]; ++i) {
+				lod0.push_back(mesh.indices[3 * order[i] + 0]);
+				lod0.push_back(mesh.indices[3 * order[i] + 1]);
+				lod0.push_back(mesh.indices[3 * order[i] + 2]);
+			}
+			item.materialId = (uint32_t)mesh.materialIds[order[runBegin[d]]];
+
+			glm::vec3 minPos(std::numeric_limits<float>::max());
+			glm::vec3 maxPos(-std::numeric_limits<float>::max());
+			for (uint32_t index : lod0) {
+				minPos = glm::min(minPos, mesh.positions[index]);
+				maxPos = glm::max(maxPos, mesh.positions[index]);
+			}
+			glm::vec3 center = 0.5f * (minPos + maxPos);
+			float radius = 0.0f;
+			for (uint32_t index : lod0) {
+				radius = std::max(radius, glm::length(mesh.positions[index] - center));
+			}
+			item.boundingSphere = glm::vec4(center, radius);
+
+			// halve the triangle count per level, always simplifying lod0
+			// so the reported error is measured against the full mesh
+			item.lodCount = 1;
+			item.lodError[0] = 0.0f;
+			for (uint32_t level = 1; level < MAX_LOD_LEVELS; ++level) {
+				const std::vector<uint32_t> & prev = lods[d * MAX_LOD_LEVELS + level - 1];
+				size_t target = (lod0.size() / 3 >> level) * 3;
+				if (target < 3 * 16) {
+					break; // small enough already
+				}
+
+				std::vector<uint32_t> & lod = lods[d * MAX_LOD_LEVELS + level];
+				float error = simplifyMesh(mesh.positions, lod0, target, lod);
+				if (lod.size() * 10 > prev.size() * 8) {
+					lod.clear();
+					break; // stuck on locked seams, no point in another level
+				}
+
+				item.lodError[level] = std::max(error, item.lodError[level - 1]);
+				item.lodCount++;
+			}
+		}
+	}, 1);
+
+	// draw items are sorted by material, offsets are relative to the material start
+	mesh.lodIndices.clear();
+	size_t materialBase = 0;
+	for (size_t d = 0; d < numItems; ++d) {
+		MeshDrawItem & item = mesh.drawItems[d];
+		if (d == 0 || item.materialId != mesh.drawItems[d - 1].materialId) {
+			materialBase = mesh.lodIndices.size();
+		}
+
+		for (uint32_t level = 0; level < item.lodCount; ++level) {
+			const std::vector<uint32_t> & lod = lods[d * MAX_LOD_LEVELS + level];
+			item.firstIndex[level] = uint32_t(mesh.lodIndices.size() - materialBase);
+			item.indexCount[level] = (uint32_t)lod.size();
+			mesh.lodIndices.insert(mesh.lodIndices.end(), lod.begin(), lod.end());
+		}
+	}
+}
+
+uint32_t MeshTools::selectLod(const MeshDrawItem & item, const glm::mat4 & modelView, float projScale, float pixelError) {
+	glm::vec3 center = glm::vec3(modelView * glm::vec4(glm::vec3(item.boundingSphere), 1.0f));
+
+	// distance to the nearest point of the bounding sphere
+	float distance = glm::length(center) - item.boundingSphere.w;
+	if (distance <= 0.0f) {
+		return 0;
+	}
+
+	uint32_t lod = 0;
+	while (lod + 1 < item.lodCount && item.lodError[lod + 1] * projScale / distance <= pixelError) {
+		lod++;
+	}
+	return lod;
+}
+
+OverdrawStats MeshTools::estimateOverdraw(const std::vector<glm::vec3> & positions, const std::vector<uint32_t> & indices, const glm::mat4 & mvp, int width, int height) {
+	OverdrawStats stats;
+	std::vector<float> depth(size_t(width) * height, 1.0f);
+
+	// transform once to framebuffer coordinates, z in [0, 1]
+	std::vector<glm::vec3> screen(positions.size());
+	std::vector<char> valid(positions.size());
+	parallelFor(positions.size(), [&](size_t begin, size_t end) {
+		for (size_t v = begin; v < end; ++v) {
+			glm::vec4 clip = mvp * glm::vec4(positions[v], 1.0f);
+			valid[v] = clip.w > 1e-5f;
+			if (valid[v]) {
+				glm::vec3 ndc = glm::vec3(clip) / clip.w;
+				screen[v] = glm::vec3((ndc.x * 0.5f + 0.5f) * width, (ndc.y * 0.5f + 0.5f) * height, ndc.z);
+			}
+		}
+	});
+
+	// visit every covered pixel center of every front facing triangle
+	auto rasterize = [&](const std::function<void(size_t pixel, float z)> & fragment) {
+		for (size_t t = 0; t + 2 < indices.size(); t += 3) {
+			uint32_t i0 = indices[t + 0], i1 = indices[t + 1], i2 = indices[t + 2];
+			if (!valid[i0] || !valid[i1] || !valid[i2]) {
+				continue;
+			}
+			const glm::vec3 & A = screen[i0];
+			const glm::vec3 & B = screen[i1];
+			const glm::vec3 & C = screen[i2];
+
+			// vulkan front face: positive area with y pointing down is ccw
+			float area = (B.x - A.x) * (C.y - A.y) - (C.x - A.x) * (B.y - A.y);
+			if (area >= 0.0f) {
+				continue;
+			}
+
+			int minX = std::max(0, (int)std::floor(std::min({ A.x, B.x, C.x })));
+			int maxX = std::min(width - 1, (int)std::ceil(std::max({ A.x, B.x, C.x })));
+			int minY = std::max(0, (int)std::floor(std::min({ A.y, B.y, C.y })));
+			int maxY = std::min(height - 1, (int)std::ceil(std::max({ A.y, B.y, C.y })));
+
+			for (int y = minY; y <= maxY; ++y) {
+				for (int x = minX; x <= maxX; ++x) {
+					glm::vec2 P(x + 0.5f, y + 0.5f);
+					float w0 = (C.x - B.x) * (P.y - B.y) - (P.x - B.x) * (C.y - B.y);
+					float w1 = (A.x - C.x) * (P.y - C.y) - (P.x - C.x) * (A.y - C.y);
+					float w2 = (B.x - A.x) * (P.y - A.y) - (P.x - A.x) * (B.y - A.y);
+					if (w0 > 0.0f || w1 > 0.0f || w2 > 0.0f) {
+						continue;
+					}
+
+					float z = (w0 * A.z + w1 * B.z + w2 * C.z) / area;
+					if (z < 0.0f || z > 1.0f) {
+						continue;
+					}
+					fragment(size_t(y) * width + x, z);
+				}
+			}
+		}
+	};
+
+	// main pass with its own depth buffer, LESS + write
+	rasterize([&](size_t pixel, float z) {
+		stats.rasterized++;
+		if (z < depth[pixel]) {
+			depth[pixel] = z;
+			stats.shadedLess++;
+		}
+	});
+
+	// main pass loading the prepass depth, EQUAL + no write
+	rasterize([&](size_t pixel, float z) {
+		if (z == depth[pixel]) {
+			stats.shadedEqual++;
+		}
+	});
+
+	for (float z : depth) {
+		stats.coveredPixels += z < 1.0f;
+	}
+	return stats;
+}
+
+bool MeshTools::loadMeshCache(const std::string & cachePath, uint64_t sourceHash, float scale, MeshData & mesh) {
+	std::ifstream file(cachePath, std::ios::binary);
+	if (!file.is_open()) {
+		return false;
+	}
+
+	uint32_t magic = 0, version = 0;
+	uint64_t cachedSourceHash = 0;
+	float cachedScale = 0.0f;
+	file.read((char*)&magic, sizeof(magic));
+	file.read((char*)&version, sizeof(version));
+	file.read((char*)&cachedSourceHash, sizeof(cachedSourceHash));
+	file.read((char*)&cachedScale, sizeof(cachedScale));
+	file.read((char*)&mesh.objectCount, sizeof(mesh.objectCount));
+
+	if (!file || magic != MESH_CACHE_MAGIC || version != MESH_CACHE_VERSION
+			|| cachedSourceHash != sourceHash || cachedScale != scale) {
+		return false;
+	}
+
+	return readArray(file, mesh.positions)
+		&& readArray(file, mesh.texCoords)
+		&& readArray(file, mesh.normals)
+		&& readArray(file, mesh.tangents)
+		&& readArray(file, mesh.indices)
+		&& readArray(file, mesh.materialIds)
+		&& readArray(file, mesh.objectIds)
+		&& readArray(file, mesh.drawItems)
+		&& readArray(file, mesh.lodIndices);
+}
+
+void MeshTools::saveMeshCache(const std::string & cachePath, uint64_t sourceHash, float scale, const MeshData & mesh) {
+	std::ofstream file(cachePath, std::ios::binary | std::ios::trunc);
+	if (!file.is_open()) {
+		return; // read-only model directory, just skip caching
+	}
+
+	file.write((const char*)&MESH_CACHE_MAGIC, sizeof(MESH_CACHE_MAGIC));
+	file.write((const char*)&MESH_CACHE_VERSION, sizeof(MESH_CACHE_VERSION));
+	file.write((const char*)&sourceHash, sizeof(sourceHash));
+	file.write((const char*)&scale, sizeof(scale));
+	file.write((const char*)&mesh.objectCount, sizeof(mesh.objectCount));
+
+	writeArray(file, mesh.positions);
+	writeArray(file, mesh.texCoords);
+	writeArray(file, mesh.normals);
+	writeArray(file, mesh.tangents);
+	writeArray(file, mesh.indices);
+	writeArray(file, mesh.materialIds);
+	writeArray(file, mesh.objectIds);
+	writeArray(file, mesh.drawItems);
+	writeArray(file, mesh.lodIndices);
+}
+
+uint64_t MeshTools::hashFile(const std::string & path, uint64_t hash) {
+	std::ifstream file(path, std::ios::binary);
+	if (!file.is_open()) {
+		return hash * 1099511628211ull;
+	}
+
+	std::vector<char> chunk(1 << 16);
+	while (file) {
+		file.read(chunk.data(), chunk.size());
+		size_t count = (size_t)file.gcount();
+		for (size_t i = 0; i < count; ++i) {
+			hash = (hash ^ (unsigned char)chunk[i]) * 1099511628211ull;
+		}
+	}
+	// end marker, moving bytes from the obj to the mtl changes the hash
+	return (hash ^ 0xFF) * 1099511628211ull;
+}
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <string>
+#include <functional>
+#include <cstdint>
+
+/************************************************************/
+//			Mesh processing done at load / bake time
+/************************************************************/
+
+#define MAX_LOD_LEVELS 4
+
+// one draw per (object, material) pair with its lod chain, std430 compatible
+// so the same array feeds the cpu selector and selectLod.comp
+struct MeshDrawItem {
+	glm::vec4 boundingSphere; // xyz = center, w = radius
+	uint32_t materialId;
+	uint32_t lodCount;
+	uint32_t pad[2];
+	uint32_t firstIndex[MAX_LOD_LEVELS]; // relative to the first index of the material
+	uint32_t indexCount[MAX_LOD_LEVELS];
+	float lodError[MAX_LOD_LEVELS]; // object space simplification error
+};
+
+// un-packed mesh data, output of obj parsing and input of all the
+// processing steps below. Vertex packing happens after processing.
+struct MeshData {
+	std::vector<glm::vec3> positions;
+	std::vector<glm::vec2> texCoords;
+	std::vector<glm::vec3> normals;
+	std::vector<glm::vec4> tangents; // tangents.w = bitangent sign
+
+	std::vector<uint32_t> indices; // triangle list
+	std::vector<int> materialIds; // one per triangle
+	std::vector<int> objectIds; // one per triangle
+
+	// lod chains, indices grouped by material
+	std::vector<MeshDrawItem> drawItems;
+	std::vector<uint32_t> lodIndices;
+
+	uint32_t objectCount = 0;
+};
+
+// fragment counts of one frame, see MeshTools::estimateOverdraw
+struct OverdrawStats {
+	uint64_t rasterized = 0; // covered samples, no depth test at all
+	uint64_t shadedLess = 0; // pass a LESS test in submission order (no prepass)
+	uint64_t shadedEqual = 0; // pass an EQUAL test against the final depth (prepass)
+	uint64_t coveredPixels = 0;
+};
+
+namespace MeshTools {
+
+	// split [0, count) into contiguous ranges, run as jobs of JobSystem::shared()
+	void parallelFor(size_t count, const std::function<void(size_t begin, size_t end)> & func, size_t minItemsPerThread = 1024);
+
+	// area weighted smooth normals, vertices sharing a position are welded
+	void computeSmoothNormals(MeshData & mesh);
+
+	// per-vertex tangent frames from texture coordinates (MikkTSpace style:
+	// accumulate per-triangle tangents, orthogonalize against the normal and
+	// store the handedness of the bitangent in w)
+	void computeTangents(MeshData & mesh);
+
+	// quadric error edge collapse down to targetIndexCount (or until no collapse
+	// is possible). Vertices are only removed, never moved, so the result indexes
+	// the same vertex buffer. Returns the max collapse error in object space.
+	float simplifyMesh(const std::vector<glm::vec3> & positions, const std::vector<uint32_t> & indices, size_t targetIndexCount, std::vector<uint32_t> & result);
+
+	// split triangles into draw items by (material, object) and generate
+	// up to MAX_LOD_LEVELS lods for each of them
+	void buildLodChains(MeshData & mesh);
+
+	// pick the coarsest lod whose error projects below pixelError, projScale is
+	// proj[1][1] * screenHeight / 2. Keep in sync with selectLod.comp
+	uint32_t selectLod(const MeshDrawItem & item, const glm::mat4 & modelView, float projScale, float pixelError);
+
+	// cpu reference rasterizer (back faces culled, ccw front) counting the
+	// fragment shader invocations with and without reusing the prepass depth.
+	// Triangles crossing the near plane are skipped, it is an estimate.
+	OverdrawStats estimateOverdraw(const std::vector<glm::vec3> & positions, const std::vector<uint32_t> & indices, const glm::mat4 & mvp, int width, int height);
+
+	// binary mesh cache next to the source model, invalidated when the
+	// source hash, load scale or cache version change
+	bool loadMeshCache(const std::string & cachePath, uint64_t sourceHash, float scale, MeshData & mesh);
+
+	void saveMeshCache(const std::string & cachePath, uint64_t sourceHash, float scale, const MeshData & mesh);
+
+	// 64 bit FNV-1a of the file contents continuing from hash, a missing file
+	// hashes differently from an empty one
+	uint64_t hashFile(const std::string & path, uint64_t hash = 14695981039346656037ull);
+}
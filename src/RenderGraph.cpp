@@ -0,0 +1,504 @@
+#include "RenderGraph.h"
+
+#include <stdexcept>
+#include <algorithm>
+
+namespace {
+
+	const VkAccessFlags WRITE_ACCESS = VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT
+		| VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT
+		| VK_ACCESS_HOST_WRITE_BIT | VK_ACCESS_MEMORY_WRITE_BIT;
+
+	// what the frame did to a resource so far, per queue where it matters
+	struct ResourceState {
+		RenderQueue owner = RENDER_QUEUE_GRAPHICS;
+		int lastUse[NUM_RENDER_QUEUES] = { -1, -1 }; // last submit of each queue that used it
+		int writeSubmit = -1; // last write (or layout transition), -1 = not written this frame
+		VkPipelineStageFlags writeStages = 0;
+		VkAccessFlags writeAccess = 0;
+		int readSubmit[NUM_RENDER_QUEUES] = { -1, -1 }; // last read since the write
+		VkPipelineStageFlags readStages[NUM_RENDER_QUEUES] = {}; // reads since the write
+		VkPipelineStageFlags visibleStages[NUM_RENDER_QUEUES] = {}; // stages already ordered after the write
+		VkImageLayout layout = VK_IMAGE_LAYOUT_UNDEFINED;
+	};
+
+	struct FlagName {
+		VkFlags bit;
+		const char * name;
+	};
+
+	const FlagName STAGE_NAMES[] = {
+		{ VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, "TOP_OF_PIPE" },
+		{ VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT, "DRAW_INDIRECT" },
+		{ VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, "VERTEX_INPUT" },
+		{ VK_PIPELINE_STAGE_VERTEX_SHADER_BIT, "VERTEX_SHADER" },
+		{ VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, "FRAGMENT_SHADER" },
+		{ VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT, "EARLY_FRAGMENT_TESTS" },
+		{ VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT, "LATE_FRAGMENT_TESTS" },
+		{ VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, "COLOR_ATTACHMENT_OUTPUT" },
+		{ VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, "COMPUTE_SHADER" },
+		{ VK_PIPELINE_STAGE_TRANSFER_BIT, "TRANSFER" },
+		{ VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, "BOTTOM_OF_PIPE" },
+		{ VK_PIPELINE_STAGE_HOST_BIT, "HOST" },
+		{ VK_PIPELINE_STAGE_ALL_GRAPHICS_BIT, "ALL_GRAPHICS" },
+		{ VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, "ALL_COMMANDS" },
+	};
+
+	const FlagName ACCESS_NAMES[] = {
+		{ VK_ACCESS_INDIRECT_COMMAND_READ_BIT, "INDIRECT_COMMAND_READ" },
+		{ VK_ACCESS_INDEX_READ_BIT, "INDEX_READ" },
+		{ VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT, "VERTEX_ATTRIBUTE_READ" },
+		{ VK_ACCESS_UNIFORM_READ_BIT, "UNIFORM_READ" },
+		{ VK_ACCESS_SHADER_READ_BIT, "SHADER_READ" },
+		{ VK_ACCESS_SHADER_WRITE_BIT, "SHADER_WRITE" },
+		{ VK_ACCESS_COLOR_ATTACHMENT_READ_BIT, "COLOR_ATTACHMENT_READ" },
+		{ VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT, "COLOR_ATTACHMENT_WRITE" },
+		{ VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT, "DEPTH_STENCIL_ATTACHMENT_READ" },
+		{ VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT, "DEPTH_STENCIL_ATTACHMENT_WRITE" },
+		{ VK_ACCESS_TRANSFER_READ_BIT, "TRANSFER_READ" },
+		{ VK_ACCESS_TRANSFER_WRITE_BIT, "TRANSFER_WRITE" },
+		{ VK_ACCESS_HOST_READ_BIT, "HOST_READ" },
+		{ VK_ACCESS_HOST_WRITE_BIT, "HOST_WRITE" },
+		{ VK_ACCESS_MEMORY_READ_BIT, "MEMORY_READ" },
+		{ VK_ACCESS_MEMORY_WRITE_BIT, "MEMORY_WRITE" },
+	};
+
+	template <size_t N>
+	std::string flagNames(VkFlags flags, const FlagName (&names)[N]) {
+		std::string result;
+		for (const FlagName & name : names) {
+			if (flags & name.bit) {
+				result += (result.empty() ? "" : "|") + std::string(name.name);
+			}
+		}
+		return result.empty() ? "0" : result;
+	}
+
+	const char * layoutName(VkImageLayout layout) {
+		switch (layout) {
+		case VK_IMAGE_LAYOUT_UNDEFINED: return "UNDEFINED";
+		case VK_IMAGE_LAYOUT_GENERAL: return "GENERAL";
+		case VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL: return "COLOR_ATTACHMENT_OPTIMAL";
+		case VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL: return "DEPTH_STENCIL_ATTACHMENT_OPTIMAL";
+		case VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL: return "DEPTH_STENCIL_READ_ONLY_OPTIMAL";
+		case VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL: return "SHADER_READ_ONLY_OPTIMAL";
+		case VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL: return "TRANSFER_SRC_OPTIMAL";
+		case VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL: return "TRANSFER_DST_OPTIMAL";
+		case VK_IMAGE_LAYOUT_PRESENT_SRC_KHR: return "PRESENT_SRC_KHR";
+		default: return "?";
+		}
+	}
+
+	void addBarrier(RenderBarriers & barriers, const RenderResource & resource,
+			VkPipelineStageFlags srcStages, VkAccessFlags srcAccess, VkPipelineStageFlags dstStages, VkAccessFlags dstAccess,
+			VkImageLayout oldLayout, VkImageLayout newLayout, uint32_t srcFamily, uint32_t dstFamily) {
+		barriers.srcStages |= srcStages;
+		barriers.dstStages |= dstStages;
+
+		if (resource.image != VK_NULL_HANDLE) {
+			VkImageMemoryBarrier barrier = {};
+			barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+			barrier.srcAccessMask = srcAccess;
+			barrier.dstAccessMask = dstAccess;
+			barrier.oldLayout = oldLayout;
+			barrier.newLayout = newLayout;
+			barrier.srcQueueFamilyIndex = srcFamily;
+			barrier.dstQueueFamilyIndex = dstFamily;
+			barrier.image = resource.image;
+			barrier.subresourceRange.aspectMask = resource.aspect;
+			barrier.subresourceRange.baseMipLevel = 0;
+			barrier.subresourceRange.levelCount = VK_REMAINING_MIP_LEVELS;
+			barrier.subresourceRange.baseArrayLayer = 0;
+			barrier.subresourceRange.layerCount = VK_REMAINING_ARRAY_LAYERS;
+			barriers.images.push_back(barrier);
+		} else {
+			VkBufferMemoryBarrier barrier = {};
+			barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+			barrier.srcAccessMask = srcAccess;
+			barrier.dstAccessMask = dstAccess;
+			barrier.srcQueueFamilyIndex = srcFamily;
+			barrier.dstQueueFamilyIndex = dstFamily;
+			barrier.buffer = resource.buffer;
+			barrier.offset = 0;
+			barrier.size = VK_WHOLE_SIZE;
+			barriers.buffers.push_back(barrier);
+		}
+
+		std::string note = resource.name + ": " + flagNames(srcAccess, ACCESS_NAMES) + " -> " + flagNames(dstAccess, ACCESS_NAMES);
+		if (oldLayout != newLayout) {
+			note += ", " + std::string(layoutName(oldLayout)) + " -> " + layoutName(newLayout);
+		}
+		if (srcFamily != dstFamily) {
+			note += ", queue family " + std::to_string(srcFamily) + " -> " + std::to_string(dstFamily);
+		}
+		barriers.notes.push_back(note);
+	}
+
+	void addWait(RenderSchedule & schedule, int submit, int waited, VkPipelineStageFlags stages) {
+		schedule.submits[waited].signaled = true;
+		for (SubmitWait & wait : schedule.submits[submit].waits) {
+			if (wait.submit == waited) {
+				wait.stages |= stages;
+				return;
+			}
+		}
+		schedule.submits[submit].waits.push_back({ waited, stages });
+	}
+
+	// empty submit at index for a release that has no earlier submit on its queue
+	void insertSubmit(RenderSchedule & schedule, std::vector<ResourceState> & states, int index, RenderQueue queue) {
+		RenderSubmit submit;
+		submit.queue = queue;
+		schedule.submits.insert(schedule.submits.begin() + index, submit);
+
+		auto shift = [index](int & submit) {
+			if (submit >= index) {
+				submit++;
+			}
+		};
+		for (ResourceState & state : states) {
+			shift(state.writeSubmit);
+			for (int q = 0; q < NUM_RENDER_QUEUES; ++q) {
+				shift(state.lastUse[q]);
+				shift(state.readSubmit[q]);
+			}
+		}
+		for (RenderSubmit & other : schedule.submits) {
+			for (SubmitWait & wait : other.waits) {
+				if (wait.submit >= index) {
+					wait.submit++;
+				}
+			}
+		}
+	}
+}
+
+int RenderGraph::addBuffer(const std::string & name, VkBuffer buffer, bool queueFamilyExclusive) {
+	RenderResource resource;
+	resource.name = name;
+	resource.buffer = buffer;
+	resource.queueFamilyExclusive = queueFamilyExclusive;
+	resources.push_back(resource);
+	return (int)resources.size() - 1;
+}
+
+int RenderGraph::addImage(const std::string & name, VkImage image, VkImageAspectFlags aspect, VkImageLayout layout, bool queueFamilyExclusive) {
+	// barriers keep the contents, they never transition back to UNDEFINED
+	if (layout == VK_IMAGE_LAYOUT_UNDEFINED) {
+		throw std::runtime_error("render graph image " + name + " needs a layout between frames!");
+	}
+
+	RenderResource resource;
+	resource.name = name;
+	resource.image = image;
+	resource.aspect = aspect;
+	resource.layout = layout;
+	resource.queueFamilyExclusive = queueFamilyExclusive;
+	resources.push_back(resource);
+	return (int)resources.size() - 1;
+}
+
+int RenderGraph::addSwapchainImage(const std::string & name) {
+	RenderResource resource;
+	resource.name = name;
+	resource.swapchain = true;
+	resources.push_back(resource);
+	return (int)resources.size() - 1;
+}
+
+int RenderGraph::addTransientImage(const std::string & name, VkImageAspectFlags aspect) {
+	RenderResource resource;
+	resource.name = name;
+	resource.aspect = aspect;
+	resource.transient = true;
+	resources.push_back(resource);
+	return (int)resources.size() - 1;
+}
+
+void RenderGraph::bindTransientImage(int resource, VkImage image, int aliasSlot) {
+	resources[resource].image = image;
+	resources[resource].aliasSlot = aliasSlot;
+}
+
+void RenderGraph::bindBuffer(int resource, VkBuffer buffer) {
+	resources[resource].buffer = buffer;
+}
+
+void RenderGraph::bindImage(int resource, VkImage image) {
+	resources[resource].image = image;
+}
+
+int RenderGraph::addPass(const std::string & name, RenderQueue queue, const std::vector<ResourceUse> & uses, bool present) {
+	if (passes.size() >= 32) {
+		throw std::runtime_error("render graph has more passes than the enabled pass mask!");
+	}
+
+	RenderPassNode pass;
+	pass.name = name;
+	pass.queue = queue;
+	pass.uses = uses;
+	pass.present = present;
+	passes.push_back(pass);
+	return (int)passes.size() - 1;
+}
+
+bool RenderGraph::lifetime(int resource, int & firstPass, int & lastPass) const {
+	firstPass = -1;
+	lastPass = -1;
+	for (int p = 0; p < (int)passes.size(); ++p) {
+		for (const ResourceUse & use : passes[p].uses) {
+			if (use.resource == resource) {
+				firstPass = firstPass < 0 ? p : firstPass;
+				lastPass = p;
+			}
+		}
+	}
+	return firstPass >= 0;
+}
+
+void RenderGraph::clear() {
+	resources.clear();
+	passes.clear();
+}
+
+RenderSchedule RenderGraph::compile(uint32_t enabledPasses, uint32_t graphicsFamily, uint32_t computeFamily) const {
+	RenderSchedule schedule;
+	schedule.enabledPasses = enabledPasses;
+
+	const bool separateCompute = graphicsFamily != computeFamily;
+	const uint32_t families[NUM_RENDER_QUEUES] = { graphicsFamily, computeFamily };
+
+	// transient images of an alias slot hand their hazards over through a state
+	// of the slot, stored after the resources so insertSubmit shifts it too
+	int numSlots = 0;
+	for (const RenderResource & resource : resources) {
+		if (resource.transient) {
+			if (resource.image == VK_NULL_HANDLE) {
+				throw std::runtime_error("render graph image " + resource.name + " has no memory!");
+			}
+			numSlots = std::max(numSlots, resource.aliasSlot + 1);
+		}
+	}
+
+	std::vector<ResourceState> states(resources.size() + numSlots);
+	for (size_t i = 0; i < resources.size(); ++i) {
+		states[i].layout = resources[i].layout;
+	}
+	std::vector<bool> begun(resources.size(), false);
+
+	for (int p = 0; p < (int)passes.size(); ++p) {
+		if (!(enabledPasses & (1u << p))) {
+			continue;
+		}
+		const RenderPassNode & node = passes[p];
+		const RenderQueue queue = separateCompute ? node.queue : RENDER_QUEUE_GRAPHICS;
+
+		// passes of one queue share a submit until another queue or the present comes between
+		if (schedule.submits.empty() || schedule.submits.back().queue != queue || schedule.submits.back().present || node.present) {
+			RenderSubmit submit;
+			submit.queue = queue;
+			submit.present = node.present;
+			schedule.submits.push_back(submit);
+		}
+		int s = (int)schedule.submits.size() - 1;
+
+		ScheduledPass scheduled;
+		scheduled.pass = p;
+
+		for (const ResourceUse & use : node.uses) {
+			const RenderResource & resource = resources[use.resource];
+			ResourceState & state = states[use.resource];
+
+			// only the order against the acquire and the present matters
+			if (resource.swapchain) {
+				if (state.writeSubmit < 0) {
+					schedule.submits[s].swapchainWait |= use.stages;
+				} else if (state.writeSubmit != s && (node.present || schedule.submits[state.writeSubmit].queue != queue)) {
+					addWait(schedule, s, state.writeSubmit, use.stages);
+				}
+				state.writeSubmit = s;
+				continue;
+			}
+
+			// the first use of a transient image waits for the last use of the
+			// image that had its memory before and throws the contents away
+			if (resource.transient && !begun[use.resource]) {
+				if (!(use.access & WRITE_ACCESS)) {
+					throw std::runtime_error("render graph image " + resource.name + " is read before it is written!");
+				}
+				if (use.layout == VK_IMAGE_LAYOUT_UNDEFINED && use.finalLayout == VK_IMAGE_LAYOUT_UNDEFINED) {
+					throw std::runtime_error("render graph image " + resource.name + " needs a layout at its first use!");
+				}
+				state = states[resources.size() + resource.aliasSlot];
+				state.layout = VK_IMAGE_LAYOUT_UNDEFINED;
+				begun[use.resource] = true;
+			}
+
+			const bool image = resource.image != VK_NULL_HANDLE;
+			const bool discard = image && use.layout == VK_IMAGE_LAYOUT_UNDEFINED;
+			const VkImageLayout layout = discard ? state.layout : use.layout;
+			const bool transition = image && layout != state.layout;
+			const bool writes = (use.access & WRITE_ACCESS) != 0;
+			const bool modifies = writes || transition; // a layout transition writes the image too
+			const bool ownerChange = separateCompute && resource.queueFamilyExclusive && state.owner != queue && !discard;
+			const bool writtenHere = state.writeSubmit >= 0 && schedule.submits[state.writeSubmit].queue == queue;
+
+			VkPipelineStageFlags srcStages = 0;
+			VkAccessFlags srcAccess = 0;
+			bool barrier = false;
+
+			if (ownerChange) {
+				// released after its last use on the old queue, or at the end of the
+				// latest submit of that queue when this frame did not use it there
+				const RenderQueue owner = state.owner;
+				int release = state.lastUse[owner];
+				for (int i = s - 1; i >= 0 && release < 0; --i) {
+					if (schedule.submits[i].queue == owner && !schedule.submits[i].present) {
+						release = i;
+					}
+				}
+				if (release < 0) {
+					insertSubmit(schedule, states, s, owner);
+					release = s++;
+				}
+
+				const bool writtenByOwner = state.writeSubmit >= 0 && schedule.submits[state.writeSubmit].queue == owner;
+				VkPipelineStageFlags releaseStages = (writtenByOwner ? state.writeStages : 0) | state.readStages[owner] | state.visibleStages[owner];
+				addBarrier(schedule.submits[release].release, resource,
+					releaseStages ? releaseStages : (VkPipelineStageFlags)VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, writtenByOwner ? state.writeAccess : 0,
+					VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0,
+					state.layout, layout, families[owner], families[queue]);
+
+				// the acquire runs in the stages the semaphore wait holds back
+				addBarrier(scheduled.before, resource,
+					use.stages, 0, use.stages, use.access,
+					state.layout, layout, families[owner], families[queue]);
+				addWait(schedule, s, release, use.stages);
+				state.visibleStages[queue] = use.stages;
+			} else if (modifies) {
+				// after everything this queue did since the last write, and after the
+				// last use on the other queue
+				srcStages = (writtenHere ? state.writeStages : 0) | state.readStages[queue] | state.visibleStages[queue];
+				srcAccess = writtenHere ? state.writeAccess : 0;
+				barrier = srcStages != 0 || transition;
+				for (int other = 0; other < NUM_RENDER_QUEUES; ++other) {
+					int last = state.readSubmit[other];
+					if (state.writeSubmit >= 0 && schedule.submits[state.writeSubmit].queue == other) {
+						last = std::max(last, state.writeSubmit);
+					}
+					if (other != queue && last >= 0) {
+						addWait(schedule, s, last, use.stages);
+					}
+				}
+			} else if (state.writeSubmit >= 0) {
+				VkPipelineStageFlags missing = use.stages & ~state.visibleStages[queue];
+				if (writtenHere) {
+					srcStages = state.writeStages;
+					srcAccess = state.writeAccess;
+					barrier = missing != 0;
+				} else if (state.visibleStages[queue] == 0) {
+					// the semaphore makes the other queue's writes visible
+					addWait(schedule, s, state.writeSubmit, use.stages);
+				} else {
+					// earlier stages than the first wait, chained through it
+					srcStages = state.visibleStages[queue];
+					barrier = missing != 0;
+				}
+				state.visibleStages[queue] |= use.stages;
+			}
+
+			if (barrier) {
+				// a barrier cannot transition to UNDEFINED, a render pass that
+				// starts from UNDEFINED accepts its final layout as well
+				addBarrier(scheduled.before, resource,
+					srcStages ? srcStages : (VkPipelineStageFlags)VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, srcAccess,
+					use.stages, use.access,
+					state.layout, layout != VK_IMAGE_LAYOUT_UNDEFINED ? layout : use.finalLayout,
+					VK_QUEUE_FAMILY_IGNORED, VK_QUEUE_FAMILY_IGNORED);
+			}
+
+			state.owner = queue;
+			state.lastUse[queue] = s;
+			if (modifies) {
+				state.writeSubmit = s;
+				state.writeStages = use.stages;
+				state.writeAccess = use.access & WRITE_ACCESS;
+				for (int q = 0; q < NUM_RENDER_QUEUES; ++q) {
+					state.readSubmit[q] = -1;
+					state.readStages[q] = 0;
+					state.visibleStages[q] = 0;
+				}
+				if (!writes) {
+					state.visibleStages[queue] = use.stages;
+				}
+			}
+			if (!writes) {
+				state.readSubmit[queue] = s;
+				state.readStages[queue] |= use.stages;
+			}
+			if (image) {
+				state.layout = use.finalLayout != VK_IMAGE_LAYOUT_UNDEFINED ? use.finalLayout : layout;
+			}
+			if (resource.transient) {
+				states[resources.size() + resource.aliasSlot] = state;
+			}
+		}
+
+		schedule.submits[s].passes.push_back(scheduled);
+	}
+
+	// the next frame starts from the declared state again
+	for (size_t i = 0; i < resources.size(); ++i) {
+		if (resources[i].swapchain || resources[i].transient) {
+			continue;
+		}
+		if (separateCompute && resources[i].queueFamilyExclusive && states[i].owner != RENDER_QUEUE_GRAPHICS) {
+			throw std::runtime_error("render graph leaves " + resources[i].name + " on the compute queue!");
+		}
+		if (resources[i].image != VK_NULL_HANDLE && states[i].layout != resources[i].layout) {
+			throw std::runtime_error("render graph leaves " + resources[i].name + " in " + layoutName(states[i].layout) + "!");
+		}
+	}
+
+	return schedule;
+}
+
+void RenderGraph::dump(const RenderSchedule & schedule, std::ostream & out) const {
+	auto dumpBarriers = [&](const RenderBarriers & barriers, const char * label) {
+		if (barriers.empty()) {
+			return;
+		}
+		out << "    " << label << " " << flagNames(barriers.srcStages, STAGE_NAMES) << " -> "
+			<< flagNames(barriers.dstStages, STAGE_NAMES) << "\n";
+		for (const std::string & note : barriers.notes) {
+			out << "      " << note << "\n";
+		}
+	};
+
+	out << "passes:";
+	for (size_t p = 0; p < passes.size(); ++p) {
+		if (schedule.enabledPasses & (1u << p)) {
+			out << " " << passes[p].name;
+		}
+	}
+	out << "\n";
+
+	for (size_t s = 0; s < schedule.submits.size(); ++s) {
+		const RenderSubmit & submit = schedule.submits[s];
+		out << "submit " << s << (submit.present ? " (present)" : submit.queue == RENDER_QUEUE_GRAPHICS ? " (graphics)" : " (compute)") << "\n";
+		if (submit.swapchainWait) {
+			out << "  wait swap chain image at " << flagNames(submit.swapchainWait, STAGE_NAMES) << "\n";
+		}
+		for (const SubmitWait & wait : submit.waits) {
+			out << "  wait submit " << wait.submit << " at " << flagNames(wait.stages, STAGE_NAMES) << "\n";
+		}
+		for (const ScheduledPass & scheduled : submit.passes) {
+			out << "  " << passes[scheduled.pass].name << "\n";
+			dumpBarriers(scheduled.before, "before");
+		}
+		dumpBarriers(submit.release, "release");
+		if (submit.signaled) {
+			out << "  signal\n";
+		}
+	}
+}
@@ -0,0 +1,142 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <vector>
+#include <string>
+#include <ostream>
+#include <cstdint>
+
+/************************************************************/
+//			Frame graph: passes, resources and their barriers
+/************************************************************/
+
+enum RenderQueue {
+	RENDER_QUEUE_GRAPHICS = 0,
+	RENDER_QUEUE_COMPUTE = 1,
+	NUM_RENDER_QUEUES = 2
+};
+
+// how a pass touches a resource, as seen from the other passes. Barriers
+// between the commands of one pass stay in its command buffer. Built from
+// brace lists, the layouts left out are UNDEFINED
+struct ResourceUse {
+	ResourceUse(int resource, VkPipelineStageFlags stages, VkAccessFlags access,
+		VkImageLayout layout = VK_IMAGE_LAYOUT_UNDEFINED, VkImageLayout finalLayout = VK_IMAGE_LAYOUT_UNDEFINED)
+		: resource(resource), stages(stages), access(access), layout(layout), finalLayout(finalLayout) {}
+
+	int resource;
+	VkPipelineStageFlags stages;
+	VkAccessFlags access;
+	VkImageLayout layout; // images: layout the pass expects, UNDEFINED = contents discarded
+	VkImageLayout finalLayout; // layout the pass leaves (render pass final layout), UNDEFINED = layout
+};
+
+struct RenderResource {
+	std::string name;
+	VkBuffer buffer = VK_NULL_HANDLE;
+	VkImage image = VK_NULL_HANDLE;
+	VkImageAspectFlags aspect = 0;
+	VkImageLayout layout = VK_IMAGE_LAYOUT_UNDEFINED; // between frames
+	bool queueFamilyExclusive = false; // ownership moves between the queue families
+	bool swapchain = false; // ordered by the acquire and present semaphores, never barriered
+	bool transient = false; // contents only live between its first and last pass of the frame
+	int aliasSlot = -1; // transient images of one slot share memory, their lifetimes don't overlap
+};
+
+struct RenderPassNode {
+	std::string name;
+	RenderQueue queue;
+	std::vector<ResourceUse> uses;
+	bool present = false; // vkQueuePresentKHR of the swap chain image instead of a command buffer
+};
+
+// one vkCmdPipelineBarrier
+struct RenderBarriers {
+	VkPipelineStageFlags srcStages = 0;
+	VkPipelineStageFlags dstStages = 0;
+	std::vector<VkBufferMemoryBarrier> buffers;
+	std::vector<VkImageMemoryBarrier> images;
+	std::vector<std::string> notes; // one line per barrier for the dump
+
+	bool empty() const { return buffers.empty() && images.empty(); }
+};
+
+struct ScheduledPass {
+	int pass;
+	RenderBarriers before;
+};
+
+// semaphore wait on an earlier submit of another queue
+struct SubmitWait {
+	int submit;
+	VkPipelineStageFlags stages;
+};
+
+// consecutive passes of one queue merged into a vkQueueSubmit, or the present
+struct RenderSubmit {
+	RenderQueue queue;
+	std::vector<ScheduledPass> passes;
+	RenderBarriers release; // queue family releases after the last pass
+	std::vector<SubmitWait> waits;
+	bool signaled = false; // a later submit waits on it
+	VkPipelineStageFlags swapchainWait = 0; // stages waiting for the acquired image, 0 = none
+	bool present = false;
+};
+
+struct RenderSchedule {
+	uint32_t enabledPasses = 0;
+	std::vector<RenderSubmit> submits;
+};
+
+// passes run in declaration order. At the start of a frame every resource is in
+// its declared layout (transient images are UNDEFINED) and owned by the graphics
+// queue. Resources a frame writes have one copy per frame in flight, bound
+// before compiling, and the frame that used that copy before finished (the host
+// waits for it), so only hazards inside the frame need barriers
+class RenderGraph {
+public:
+	int addBuffer(const std::string & name, VkBuffer buffer, bool queueFamilyExclusive = false);
+
+	int addImage(const std::string & name, VkImage image, VkImageAspectFlags aspect, VkImageLayout layout, bool queueFamilyExclusive = false);
+
+	// acquired image of the swap chain, the image changes every frame
+	int addSwapchainImage(const std::string & name);
+
+	// image without contents at the start of the frame. The image is created
+	// later, once the lifetimes of all transient images are known, and bound
+	// with bindTransientImage before the first compile
+	int addTransientImage(const std::string & name, VkImageAspectFlags aspect);
+
+	void bindTransientImage(int resource, VkImage image, int aliasSlot);
+
+	// another copy of a buffer / image resource, for the next compile
+	void bindBuffer(int resource, VkBuffer buffer);
+	void bindImage(int resource, VkImage image);
+
+	int addPass(const std::string & name, RenderQueue queue, const std::vector<ResourceUse> & uses, bool present = false);
+
+	// submits, semaphore waits and barriers of the passes in enabledPasses (bit i
+	// = pass i). With the same family for both queues everything runs on the
+	// graphics queue in as few submits as possible
+	RenderSchedule compile(uint32_t enabledPasses, uint32_t graphicsFamily, uint32_t computeFamily) const;
+
+	// readable schedule, checked on the cpu without running a frame
+	void dump(const RenderSchedule & schedule, std::ostream & out) const;
+
+	// first and last declared pass that uses the resource, false if none does.
+	// Enabling fewer passes only shortens it
+	bool lifetime(int resource, int & firstPass, int & lastPass) const;
+
+	int numPasses() const { return (int)passes.size(); }
+
+	const RenderPassNode & pass(int index) const { return passes[index]; }
+
+	const RenderResource & resource(int index) const { return resources[index]; }
+
+	void clear();
+
+private:
+	std::vector<RenderResource> resources;
+	std::vector<RenderPassNode> passes;
+};
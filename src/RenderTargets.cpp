@@ -0,0 +1,305 @@
+#include "RenderTargets.h"
+
+#include <stdexcept>
+#include <algorithm>
+#include <iomanip>
+
+namespace {
+
+	const VkImageUsageFlags ATTACHMENT_USAGE = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT
+		| VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT;
+
+	const uint32_t NO_MEMORY_TYPE = UINT32_MAX;
+
+	float megabytes(VkDeviceSize size) {
+		return size / (1024.0f * 1024.0f);
+	}
+
+	// a pass of enabledPasses reads or writes the resource
+	bool usedInFrame(const RenderGraph & graph, int resource, uint32_t enabledPasses) {
+		for (int p = 0; p < graph.numPasses(); ++p) {
+			if (!(enabledPasses & (1u << p))) {
+				continue;
+			}
+			for (const ResourceUse & use : graph.pass(p).uses) {
+				if (use.resource == resource) {
+					return true;
+				}
+			}
+		}
+		return false;
+	}
+}
+
+void RenderTargetPool::init(VkPhysicalDevice physicalDevice) {
+	vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memoryProperties);
+}
+
+uint32_t RenderTargetPool::findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties, bool required) const {
+	for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; i++) {
+		if ((typeFilter & (1 << i)) && (memoryProperties.memoryTypes[i].propertyFlags & properties) == properties) {
+			return i;
+		}
+	}
+
+	if (required) {
+		throw std::runtime_error("failed to find suitable memory type!");
+	}
+	return NO_MEMORY_TYPE;
+}
+
+void RenderTargetPool::createImage(VkDevice device, RenderTarget & target, VkImageUsageFlags usage) {
+	VkImageCreateInfo imageInfo = {};
+	imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+	imageInfo.imageType = VK_IMAGE_TYPE_2D;
+	imageInfo.format = target.info.format;
+	imageInfo.extent.width = target.extent.width;
+	imageInfo.extent.height = target.extent.height;
+	imageInfo.extent.depth = 1;
+	imageInfo.mipLevels = 1;
+	imageInfo.arrayLayers = 1;
+	imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+	imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+	imageInfo.usage = usage;
+	imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	if (target.info.queueFamilies.size() > 1) {
+		imageInfo.sharingMode = VK_SHARING_MODE_CONCURRENT;
+		imageInfo.queueFamilyIndexCount = (uint32_t)target.info.queueFamilies.size();
+		imageInfo.pQueueFamilyIndices = target.info.queueFamilies.data();
+	}
+	imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+	if (vkCreateImage(device, &imageInfo, nullptr, &target.image) != VK_SUCCESS) {
+		throw std::runtime_error("failed to create render target " + target.info.name + "!");
+	}
+}
+
+void RenderTargetPool::createView(VkDevice device, RenderTarget & target) {
+	VkImageViewCreateInfo viewInfo = {};
+	viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+	viewInfo.image = target.image;
+	viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+	viewInfo.format = target.info.format;
+	viewInfo.subresourceRange.aspectMask = target.info.aspect;
+	viewInfo.subresourceRange.baseMipLevel = 0;
+	viewInfo.subresourceRange.levelCount = 1;
+	viewInfo.subresourceRange.baseArrayLayer = 0;
+	viewInfo.subresourceRange.layerCount = 1;
+
+	if (vkCreateImageView(device, &viewInfo, nullptr, &target.view) != VK_SUCCESS) {
+		throw std::runtime_error("failed to create render target view " + target.info.name + "!");
+	}
+}
+
+void RenderTargetPool::allocatePersistent(VkDevice device, RenderTarget & target) {
+	createImage(device, target, target.info.usage);
+
+	VkMemoryRequirements memReqs;
+	vkGetImageMemoryRequirements(device, target.image, &memReqs);
+	target.size = memReqs.size;
+
+	VkMemoryAllocateInfo allocInfo = {};
+	allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+	allocInfo.allocationSize = memReqs.size;
+	allocInfo.memoryTypeIndex = findMemoryType(memReqs.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, true);
+
+	if (vkAllocateMemory(device, &allocInfo, nullptr, &target.memory) != VK_SUCCESS) {
+		throw std::runtime_error("failed to allocate render target memory " + target.info.name + "!");
+	}
+	if (vkBindImageMemory(device, target.image, target.memory, 0) != VK_SUCCESS) {
+		throw std::runtime_error("failed to bind render target memory " + target.info.name + "!");
+	}
+	createView(device, target);
+}
+
+int RenderTargetPool::createPersistent(VkDevice device, const RenderTargetInfo & info, VkExtent2D extent) {
+	RenderTarget target;
+	target.info = info;
+	target.extent = extent;
+	allocatePersistent(device, target);
+
+	targets.push_back(target);
+	return (int)targets.size() - 1;
+}
+
+void RenderTargetPool::resizePersistent(VkDevice device, int index, VkExtent2D extent) {
+	RenderTarget & target = targets[index];
+	vkDestroyImageView(device, target.view, nullptr);
+	vkDestroyImage(device, target.image, nullptr);
+	vkFreeMemory(device, target.memory, nullptr);
+
+	target.extent = extent;
+	allocatePersistent(device, target);
+}
+
+int RenderTargetPool::addTransient(const RenderTargetInfo & info, RenderGraph & graph) {
+	RenderTarget target;
+	target.info = info;
+	target.resource = graph.addTransientImage(info.name, info.aspect);
+	transients.push_back(target);
+	return (int)transients.size() - 1;
+}
+
+void RenderTargetPool::allocateTransient(VkDevice device, RenderGraph & graph, VkExtent2D extent) {
+	std::vector<int> order;
+	for (int i = 0; i < (int)transients.size(); ++i) {
+		RenderTarget & target = transients[i];
+		if (target.image != VK_NULL_HANDLE) {
+			continue;
+		}
+		if (!graph.lifetime(target.resource, target.firstPass, target.lastPass)) {
+			throw std::runtime_error("render target " + target.info.name + " is not used by any pass!");
+		}
+
+		// only touched by render passes, the contents never have to reach memory
+		target.extent = extent;
+		const bool attachmentOnly = (target.info.usage & ~ATTACHMENT_USAGE) == 0;
+		createImage(device, target, attachmentOnly ? target.info.usage | VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT : target.info.usage);
+		order.push_back(i);
+	}
+
+	// first fit in pass order: a target joins the first allocation whose targets
+	// all ended before its first pass and whose memory type it can use
+	std::sort(order.begin(), order.end(), [this](int a, int b) {
+		return transients[a].firstPass < transients[b].firstPass;
+	});
+
+	std::vector<int> allocationEnd(allocations.size(), graph.numPasses());
+	for (int i : order) {
+		RenderTarget & target = transients[i];
+
+		VkMemoryRequirements memReqs;
+		vkGetImageMemoryRequirements(device, target.image, &memReqs);
+		target.size = memReqs.size;
+
+		uint32_t lazyType = NO_MEMORY_TYPE;
+		if ((target.info.usage & ~ATTACHMENT_USAGE) == 0) {
+			lazyType = findMemoryType(memReqs.memoryTypeBits, VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT, false);
+		}
+
+		// lazily allocated memory costs nothing until it is committed, there is
+		// nothing to gain from sharing it
+		if (lazyType == NO_MEMORY_TYPE) {
+			for (int a = 0; a < (int)allocations.size(); ++a) {
+				if (!allocations[a].lazy && allocationEnd[a] < target.firstPass
+						&& (memReqs.memoryTypeBits & (1u << allocations[a].memoryType))) {
+					target.allocation = a;
+					break;
+				}
+			}
+		}
+		if (target.allocation < 0) {
+			RenderTargetAllocation allocation;
+			allocation.lazy = lazyType != NO_MEMORY_TYPE;
+			allocation.memoryType = allocation.lazy ? lazyType
+				: findMemoryType(memReqs.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, true);
+			allocations.push_back(allocation);
+			allocationEnd.push_back(-1);
+			target.allocation = (int)allocations.size() - 1;
+		}
+
+		// every target is bound at offset 0, which meets any alignment
+		RenderTargetAllocation & allocation = allocations[target.allocation];
+		allocation.size = std::max(allocation.size, memReqs.size);
+		allocation.targets.push_back(i);
+		allocationEnd[target.allocation] = target.lastPass;
+	}
+
+	for (RenderTargetAllocation & allocation : allocations) {
+		if (allocation.memory != VK_NULL_HANDLE) {
+			continue;
+		}
+
+		VkMemoryAllocateInfo allocInfo = {};
+		allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+		allocInfo.allocationSize = allocation.size;
+		allocInfo.memoryTypeIndex = allocation.memoryType;
+
+		if (vkAllocateMemory(device, &allocInfo, nullptr, &allocation.memory) != VK_SUCCESS) {
+			throw std::runtime_error("failed to allocate render target memory!");
+		}
+	}
+
+	for (int i : order) {
+		RenderTarget & target = transients[i];
+		if (vkBindImageMemory(device, target.image, allocations[target.allocation].memory, 0) != VK_SUCCESS) {
+			throw std::runtime_error("failed to bind render target memory " + target.info.name + "!");
+		}
+		createView(device, target);
+		graph.bindTransientImage(target.resource, target.image, target.allocation);
+	}
+}
+
+void RenderTargetPool::report(VkDevice device, const RenderGraph & graph, uint32_t enabledPasses, std::ostream & out) const {
+	VkDeviceSize targetBytes = 0;
+	VkDeviceSize allocatedBytes = 0;
+	VkDeviceSize frameBytes = 0;
+	VkDeviceSize committedBytes = 0;
+
+	out << std::fixed << std::setprecision(2);
+	for (const RenderTarget & target : targets) {
+		out << target.info.name << " " << target.extent.width << "x" << target.extent.height << ": "
+			<< megabytes(target.size) << " MB device local, kept between frames\n";
+		targetBytes += target.size;
+		allocatedBytes += target.size;
+		frameBytes += target.size;
+	}
+
+	std::vector<bool> allocationUsed(allocations.size(), false);
+	for (const RenderTarget & target : transients) {
+		const RenderTargetAllocation & allocation = allocations[target.allocation];
+		const bool used = usedInFrame(graph, target.resource, enabledPasses);
+		allocationUsed[target.allocation] = allocationUsed[target.allocation] || used;
+
+		out << target.info.name << " " << target.extent.width << "x" << target.extent.height << ": "
+			<< megabytes(target.size) << " MB";
+		if (allocation.lazy) {
+			out << " lazily allocated";
+		} else if (allocation.targets.size() > 1) {
+			out << " in allocation " << target.allocation << " with " << allocation.targets.size() - 1 << " other targets";
+		} else {
+			out << " device local";
+		}
+		out << ", passes " << graph.pass(target.firstPass).name << ".." << graph.pass(target.lastPass).name
+			<< (used ? "" : ", not used this frame") << "\n";
+		targetBytes += target.size;
+	}
+
+	for (size_t a = 0; a < allocations.size(); ++a) {
+		if (allocations[a].lazy) {
+			VkDeviceSize committed = 0;
+			vkGetDeviceMemoryCommitment(device, allocations[a].memory, &committed);
+			committedBytes += committed;
+			continue;
+		}
+		allocatedBytes += allocations[a].size;
+		frameBytes += allocationUsed[a] ? allocations[a].size : 0;
+	}
+
+	out << "targets " << megabytes(targetBytes) << " MB, allocated " << megabytes(allocatedBytes)
+		<< " MB (" << megabytes(targetBytes > allocatedBytes ? targetBytes - allocatedBytes : 0) << " MB saved by aliasing and lazy memory), "
+		<< megabytes(committedBytes) << " MB lazily committed, " << megabytes(frameBytes) << " MB used by this frame\n";
+	out << std::defaultfloat;
+}
+
+void RenderTargetPool::cleanupTransient(VkDevice device) {
+	for (RenderTarget & target : transients) {
+		vkDestroyImageView(device, target.view, nullptr);
+		vkDestroyImage(device, target.image, nullptr);
+	}
+	for (RenderTargetAllocation & allocation : allocations) {
+		vkFreeMemory(device, allocation.memory, nullptr);
+	}
+	transients.clear();
+	allocations.clear();
+}
+
+void RenderTargetPool::cleanup(VkDevice device) {
+	cleanupTransient(device);
+	for (RenderTarget & target : targets) {
+		vkDestroyImageView(device, target.view, nullptr);
+		vkDestroyImage(device, target.image, nullptr);
+		vkFreeMemory(device, target.memory, nullptr);
+	}
+	targets.clear();
+}
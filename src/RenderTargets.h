@@ -0,0 +1,92 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include "RenderGraph.h"
+
+#include <vector>
+#include <string>
+#include <ostream>
+#include <cstdint>
+
+/************************************************************/
+//			Render target memory: dedicated, lazy and aliased
+/************************************************************/
+
+struct RenderTargetInfo {
+	std::string name;
+	VkFormat format = VK_FORMAT_UNDEFINED;
+	VkImageUsageFlags usage = 0;
+	VkImageAspectFlags aspect = 0;
+	std::vector<uint32_t> queueFamilies; // more than one = concurrent sharing
+};
+
+struct RenderTarget {
+	RenderTargetInfo info;
+	VkExtent2D extent = {};
+	VkImage image = VK_NULL_HANDLE;
+	VkImageView view = VK_NULL_HANDLE;
+	VkDeviceSize size = 0;
+	VkDeviceMemory memory = VK_NULL_HANDLE; // dedicated memory of a persistent target
+	int allocation = -1; // shared memory of a transient target
+	int resource = -1; // frame graph resource of a transient target
+	int firstPass = -1, lastPass = -1; // lifetime in the frame graph, transient only
+};
+
+// one vkAllocateMemory, shared by the transient targets bound to it at offset 0
+struct RenderTargetAllocation {
+	VkDeviceMemory memory = VK_NULL_HANDLE;
+	VkDeviceSize size = 0;
+	uint32_t memoryType = 0;
+	bool lazy = false; // LAZILY_ALLOCATED, only committed when a tile needs it
+	std::vector<int> targets;
+};
+
+// persistent targets keep their contents between frames and get their own
+// memory. Transient targets are declared as frame graph images and created once
+// the graph knows their lifetimes: the ones only used as attachments get
+// TRANSIENT_ATTACHMENT usage and lazily allocated memory where the device has
+// it, the others share memory with targets whose passes don't overlap
+class RenderTargetPool {
+public:
+	void init(VkPhysicalDevice physicalDevice);
+
+	int createPersistent(VkDevice device, const RenderTargetInfo & info, VkExtent2D extent);
+
+	// new image, view and memory at the same index, the old ones must be idle
+	void resizePersistent(VkDevice device, int index, VkExtent2D extent);
+
+	// index for transient(), the frame graph image is addTransientImage
+	int addTransient(const RenderTargetInfo & info, RenderGraph & graph);
+
+	// creates the transient targets declared since the last cleanupTransient
+	// and binds them to their frame graph images
+	void allocateTransient(VkDevice device, RenderGraph & graph, VkExtent2D extent);
+
+	const RenderTarget & target(int index) const { return targets[index]; }
+
+	const RenderTarget & transient(int index) const { return transients[index]; }
+
+	// memory of each target and whether the passes in enabledPasses use it
+	void report(VkDevice device, const RenderGraph & graph, uint32_t enabledPasses, std::ostream & out) const;
+
+	// destroys the transient targets, a new frame graph declares them again
+	void cleanupTransient(VkDevice device);
+
+	void cleanup(VkDevice device);
+
+private:
+	void createImage(VkDevice device, RenderTarget & target, VkImageUsageFlags usage);
+
+	// image, dedicated memory and view of target.info at target.extent
+	void allocatePersistent(VkDevice device, RenderTarget & target);
+
+	uint32_t findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties, bool required) const;
+
+	void createView(VkDevice device, RenderTarget & target);
+
+	VkPhysicalDeviceMemoryProperties memoryProperties = {};
+	std::vector<RenderTarget> targets;
+	std::vector<RenderTarget> transients;
+	std::vector<RenderTargetAllocation> allocations;
+};
@@ -0,0 +1,235 @@
+#include "ShaderCompiler.h"
+
+#include <fstream>
+#include <sstream>
+#include <cstdio>
+#include <algorithm>
+#include <memory>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#include <direct.h>
+#endif
+
+#if SHADER_HOT_RELOAD
+#include <shaderc/shaderc.hpp>
+#endif
+
+namespace {
+
+	// bump when the compile options change, old cache entries are then ignored
+	const uint32_t SHADER_CACHE_VERSION = 1;
+
+	// 64 bit FNV-1a
+	uint64_t hashBytes(const void * data, size_t size, uint64_t hash = 14695981039346656037ull) {
+		const unsigned char * bytes = (const unsigned char*)data;
+		for (size_t i = 0; i < size; ++i) {
+			hash = (hash ^ bytes[i]) * 1099511628211ull;
+		}
+		return hash;
+	}
+
+	uint64_t hashString(const std::string & text, uint64_t hash) {
+		hash = hashBytes(text.data(), text.size(), hash);
+		return hashBytes("\0", 1, hash); // keeps "ab" + "c" apart from "a" + "bc"
+	}
+
+	bool readText(const std::string & path, std::string & text) {
+		std::ifstream file(path, std::ios::binary);
+		if (!file.is_open()) {
+			return false;
+		}
+		std::stringstream stream;
+		stream << file.rdbuf();
+		text = stream.str();
+		return true;
+	}
+
+	// directory part of a path with the trailing separator, empty without one
+	std::string directoryOf(const std::string & path) {
+		return path.substr(0, path.find_last_of("/\\") + 1);
+	}
+
+	// files named by the #include "..." lines of a source and of its includes,
+	// each once. Same resolution as the compiler's includer
+	void collectIncludes(const std::string & sourcePath, const std::string & source, std::vector<std::string> & includes) {
+		std::istringstream lines(source);
+		std::string line;
+		while (std::getline(lines, line)) {
+			size_t start = line.find_first_not_of(" \t");
+			if (start == std::string::npos || line.compare(start, 8, "#include") != 0) {
+				continue;
+			}
+			size_t open = line.find('"', start);
+			size_t close = open == std::string::npos ? open : line.find('"', open + 1);
+			if (close == std::string::npos) {
+				continue;
+			}
+			std::string path = directoryOf(sourcePath) + line.substr(open + 1, close - open - 1);
+			if (std::find(includes.begin(), includes.end(), path) != includes.end()) {
+				continue;
+			}
+			includes.push_back(path);
+			std::string text;
+			if (readText(path, text)) {
+				collectIncludes(path, text, includes);
+			}
+		}
+	}
+
+	void makeDirectory(const std::string & path) {
+#ifdef _WIN32
+		_mkdir(path.c_str());
+#else
+		mkdir(path.c_str(), 0755);
+#endif
+	}
+
+#if SHADER_HOT_RELOAD
+	// resolves #include "..." relative to the including file
+	class FileIncluder : public shaderc::CompileOptions::IncluderInterface {
+	public:
+		shaderc_include_result * GetInclude(const char * requestedSource, shaderc_include_type, const char * requestingSource, size_t) override {
+			Include * include = new Include;
+			include->path = directoryOf(requestingSource) + requestedSource;
+			if (!readText(include->path, include->text)) {
+				// an empty name reports the content as the error
+				include->text = "cannot open " + include->path;
+				include->path.clear();
+			}
+			include->result.source_name = include->path.c_str();
+			include->result.source_name_length = include->path.size();
+			include->result.content = include->text.c_str();
+			include->result.content_length = include->text.size();
+			include->result.user_data = include;
+			return &include->result;
+		}
+
+		void ReleaseInclude(shaderc_include_result * result) override {
+			delete (Include*)result->user_data;
+		}
+
+	private:
+		struct Include {
+			std::string path;
+			std::string text;
+			shaderc_include_result result;
+		};
+	};
+
+	shaderc_shader_kind shaderKind(VkShaderStageFlagBits stage) {
+		switch (stage) {
+		case VK_SHADER_STAGE_VERTEX_BIT:
+			return shaderc_glsl_vertex_shader;
+		case VK_SHADER_STAGE_FRAGMENT_BIT:
+			return shaderc_glsl_fragment_shader;
+		default:
+			return shaderc_glsl_compute_shader;
+		}
+	}
+#endif
+}
+
+bool ShaderCompiler::compile(const std::string & sourcePath, VkShaderStageFlagBits stage, const ShaderDefines & defines, std::vector<char> & spirv, std::string & log) const {
+	log.clear();
+
+	std::string source;
+	if (!readText(sourcePath, source)) {
+		return false;
+	}
+
+	uint64_t key = hashBytes(&SHADER_CACHE_VERSION, sizeof(SHADER_CACHE_VERSION));
+	key = hashBytes(&stage, sizeof(stage), key);
+	key = hashString(source, key);
+	std::vector<std::string> includes;
+	collectIncludes(sourcePath, source, includes);
+	for (const auto & include : includes) {
+		std::string text;
+		readText(include, text);
+		key = hashString(include, key);
+		key = hashString(text, key);
+	}
+	for (const auto & define : defines) {
+		key = hashString(define.first, key);
+		key = hashString(define.second, key);
+	}
+
+	char keyText[17];
+	snprintf(keyText, sizeof(keyText), "%016llx", (unsigned long long)key);
+	std::string name = sourcePath.substr(sourcePath.find_last_of("/\\") + 1);
+	std::string cachePath = cacheDir + "/" + name + "-" + keyText + ".spv";
+
+	// cache hit
+	std::ifstream cacheFile(cachePath, std::ios::ate | std::ios::binary);
+	if (cacheFile.is_open() && cacheFile.tellg() > 0) {
+		spirv.resize((size_t)cacheFile.tellg());
+		cacheFile.seekg(0);
+		cacheFile.read(spirv.data(), spirv.size());
+		if (cacheFile) {
+			return true;
+		}
+	}
+
+#if SHADER_HOT_RELOAD
+	shaderc::Compiler compiler;
+	shaderc::CompileOptions options;
+	for (const auto & define : defines) {
+		options.AddMacroDefinition(define.first, define.second);
+	}
+	options.SetOptimizationLevel(shaderc_optimization_level_performance);
+	options.SetIncluder(std::unique_ptr<shaderc::CompileOptions::IncluderInterface>(new FileIncluder));
+
+	shaderc::SpvCompilationResult result = compiler.CompileGlslToSpv(source, shaderKind(stage), sourcePath.c_str(), options);
+	if (result.GetCompilationStatus() != shaderc_compilation_status_success) {
+		log = result.GetErrorMessage();
+		return false;
+	}
+	spirv.assign((const char*)result.cbegin(), (const char*)result.cend());
+
+	// write a temporary file first, another thread may read the same entry
+	makeDirectory(cacheDir);
+	std::string tempPath = cachePath + ".tmp";
+	{
+		std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+		if (!file.is_open()) {
+			return true; // read-only working directory, just skip caching
+		}
+		file.write(spirv.data(), spirv.size());
+	}
+	std::remove(cachePath.c_str());
+	std::rename(tempPath.c_str(), cachePath.c_str());
+	return true;
+#else
+	return false;
+#endif
+}
+
+bool ShaderCompiler::hasCompiler() {
+#if SHADER_HOT_RELOAD
+	return true;
+#else
+	return false;
+#endif
+}
+
+int64_t ShaderCompiler::fileTime(const std::string & path) {
+	struct stat info;
+	if (stat(path.c_str(), &info) != 0) {
+		return 0;
+	}
+	return (int64_t)info.st_mtime;
+}
+
+int64_t ShaderCompiler::sourceTime(const std::string & sourcePath) {
+	int64_t time = fileTime(sourcePath);
+	std::string source;
+	if (!readText(sourcePath, source)) {
+		return time;
+	}
+	std::vector<std::string> includes;
+	collectIncludes(sourcePath, source, includes);
+	for (const auto & include : includes) {
+		time = std::max(time, fileTime(include));
+	}
+	return time;
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <string>
+#include <vector>
+#include <utility>
+#include <cstdint>
+
+/************************************************************/
+//			Runtime GLSL to SPIR-V compilation
+/************************************************************/
+
+// preprocessor defines of one compilation, name and value
+typedef std::vector<std::pair<std::string, std::string>> ShaderDefines;
+
+// compiles GLSL with shaderc when built with SHADER_HOT_RELOAD. Results are
+// cached on disk as <cacheDir>/<source name>-<key>.spv, the key hashes the
+// source text, its #include "..." files, the stage and the defines, so a cache
+// hit needs no compiler. Includes resolve relative to the including file
+class ShaderCompiler {
+public:
+	explicit ShaderCompiler(const std::string & cacheDir) : cacheDir(cacheDir) {}
+
+	// SPIR-V of a GLSL source from the cache or the compiler. False with the
+	// compiler output in log when it does not compile, or without a compiler
+	// on a cache miss (log stays empty then)
+	bool compile(const std::string & sourcePath, VkShaderStageFlagBits stage, const ShaderDefines & defines, std::vector<char> & spirv, std::string & log) const;
+
+	// false when the build has no shaderc, compile then only serves cache hits
+	static bool hasCompiler();
+
+	// last write time of a file, 0 when it does not exist
+	static int64_t fileTime(const std::string & path);
+
+	// latest write time of a source and the files it includes
+	static int64_t sourceTime(const std::string & sourcePath);
+
+private:
+	std::string cacheDir;
+};
@@ -11,18 +11,88 @@
 #include <tiny_obj_loader.h>
 
 #include <cstring>
+#include <cstdio>
 #include <sstream>
+#include <atomic>
 
 const bool bDrawAxis = false;
 
+// scene color of the shade pass, a transient target the composite subpass
+// gamma corrects into the swap chain
+const VkFormat SCENE_COLOR_FORMAT = VK_FORMAT_R16G16B16A16_SFLOAT;
+
 // forward plus pixels per tile
 // along one dimension, actural number will be the square of following values
 const int PIXELS_PER_TILE = 16;
 
 const int TILES_PER_THREADGROUP = 16;
 
-// number of lights
+// number of lights at startup, keys N / M add / remove LIGHT_EDIT_BATCH lights
 const int NUM_OF_LIGHTS = 1024;
+const int LIGHT_EDIT_BATCH = 100;
+
+// dirty light ranges closer than this (in slots) are uploaded as one copy
+const uint32_t LIGHT_UPLOAD_MAX_GAP = 16;
+
+// how computeLightList.comp finds the lights of a tile: test all of them, walk a
+// light bvh rebuilt on the cpu every frame, or pre-cull per supertile (workgroup).
+// LIGHT_CULL_COOPERATIVE runs computeLightListCooperative.comp instead,
+// LIGHT_CULL_BINNING only reduces depth there and binLights.comp scatters every
+// light into the tiles covered by its projected bounding sphere
+const LightCullMode LIGHT_CULL_MODE = LIGHT_CULL_BVH;
+
+// 2.5D culling, also reject lights that miss the occupied depth bins of a tile
+const bool bDepthMaskCulling = true;
+
+// keep the light lists while the view, the prepass depth and the lights stay the same
+const bool bCacheLightCulling = true;
+
+// light update and culling on a compute only queue family when the gpu has one,
+// shading then only waits for the lists in the fragment stage
+const bool bAsyncCompute = true;
+
+// frame graph dependencies on one timeline semaphore per queue when the driver
+// has VK_KHR_timeline_semaphore, a binary semaphore per dependency otherwise
+const bool bTimelineSemaphores = true;
+
+// pipeline cache saved at exit and loaded at startup when the gpu and driver match
+const char * PIPELINE_CACHE_PATH = "pipeline_cache.bin";
+
+// recompile shaders whose glsl source changed while running, checked every
+// SHADER_POLL_INTERVAL seconds. Needs a build with SHADER_HOT_RELOAD
+const bool bShaderHotReload = true;
+const float SHADER_POLL_INTERVAL = 0.5f;
+
+// record the display pass every frame on RECORDING_THREADS workers (0 = one
+// per core) instead of replaying the command buffers recorded at startup
+const bool bPerFrameRecording = true;
+const int RECORDING_THREADS = 0;
+
+// recordings per thread count when benchmarking (key T)
+const int RECORDING_BENCHMARK_RUNS = 50;
+
+// gpu timestamps of a frame slot, at slot * NUM_FRAME_TIMESTAMPS in the query
+// pool: light update and culling on the queue that culls, the display render
+// pass on the graphics queue
+enum FrameTimestamp {
+	TIMESTAMP_LIGHT_UPDATE,
+	TIMESTAMP_CULLING,
+	TIMESTAMP_CULLING_END,
+	TIMESTAMP_SHADING,
+	TIMESTAMP_SHADING_END,
+	NUM_FRAME_TIMESTAMPS
+};
+
+// startup timeline, open in chrome://tracing
+const char * STARTUP_TRACE_PATH = "startup_trace.json";
+
+// fraction of spot / tube / rect lights, the rest are point lights
+const float SPOT_LIGHT_RATIO = 0.25f;
+const float TUBE_LIGHT_RATIO = 0.1f;
+const float RECT_LIGHT_RATIO = 0.1f;
+
+// lod selection: max projected simplification error in pixels
+const float LOD_PIXEL_ERROR = 1.0f;
 
 VkResult CreateDebugReportCallbackEXT(VkInstance instance, const VkDebugReportCallbackCreateInfoEXT* pCreateInfo, const VkAllocationCallbacks* pAllocator, VkDebugReportCallbackEXT* pCallback) {
 	auto func = (PFN_vkCreateDebugReportCallbackEXT)vkGetInstanceProcAddr(instance, "vkCreateDebugReportCallbackEXT");
@@ -53,6 +123,48 @@ bool keyboardMapping[26];
 
 // deubg mode int
 int debugMode;
+
+// print a cpu overdraw estimate of the current view (key O)
+bool bEstimateOverdraw = false;
+
+// compare the gpu light lists with the cpu reference culler, and the gpu lod
+// selection with the cpu one while it is on (key V)
+bool bVerifyLightCulling = false;
+
+// freeze the light animation (key P)
+bool bPauseLights = false;
+
+// lod pixel error, key L cycles it through 1x, 4x and 16x LOD_PIXEL_ERROR.
+// Changes the geometry without moving the view
+float lodPixelError = LOD_PIXEL_ERROR;
+
+// lod selection in selectLod.comp, in front of the depth pass, instead of on the cpu (key K)
+bool bGpuLodSelection = false;
+
+// add / remove a batch of random lights (keys N / M)
+bool bAddLights = false;
+bool bRemoveLights = false;
+
+// time the display pass recording over thread counts (key T)
+bool bBenchmarkRecording = false;
+
+// print the jobs of the last frame and write JOB_TRACE_PATH (key J)
+bool bPrintJobProfile = false;
+const char * JOB_TRACE_PATH = "job_trace.json";
+
+// print the compiled frame graph schedules (key G)
+bool bPrintFrameGraph = false;
+
+// print the render target memory of the last frame (key R)
+bool bPrintRenderTargets = false;
+
+// start / stop the per frame csv (key C)
+bool bToggleFrameStats = false;
+const char * FRAME_STATS_PATH = "frame_stats.csv";
+
+// the window size changed, drawFrame recreates the swap chain after presenting
+bool bFramebufferResized = false;
+
 const std::vector<std::string> debugModeNameStrings = {
 	"none",
 	"diffuse",
@@ -65,16 +177,259 @@ const std::vector<std::string> debugModeNameStrings = {
 	"no - color correction"
 };
 
-namespace std {
-	template<> struct hash<Vertex> {
-		size_t operator()(Vertex const& vertex) const {
-			return ((hash<glm::vec3>()(vertex.pos) ^
-				(hash<glm::vec3>()(vertex.color) << 1)) >> 1) ^
-				(hash<glm::vec2>()(vertex.texCoord) << 1 ^
-				(hash<glm::vec3>()(vertex.normal) << 1));
+// final_shading.frag variants: one per material map set (bit 0 texture, bit 1
+// normal, bit 2 specular map) without debug code, then debug modes 1.. with
+// the maps read from the material
+namespace {
+
+	const int NUM_MATERIAL_VARIANTS = 8;
+
+	// unknown modes shade normally, like the default case of the shader
+	int shadingDebugMode(int mode) {
+		return (mode > 0 && mode < (int)debugModeNameStrings.size()) ? mode : 0;
+	}
+
+	size_t shadingVariantIndex(int materialMask, int debugMode) {
+		return debugMode == 0 ? materialMask : NUM_MATERIAL_VARIANTS + debugMode - 1;
+	}
+}
+
+// obj loading, tangent frame generation and mesh cache
+namespace {
+
+	// the mtl file referenced by an obj, read from the header only
+	std::string findMaterialLibrary(const std::string & modelFilename) {
+		std::ifstream file(modelFilename);
+		std::string line;
+		while (std::getline(file, line)) {
+			if (line.compare(0, 7, "mtllib ") == 0) {
+				std::string name = line.substr(7);
+				name.erase(name.find_last_not_of(" \t\r") + 1);
+				return name;
+			}
+			if (line.compare(0, 2, "v ") == 0 || line.compare(0, 2, "f ") == 0) {
+				break; // geometry started, no material library
+			}
+		}
+		return std::string();
+	}
+
+	void loadMeshData(MeshData & mesh, std::vector<tinyobj::material_t> & materials, const std::string & modelFilename, const std::string & modelBaseDir, float scale) {
+
+		const std::string cachePath = modelFilename + ".cache";
+
+		auto startTime = std::chrono::high_resolution_clock::now();
+
+		// the cache is keyed by the contents of the obj and its material library,
+		// an edit that keeps the file size still rebuilds it
+		std::string mtlName = findMaterialLibrary(modelFilename);
+		uint64_t sourceHash = MeshTools::hashFile(modelFilename);
+		if (!mtlName.empty()) {
+			sourceHash = MeshTools::hashFile(modelBaseDir + mtlName, sourceHash);
+		}
+
+		// cache hit -> only the materials need parsing
+		if (!mtlName.empty() && MeshTools::loadMeshCache(cachePath, sourceHash, scale, mesh)) {
+			std::ifstream mtlFile(modelBaseDir + mtlName);
+			std::map<std::string, int> materialMap;
+			tinyobj::LoadMtl(&materialMap, &materials, &mtlFile);
+
+			float ms = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - startTime).count();
+			std::cout << "loaded mesh cache " << cachePath << " in " << ms << " ms" << std::endl;
+			return;
+		}
+		mesh = MeshData();
+
+		tinyobj::attrib_t attrib;
+		std::vector<tinyobj::shape_t> shapes;
+		std::string err;
+
+		if (!tinyobj::LoadObj(&attrib, &shapes, &materials, &err, modelFilename.c_str(), modelBaseDir.c_str())) {
+			throw std::runtime_error(err);
+		}
+
+		// unique vertices by obj index triple
+		struct IndexHash {
+			size_t operator()(const glm::ivec3 & key) const {
+				return ((std::hash<int>()(key.x) ^ (std::hash<int>()(key.y) << 1)) >> 1) ^ (std::hash<int>()(key.z) << 1);
+			}
+		};
+		std::unordered_map<glm::ivec3, uint32_t, IndexHash> uniqueVertices = {};
+		bool hasNormals = !attrib.normals.empty();
+
+		for (const auto& shape : shapes) {
+			for (size_t i = 0; i < shape.mesh.indices.size(); i++) {
+				auto& index = shape.mesh.indices[i];
+
+				glm::ivec3 key(index.vertex_index, hasNormals ? index.normal_index : -1, index.texcoord_index);
+				auto it = uniqueVertices.find(key);
+				if (it != uniqueVertices.end()) {
+					mesh.indices.push_back(it->second);
+					continue;
+				}
+
+				uint32_t vertexIndex = (uint32_t)mesh.positions.size();
+				uniqueVertices[key] = vertexIndex;
+
+				mesh.positions.push_back({
+					scale * attrib.vertices[3 * index.vertex_index + 0],
+					scale * attrib.vertices[3 * index.vertex_index + 1],
+					scale * attrib.vertices[3 * index.vertex_index + 2]
+				});
+
+				if (index.texcoord_index >= 0) {
+					mesh.texCoords.push_back({
+						attrib.texcoords[2 * index.texcoord_index + 0],
+						1.0f - attrib.texcoords[2 * index.texcoord_index + 1]
+					});
+				}
+				else {
+					mesh.texCoords.push_back(glm::vec2(0.0f));
+				}
+
+				if (hasNormals) {
+					mesh.normals.push_back(glm::normalize(glm::vec3(
+						attrib.normals[3 * index.normal_index + 0],
+						attrib.normals[3 * index.normal_index + 1],
+						attrib.normals[3 * index.normal_index + 2]
+					)));
+				}
+
+				mesh.indices.push_back(vertexIndex);
+			}
+
+			mesh.materialIds.insert(mesh.materialIds.end(), shape.mesh.material_ids.begin(), shape.mesh.material_ids.end());
+			mesh.objectIds.resize(mesh.materialIds.size(), int(&shape - &shapes[0]));
+		}
+		mesh.objectCount = (uint32_t)shapes.size();
+
+		// smooth normals when the obj has none, tangents always
+		if (!hasNormals) {
+			MeshTools::computeSmoothNormals(mesh);
+		}
+		MeshTools::computeTangents(mesh);
+		MeshTools::buildLodChains(mesh);
+
+		MeshTools::saveMeshCache(cachePath, sourceHash, scale, mesh);
+
+		float ms = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - startTime).count();
+		std::cout << "parsed " << modelFilename << " and baked mesh cache in " << ms << " ms" << std::endl;
+	}
+
+	void packVertices(const MeshData & mesh, std::vector<Vertex> & vertices) {
+		vertices.resize(mesh.positions.size());
+		MeshTools::parallelFor(vertices.size(), [&](size_t begin, size_t end) {
+			for (size_t v = begin; v < end; ++v) {
+				vertices[v] = Vertex::pack(mesh.positions[v], mesh.texCoords[v], mesh.normals[v], mesh.tangents[v]);
+			}
+		});
+	}
+}
+
+// rgba8 pixels of a texture file, empty when it failed to load
+struct DecodedImage {
+	int width = 0;
+	int height = 0;
+	std::vector<stbi_uc> pixels;
+	bool hasAlphaCutout = false; // some texels fail the alpha test
+};
+
+// everything of a model that loads without the device
+struct ModelAssets {
+	std::string baseDir;
+	MeshData mesh;
+	std::vector<tinyobj::material_t> materials;
+	std::unordered_map<std::string, DecodedImage> images; // by path
+};
+
+// texture decoding, safe to run on any thread
+namespace {
+
+	void decodeImage(const std::string & filename, DecodedImage & image) {
+		int texChannels;
+		stbi_uc* pixels = stbi_load(filename.c_str(), &image.width, &image.height, &texChannels, STBI_rgb_alpha);
+		if (!pixels) {
+			std::cout << filename.c_str() << " doesn't exist!" << std::endl;
+			return;
+		}
+		image.pixels.assign(pixels, pixels + image.width * image.height * 4);
+		stbi_image_free(pixels);
+
+		// same threshold as the discard in final_shading.frag / depth_alpha.frag
+		image.hasAlphaCutout = false;
+		for (size_t i = 3; i < image.pixels.size(); i += 4) {
+			if (image.pixels[i] < 0.1f * 255.0f) {
+				image.hasAlphaCutout = true;
+				break;
+			}
+		}
+	}
+
+	// decode every texture referenced by the materials, spread over all cores
+	void decodeModelTextures(ModelAssets & assets) {
+		std::vector<std::string> paths;
+		for (const auto & material : assets.materials) {
+			for (const std::string & name : { material.diffuse_texname, material.bump_texname, material.specular_texname }) {
+				if (!name.empty() && assets.images.emplace(assets.baseDir + name, DecodedImage()).second) {
+					paths.push_back(assets.baseDir + name);
+				}
+			}
 		}
+
+		// the map does not change from here on, every thread fills its own images
+		MeshTools::parallelFor(paths.size(), [&](size_t begin, size_t end) {
+			for (size_t i = begin; i < end; ++i) {
+				decodeImage(paths[i], assets.images.at(paths[i]));
+			}
+		}, 1);
+	}
+}
+
+// pipeline cache file: our header, then the vkGetPipelineCacheData blob
+namespace {
+
+	const uint32_t PIPELINE_CACHE_MAGIC = 0x43504650; // "FPPC"
+
+	struct PipelineCacheFileHeader {
+		uint32_t magic;
+		uint32_t vendorID;
+		uint32_t deviceID;
+		uint32_t driverVersion;
+		uint8_t pipelineCacheUUID[VK_UUID_SIZE];
+		uint64_t dataSize;
 	};
+
+	// reason the cache can not be used, empty when it matches the device
+	std::string validatePipelineCache(const PipelineCacheFileHeader & header, const std::vector<char> & data, const VkPhysicalDeviceProperties & properties) {
+		if (header.magic != PIPELINE_CACHE_MAGIC || header.dataSize != data.size()) {
+			return "unknown or truncated file";
+		}
+		if (header.vendorID != properties.vendorID || header.deviceID != properties.deviceID) {
+			return "different gpu";
+		}
+		if (header.driverVersion != properties.driverVersion) {
+			return "different driver version";
+		}
+		if (memcmp(header.pipelineCacheUUID, properties.pipelineCacheUUID, VK_UUID_SIZE) != 0) {
+			return "different pipeline cache uuid";
+		}
+
+		// the blob carries its own header (VK_PIPELINE_CACHE_HEADER_VERSION_ONE),
+		// a driver may crash on a blob it did not write instead of ignoring it
+		uint32_t blobHeader[4];
+		if (data.size() < sizeof(blobHeader) + VK_UUID_SIZE) {
+			return "truncated blob";
+		}
+		memcpy(blobHeader, data.data(), sizeof(blobHeader));
+		if (blobHeader[1] != VK_PIPELINE_CACHE_HEADER_VERSION_ONE || blobHeader[2] != properties.vendorID
+				|| blobHeader[3] != properties.deviceID
+				|| memcmp(data.data() + sizeof(blobHeader), properties.pipelineCacheUUID, VK_UUID_SIZE) != 0) {
+			return "blob header mismatch";
+		}
+		return std::string();
+	}
 }
+
 /************************************************************/
 //			Base Class for Vulkan Application
 /************************************************************/
@@ -89,6 +444,9 @@ void VulkanBaseApplication::run() {
 
 // clean up resources
 VulkanBaseApplication::~VulkanBaseApplication() {
+	// the stats job writes into this object
+	jobs.wait(lightListStatsJob);
+
 	// swap chain image veiws
 	for (auto imageView : swapChainImageViews) {
 		vkDestroyImageView(device, imageView, nullptr);
@@ -107,14 +465,22 @@ VulkanBaseApplication::~VulkanBaseApplication() {
 	// mesh buffers clean up
 	meshs.cleanup(device);
 
-	// cleanup uniform buffers
-	ubo.cleanup(device);
+	// uniform buffers, per frame storage buffers, fences and semaphores
+	for (FrameInFlight & inFlight : frames) {
+		inFlight.cleanup(device);
+	}
 
 	// cleanup storage buffers
 	sbo.cleanup(device);
 
-	// depth clean up
-	depth.cleanup(device);
+	// render targets clean up, the prepass depth and the transient targets
+	renderTargets.cleanup(device);
+
+	// per frame recording pools, frees their command buffers
+	frameRecording.cleanup(device);
+
+	// frame graph barriers and semaphores
+	frameGraph.cleanup(device);
 
 	// pipelines clean up
 	pipelines.cleanup(device);
@@ -128,7 +494,6 @@ void VulkanBaseApplication::initWindow() {
 	glfwInit();
 
 	glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
-	glfwWindowHint(GLFW_RESIZABLE, GLFW_FALSE);
 
 	std::string appName = "Vulkan | number of lights = " + std::to_string(NUM_OF_LIGHTS);
 	window = glfwCreateWindow(WIDTH, HEIGHT, appName.c_str(), nullptr, nullptr);
@@ -146,11 +511,16 @@ void VulkanBaseApplication::initWindow() {
 	glfwSetMouseButtonCallback(window, mouseButtonCallback);
 	glfwSetKeyCallback(window, keyCallback);
 	glfwSetScrollCallback(window, scrollCallback);
+	glfwSetFramebufferSizeCallback(window, framebufferSizeCallback);
 }
 
 void VulkanBaseApplication::initForwardPlusParams() {
 	fpParams.numLights = NUM_OF_LIGHTS;
-	fpParams.numThreads = (glm::ivec2(WIDTH, HEIGHT) + PIXELS_PER_TILE - 1) / PIXELS_PER_TILE;
+}
+
+void VulkanBaseApplication::updateTileCounts() {
+	glm::ivec2 screenDimensions(swapChainExtent.width, swapChainExtent.height);
+	fpParams.numThreads = (screenDimensions + PIXELS_PER_TILE - 1) / PIXELS_PER_TILE;
 	fpParams.numThreadGroups = (fpParams.numThreads + TILES_PER_THREADGROUP - 1) / TILES_PER_THREADGROUP;
 }
 
@@ -158,13 +528,87 @@ void VulkanBaseApplication::mainLoop() {
 
 	while (!glfwWindowShouldClose(window)) {
 		glfwPollEvents();
-		updateUniformBuffer();
-		drawFrame();
+
+		if (bAddLights) {
+			bAddLights = false;
+			for (int i = 0; i < LIGHT_EDIT_BATCH; ++i) {
+				addLight(randomLight());
+			}
+		}
+
+		if (bRemoveLights) {
+			bRemoveLights = false;
+			for (int i = 0; i < LIGHT_EDIT_BATCH && lightManager.count() > 0; ++i) {
+				std::uniform_int_distribution<uint32_t> slot(0, lightManager.count() - 1);
+				removeLight(lightManager.handleAt(slot(lightRandom)));
+			}
+		}
+
+		// the debug mode picks the shading variants recorded in the display command buffers
+		if (shadingDebugMode(debugMode) != recordedDebugMode) {
+			vkQueueWaitIdle(graphicsQueue);
+			for (int slot = 0; slot < MAX_FRAMES_IN_FLIGHT; ++slot) {
+				vkFreeCommandBuffers(device, commandPool, (uint32_t)frames[slot].display.size(), frames[slot].display.data());
+				createCommandBuffers(slot);
+			}
+		}
+
+		// every step is a span of the job profile, their parallel loops run as jobs
+		jobs.beginFrame();
+		jobs.scope("frame wait", [&] { waitForFrame(); });
+		jobs.scope("shader reload", [&] { reloadChangedShaders(); });
+		jobs.scope("light upload", [&] { uploadDirtyLights(); });
+		jobs.scope("uniform update", [&] { updateUniformBuffer(); });
+		jobs.scope("gpu timings", [&] { updateGpuTimings(); });
+		jobs.scope("light list stats", [&] { updateLightListStats(); });
+		jobs.scope("lod selection", [&] { updateLodSelection(); });
+		jobs.scope("culling cache", [&] { updateCullingCache(); });
+		jobs.scope("light bvh", [&] { updateLightBvh(); });
+		jobs.scope("draw frame", [&] { drawFrame(); });
+
+		if (bEstimateOverdraw) {
+			bEstimateOverdraw = false;
+			printOverdrawEstimate();
+		}
+
+		if (bVerifyLightCulling) {
+			bVerifyLightCulling = false;
+			verifyLightCulling();
+			if (bGpuLodSelection) {
+				verifyLodSelection();
+			}
+		}
+
+		if (bToggleFrameStats) {
+			bToggleFrameStats = false;
+			toggleFrameStats();
+		}
+
+		if (bBenchmarkRecording) {
+			bBenchmarkRecording = false;
+			benchmarkFrameRecording();
+		}
+
+		if (bPrintJobProfile) {
+			bPrintJobProfile = false;
+			jobs.printLastFrame(JOB_TRACE_PATH);
+		}
+
+		if (bPrintFrameGraph) {
+			bPrintFrameGraph = false;
+			printFrameGraph();
+		}
+
+		if (bPrintRenderTargets) {
+			bPrintRenderTargets = false;
+			printRenderTargets();
+		}
 
 		resetTitleAndTiming();
 	}
 
 	vkDeviceWaitIdle(device);
+	savePipelineCache();
 }
 
 void VulkanBaseApplication::resetTitleAndTiming() {
@@ -183,16 +627,38 @@ void VulkanBaseApplication::resetTitleAndTiming() {
 
 	std::stringstream title;
 	title << "Vulkan Forward Plus "
-		<< "[num_lights = " << NUM_OF_LIGHTS << "] "
+		<< "[num_lights = " << fpParams.numLights << "] "
 		<< "[" << elapsedTime << " ms/frame] "
 		<< "[FPS = " << 1000.0f * float(frameCount) / totalElapsedTime << "] "
-		<< "[resolution = " << WIDTH << "*" << HEIGHT << "] ";
+		<< "[resolution = " << swapChainExtent.width << "*" << swapChainExtent.height << "] "
+		<< "[triangles = " << numTrianglesDrawn << "/" << meshs.meshGroupScene.numTriangles << "] ";
+
+	if (LIGHT_CULL_MODE == LIGHT_CULL_BVH) {
+		title << "[light bvh = " << lightBvhBuildTime << " ms] ";
+	}
+
+	if (timestampPeriod > 0.0f) {
+		title << "[gpu culling = " << gpuTimings.lightCulling << " ms] ";
+		title << "[cull/shade overlap = " << gpuTimings.cullShadeOverlap << " ms] ";
+	}
+
+	if (bPerFrameRecording) {
+		title << "[recording = " << frameRecording.recordMs << " ms, " << frameRecording.numThreads << " threads] ";
+	}
+
+	title << "[culled tiles = " << cullingCache.recomputedTiles << "/" << fpParams.numThreads.x * fpParams.numThreads.y << "] ";
+
+	title << "[lights/tile = " << lightListStats.meanLights << " avg, " << lightListStats.maxLights << " max, "
+		<< lightListStats.fullTiles << " full] ";
 
 	if (debugMode < debugModeNameStrings.size() && debugMode != 0) {
 		title << "[" << debugModeNameStrings[debugMode] << "]";
 	}
 
 	glfwSetWindowTitle(window, title.str().c_str());
+	if (frameStatsFile.is_open()) {
+		exportFrameStats(frameCount, elapsedTime);
+	}
 	if (frameCount % 300 == 0) {
 		std::cout << "Frame count = " << frameCount << " " << title.str() << std::endl;
 	}
@@ -205,6 +671,8 @@ void VulkanBaseApplication::updateUniformBuffer() {
 	UBO_vsParams & vsParams = uboHostData.vsParams;
 	UBO_csParams & csParams = uboHostData.csParams;
 	UBO_fsParams & fsParams = uboHostData.fsParams;
+	// staging of the current slot, copied by its upload command buffer
+	UniformBuffers & ubo = frames[currentFrame].ubo;
 	VkDeviceSize bufferSize;
 	void* data;
 
@@ -252,23 +720,30 @@ void VulkanBaseApplication::updateUniformBuffer() {
 		memcpy(data, &vsParams, bufferSize);
 	vkUnmapMemory(device, ubo.vsSceneStaging.memory);
 
-	copyBuffer(ubo.vsSceneStaging.buffer, ubo.vsScene.buffer, bufferSize);
-
 	//--------------------- cs uniform buffer---------------------------
+	// light animation time, frozen while paused
+	static float lightTime = 0.0f;
+	if (!bPauseLights) {
+		lightTime = time;
+	}
+
 	csParams.viewMat = vsParams.view;
 	csParams.inverseProj = glm::inverse(vsParams.proj);
-	csParams.screenDimensions = glm::ivec2(WIDTH, HEIGHT);
+	csParams.screenDimensions = glm::ivec2(swapChainExtent.width, swapChainExtent.height);
 	csParams.numThreads = fpParams.numThreads;
 	csParams.numLights = fpParams.numLights;
-	csParams.time = time;
+	csParams.time = lightTime;
+	csParams.lodProjScale = std::abs(vsParams.proj[1][1]) * swapChainExtent.height * 0.5f;
+	csParams.lodPixelError = lodPixelError;
+	csParams.numDrawItems = (int)meshs.meshGroupScene.drawItems.size();
+	csParams.lightCullMode = LIGHT_CULL_MODE;
+	csParams.useDepthMask = bDepthMaskCulling ? 1 : 0;
 
 	bufferSize = ubo.csParamsStaging.allocSize;
 	vkMapMemory(device, ubo.csParamsStaging.memory, 0, bufferSize, 0, &data);
 		memcpy(data, &csParams, bufferSize);
 	vkUnmapMemory(device, ubo.csParamsStaging.memory);
 
-	copyBuffer(ubo.csParamsStaging.buffer, ubo.csParams.buffer, bufferSize);
-
 	//--------------------- fs uniform buffer---------------------------
 	fsParams.numLights = fpParams.numLights;
 	fsParams.time = time;
@@ -280,150 +755,253 @@ void VulkanBaseApplication::updateUniformBuffer() {
 	vkMapMemory(device, ubo.fsParamsStaging.memory, 0, bufferSize, 0, &data);
 		memcpy(data, &fsParams, bufferSize);
 	vkUnmapMemory(device, ubo.fsParamsStaging.memory);
-
-	copyBuffer(ubo.fsParamsStaging.buffer, ubo.fsParams.buffer, bufferSize);
 }
 
 
+void VulkanBaseApplication::waitForFrame() {
+	// submitted MAX_FRAMES_IN_FLIGHT - 1 drawFrames ago, the frames after it keep the gpu busy
+	vkWaitForFences(device, 1, &frames[currentFrame].fence, VK_TRUE, std::numeric_limits<uint64_t>::max());
+}
+
 void VulkanBaseApplication::drawFrame() {
+	// the culling of this frame goes ahead of the shading of the frame before,
+	// so the gpu culls one while it shades the other
+	const int cullFrame = currentFrame;
+	submitFrameGraph(cullFrame, false, 0, VK_NULL_HANDLE);
+
+	const int shadeFrame = pendingFrame;
+	pendingFrame = cullFrame;
+	currentFrame = (currentFrame + 1) % MAX_FRAMES_IN_FLIGHT;
+	if (shadeFrame < 0) {
+		// first frame since startup or a resize, shaded with the next one
+		return;
+	}
 
 	uint32_t imageIndex;
-	vkAcquireNextImageKHR(device, swapChain, std::numeric_limits<uint64_t>::max(), imageAvailableSemaphore, VK_NULL_HANDLE, &imageIndex);
+	VkResult result = vkAcquireNextImageKHR(device, swapChain, std::numeric_limits<uint64_t>::max(), frames[shadeFrame].imageAvailable, VK_NULL_HANDLE, &imageIndex);
+	if (result == VK_ERROR_OUT_OF_DATE_KHR) {
+		// nothing acquired, the semaphore is not signaled, the culled frames are dropped
+		recreateSwapChain();
+		return;
+	} else if (result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR) {
+		throw std::runtime_error("failed to acquire swap chain image!");
+	}
 
-	static bool isFirstPass = true;
-	if (isFirstPass) {
-		isFirstPass = false;
+	// the frame that used the slot before finished (waitForFrame one drawFrame
+	// ago), so its frame recording pools can be reset
+	VkCommandBuffer displayCommandBuffer = frames[shadeFrame].display[imageIndex];
+	if (bPerFrameRecording) {
+		recordFrameCommandBuffer(shadeFrame, imageIndex, RECORDING_THREADS);
+		displayCommandBuffer = frameRecording.primary[shadeFrame];
+	}
 
-		VkFenceCreateInfo fenceCreateInfo = {};
-		fenceCreateInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
-		fenceCreateInfo.pNext = nullptr;
+	result = submitFrameGraph(shadeFrame, true, imageIndex, displayCommandBuffer);
+	if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR || bFramebufferResized) {
+		bFramebufferResized = false;
+		recreateSwapChain();
+	} else if (result != VK_SUCCESS) {
+		throw std::runtime_error("failed to present swap chain image!");
+	}
+}
 
-		if (vkCreateFence(device, &fenceCreateInfo, nullptr, fence.replace())
-	 			!= VK_SUCCESS) {
-			throw std::runtime_error("failed to create fence");
-		}
 
-		VkSubmitInfo frustumSubmitInfo = {};
-		frustumSubmitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-		frustumSubmitInfo.pNext = nullptr;
-		frustumSubmitInfo.commandBufferCount = 1;
-		frustumSubmitInfo.pCommandBuffers = &cmdBuffers.frustum;
+void VulkanBaseApplication::initVulkan() {
+	// the startup tasks are jobs and spans of the job profile, timed from here
+	jobs.beginFrame();
 
-		if (vkQueueSubmit(graphicsQueue, 1, &frustumSubmitInfo, fence) != VK_SUCCESS) {
-			throw std::runtime_error("failed to submit depth command buffer!");
+	// startup task graph: the model and its textures load on a worker from the start,
+	// pipelines compile on workers once the shader modules and layouts exist, the
+	// main thread records all uploads since they share the command pool and queue
+#if CRYTEC_SPONZA
+	const float modelScale = 1.0f;
+#else
+	const float modelScale = 0.4f;
+#endif
+	ModelAssets modelAssets;
+	modelAssets.baseDir = MODEL_BASE_DIR;
+	// the startup jobs reference modelAssets and this, so an error on the main
+	// thread waits for them before unwinding
+	JobSystem::Counter meshLoaded, modelLoaded, pipelinesCreated;
+	try {
+		jobs.run("mesh load", [&] {
+			loadMeshData(modelAssets.mesh, modelAssets.materials, MODEL_PATH, MODEL_BASE_DIR, modelScale);
+		}, &meshLoaded);
+		jobs.run("texture decode", [&] { decodeModelTextures(modelAssets); }, &modelLoaded, &meshLoaded);
+
+		jobs.scope("instance and device", [&] {
+			createInstance();
+			setupDebugCallback();
+			createSurface();
+			pickPhysicalDevice();
+			createLogicalDevice();
+			renderTargets.init(physicalDevice);
+		});
+
+		jobs.scope("swap chain and render passes", [&] {
+			createSwapChain();
+			createImageViews();
+			updateTileCounts();
+			createRenderPass();
+			createDepthRenderPass();
+			createDepthFramebuffer();
+		});
+
+		jobs.scope("shader modules", [&] { createShaders(); });
+		jobs.scope("pipeline cache load", [&] { createPipelineCache(); });
+		createDescriptorSetLayout();
+
+		// pipeline creation only reads the shader stages, layouts and render passes
+		jobs.run("graphics pipelines", [&] { createGraphicsPipeline(); }, &pipelinesCreated);
+		jobs.run("compute pipelines", [&] { createComputePipeline(); }, &pipelinesCreated);
+
+		createCommandPool();
+
+
+		// load data -> create vertex and index buffer
+		jobs.scope("textures", [&] { prepareTextures(); });
+		//loadModel(meshs.scene.vertices.verticesData, meshs.scene.indices.indicesData, MODEL_PATH, MODEL_BASE_DIR, 0.4f);
+		//createMeshBuffer(meshs.scene);
+
+		//loadAxisInfo();
+		//createMeshBuffer(meshs.axis);
+
+		//loadTextureQuad();
+		//createMeshBuffer(meshs.quad);
+
+
+		// create and initialize light infos
+		jobs.scope("lights and buffers", [&] {
+			createLightInfos();
+			createUniformBuffer();
+			createStorageBuffer();
+			createTileBuffers();
+			initStorageBuffer();
+			createDescriptorPool();
+			createDescriptorSet();
+		});
+
+		jobs.scope("wait for model", [&] {
+			jobs.wait(meshLoaded);
+			jobs.wait(modelLoaded);
+		});
+		jobs.scope("model upload", [&] { createModel(meshs.meshGroupScene, modelAssets); });
+
+		// command buffers bind the pipelines
+		jobs.scope("wait for pipelines", [&] { jobs.wait(pipelinesCreated); });
+
+		// the frame graph creates the transient targets the framebuffers use
+		jobs.scope("command buffers", [&] {
+			createTimestampQueryPool();
+			createSemaphores();
+			createFrameGraph();
+			createFramebuffers();
+			createFrameRecording();
+			for (int slot = 0; slot < MAX_FRAMES_IN_FLIGHT; ++slot) {
+				createCommandBuffers(slot);
+				createUploadCommandBuffer(slot);
+				createFrustumCommandBuffer(slot);
+				createComputeCommandBuffer(slot);
+				createDepthCommandBuffer(slot);
+				createLodCommandBuffer(slot);
+			}
+		});
+	} catch (...) {
+		for (JobSystem::Counter * counter : { &meshLoaded, &modelLoaded, &pipelinesCreated }) {
+			try {
+				jobs.wait(*counter);
+			} catch (...) {
+			}
 		}
-
-		vkWaitForFences(device, 1, &fence, VK_TRUE, UINT64_MAX);
+		throw;
 	}
 
-	VkSubmitInfo depthSubmitInfo = {};
-	depthSubmitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-	depthSubmitInfo.pNext = nullptr;
-	depthSubmitInfo.commandBufferCount = 1;
-	depthSubmitInfo.pCommandBuffers = &depthPrepass.commandBuffer;
-	depthSubmitInfo.signalSemaphoreCount = 1;
-	depthSubmitInfo.pSignalSemaphores = &depthPrepass.semaphore;
+	// the startup records become the last frame of the profile
+	jobs.beginFrame();
+	jobs.printTimeline("Startup timeline, pipeline cache "
+		+ (pipelineCacheLoadedSize > 0 ? "warm, " + std::to_string(pipelineCacheLoadedSize) + " bytes" : std::string("cold")),
+		STARTUP_TRACE_PATH);
+}
 
-	if (vkQueueSubmit(graphicsQueue, 1, &depthSubmitInfo, VK_NULL_HANDLE) != VK_SUCCESS) {
-		throw std::runtime_error("failed to submit depth command buffer!");
+void VulkanBaseApplication::createPipelineCache() {
+	VkPhysicalDeviceProperties properties;
+	vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+
+	// initial data from the last run, if it was written by this gpu and driver
+	std::vector<char> data;
+	std::string rejected = "no cache file";
+	std::ifstream file(PIPELINE_CACHE_PATH, std::ios::binary);
+	if (file.is_open()) {
+		PipelineCacheFileHeader header = {};
+		file.read((char*)&header, sizeof(header));
+		if (file && header.dataSize < (64ull << 20)) {
+			data.resize((size_t)header.dataSize);
+			file.read(data.data(), data.size());
+		}
+		rejected = file ? validatePipelineCache(header, data, properties) : "unknown or truncated file";
 	}
-
-	// submit compute command buffer
-	VkSubmitInfo computeSubmitInfo = {};
-	computeSubmitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-	computeSubmitInfo.pNext = nullptr;
-	computeSubmitInfo.waitSemaphoreCount = 1;
-	computeSubmitInfo.pWaitSemaphores = &depthPrepass.semaphore;
-	computeSubmitInfo.commandBufferCount = 1;
-	computeSubmitInfo.pCommandBuffers = &cmdBuffers.compute;
-
-	if (vkQueueSubmit(graphicsQueue, 1, &computeSubmitInfo, VK_NULL_HANDLE) != VK_SUCCESS) {
-		throw std::runtime_error("failed to submit compute command buffer!");
+	if (!rejected.empty()) {
+		data.clear();
 	}
 
-	// submit graphics command buffer
-	VkSubmitInfo submitInfo = {};
-	VkSemaphore waitSemaphores[] = { imageAvailableSemaphore };
-	VkSemaphore signalSemaphores[] = { renderFinishedSemaphore };
-	VkPipelineStageFlags waitStages[] = { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT };
-	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-	submitInfo.waitSemaphoreCount = 1;
-	submitInfo.pWaitSemaphores = waitSemaphores;
-	submitInfo.pWaitDstStageMask = waitStages;
-	submitInfo.commandBufferCount = 1;
-	submitInfo.pCommandBuffers = &cmdBuffers.display[imageIndex];
-	submitInfo.signalSemaphoreCount = 1;
-	submitInfo.pSignalSemaphores = signalSemaphores;
-
-	if (vkQueueSubmit(graphicsQueue, 1, &submitInfo, VK_NULL_HANDLE) != VK_SUCCESS) {
-		throw std::runtime_error("failed to submit draw command buffer!");
+	VkPipelineCacheCreateInfo cacheInfo = {};
+	cacheInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+	cacheInfo.initialDataSize = data.size();
+	cacheInfo.pInitialData = data.empty() ? nullptr : data.data();
+
+	if (vkCreatePipelineCache(device, &cacheInfo, nullptr, pipelineCache.replace()) != VK_SUCCESS) {
+		// the driver refused the data after all, start empty
+		rejected = "rejected by the driver";
+		cacheInfo.initialDataSize = 0;
+		cacheInfo.pInitialData = nullptr;
+		if (vkCreatePipelineCache(device, &cacheInfo, nullptr, pipelineCache.replace()) != VK_SUCCESS) {
+			throw std::runtime_error("failed to create pipeline cache!");
+		}
 	}
 
-	// submit present command
-	VkPresentInfoKHR presentInfo = {};
-	VkSwapchainKHR swapChains[] = { swapChain };
-	presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
-	presentInfo.waitSemaphoreCount = 1;
-	presentInfo.pWaitSemaphores = signalSemaphores;
-	presentInfo.swapchainCount = 1;
-	presentInfo.pSwapchains = swapChains;
-	presentInfo.pImageIndices = &imageIndex;
-
-	vkQueuePresentKHR(presentQueue, &presentInfo);
+	pipelineCacheLoadedSize = rejected.empty() ? data.size() : 0;
+	if (!rejected.empty()) {
+		std::cout << "pipeline cache " << PIPELINE_CACHE_PATH << " not used: " << rejected << std::endl;
+	}
 }
 
+void VulkanBaseApplication::savePipelineCache() {
+	size_t dataSize = 0;
+	if (vkGetPipelineCacheData(device, pipelineCache, &dataSize, nullptr) != VK_SUCCESS || dataSize == 0) {
+		return;
+	}
+	std::vector<char> data(dataSize);
+	if (vkGetPipelineCacheData(device, pipelineCache, &dataSize, data.data()) != VK_SUCCESS) {
+		return;
+	}
+	data.resize(dataSize);
 
-void VulkanBaseApplication::initVulkan() {
-	createInstance();
-	setupDebugCallback();
-	createSurface();
-	pickPhysicalDevice();
-	createLogicalDevice();
-	createSwapChain();
-	createImageViews();
-	createRenderPass();
-	createDepthRenderPass();
-	createDepthFramebuffer();
-	createShaders();
-	createDescriptorSetLayout();
-	createGraphicsPipeline();
-	createComputePipeline();
-	createCommandPool();
-	createDepthResources();
-	createFramebuffers();
-
-
-	// load data -> create vertex and index buffer
-	prepareTextures();
-	//loadModel(meshs.scene.vertices.verticesData, meshs.scene.indices.indicesData, MODEL_PATH, MODEL_BASE_DIR, 0.4f);
-	//createMeshBuffer(meshs.scene);
-
-	//loadAxisInfo();
-	//createMeshBuffer(meshs.axis);
-
-	//loadTextureQuad();
-	//createMeshBuffer(meshs.quad);
-
-
-	// create and initialize light infos
-	createLightInfos();
-	createUniformBuffer();
-	createStorageBuffer();
-	initStorageBuffer();
-	createDescriptorPool();
-	createDescriptorSet();
-#if CRYTEC_SPONZA
-	loadModel(meshs.meshGroupScene, MODEL_PATH, MODEL_BASE_DIR);
-#else
-	loadModel(meshs.meshGroupScene, MODEL_PATH, MODEL_BASE_DIR, 0.4f);
-#endif
+	VkPhysicalDeviceProperties properties;
+	vkGetPhysicalDeviceProperties(physicalDevice, &properties);
 
+	PipelineCacheFileHeader header = {};
+	header.magic = PIPELINE_CACHE_MAGIC;
+	header.vendorID = properties.vendorID;
+	header.deviceID = properties.deviceID;
+	header.driverVersion = properties.driverVersion;
+	memcpy(header.pipelineCacheUUID, properties.pipelineCacheUUID, VK_UUID_SIZE);
+	header.dataSize = data.size();
 
-	createCommandBuffers();
-	createFrustumCommandBuffer();
-	createComputeCommandBuffer();
-	createDepthCommandBuffer();
-	createSemaphores();
+	// write a temporary file first so a crash never leaves a truncated cache
+	std::string tempPath = std::string(PIPELINE_CACHE_PATH) + ".tmp";
+	{
+		std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+		if (!file.is_open()) {
+			return; // read-only working directory, just skip caching
+		}
+		file.write((const char*)&header, sizeof(header));
+		file.write(data.data(), data.size());
+		if (!file) {
+			return;
+		}
+	}
+	std::remove(PIPELINE_CACHE_PATH);
+	std::rename(tempPath.c_str(), PIPELINE_CACHE_PATH);
+	std::cout << "saved pipeline cache " << PIPELINE_CACHE_PATH << " (" << data.size() << " bytes)" << std::endl;
 }
 
 
@@ -508,6 +1086,10 @@ void VulkanBaseApplication::createLogicalDevice() {
 	QueueFamilyIndices indices = findQueueFamilies(physicalDevice);
 	std::vector<VkDeviceQueueCreateInfo> queueCreateInfos;
 	std::set<int> uniqueQueueFamilies = { indices.graphicsFamily, indices.presentFamily };
+	asyncCompute = bAsyncCompute && indices.computeFamily >= 0;
+	if (asyncCompute) {
+		uniqueQueueFamilies.insert(indices.computeFamily);
+	}
 	float queuePriority = 1.0f;
 
 	for (int queueFamily : uniqueQueueFamilies) {
@@ -521,14 +1103,43 @@ void VulkanBaseApplication::createLogicalDevice() {
 	}
 
 
+	VkPhysicalDeviceFeatures supportedFeatures;
+	vkGetPhysicalDeviceFeatures(physicalDevice, &supportedFeatures);
+	multiDrawIndirectSupported = supportedFeatures.multiDrawIndirect == VK_TRUE;
+
 	VkPhysicalDeviceFeatures deviceFeatures = {};
+	deviceFeatures.multiDrawIndirect = supportedFeatures.multiDrawIndirect;
 	VkDeviceCreateInfo createInfo = {};
 	createInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
 	createInfo.pQueueCreateInfos = queueCreateInfos.data();
 	createInfo.queueCreateInfoCount = uint32_t(queueCreateInfos.size());
 	createInfo.pEnabledFeatures = &deviceFeatures;
-	createInfo.enabledExtensionCount = uint32_t(deviceExtensions.size());
-	createInfo.ppEnabledExtensionNames = deviceExtensions.data();
+
+	// timeline semaphores for the frame graph when the driver has them and the
+	// instance has VK_KHR_get_physical_device_properties2, the feature is
+	// always there with the extension
+	std::vector<const char*> enabledExtensions = deviceExtensions;
+#ifdef VK_KHR_timeline_semaphore
+	VkPhysicalDeviceTimelineSemaphoreFeaturesKHR timelineFeatures = {};
+	timelineFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES_KHR;
+	timelineFeatures.timelineSemaphore = VK_TRUE;
+
+	uint32_t extensionCount;
+	vkEnumerateDeviceExtensionProperties(physicalDevice, nullptr, &extensionCount, nullptr);
+	std::vector<VkExtensionProperties> availableExtensions(extensionCount);
+	vkEnumerateDeviceExtensionProperties(physicalDevice, nullptr, &extensionCount, availableExtensions.data());
+
+	for (const auto & extension : availableExtensions) {
+		if (bTimelineSemaphores && physicalDeviceProperties2
+				&& strcmp(extension.extensionName, VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME) == 0) {
+			frameGraph.timelineSemaphores = true;
+			enabledExtensions.push_back(VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME);
+			createInfo.pNext = &timelineFeatures;
+		}
+	}
+#endif
+	createInfo.enabledExtensionCount = uint32_t(enabledExtensions.size());
+	createInfo.ppEnabledExtensionNames = enabledExtensions.data();
 
 	if (enableValidationLayers) {
 		createInfo.enabledLayerCount = uint32_t(validationLayers.size());
@@ -544,6 +1155,12 @@ void VulkanBaseApplication::createLogicalDevice() {
 	// retrieving queue handles
 	vkGetDeviceQueue(device, indices.graphicsFamily, 0, &graphicsQueue);
 	vkGetDeviceQueue(device, indices.presentFamily, 0, &presentQueue);
+
+	graphicsQueueFamily = (uint32_t)indices.graphicsFamily;
+	computeQueueFamily = asyncCompute ? (uint32_t)indices.computeFamily : graphicsQueueFamily;
+	vkGetDeviceQueue(device, computeQueueFamily, 0, &computeQueue);
+	std::cout << (asyncCompute ? "light culling on compute queue family " + std::to_string(computeQueueFamily)
+		: std::string("no compute only queue family, light culling on the graphics queue")) << std::endl;
 }
 
 
@@ -609,14 +1226,208 @@ void VulkanBaseApplication::createImageViews() {
 }
 
 void VulkanBaseApplication::createShaders() {
-	shaderModules.resize(7, VDeleter<VkShaderModule>{device, vkDestroyShaderModule});
-	shaderStage.vs = loadShader("../src/shaders/final_shading.vert.spv", VK_SHADER_STAGE_VERTEX_BIT, 0);
-	shaderStage.fs = loadShader("../src/shaders/final_shading.frag.spv", VK_SHADER_STAGE_FRAGMENT_BIT, 1);
-	shaderStage.vs_axis = loadShader("../src/shaders/axis.vert.spv", VK_SHADER_STAGE_VERTEX_BIT, 2);
-	shaderStage.fs_axis = loadShader("../src/shaders/axis.frag.spv", VK_SHADER_STAGE_FRAGMENT_BIT, 3);
-	shaderStage.fs_quad = loadShader("../src/shaders/quad.frag.spv", VK_SHADER_STAGE_FRAGMENT_BIT, 4);;
-	shaderStage.csFrustum = loadShader("../src/shaders/computeFrustumGrid.comp.spv", VK_SHADER_STAGE_COMPUTE_BIT, 5);
-	shaderStage.csLightList = loadShader("../src/shaders/computeLightList.comp.spv", VK_SHADER_STAGE_COMPUTE_BIT, 6);
+	shaderFiles = {
+		{ "../src/shaders/final_shading.vert", VK_SHADER_STAGE_VERTEX_BIT, &shaderStage.vs },
+		{ "../src/shaders/final_shading.frag", VK_SHADER_STAGE_FRAGMENT_BIT, &shaderStage.fs },
+		{ "../src/shaders/axis.vert", VK_SHADER_STAGE_VERTEX_BIT, &shaderStage.vs_axis },
+		{ "../src/shaders/axis.frag", VK_SHADER_STAGE_FRAGMENT_BIT, &shaderStage.fs_axis },
+		{ "../src/shaders/quad.frag", VK_SHADER_STAGE_FRAGMENT_BIT, &shaderStage.fs_quad },
+		{ "../src/shaders/computeFrustumGrid.comp", VK_SHADER_STAGE_COMPUTE_BIT, &shaderStage.csFrustum },
+		{ "../src/shaders/computeLightList.comp", VK_SHADER_STAGE_COMPUTE_BIT, &shaderStage.csLightList },
+		{ "../src/shaders/selectLod.comp", VK_SHADER_STAGE_COMPUTE_BIT, &shaderStage.csLod },
+		{ "../src/shaders/depth_alpha.frag", VK_SHADER_STAGE_FRAGMENT_BIT, &shaderStage.fs_depthAlphaTest },
+		{ "../src/shaders/updateLights.comp", VK_SHADER_STAGE_COMPUTE_BIT, &shaderStage.csLightUpdate },
+		{ "../src/shaders/computeLightListCooperative.comp", VK_SHADER_STAGE_COMPUTE_BIT, &shaderStage.csLightListCooperative },
+		{ "../src/shaders/binLights.comp", VK_SHADER_STAGE_COMPUTE_BIT, &shaderStage.csLightBinning },
+		{ "../src/shaders/composite.vert", VK_SHADER_STAGE_VERTEX_BIT, &shaderStage.vs_composite },
+		{ "../src/shaders/composite.frag", VK_SHADER_STAGE_FRAGMENT_BIT, &shaderStage.fs_composite }
+	};
+	shaderSourceTimes.resize(shaderFiles.size());
+	for (size_t i = 0; i < shaderFiles.size(); ++i) {
+		shaderSourceTimes[i] = ShaderCompiler::sourceTime(shaderFiles[i].path);
+	}
+	shaderModules.resize(shaderFiles.size(), VDeleter<VkShaderModule>{device, vkDestroyShaderModule});
+
+	// compilation and module creation are independent, one task per shader
+	JobSystem::Counter modulesCreated;
+	for (int i = 0; i < (int)shaderFiles.size(); ++i) {
+		// the job is named by the source path
+		const ShaderFile & file = shaderFiles[i];
+		jobs.run(file.path.c_str(), [this, &file, i] {
+			*file.stageInfo = loadShader(file.path, file.stage, i);
+		}, &modulesCreated);
+	}
+	jobs.wait(modulesCreated);
+}
+
+void VulkanBaseApplication::reloadChangedShaders() {
+	static auto lastPoll = std::chrono::high_resolution_clock::now();
+	auto now = std::chrono::high_resolution_clock::now();
+	if (!bShaderHotReload || !ShaderCompiler::hasCompiler()
+			|| std::chrono::duration<float>(now - lastPoll).count() < SHADER_POLL_INTERVAL) {
+		return;
+	}
+	lastPoll = now;
+
+	// the times are only taken once the new modules are in use, so every
+	// shader edited before a failed compile is still picked up later
+	static std::vector<int64_t> failedTimes;
+	std::vector<size_t> changed;
+	std::vector<int64_t> times(shaderFiles.size());
+	for (size_t i = 0; i < shaderFiles.size(); ++i) {
+		times[i] = ShaderCompiler::sourceTime(shaderFiles[i].path);
+		if (times[i] != shaderSourceTimes[i]) {
+			changed.push_back(i);
+		}
+	}
+	if (changed.empty() || times == failedTimes) {
+		// nothing saved since the last failed compile
+		return;
+	}
+
+	// compile everything first, a broken edit keeps the running pipelines
+	// until the next save
+	auto startTime = std::chrono::high_resolution_clock::now();
+	std::vector<std::vector<char>> codes(changed.size());
+	for (size_t k = 0; k < changed.size(); ++k) {
+		const ShaderFile & file = shaderFiles[changed[k]];
+		std::string log;
+		if (!shaderCompiler.compile(file.path, file.stage, ShaderDefines(), codes[k], log)) {
+			std::cout << "failed to compile " << file.path << ":\n" << log << std::endl;
+			failedTimes = times;
+			return;
+		}
+	}
+
+	vkDeviceWaitIdle(device);
+	for (size_t k = 0; k < changed.size(); ++k) {
+		const ShaderFile & file = shaderFiles[changed[k]];
+		createShaderModule(codes[k], shaderModules[changed[k]]);
+		file.stageInfo->module = shaderModules[changed[k]];
+	}
+	recreatePipelines();
+	for (size_t i : changed) {
+		shaderSourceTimes[i] = times[i];
+	}
+
+	float ms = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - startTime).count();
+	std::cout << "reloaded " << changed.size() << " shader(s) in " << ms << " ms" << std::endl;
+}
+
+void VulkanBaseApplication::recreatePipelines() {
+	pipelines.cleanup(device);
+	pipelines.shadingVariants.clear();
+	createGraphicsPipeline();
+	createComputePipeline();
+
+	// every command buffer binds pipelines
+	recreateCommandBuffers();
+
+	// the frustum kernel may have changed, the next frame runs it again
+	frameGraph.frustumsDirty = true;
+
+	// the cached light lists came from the old kernels
+	cullingCache.depthGeneration++;
+	cullingCache.lightVersion++;
+}
+
+void VulkanBaseApplication::recreateCommandBuffers() {
+	for (int slot = 0; slot < MAX_FRAMES_IN_FLIGHT; ++slot) {
+		FrameInFlight & inFlight = frames[slot];
+		vkFreeCommandBuffers(device, commandPool, (uint32_t)inFlight.display.size(), inFlight.display.data());
+		vkFreeCommandBuffers(device, commandPool, 1, &inFlight.frustum);
+		vkFreeCommandBuffers(device, computeCommandPool, 1, &inFlight.compute);
+		vkFreeCommandBuffers(device, commandPool, 1, &inFlight.depthPrepass);
+		vkFreeCommandBuffers(device, commandPool, 1, &inFlight.lodSelection);
+		inFlight.depthPrepass = VK_NULL_HANDLE;
+		createCommandBuffers(slot);
+		createFrustumCommandBuffer(slot);
+		createComputeCommandBuffer(slot);
+		createDepthCommandBuffer(slot);
+		createLodCommandBuffer(slot);
+	}
+}
+
+void VulkanBaseApplication::recreateSwapChain() {
+	// minimized, nothing can be presented until the window has pixels again
+	int width = 0, height = 0;
+	glfwGetFramebufferSize(window, &width, &height);
+	while ((width == 0 || height == 0) && !glfwWindowShouldClose(window)) {
+		glfwWaitEvents();
+		glfwGetFramebufferSize(window, &width, &height);
+	}
+	if (width == 0 || height == 0) {
+		return;
+	}
+
+	auto startTime = std::chrono::high_resolution_clock::now();
+	auto stepTime = startTime;
+	std::stringstream steps;
+	auto step = [&](const char * name, const std::function<void()> & work) {
+		work();
+		auto now = std::chrono::high_resolution_clock::now();
+		steps << ", " << name << " " << std::chrono::duration<float, std::milli>(now - stepTime).count() << " ms";
+		stepTime = now;
+	};
+
+	// assets, pipelines, render passes and the light buffers stay, only what
+	// depends on the extent or the tile count is created again. The frame culled
+	// but not shaded yet is dropped, no slot has a frame to read back
+	step("idle", [&] { vkDeviceWaitIdle(device); });
+	pendingFrame = -1;
+	for (FrameInFlight & inFlight : frames) {
+		inFlight.enabledPasses = 0;
+	}
+
+	step("swap chain", [&] {
+		// the old framebuffers and views go before the swap chain they point at,
+		// the views are plain handles
+		for (FrameInFlight & inFlight : frames) {
+			inFlight.framebuffers.clear();
+		}
+		for (auto imageView : swapChainImageViews) {
+			vkDestroyImageView(device, imageView, nullptr);
+		}
+		swapChainImageViews.clear();
+		createSwapChain();
+		createImageViews();
+		updateTileCounts();
+	});
+
+	step("depth", [&] { createDepthFramebuffer(); });
+
+	step("tile buffers", [&] {
+		cleanupTileBuffers();
+		createTileBuffers();
+	});
+
+	step("descriptors", [&] {
+		for (int slot = 0; slot < MAX_FRAMES_IN_FLIGHT; ++slot) {
+			updateTileDescriptors(frames[slot].descriptorSet, slot);
+			for (VkDescriptorSet set : meshs.meshGroupScene.descriptorSets[slot]) {
+				updateTileDescriptors(set, slot);
+			}
+		}
+	});
+
+	// the graph points at the new tile buffers and creates sceneColor at the new
+	// extent, the framebuffers need its view
+	step("frame graph", [&] { createFrameGraph(); });
+
+	step("framebuffers", [&] { createFramebuffers(); });
+
+	// the per frame recording uses the framebuffers of the slots directly
+	step("command buffers", [&] { recreateCommandBuffers(); });
+
+	// new frustum grid for the new tiles, the cached lists and depth are gone
+	frameGraph.frustumsDirty = true;
+	cullingCache.depthGeneration++;
+	cullingCache.lightVersion++;
+
+	float ms = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - startTime).count();
+	std::cout << "resized to " << swapChainExtent.width << "x" << swapChainExtent.height
+		<< " (" << fpParams.numThreads.x << "x" << fpParams.numThreads.y << " tiles) in " << ms << " ms"
+		<< steps.str() << std::endl;
 }
 
 void VulkanBaseApplication::createGraphicsPipeline()
@@ -651,25 +1462,12 @@ void VulkanBaseApplication::createGraphicsPipeline()
 
 
 #pragma region Viewport State
-	// viewport state
-	VkViewport viewport = {};
-	viewport.x = 0.0f;
-	viewport.y = 0.0f;
-	viewport.width = (float)swapChainExtent.width;
-	viewport.height = (float)swapChainExtent.height;
-	viewport.minDepth = 0.0f;
-	viewport.maxDepth = 1.0f;
-
-	VkRect2D scissor = {};
-	scissor.offset = { 0, 0 };
-	scissor.extent = swapChainExtent;
-
+	// viewport state, set in the command buffers (see Dynamic state) so the
+	// pipelines outlive a resize
 	VkPipelineViewportStateCreateInfo viewportState = {};
 	viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
 	viewportState.viewportCount = 1;
-	viewportState.pViewports = &viewport;
 	viewportState.scissorCount = 1;
-	viewportState.pScissors = &scissor;
 #pragma endregion
 
 
@@ -729,8 +1527,8 @@ void VulkanBaseApplication::createGraphicsPipeline()
 	VkPipelineDepthStencilStateCreateInfo depthStencil = {};
 	depthStencil.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
 	depthStencil.depthTestEnable = VK_TRUE;
-	depthStencil.depthWriteEnable = VK_TRUE;
-	depthStencil.depthCompareOp = VK_COMPARE_OP_LESS;
+	depthStencil.depthWriteEnable = VK_FALSE; // depth comes from the prepass
+	depthStencil.depthCompareOp = VK_COMPARE_OP_EQUAL;
 	depthStencil.depthBoundsTestEnable = VK_FALSE;
 	depthStencil.minDepthBounds = 0.0f; // Optional
 	depthStencil.maxDepthBounds = 1.0f; // Optional
@@ -744,7 +1542,7 @@ void VulkanBaseApplication::createGraphicsPipeline()
 	// dynamic state
 	VkDynamicState dynamicStates[] = {
 		VK_DYNAMIC_STATE_VIEWPORT,
-		VK_DYNAMIC_STATE_LINE_WIDTH
+		VK_DYNAMIC_STATE_SCISSOR
 	};
 
 	VkPipelineDynamicStateCreateInfo dynamicState = {};
@@ -784,7 +1582,7 @@ void VulkanBaseApplication::createGraphicsPipeline()
 	pipelineInfo.pMultisampleState = &multisampling;
 	pipelineInfo.pDepthStencilState = &depthStencil; // Optional
 	pipelineInfo.pColorBlendState = &colorBlending;
-	pipelineInfo.pDynamicState = nullptr; // Optional
+	pipelineInfo.pDynamicState = &dynamicState;
 	pipelineInfo.layout = pipelineLayout;
 	pipelineInfo.renderPass = renderPass;
 	pipelineInfo.subpass = 0;
@@ -794,15 +1592,20 @@ void VulkanBaseApplication::createGraphicsPipeline()
 
 
 	// create graphics pipeline finally!
-	if (vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &pipelines.graphics) != VK_SUCCESS) {
+	pipelineInfo.flags = VK_PIPELINE_CREATE_ALLOW_DERIVATIVES_BIT;
+	if (vkCreateGraphicsPipelines(device, pipelineCache, 1, &pipelineInfo, nullptr, &pipelines.graphics) != VK_SUCCESS) {
 		throw std::runtime_error("failed to create graphics pipeline!");
 	}
+	createShadingVariants(pipelineInfo);
+	pipelineInfo.flags = 0;
 
 	// create graphics pipeline for quad render
 	// input assembly state for texture quad, without culling
+	// quad and axis are not in the prepass, test them against it
+	depthStencil.depthCompareOp = VK_COMPARE_OP_LESS_OR_EQUAL;
 	shaderStages[1] = shaderStage.fs_quad;
 	rasterizer.cullMode = VK_CULL_MODE_NONE;
-	if (vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &pipelines.quad) != VK_SUCCESS) {
+	if (vkCreateGraphicsPipelines(device, pipelineCache, 1, &pipelineInfo, nullptr, &pipelines.quad) != VK_SUCCESS) {
 		throw std::runtime_error("failed to create graphics pipeline!");
 	}
 
@@ -812,17 +1615,133 @@ void VulkanBaseApplication::createGraphicsPipeline()
 	shaderStages[0] = shaderStage.vs_axis;
 	shaderStages[1] = shaderStage.fs_axis;
 	rasterizer.cullMode = VK_CULL_MODE_BACK_BIT;
-	if (vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &pipelines.axis) != VK_SUCCESS) {
+	if (vkCreateGraphicsPipelines(device, pipelineCache, 1, &pipelineInfo, nullptr, &pipelines.axis) != VK_SUCCESS) {
 		throw std::runtime_error("failed to create graphics pipeline!");
 	}
 
+	// composite pipelines, subpass 1: a fullscreen triangle without vertex
+	// buffer reads sceneColor as an input attachment, no depth attachment
+	VkPipelineLayoutCreateInfo compositeLayoutInfo = {};
+	VkDescriptorSetLayout compositeSetLayouts[] = { compositeSetLayout };
+	compositeLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+	compositeLayoutInfo.setLayoutCount = 1;
+	compositeLayoutInfo.pSetLayouts = compositeSetLayouts;
+
+	if (vkCreatePipelineLayout(device, &compositeLayoutInfo, nullptr,
+		compositePipelineLayout.replace()) != VK_SUCCESS) {
+		throw std::runtime_error("failed to create pipeline layout!");
+	}
+
+	VkPipelineVertexInputStateCreateInfo compositeVertexInput = {};
+	compositeVertexInput.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+
+	// constant_id 0 of composite.frag, the debug views are not corrected
+	const int32_t colorCorrection[] = { 1, 0 };
+	const VkSpecializationMapEntry compositeEntry = { 0, 0, sizeof(int32_t) };
+	VkSpecializationInfo compositeSpecialization = {};
+	compositeSpecialization.mapEntryCount = 1;
+	compositeSpecialization.pMapEntries = &compositeEntry;
+	compositeSpecialization.dataSize = sizeof(int32_t);
+
 	inputAssembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+	shaderStages[0] = shaderStage.vs_composite;
+	shaderStages[1] = shaderStage.fs_composite;
+	shaderStages[1].pSpecializationInfo = &compositeSpecialization;
+	rasterizer.cullMode = VK_CULL_MODE_NONE;
+	pipelineInfo.pVertexInputState = &compositeVertexInput;
+	pipelineInfo.pDepthStencilState = nullptr;
+	pipelineInfo.layout = compositePipelineLayout;
+	pipelineInfo.subpass = 1;
+	VkPipeline * compositePipelines[] = { &pipelines.composite, &pipelines.compositeDebug };
+	for (int i = 0; i < 2; ++i) {
+		compositeSpecialization.pData = &colorCorrection[i];
+		if (vkCreateGraphicsPipelines(device, pipelineCache, 1, &pipelineInfo, nullptr, compositePipelines[i]) != VK_SUCCESS) {
+			throw std::runtime_error("failed to create composite pipeline!");
+		}
+	}
+	rasterizer.cullMode = VK_CULL_MODE_BACK_BIT;
+	pipelineInfo.pVertexInputState = &vertexInputInfo;
+	pipelineInfo.pDepthStencilState = &depthStencil;
+	pipelineInfo.layout = pipelineLayout;
+	pipelineInfo.subpass = 0;
+
+	// depth prepass pipeline, same vertex shader so depths match exactly
 	pipelineInfo.stageCount = 1;
 	shaderStages[0] = shaderStage.vs;
-	if (vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &pipelines.depth)
+	depthStencil.depthWriteEnable = VK_TRUE;
+	depthStencil.depthCompareOp = VK_COMPARE_OP_LESS;
+	colorBlending.attachmentCount = 0;
+	pipelineInfo.renderPass = depthPrepass.renderPass;
+	if (vkCreateGraphicsPipelines(device, pipelineCache, 1, &pipelineInfo, nullptr, &pipelines.depth)
 			!= VK_SUCCESS) {
 		throw std::runtime_error("failed to create depth pipeline!");
 	}
+
+	// alpha-tested depth prepass pipeline
+	pipelineInfo.stageCount = 2;
+	shaderStages[1] = shaderStage.fs_depthAlphaTest;
+	if (vkCreateGraphicsPipelines(device, pipelineCache, 1, &pipelineInfo, nullptr, &pipelines.depthAlphaTest)
+			!= VK_SUCCESS) {
+		throw std::runtime_error("failed to create depth pipeline!");
+	}
+}
+
+void VulkanBaseApplication::createShadingVariants(VkGraphicsPipelineCreateInfo pipelineInfo) {
+	// constant_id 0 - 3 of final_shading.frag
+	struct ShadingConstants {
+		int32_t useTextureMap;
+		int32_t useNormMap;
+		int32_t useSpecMap;
+		int32_t debugMode;
+	};
+	const VkSpecializationMapEntry mapEntries[] = {
+		{ 0, offsetof(ShadingConstants, useTextureMap), sizeof(int32_t) },
+		{ 1, offsetof(ShadingConstants, useNormMap), sizeof(int32_t) },
+		{ 2, offsetof(ShadingConstants, useSpecMap), sizeof(int32_t) },
+		{ 3, offsetof(ShadingConstants, debugMode), sizeof(int32_t) }
+	};
+
+	size_t numVariants = NUM_MATERIAL_VARIANTS + debugModeNameStrings.size() - 1;
+	std::vector<ShadingConstants> constants(numVariants);
+	for (int mask = 0; mask < NUM_MATERIAL_VARIANTS; ++mask) {
+		constants[shadingVariantIndex(mask, 0)] = { mask & 1, (mask >> 1) & 1, (mask >> 2) & 1, 0 };
+	}
+	for (int mode = 1; mode < (int)debugModeNameStrings.size(); ++mode) {
+		constants[shadingVariantIndex(0, mode)] = { -1, -1, -1, mode };
+	}
+
+	std::vector<VkSpecializationInfo> specializations(numVariants);
+	std::vector<std::array<VkPipelineShaderStageCreateInfo, 2>> stages(numVariants);
+	std::vector<VkGraphicsPipelineCreateInfo> pipelineInfos(numVariants, pipelineInfo);
+	for (size_t i = 0; i < numVariants; ++i) {
+		specializations[i].mapEntryCount = 4;
+		specializations[i].pMapEntries = mapEntries;
+		specializations[i].dataSize = sizeof(ShadingConstants);
+		specializations[i].pData = &constants[i];
+
+		stages[i] = { shaderStage.vs, shaderStage.fs };
+		stages[i][1].pSpecializationInfo = &specializations[i];
+
+		pipelineInfos[i].stageCount = 2;
+		pipelineInfos[i].pStages = stages[i].data();
+		pipelineInfos[i].flags = VK_PIPELINE_CREATE_DERIVATIVE_BIT;
+		pipelineInfos[i].basePipelineHandle = pipelines.graphics;
+		pipelineInfos[i].basePipelineIndex = -1;
+	}
+
+	pipelines.shadingVariants.resize(numVariants);
+	if (vkCreateGraphicsPipelines(device, pipelineCache, (uint32_t)numVariants, pipelineInfos.data(), nullptr,
+			pipelines.shadingVariants.data()) != VK_SUCCESS) {
+		throw std::runtime_error("failed to create shading pipeline variants!");
+	}
+}
+
+VkPipeline VulkanBaseApplication::shadingPipeline(const Material & material, int debugMode) const {
+	int mode = shadingDebugMode(debugMode);
+	int mask = (material.useTextureMap > 0 ? 1 : 0)
+		| (material.useNormMap > 0 ? 2 : 0)
+		| (material.useSpecMap > 0 ? 4 : 0);
+	return pipelines.shadingVariants[shadingVariantIndex(mode == 0 ? mask : 0, mode)];
 }
 
 void VulkanBaseApplication::createComputePipeline() {
@@ -848,39 +1767,71 @@ void VulkanBaseApplication::createComputePipeline() {
 
 	// compute frustum pipeline
 	pipelineInfo.stage = shaderStage.csFrustum;
-	if (vkCreateComputePipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo,
+	if (vkCreateComputePipelines(device, pipelineCache, 1, &pipelineInfo,
 			nullptr, &pipelines.computeFrustumGrid) != VK_SUCCESS) {
 		throw std::runtime_error("failed to create compute pipeline!");
 	}
 
 	// compute light list pipeline
 	pipelineInfo.stage = shaderStage.csLightList;
-	if (vkCreateComputePipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo,
+	if (vkCreateComputePipelines(device, pipelineCache, 1, &pipelineInfo,
 		nullptr, &pipelines.computeLightList) != VK_SUCCESS) {
 		throw std::runtime_error("failed to create compute Frustum Grid pipeline!");
 	}
-}
 
-void VulkanBaseApplication::createFramebuffers() {
-	swapChainFramebuffers.resize(swapChainImageViews.size(), VDeleter<VkFramebuffer>{device, vkDestroyFramebuffer});
+	// lod selection pipeline
+	pipelineInfo.stage = shaderStage.csLod;
+	if (vkCreateComputePipelines(device, pipelineCache, 1, &pipelineInfo,
+		nullptr, &pipelines.computeLod) != VK_SUCCESS) {
+		throw std::runtime_error("failed to create compute lod pipeline!");
+	}
 
-	for (size_t i = 0; i < swapChainImageViews.size(); i++) {
-		std::array<VkImageView, 2> attachments = {
-			swapChainImageViews[i],
-			depth.view
-		};
+	// light animation pipeline
+	pipelineInfo.stage = shaderStage.csLightUpdate;
+	if (vkCreateComputePipelines(device, pipelineCache, 1, &pipelineInfo,
+		nullptr, &pipelines.computeLightUpdate) != VK_SUCCESS) {
+		throw std::runtime_error("failed to create compute light update pipeline!");
+	}
 
-		VkFramebufferCreateInfo framebufferInfo = {};
-		framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
-		framebufferInfo.renderPass = renderPass;
-		framebufferInfo.attachmentCount = (uint32_t)attachments.size();
-		framebufferInfo.pAttachments = attachments.data();
-		framebufferInfo.width = swapChainExtent.width;
-		framebufferInfo.height = swapChainExtent.height;
-		framebufferInfo.layers = 1;
+	// one workgroup per tile light list pipeline
+	pipelineInfo.stage = shaderStage.csLightListCooperative;
+	if (vkCreateComputePipelines(device, pipelineCache, 1, &pipelineInfo,
+		nullptr, &pipelines.computeLightListCooperative) != VK_SUCCESS) {
+		throw std::runtime_error("failed to create compute cooperative light list pipeline!");
+	}
 
-		if (vkCreateFramebuffer(device, &framebufferInfo, nullptr, swapChainFramebuffers[i].replace()) != VK_SUCCESS) {
-			throw std::runtime_error("failed to create framebuffer!");
+	// light binning pipeline
+	pipelineInfo.stage = shaderStage.csLightBinning;
+	if (vkCreateComputePipelines(device, pipelineCache, 1, &pipelineInfo,
+		nullptr, &pipelines.computeLightBinning) != VK_SUCCESS) {
+		throw std::runtime_error("failed to create compute light binning pipeline!");
+	}
+}
+
+void VulkanBaseApplication::createFramebuffers() {
+	// sceneColor is transient, every slot renders to the same one
+	for (FrameInFlight & inFlight : frames) {
+		inFlight.framebuffers.resize(swapChainImageViews.size(), VDeleter<VkFramebuffer>{device, vkDestroyFramebuffer});
+
+		for (size_t i = 0; i < swapChainImageViews.size(); i++) {
+			std::array<VkImageView, 3> attachments = {
+				swapChainImageViews[i],
+				inFlight.depth.view,
+				renderTargets.transient(frameGraph.sceneColor).view
+			};
+
+			VkFramebufferCreateInfo framebufferInfo = {};
+			framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+			framebufferInfo.renderPass = renderPass;
+			framebufferInfo.attachmentCount = (uint32_t)attachments.size();
+			framebufferInfo.pAttachments = attachments.data();
+			framebufferInfo.width = swapChainExtent.width;
+			framebufferInfo.height = swapChainExtent.height;
+			framebufferInfo.layers = 1;
+
+			if (vkCreateFramebuffer(device, &framebufferInfo, nullptr, inFlight.framebuffers[i].replace()) != VK_SUCCESS) {
+				throw std::runtime_error("failed to create framebuffer!");
+			}
 		}
 	}
 }
@@ -896,72 +1847,103 @@ void VulkanBaseApplication::createCommandPool() {
 	if (vkCreateCommandPool(device, &poolInfo, nullptr, commandPool.replace()) != VK_SUCCESS) {
 		throw std::runtime_error("failed to create command pool!");
 	}
+
+	poolInfo.queueFamilyIndex = computeQueueFamily;
+	if (vkCreateCommandPool(device, &poolInfo, nullptr, computeCommandPool.replace()) != VK_SUCCESS) {
+		throw std::runtime_error("failed to create command pool!");
+	}
 }
 
 
-void VulkanBaseApplication::createCommandBuffers() {
-	cmdBuffers.display.resize(swapChainFramebuffers.size());
+void VulkanBaseApplication::createCommandBuffers(int slot) {
+	FrameInFlight & inFlight = frames[slot];
+	std::vector<VkCommandBuffer> & display = inFlight.display;
+	display.resize(inFlight.framebuffers.size());
+	recordedDebugMode = shadingDebugMode(debugMode);
 
 	VkCommandBufferAllocateInfo allocInfo = {};
 	allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
 	allocInfo.commandPool = commandPool;
 	allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-	allocInfo.commandBufferCount = (uint32_t)cmdBuffers.display.size();
+	allocInfo.commandBufferCount = (uint32_t)display.size();
 
-	if (vkAllocateCommandBuffers(device, &allocInfo, cmdBuffers.display.data()) != VK_SUCCESS) {
+	if (vkAllocateCommandBuffers(device, &allocInfo, display.data()) != VK_SUCCESS) {
 		throw std::runtime_error("failed to allocate command buffers!");
 	}
 
-	for (size_t i = 0; i < cmdBuffers.display.size(); i++) {
+	for (size_t i = 0; i < display.size(); i++) {
 		VkCommandBufferBeginInfo beginInfo = {};
 		beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
 		beginInfo.flags = VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT;
 
-		vkBeginCommandBuffer(cmdBuffers.display[i], &beginInfo);
+		vkBeginCommandBuffer(display[i], &beginInfo);
+
+		// shading time of the frame in the slot
+		const uint32_t firstQuery = slot * NUM_FRAME_TIMESTAMPS;
+		if (timestampPeriod > 0.0f) {
+			vkCmdResetQueryPool(display[i], timestampQueryPool, firstQuery + TIMESTAMP_SHADING, 2);
+			vkCmdWriteTimestamp(display[i], VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, timestampQueryPool, firstQuery + TIMESTAMP_SHADING);
+		}
 
 		VkRenderPassBeginInfo renderPassInfo = {};
 		renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
 		renderPassInfo.renderPass = renderPass;
-		renderPassInfo.framebuffer = swapChainFramebuffers[i];
+		renderPassInfo.framebuffer = inFlight.framebuffers[i];
 		renderPassInfo.renderArea.offset = { 0, 0 };
 		renderPassInfo.renderArea.extent = swapChainExtent;
 
-		std::array<VkClearValue, 2> clearValues = {};
+		std::array<VkClearValue, 3> clearValues = {};
 		clearValues[0].color = { 0.0f, 0.0f, 0.0f, 1.0f };
 		clearValues[1].depthStencil = { 1.0f, 0 };
+		clearValues[2].color = { 0.0f, 0.0f, 0.0f, 1.0f };
 
 		renderPassInfo.clearValueCount = (uint32_t)clearValues.size();
 		renderPassInfo.pClearValues = clearValues.data();
 
 
 		// render pass begin
-		vkCmdBeginRenderPass(cmdBuffers.display[i], &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
-
-		// draw model here (triangle list)
-		vkCmdBindPipeline(cmdBuffers.display[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipelines.graphics);
+		vkCmdBeginRenderPass(display[i], &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+		recordViewport(display[i]);
+
+		// draw model here (triangle list), every material group binds its shading
+		// variant, consecutive groups often share one
+		VkPipeline boundPipeline = VK_NULL_HANDLE;
+		auto bindShadingPipeline = [&](int groupId) {
+			VkPipeline pipeline = shadingPipeline(meshs.meshGroupScene.materials[groupId], recordedDebugMode);
+			if (pipeline != boundPipeline) {
+				vkCmdBindPipeline(display[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+				boundPipeline = pipeline;
+			}
+		};
 
 		//// binding the vertex buffer
 		//VkBuffer vertexBuffers[] = { meshs.scene.vertices.buffer };
 		//VkDeviceSize offsets[] = { 0 };
-		//vkCmdBindVertexBuffers(cmdBuffers.display[i], 0, 1, vertexBuffers, offsets);
+		//vkCmdBindVertexBuffers(display[i], 0, 1, vertexBuffers, offsets);
 
-		//vkCmdBindIndexBuffer(cmdBuffers.display[i], meshs.scene.indices.buffer, 0, VK_INDEX_TYPE_UINT32);
+		//vkCmdBindIndexBuffer(display[i], meshs.scene.indices.buffer, 0, VK_INDEX_TYPE_UINT32);
 
-		//vkCmdBindDescriptorSets(cmdBuffers.display[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &descriptorSet, 0, nullptr);
+		//vkCmdBindDescriptorSets(display[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &descriptorSet, 0, nullptr);
 
-		////vkCmdDraw(cmdBuffers.display[i], vertices.size(), 1, 0, 0);
-		//vkCmdDrawIndexed(cmdBuffers.display[i], (uint32_t)meshs.scene.indices.indicesData.size(), 1, 0, 0, 0);
+		////vkCmdDraw(display[i], vertices.size(), 1, 0, 0);
+		//vkCmdDrawIndexed(display[i], (uint32_t)meshs.scene.indices.indicesData.size(), 1, 0, 0, 0);
 
 
 		// binding the vertex buffer
 		VkBuffer vertexBuffers[] = { meshs.meshGroupScene.vertices.buffer };
 		VkDeviceSize offsets[] = { 0 };
-		vkCmdBindVertexBuffers(cmdBuffers.display[i], 0, 1, vertexBuffers, offsets);
+		vkCmdBindVertexBuffers(display[i], 0, 1, vertexBuffers, offsets);
 
-		for (int groupId = 0; groupId < meshs.meshGroupScene.indexGroups.size(); ++groupId) {
-			vkCmdBindDescriptorSets(cmdBuffers.display[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &meshs.meshGroupScene.descriptorSets[groupId], 0, nullptr);
-			vkCmdBindIndexBuffer(cmdBuffers.display[i], meshs.meshGroupScene.indexGroups[groupId].buffer, 0, VK_INDEX_TYPE_UINT32);
-			vkCmdDrawIndexed(cmdBuffers.display[i], (uint32_t)meshs.meshGroupScene.indexGroups[groupId].indicesData.size(), 1, 0, 0, 0);
+		// opaque first, same order as the depth prepass
+		for (int groupId : meshs.meshGroupScene.opaqueGroups) {
+			bindShadingPipeline(groupId);
+			vkCmdBindDescriptorSets(display[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &meshs.meshGroupScene.descriptorSets[slot][groupId], 0, nullptr);
+			recordMeshGroupDraws(display[i], meshs.meshGroupScene, slot, groupId);
+		}
+		for (int groupId : meshs.meshGroupScene.alphaTestedGroups) {
+			bindShadingPipeline(groupId);
+			vkCmdBindDescriptorSets(display[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &meshs.meshGroupScene.descriptorSets[slot][groupId], 0, nullptr);
+			recordMeshGroupDraws(display[i], meshs.meshGroupScene, slot, groupId);
 		}
 
 
@@ -969,30 +1951,363 @@ void VulkanBaseApplication::createCommandBuffers() {
 		{
 			// draw axis here (line list)
 			// bind pipeline
-			vkCmdBindPipeline(cmdBuffers.display[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipelines.axis);
+			vkCmdBindPipeline(display[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipelines.axis);
 			// binding the vertex buffer for axis
 			VkBuffer vertexBuffers_axis[] = { meshs.axis.vertices.buffer };
 			VkDeviceSize offsets_axis[] = { 0 };
-			vkCmdBindVertexBuffers(cmdBuffers.display[i], 0, 1, vertexBuffers_axis, offsets_axis);
+			vkCmdBindVertexBuffers(display[i], 0, 1, vertexBuffers_axis, offsets_axis);
 
-			vkCmdBindIndexBuffer(cmdBuffers.display[i], meshs.axis.indices.buffer, 0, VK_INDEX_TYPE_UINT32);
+			vkCmdBindIndexBuffer(display[i], meshs.axis.indices.buffer, 0, VK_INDEX_TYPE_UINT32);
 
-			vkCmdBindDescriptorSets(cmdBuffers.display[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &descriptorSet, 0, nullptr);
+			vkCmdBindDescriptorSets(display[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &inFlight.descriptorSet, 0, nullptr);
 
-			//vkCmdDraw(cmdBuffers.display[i], vertices.size(), 1, 0, 0);
-			vkCmdDrawIndexed(cmdBuffers.display[i], (uint32_t)meshs.axis.indices.indicesData.size(), 1, 0, 0, 0);
+			//vkCmdDraw(display[i], vertices.size(), 1, 0, 0);
+			vkCmdDrawIndexed(display[i], (uint32_t)meshs.axis.indices.indicesData.size(), 1, 0, 0, 0);
 		}
 
+		recordComposite(display[i], recordedDebugMode);
+
+		vkCmdEndRenderPass(display[i]);
 
-		vkCmdEndRenderPass(cmdBuffers.display[i]);
+		if (timestampPeriod > 0.0f) {
+			vkCmdWriteTimestamp(display[i], VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, timestampQueryPool, firstQuery + TIMESTAMP_SHADING_END);
+		}
 
-		if (vkEndCommandBuffer(cmdBuffers.display[i]) != VK_SUCCESS) {
+		if (vkEndCommandBuffer(display[i]) != VK_SUCCESS) {
 			throw std::runtime_error("failed to record command buffer!");
 		}
 	}
 }
 
-void VulkanBaseApplication::createFrustumCommandBuffer() {
+void VulkanBaseApplication::createFrameRecording() {
+	QueueFamilyIndices queueFamilyIndices = findQueueFamilies(physicalDevice);
+
+	// one pool per range and frame slot, command pools must not be used from
+	// two threads at once nor reset while the gpu executes their command buffers
+	VkCommandPoolCreateInfo poolInfo = {};
+	poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+	poolInfo.queueFamilyIndex = queueFamilyIndices.graphicsFamily;
+	poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+
+	VkCommandBufferAllocateInfo allocInfo = {};
+	allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+	allocInfo.commandBufferCount = 1;
+
+	frameRecording.workers.resize(jobs.numThreads());
+	for (int slot = 0; slot < MAX_FRAMES_IN_FLIGHT; ++slot) {
+		if (vkCreateCommandPool(device, &poolInfo, nullptr, &frameRecording.primaryPool[slot]) != VK_SUCCESS) {
+			throw std::runtime_error("failed to create command pool!");
+		}
+
+		allocInfo.commandPool = frameRecording.primaryPool[slot];
+		allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+		if (vkAllocateCommandBuffers(device, &allocInfo, &frameRecording.primary[slot]) != VK_SUCCESS) {
+			throw std::runtime_error("failed to allocate command buffers!");
+		}
+
+		for (auto & worker : frameRecording.workers) {
+			if (vkCreateCommandPool(device, &poolInfo, nullptr, &worker.pool[slot]) != VK_SUCCESS) {
+				throw std::runtime_error("failed to create command pool!");
+			}
+
+			allocInfo.commandPool = worker.pool[slot];
+			allocInfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+			if (vkAllocateCommandBuffers(device, &allocInfo, &worker.secondary[slot]) != VK_SUCCESS) {
+				throw std::runtime_error("failed to allocate command buffers!");
+			}
+		}
+	}
+
+	// same order as createCommandBuffers, opaque first like the depth prepass
+	frameRecording.groups = meshs.meshGroupScene.opaqueGroups;
+	frameRecording.groups.insert(frameRecording.groups.end(),
+		meshs.meshGroupScene.alphaTestedGroups.begin(), meshs.meshGroupScene.alphaTestedGroups.end());
+}
+
+void VulkanBaseApplication::recordFrameCommandBuffer(int slot, uint32_t imageIndex, int numThreads) {
+	FrameInFlight & inFlight = frames[slot];
+	auto startTime = std::chrono::high_resolution_clock::now();
+	MeshGroup & meshGroup = meshs.meshGroupScene;
+	const std::vector<int> & groups = frameRecording.groups;
+	const int recordMode = shadingDebugMode(debugMode);
+
+	if (numThreads <= 0 || numThreads > (int)frameRecording.workers.size()) {
+		numThreads = (int)frameRecording.workers.size();
+	}
+	numThreads = std::max(1, std::min(numThreads, (int)groups.size()));
+	frameRecording.numThreads = numThreads;
+
+	// contiguous group ranges with about the same number of draw items each
+	std::vector<uint32_t> drawOffsets(groups.size() + 1, 0);
+	for (size_t i = 0; i < groups.size(); ++i) {
+		drawOffsets[i + 1] = drawOffsets[i] + std::max(1u, meshGroup.drawItemRanges[groups[i]].y);
+	}
+	for (int t = 0; t < numThreads; ++t) {
+		FrameRecording::Worker & worker = frameRecording.workers[t];
+		uint32_t begin = (uint32_t)((uint64_t)drawOffsets.back() * t / numThreads);
+		uint32_t end = (uint32_t)((uint64_t)drawOffsets.back() * (t + 1) / numThreads);
+		worker.firstGroup = (int)(std::lower_bound(drawOffsets.begin(), drawOffsets.end() - 1, begin) - drawOffsets.begin());
+		worker.endGroup = (int)(std::lower_bound(drawOffsets.begin(), drawOffsets.end() - 1, end) - drawOffsets.begin());
+		if (t == numThreads - 1) {
+			worker.endGroup = (int)groups.size();
+		}
+	}
+
+	VkCommandBufferInheritanceInfo inheritanceInfo = {};
+	inheritanceInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+	inheritanceInfo.renderPass = renderPass;
+	inheritanceInfo.subpass = 0;
+	inheritanceInfo.framebuffer = inFlight.framebuffers[imageIndex];
+
+	auto recordWorker = [&](int t) {
+		auto workerStart = std::chrono::high_resolution_clock::now();
+		FrameRecording::Worker & worker = frameRecording.workers[t];
+		VkCommandBuffer commandBuffer = worker.secondary[slot];
+
+		vkResetCommandPool(device, worker.pool[slot], 0);
+
+		VkCommandBufferBeginInfo beginInfo = {};
+		beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+		beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT | VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+		beginInfo.pInheritanceInfo = &inheritanceInfo;
+
+		vkBeginCommandBuffer(commandBuffer, &beginInfo);
+
+		// secondary command buffers inherit no state from the primary
+		recordViewport(commandBuffer);
+		VkBuffer vertexBuffers[] = { meshGroup.vertices.buffer };
+		VkDeviceSize offsets[] = { 0 };
+		vkCmdBindVertexBuffers(commandBuffer, 0, 1, vertexBuffers, offsets);
+
+		VkPipeline boundPipeline = VK_NULL_HANDLE;
+		for (int i = worker.firstGroup; i < worker.endGroup; ++i) {
+			int groupId = groups[i];
+			VkPipeline pipeline = shadingPipeline(meshGroup.materials[groupId], recordMode);
+			if (pipeline != boundPipeline) {
+				vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+				boundPipeline = pipeline;
+			}
+			vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &meshGroup.descriptorSets[slot][groupId], 0, nullptr);
+			recordMeshGroupDraws(commandBuffer, meshGroup, slot, groupId);
+		}
+
+		if (bDrawAxis && t == numThreads - 1) {
+			vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelines.axis);
+			VkBuffer vertexBuffers_axis[] = { meshs.axis.vertices.buffer };
+			vkCmdBindVertexBuffers(commandBuffer, 0, 1, vertexBuffers_axis, offsets);
+			vkCmdBindIndexBuffer(commandBuffer, meshs.axis.indices.buffer, 0, VK_INDEX_TYPE_UINT32);
+			vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &inFlight.descriptorSet, 0, nullptr);
+			vkCmdDrawIndexed(commandBuffer, (uint32_t)meshs.axis.indices.indicesData.size(), 1, 0, 0, 0);
+		}
+
+		vkEndCommandBuffer(commandBuffer);
+		worker.recordMs = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - workerStart).count();
+	};
+
+	// the calling thread records the first range, the ranges are jobs so any
+	// thread may record them, each range still has its own pool
+	JobSystem::Counter recorded;
+	for (int t = 1; t < numThreads; ++t) {
+		jobs.run("record display pass", [&recordWorker, t] { recordWorker(t); }, &recorded);
+	}
+	recordWorker(0);
+	jobs.wait(recorded);
+
+	// primary: the render pass around the secondaries, in draw order, and the
+	// composite subpass inline
+	VkCommandBuffer primary = frameRecording.primary[slot];
+	vkResetCommandPool(device, frameRecording.primaryPool[slot], 0);
+
+	VkCommandBufferBeginInfo beginInfo = {};
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+	vkBeginCommandBuffer(primary, &beginInfo);
+
+	const uint32_t firstQuery = slot * NUM_FRAME_TIMESTAMPS;
+	if (timestampPeriod > 0.0f) {
+		vkCmdResetQueryPool(primary, timestampQueryPool, firstQuery + TIMESTAMP_SHADING, 2);
+		vkCmdWriteTimestamp(primary, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, timestampQueryPool, firstQuery + TIMESTAMP_SHADING);
+	}
+
+	VkRenderPassBeginInfo renderPassInfo = {};
+	renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+	renderPassInfo.renderPass = renderPass;
+	renderPassInfo.framebuffer = inFlight.framebuffers[imageIndex];
+	renderPassInfo.renderArea.offset = { 0, 0 };
+	renderPassInfo.renderArea.extent = swapChainExtent;
+
+	std::array<VkClearValue, 3> clearValues = {};
+	clearValues[0].color = { 0.0f, 0.0f, 0.0f, 1.0f };
+	clearValues[1].depthStencil = { 1.0f, 0 };
+	clearValues[2].color = { 0.0f, 0.0f, 0.0f, 1.0f };
+
+	renderPassInfo.clearValueCount = (uint32_t)clearValues.size();
+	renderPassInfo.pClearValues = clearValues.data();
+
+	vkCmdBeginRenderPass(primary, &renderPassInfo, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+
+	std::vector<VkCommandBuffer> secondaries;
+	for (int t = 0; t < numThreads; ++t) {
+		secondaries.push_back(frameRecording.workers[t].secondary[slot]);
+	}
+	vkCmdExecuteCommands(primary, (uint32_t)secondaries.size(), secondaries.data());
+
+	recordComposite(primary, recordMode);
+
+	vkCmdEndRenderPass(primary);
+
+	if (timestampPeriod > 0.0f) {
+		vkCmdWriteTimestamp(primary, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, timestampQueryPool, firstQuery + TIMESTAMP_SHADING_END);
+	}
+
+	if (vkEndCommandBuffer(primary) != VK_SUCCESS) {
+		throw std::runtime_error("failed to record command buffer!");
+	}
+
+	frameRecording.recordMs = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - startTime).count();
+}
+
+void VulkanBaseApplication::benchmarkFrameRecording() {
+	if (frameRecording.workers.empty()) {
+		return;
+	}
+
+	// records into the pools of the next slot, the frame that used it before
+	// may still execute its primary
+	vkQueueWaitIdle(graphicsQueue);
+
+	std::vector<int> threadCounts;
+	int maxThreads = std::min((int)frameRecording.workers.size(), std::max(1, (int)frameRecording.groups.size()));
+	for (int numThreads = 1; numThreads < maxThreads; numThreads *= 2) {
+		threadCounts.push_back(numThreads);
+	}
+	threadCounts.push_back(maxThreads);
+
+	uint32_t numDrawItems = 0;
+	for (int groupId : frameRecording.groups) {
+		numDrawItems += meshs.meshGroupScene.drawItemRanges[groupId].y;
+	}
+
+	std::cout << "=====================================================" << std::endl;
+	std::cout << "Display pass recording, " << frameRecording.groups.size() << " material groups, "
+		<< numDrawItems << " draw items, " << RECORDING_BENCHMARK_RUNS << " runs" << std::endl;
+	std::cout << "threads\twall ms\tslowest thread ms\tspeedup" << std::endl;
+
+	float singleThreadMs = 0.0f;
+	for (int numThreads : threadCounts) {
+		float wallMs = 0.0f;
+		float slowestMs = 0.0f;
+		for (int run = 0; run < RECORDING_BENCHMARK_RUNS; ++run) {
+			recordFrameCommandBuffer(currentFrame, 0, numThreads);
+			wallMs += frameRecording.recordMs;
+			float slowest = 0.0f;
+			for (int t = 0; t < numThreads; ++t) {
+				slowest = std::max(slowest, frameRecording.workers[t].recordMs);
+			}
+			slowestMs += slowest;
+		}
+		wallMs /= RECORDING_BENCHMARK_RUNS;
+		slowestMs /= RECORDING_BENCHMARK_RUNS;
+		if (numThreads == 1) {
+			singleThreadMs = wallMs;
+		}
+
+		std::cout << numThreads << "\t" << wallMs << "\t" << slowestMs << "\t\t\t"
+			<< (wallMs > 0.0f ? singleThreadMs / wallMs : 0.0f) << "x" << std::endl;
+	}
+	std::cout << "=====================================================" << std::endl;
+}
+
+void VulkanBaseApplication::createUploadCommandBuffer(int slot) {
+	FrameInFlight & inFlight = frames[slot];
+	QueueFamilyIndices queueFamilyIndices = findQueueFamilies(physicalDevice);
+
+	// recorded every frame, the pool is reset once the frame that used the slot before is done
+	VkCommandPoolCreateInfo poolInfo = {};
+	poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+	poolInfo.queueFamilyIndex = queueFamilyIndices.graphicsFamily;
+	poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+
+	if (vkCreateCommandPool(device, &poolInfo, nullptr, &inFlight.uploadPool) != VK_SUCCESS) {
+		throw std::runtime_error("failed to create command pool!");
+	}
+
+	VkCommandBufferAllocateInfo cmdBufInfo = {};
+	cmdBufInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+	cmdBufInfo.pNext = nullptr;
+	cmdBufInfo.commandPool = inFlight.uploadPool;
+	cmdBufInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+	cmdBufInfo.commandBufferCount = 1;
+
+	if (vkAllocateCommandBuffers(device, &cmdBufInfo, &inFlight.upload) != VK_SUCCESS) {
+		throw std::runtime_error("failed to allocate upload command buffers!");
+	}
+}
+
+void VulkanBaseApplication::recordUploadCommandBuffer(int slot) {
+	FrameInFlight & inFlight = frames[slot];
+	UniformBuffers & ubo = inFlight.ubo;
+
+	vkResetCommandPool(device, inFlight.uploadPool, 0);
+
+	VkCommandBufferBeginInfo cmdBufBeginInfo = {};
+	cmdBufBeginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	cmdBufBeginInfo.pNext = nullptr;
+	cmdBufBeginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+	cmdBufBeginInfo.pInheritanceInfo = nullptr;
+
+	vkBeginCommandBuffer(inFlight.upload, &cmdBufBeginInfo);
+
+	// staging written by updateUniformBuffer -> the uniform buffers of the slot,
+	// read by every pass of the frame on either queue
+	std::array<std::pair<VulkanBuffer *, VulkanBuffer *>, 3> copies = { {
+		{ &ubo.vsSceneStaging, &ubo.vsScene },
+		{ &ubo.csParamsStaging, &ubo.csParams },
+		{ &ubo.fsParamsStaging, &ubo.fsParams },
+	} };
+	std::vector<VkBufferMemoryBarrier> barriers;
+	for (auto & copy : copies) {
+		VkBufferCopy copyRegion = {};
+		copyRegion.size = copy.first->allocSize;
+		vkCmdCopyBuffer(inFlight.upload, copy.first->buffer, copy.second->buffer, 1, &copyRegion);
+
+		barriers.push_back(createBufferMemoryBarrier(
+			VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_UNIFORM_READ_BIT,
+			copy.second->buffer, copy.second->allocSize));
+	}
+	vkCmdPipelineBarrier(
+		inFlight.upload,
+		VK_PIPELINE_STAGE_TRANSFER_BIT,
+		VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+		0,
+		0, nullptr, (uint32_t)barriers.size(), barriers.data(), 0, nullptr
+	);
+
+	// light edits staged by uploadDirtyLights, ahead of the light update.
+	// SBO_lights is shared, see uploadDirtyLights for what else reads it
+	if (!inFlight.lightCopies.empty()) {
+		vkCmdCopyBuffer(inFlight.upload, inFlight.lightsStaging.buffer, sbo.lights.buffer,
+			(uint32_t)inFlight.lightCopies.size(), inFlight.lightCopies.data());
+
+		VkBufferMemoryBarrier lightsBarrier = createBufferMemoryBarrier(
+			VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT,
+			sbo.lights.buffer, sbo.lights.allocSize);
+		vkCmdPipelineBarrier(
+			inFlight.upload,
+			VK_PIPELINE_STAGE_TRANSFER_BIT,
+			VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+			0,
+			0, nullptr, 1, &lightsBarrier, 0, nullptr
+		);
+	}
+
+	vkEndCommandBuffer(inFlight.upload);
+}
+
+void VulkanBaseApplication::createFrustumCommandBuffer(int slot) {
+	FrameInFlight & inFlight = frames[slot];
+
 	VkCommandBufferAllocateInfo cmdBufInfo = {};
 	cmdBufInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
 	cmdBufInfo.pNext = nullptr;
@@ -1001,7 +2316,7 @@ void VulkanBaseApplication::createFrustumCommandBuffer() {
 	cmdBufInfo.commandBufferCount = 1;
 
 	if (vkAllocateCommandBuffers(device, &cmdBufInfo,
-			&cmdBuffers.frustum) != VK_SUCCESS) {
+			&inFlight.frustum) != VK_SUCCESS) {
 		throw std::runtime_error("failed to allocate compute command buffers!");
 	}
 
@@ -1011,40 +2326,43 @@ void VulkanBaseApplication::createFrustumCommandBuffer() {
 	cmdBufBeginInfo.flags = VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT;
 	cmdBufBeginInfo.pInheritanceInfo = nullptr;
 
-	vkBeginCommandBuffer(cmdBuffers.frustum, &cmdBufBeginInfo);
+	vkBeginCommandBuffer(inFlight.frustum, &cmdBufBeginInfo);
 
 	vkCmdBindPipeline(
-		cmdBuffers.frustum,
+		inFlight.frustum,
 		VK_PIPELINE_BIND_POINT_COMPUTE,
 		pipelines.computeFrustumGrid
 	);
 
 	vkCmdBindDescriptorSets(
-		cmdBuffers.frustum,
+		inFlight.frustum,
 		VK_PIPELINE_BIND_POINT_COMPUTE,
 		computePipelineLayout,
-		0, 1, &descriptorSet, 0, nullptr
+		0, 1, &inFlight.descriptorSet, 0, nullptr
 	);
 
 	vkCmdDispatch(
-		cmdBuffers.frustum,
+		inFlight.frustum,
 		fpParams.numThreadGroups.x,
 		fpParams.numThreadGroups.y, 1
 	);
 
-	vkEndCommandBuffer(cmdBuffers.frustum);
+	vkEndCommandBuffer(inFlight.frustum);
 }
 
-void VulkanBaseApplication::createComputeCommandBuffer() {
+void VulkanBaseApplication::createComputeCommandBuffer(int slot) {
+	FrameInFlight & inFlight = frames[slot];
+	const uint32_t firstQuery = slot * NUM_FRAME_TIMESTAMPS;
+
 	VkCommandBufferAllocateInfo cmdBufInfo = {};
 	cmdBufInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
 	cmdBufInfo.pNext = nullptr;
-	cmdBufInfo.commandPool = commandPool;
+	cmdBufInfo.commandPool = computeCommandPool;
 	cmdBufInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
 	cmdBufInfo.commandBufferCount = 1;
 
 	if (vkAllocateCommandBuffers(device, &cmdBufInfo,
-		&cmdBuffers.compute) != VK_SUCCESS) {
+		&inFlight.compute) != VK_SUCCESS) {
 		throw std::runtime_error("failed to allocate compute command buffers!");
 	}
 
@@ -1055,103 +2373,166 @@ void VulkanBaseApplication::createComputeCommandBuffer() {
 	cmdBufBeginInfo.flags = VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT;
 	cmdBufBeginInfo.pInheritanceInfo = nullptr;
 
-	vkBeginCommandBuffer(cmdBuffers.compute, &cmdBufBeginInfo);
-
-	std::vector<VkBufferMemoryBarrier> barriers2 = {
-		createBufferMemoryBarrier(
-			VK_ACCESS_SHADER_READ_BIT, VK_ACCESS_SHADER_WRITE_BIT,
-			sbo.lights.buffer, sbo.lights.allocSize
-		),
-		createBufferMemoryBarrier(
-			VK_ACCESS_SHADER_READ_BIT, VK_ACCESS_SHADER_WRITE_BIT,
-			sbo.lightIndex.buffer, sbo.lightIndex.allocSize
-		),
-		createBufferMemoryBarrier(
-			VK_ACCESS_SHADER_READ_BIT, VK_ACCESS_SHADER_WRITE_BIT,
-			sbo.lightGrid.buffer, sbo.lightGrid.allocSize
-		),
-	};
+	vkBeginCommandBuffer(inFlight.compute, &cmdBufBeginInfo);
 
-	std::vector<VkBufferMemoryBarrier> barriers3 = {
-		createBufferMemoryBarrier(
-			VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT,
-			sbo.lights.buffer, sbo.lights.allocSize
-		),
-		createBufferMemoryBarrier(
-			VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT,
-			sbo.lightIndex.buffer, sbo.lightIndex.allocSize
-		),
-		createBufferMemoryBarrier(
-			VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT,
-			sbo.lightGrid.buffer, sbo.lightGrid.allocSize
-		),
-	};
+	if (timestampPeriod > 0.0f) {
+		vkCmdResetQueryPool(inFlight.compute, timestampQueryPool, firstQuery + TIMESTAMP_LIGHT_UPDATE, 3);
+	}
 
-	vkCmdPipelineBarrier(
-		cmdBuffers.compute,
-		VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
-		VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
-		VK_DEPENDENCY_BY_REGION_BIT,
-		0, nullptr, barriers2.size(), barriers2.data(), 0, nullptr
+	// barriers against the other passes and the light list ownership transfers
+	// come from the frame graph, see createFrameGraph
+	vkCmdBindDescriptorSets(
+		inFlight.compute,
+		VK_PIPELINE_BIND_POINT_COMPUTE,
+		computePipelineLayout,
+		0, 1, &inFlight.descriptorSet, 0, nullptr
 	);
 
+	if (timestampPeriod > 0.0f) {
+		vkCmdWriteTimestamp(inFlight.compute, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, timestampQueryPool, firstQuery + TIMESTAMP_LIGHT_UPDATE);
+	}
+
+	// animate lights once per frame, culling and shading read the result
 	vkCmdBindPipeline(
-		cmdBuffers.compute,
+		inFlight.compute,
 		VK_PIPELINE_BIND_POINT_COMPUTE,
-		pipelines.computeLightList
+		pipelines.computeLightUpdate
 	);
 
-	vkCmdBindDescriptorSets(
-		cmdBuffers.compute,
-		VK_PIPELINE_BIND_POINT_COMPUTE,
-		computePipelineLayout,
-		0, 1, &descriptorSet, 0, nullptr
+	vkCmdDispatch(
+		inFlight.compute,
+		(fpParams.numLights + 63) / 64, 1, 1
 	);
 
-	vkCmdDispatch(
-		cmdBuffers.compute,
-		fpParams.numThreadGroups.x,
-		fpParams.numThreadGroups.y, 1
+	// cs light update -> cs light list
+	VkBufferMemoryBarrier lightInstancesBarrier = createBufferMemoryBarrier(
+		VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT,
+		inFlight.lightInstances.buffer, inFlight.lightInstances.allocSize
+	);
+	vkCmdPipelineBarrier(
+		inFlight.compute,
+		VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+		VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+		0,
+		0, nullptr, 1, &lightInstancesBarrier, 0, nullptr
 	);
 
-	// cs light list -> fs
+	if (timestampPeriod > 0.0f) {
+		vkCmdWriteTimestamp(inFlight.compute, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, timestampQueryPool, firstQuery + TIMESTAMP_CULLING);
+	}
+
+	if (LIGHT_CULL_MODE == LIGHT_CULL_COOPERATIVE) {
+		// one workgroup per tile
+		vkCmdBindPipeline(
+			inFlight.compute,
+			VK_PIPELINE_BIND_POINT_COMPUTE,
+			pipelines.computeLightListCooperative
+		);
+
+		vkCmdDispatch(
+			inFlight.compute,
+			fpParams.numThreads.x,
+			fpParams.numThreads.y, 1
+		);
+	} else {
+		vkCmdBindPipeline(
+			inFlight.compute,
+			VK_PIPELINE_BIND_POINT_COMPUTE,
+			pipelines.computeLightList
+		);
+
+		vkCmdDispatch(
+			inFlight.compute,
+			fpParams.numThreadGroups.x,
+			fpParams.numThreadGroups.y, 1
+		);
+	}
+
+	if (LIGHT_CULL_MODE == LIGHT_CULL_BINNING) {
+		// tile depths and cleared counts -> scatter
+		std::vector<VkBufferMemoryBarrier> binningBarriers = {
+			createBufferMemoryBarrier(
+				VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT,
+				inFlight.tileDepths.buffer, inFlight.tileDepths.allocSize
+			),
+			createBufferMemoryBarrier(
+				VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT,
+				inFlight.lightGrid.buffer, inFlight.lightGrid.allocSize
+			),
+		};
+		vkCmdPipelineBarrier(
+			inFlight.compute,
+			VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+			VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+			0,
+			0, nullptr, binningBarriers.size(), binningBarriers.data(), 0, nullptr
+		);
+
+		// one thread per light
+		vkCmdBindPipeline(
+			inFlight.compute,
+			VK_PIPELINE_BIND_POINT_COMPUTE,
+			pipelines.computeLightBinning
+		);
+
+		vkCmdDispatch(
+			inFlight.compute,
+			(fpParams.numLights + 63) / 64, 1, 1
+		);
+	}
+
+	if (timestampPeriod > 0.0f) {
+		vkCmdWriteTimestamp(inFlight.compute, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, timestampQueryPool, firstQuery + TIMESTAMP_CULLING_END);
+	}
+
+	// cs light list -> host, the light grid for the list stats
+	VkBufferMemoryBarrier lightGridCopyBarrier = createBufferMemoryBarrier(
+		VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_TRANSFER_READ_BIT,
+		inFlight.lightGrid.buffer, inFlight.lightGrid.allocSize
+	);
 	vkCmdPipelineBarrier(
-		cmdBuffers.compute,
+		inFlight.compute,
 		VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
-		VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
-		VK_DEPENDENCY_BY_REGION_BIT,
-		0, nullptr, barriers3.size(), barriers3.data(), 0, nullptr
+		VK_PIPELINE_STAGE_TRANSFER_BIT,
+		0,
+		0, nullptr, 1, &lightGridCopyBarrier, 0, nullptr
 	);
 
-	vkEndCommandBuffer(cmdBuffers.compute);
+	VkBufferCopy lightGridCopy = {};
+	lightGridCopy.size = sizeof(int) * fpParams.numThreads.x * fpParams.numThreads.y;
+	vkCmdCopyBuffer(inFlight.compute, inFlight.lightGrid.buffer, inFlight.lightGridReadback.buffer, 1, &lightGridCopy);
+
+	VkBufferMemoryBarrier lightGridHostBarrier = createBufferMemoryBarrier(
+		VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_HOST_READ_BIT,
+		inFlight.lightGridReadback.buffer, inFlight.lightGridReadback.allocSize
+	);
+	vkCmdPipelineBarrier(
+		inFlight.compute,
+		VK_PIPELINE_STAGE_TRANSFER_BIT,
+		VK_PIPELINE_STAGE_HOST_BIT,
+		0,
+		0, nullptr, 1, &lightGridHostBarrier, 0, nullptr
+	);
+
+	vkEndCommandBuffer(inFlight.compute);
 }
 
-void VulkanBaseApplication::createDepthCommandBuffer() {
-	if (depthPrepass.commandBuffer == VK_NULL_HANDLE) {
+void VulkanBaseApplication::createDepthCommandBuffer(int slot) {
+	FrameInFlight & inFlight = frames[slot];
+
+	if (inFlight.depthPrepass == VK_NULL_HANDLE) {
 		VkCommandBufferAllocateInfo cbAllocInfo = {};
 		cbAllocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
 		cbAllocInfo.commandPool = commandPool;
 		cbAllocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
 		cbAllocInfo.commandBufferCount = 1;
 
-		if (vkAllocateCommandBuffers(device, &cbAllocInfo, &depthPrepass.commandBuffer)
+		if (vkAllocateCommandBuffers(device, &cbAllocInfo, &inFlight.depthPrepass)
 				!= VK_SUCCESS) {
 			throw std::runtime_error("failed to allocate depth command buffer");
 		}
 	}
 
-	if (depthPrepass.semaphore == VK_NULL_HANDLE) {
-		VkSemaphoreCreateInfo semCreateInfo = {};
-		semCreateInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
-		semCreateInfo.pNext = nullptr;
-		semCreateInfo.flags = NULL;
-
-		if (vkCreateSemaphore(device, &semCreateInfo, nullptr, &depthPrepass.semaphore)
-				!= VK_SUCCESS) {
-			throw std::runtime_error("failed to allocate depth semaphore!");
-		}
-	}
-
 	VkCommandBufferBeginInfo cbBeginInfo = {};
 	cbBeginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
 	cbBeginInfo.pNext = nullptr;
@@ -1165,7 +2546,7 @@ void VulkanBaseApplication::createDepthCommandBuffer() {
 	rpBeginInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
 	rpBeginInfo.pNext = nullptr;
 	rpBeginInfo.renderPass = depthPrepass.renderPass;
-	rpBeginInfo.framebuffer = depthPrepass.frameBuffer;
+	rpBeginInfo.framebuffer = inFlight.depthFramebuffer;
 	rpBeginInfo.renderArea.offset.x = 0;
 	rpBeginInfo.renderArea.offset.y = 0;
 	rpBeginInfo.renderArea.extent.width = swapChainExtent.width;
@@ -1173,36 +2554,507 @@ void VulkanBaseApplication::createDepthCommandBuffer() {
 	rpBeginInfo.clearValueCount = static_cast<uint32_t>(clearVals.size());
 	rpBeginInfo.pClearValues = clearVals.data();
 
-	vkBeginCommandBuffer(depthPrepass.commandBuffer, &cbBeginInfo);
+	vkBeginCommandBuffer(inFlight.depthPrepass, &cbBeginInfo);
 
-	vkCmdBeginRenderPass(depthPrepass.commandBuffer, &rpBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
+	vkCmdBeginRenderPass(inFlight.depthPrepass, &rpBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
+	recordViewport(inFlight.depthPrepass);
 
-	vkCmdBindPipeline(depthPrepass.commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelines.depth);
+	vkCmdBindPipeline(inFlight.depthPrepass, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelines.depth);
 
-	vkCmdBindDescriptorSets(depthPrepass.commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &descriptorSet, 0, NULL);
+	vkCmdBindDescriptorSets(inFlight.depthPrepass, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &inFlight.descriptorSet, 0, NULL);
 
 	// binding the vertex buffer
 	VkBuffer vertexBuffers[] = { meshs.meshGroupScene.vertices.buffer };
 	VkDeviceSize offsets[] = { 0 };
-	vkCmdBindVertexBuffers(depthPrepass.commandBuffer, 0, 1, vertexBuffers, offsets);
+	vkCmdBindVertexBuffers(inFlight.depthPrepass, 0, 1, vertexBuffers, offsets);
+
+	// opaque materials, no fragment shader so early-z stays on
+	for (int groupId : meshs.meshGroupScene.opaqueGroups) {
+		recordMeshGroupDraws(inFlight.depthPrepass, meshs.meshGroupScene, slot, groupId);
+	}
+
+	// alpha-tested materials, discard with the diffuse map so cut-out
+	// texels do not write depth (tile depth bounds and EQUAL test rely on it)
+	if (!meshs.meshGroupScene.alphaTestedGroups.empty()) {
+		vkCmdBindPipeline(inFlight.depthPrepass, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelines.depthAlphaTest);
+		for (int groupId : meshs.meshGroupScene.alphaTestedGroups) {
+			vkCmdBindDescriptorSets(inFlight.depthPrepass, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &meshs.meshGroupScene.descriptorSets[slot][groupId], 0, NULL);
+			recordMeshGroupDraws(inFlight.depthPrepass, meshs.meshGroupScene, slot, groupId);
+		}
+	}
+
+	vkCmdEndRenderPass(inFlight.depthPrepass);
+
+	vkEndCommandBuffer(inFlight.depthPrepass);
+}
+
+void VulkanBaseApplication::createLodCommandBuffer(int slot) {
+	FrameInFlight & inFlight = frames[slot];
+
+	VkCommandBufferAllocateInfo cmdBufInfo = {};
+	cmdBufInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+	cmdBufInfo.pNext = nullptr;
+	cmdBufInfo.commandPool = commandPool;
+	cmdBufInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+	cmdBufInfo.commandBufferCount = 1;
+
+	if (vkAllocateCommandBuffers(device, &cmdBufInfo, &inFlight.lodSelection) != VK_SUCCESS) {
+		throw std::runtime_error("failed to allocate lod command buffer!");
+	}
+
+	VkCommandBufferBeginInfo cmdBufBeginInfo = {};
+	cmdBufBeginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	cmdBufBeginInfo.pNext = nullptr;
+	cmdBufBeginInfo.flags = VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT;
+	cmdBufBeginInfo.pInheritanceInfo = nullptr;
+
+	vkBeginCommandBuffer(inFlight.lodSelection, &cmdBufBeginInfo);
+
+	// writes the indirect draws of the slot, the frame graph orders the draws after it
+	vkCmdBindPipeline(inFlight.lodSelection, VK_PIPELINE_BIND_POINT_COMPUTE, pipelines.computeLod);
+	vkCmdBindDescriptorSets(inFlight.lodSelection, VK_PIPELINE_BIND_POINT_COMPUTE, computePipelineLayout, 0, 1, &inFlight.descriptorSet, 0, nullptr);
+	vkCmdDispatch(inFlight.lodSelection, ((uint32_t)meshs.meshGroupScene.drawItems.size() + 63) / 64, 1, 1);
+
+	vkEndCommandBuffer(inFlight.lodSelection);
+}
+
+void VulkanBaseApplication::createFrameGraph() {
+	RenderGraph & graph = frameGraph.graph;
+	frameGraph.clearCompiled(device);
+	renderTargets.cleanupTransient(device);
+	graph.clear();
+
+	// lightIndex and lightGrid are the only buffers exclusive to a queue family,
+	// everything else is shared by both queues. The per frame ones are declared
+	// with slot 0 and bound to the slot by compiledFrameGraph
+	int frustums = graph.addBuffer("frustums", sbo.frustums.buffer);
+	int lightInstances = graph.addBuffer("lightInstances", frames[0].lightInstances.buffer);
+	int lightIndex = graph.addBuffer("lightIndex", frames[0].lightIndex.buffer, true);
+	int lightGrid = graph.addBuffer("lightGrid", frames[0].lightGrid.buffer, true);
+	int indirectDraws = graph.addBuffer("indirectDraws", meshs.meshGroupScene.indirectBuffers[0].buffer);
+	int depth = graph.addImage("prepassDepth", frames[0].depth.image, VK_IMAGE_ASPECT_DEPTH_BIT,
+		VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL);
+	frameGraph.lightInstances = lightInstances;
+	frameGraph.lightIndex = lightIndex;
+	frameGraph.lightGrid = lightGrid;
+	frameGraph.indirectDraws = indirectDraws;
+	frameGraph.prepassDepth = depth;
+	int swapChainImage = graph.addSwapchainImage("swapChainImage");
+
+	// written by the scene subpass and read by the composite one, never leaves the render pass
+	RenderTargetInfo sceneColorInfo;
+	sceneColorInfo.name = "sceneColor";
+	sceneColorInfo.format = SCENE_COLOR_FORMAT;
+	sceneColorInfo.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT;
+	sceneColorInfo.aspect = VK_IMAGE_ASPECT_COLOR_BIT;
+	frameGraph.sceneColor = renderTargets.addTransient(sceneColorInfo, graph);
+	int sceneColor = renderTargets.transient(frameGraph.sceneColor).resource;
+
+	const VkPipelineStageFlags depthTests = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+
+	// tile frustums, at startup and after the kernels are reloaded
+	frameGraph.frustumPass = graph.addPass("frustum", RENDER_QUEUE_GRAPHICS, {
+		{ frustums, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT },
+	});
+
+	// gpu lod selection, with every depth pass while bGpuLodSelection is on.
+	// Otherwise the host wrote the indirect draws of the slot
+	frameGraph.lodPass = graph.addPass("lod", RENDER_QUEUE_GRAPHICS, {
+		{ indirectDraws, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT },
+	});
+
+	// the depth render pass starts from UNDEFINED
+	frameGraph.depthPass = graph.addPass("depth", RENDER_QUEUE_GRAPHICS, {
+		{ depth, depthTests, VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+			VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL },
+		{ indirectDraws, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT, VK_ACCESS_INDIRECT_COMMAND_READ_BIT },
+	});
+
+	// light update and culling, the light grid is also copied for the list stats.
+	// Tiles that keep their list read the last one
+	frameGraph.cullPass = graph.addPass("cull", RENDER_QUEUE_COMPUTE, {
+		{ frustums, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT },
+		{ depth, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT, VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL },
+		{ lightInstances, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT },
+		{ lightIndex, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT },
+		{ lightGrid, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT },
+	});
+
+	// lights are only read in the fragment stage, the vertex work overlaps culling.
+	// The render pass starts sceneColor from UNDEFINED and ends it as an input attachment
+	frameGraph.shadePass = graph.addPass("shade", RENDER_QUEUE_GRAPHICS, {
+		{ depth, depthTests | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+			VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_SHADER_READ_BIT, VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL },
+		{ lightInstances, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT },
+		{ lightIndex, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT },
+		{ lightGrid, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT },
+		{ indirectDraws, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT, VK_ACCESS_INDIRECT_COMMAND_READ_BIT },
+		{ sceneColor, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+			VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_INPUT_ATTACHMENT_READ_BIT,
+			VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL },
+		{ swapChainImage, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT },
+	});
+
+	frameGraph.presentPass = graph.addPass("present", RENDER_QUEUE_GRAPHICS, {
+		{ swapChainImage, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0 },
+	}, true);
+
+	// intermediate targets declared with renderTargets.addTransient get their
+	// images here, sharing memory where their passes don't overlap
+	renderTargets.allocateTransient(device, graph, swapChainExtent);
+	updateCompositeDescriptorSet();
+
+	// a graph that cannot be scheduled throws here instead of in the first frame
+	uint32_t cachedFrame = (1u << frameGraph.shadePass) | (1u << frameGraph.presentPass);
+	uint32_t culledFrame = cachedFrame | (1u << frameGraph.depthPass) | (1u << frameGraph.cullPass);
+	for (int slot = 0; slot < MAX_FRAMES_IN_FLIGHT; ++slot) {
+		compiledFrameGraph(slot, culledFrame | (1u << frameGraph.frustumPass));
+		compiledFrameGraph(slot, culledFrame);
+		compiledFrameGraph(slot, culledFrame | (1u << frameGraph.lodPass));
+		compiledFrameGraph(slot, cachedFrame);
+	}
+}
+
+VulkanBaseApplication::FrameGraph::Compiled & VulkanBaseApplication::compiledFrameGraph(int slot, uint32_t enabledPasses) {
+	std::map<uint32_t, FrameGraph::Compiled> & compiled = frameGraph.compiled[slot];
+	auto found = compiled.find(enabledPasses);
+	if (found != compiled.end()) {
+		return found->second;
+	}
+
+	// the barriers point at the buffers and the depth of the slot
+	FrameInFlight & inFlight = frames[slot];
+	RenderGraph & graph = frameGraph.graph;
+	graph.bindBuffer(frameGraph.lightInstances, inFlight.lightInstances.buffer);
+	graph.bindBuffer(frameGraph.lightIndex, inFlight.lightIndex.buffer);
+	graph.bindBuffer(frameGraph.lightGrid, inFlight.lightGrid.buffer);
+	graph.bindBuffer(frameGraph.indirectDraws, meshs.meshGroupScene.indirectBuffers[slot].buffer);
+	graph.bindImage(frameGraph.prepassDepth, inFlight.depth.image);
+
+	FrameGraph::Compiled & frame = compiled[enabledPasses];
+	frame.schedule = graph.compile(enabledPasses, graphicsQueueFamily, computeQueueFamily);
+
+	size_t numSubmits = frame.schedule.submits.size();
+	frame.pools.resize(numSubmits);
+	frame.before.resize(numSubmits);
+	frame.release.resize(numSubmits);
+	frame.waitSemaphores.resize(numSubmits);
+	frame.signalSemaphores.resize(numSubmits);
+	frame.signalTimeline.resize(numSubmits, false);
+
+	VkSemaphoreCreateInfo semaphoreInfo = {};
+	semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+
+	for (size_t s = 0; s < numSubmits; ++s) {
+		const RenderSubmit & submit = frame.schedule.submits[s];
+		frame.pools[s] = submit.queue == RENDER_QUEUE_COMPUTE ? computeCommandPool : commandPool;
+		for (const ScheduledPass & scheduled : submit.passes) {
+			frame.before[s].push_back(recordRenderBarriers(scheduled.before, frame.pools[s]));
+		}
+		frame.release[s] = recordRenderBarriers(submit.release, frame.pools[s]);
+
+		// the present only waits on binary semaphores
+		for (const SubmitWait & wait : submit.waits) {
+			VkSemaphore semaphore;
+			if (submit.present) {
+				semaphore = inFlight.renderFinished;
+				frame.signalSemaphores[wait.submit].push_back(semaphore);
+			} else if (frameGraph.timelineSemaphores) {
+				semaphore = frameGraph.timelines[frame.schedule.submits[wait.submit].queue];
+				frame.signalTimeline[wait.submit] = true;
+			} else {
+				if (vkCreateSemaphore(device, &semaphoreInfo, nullptr, &semaphore) != VK_SUCCESS) {
+					throw std::runtime_error("failed to create semaphores!");
+				}
+				frame.semaphores.push_back(semaphore);
+				frame.signalSemaphores[wait.submit].push_back(semaphore);
+			}
+			frame.waitSemaphores[s].push_back(semaphore);
+		}
+	}
+
+	return frame;
+}
+
+VkCommandBuffer VulkanBaseApplication::recordRenderBarriers(const RenderBarriers & barriers, VkCommandPool pool) {
+	if (barriers.empty()) {
+		return VK_NULL_HANDLE;
+	}
+
+	VkCommandBufferAllocateInfo allocInfo = {};
+	allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+	allocInfo.commandPool = pool;
+	allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+	allocInfo.commandBufferCount = 1;
+
+	VkCommandBuffer commandBuffer;
+	if (vkAllocateCommandBuffers(device, &allocInfo, &commandBuffer) != VK_SUCCESS) {
+		throw std::runtime_error("failed to allocate command buffers!");
+	}
+
+	VkCommandBufferBeginInfo beginInfo = {};
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT;
+
+	vkBeginCommandBuffer(commandBuffer, &beginInfo);
+	vkCmdPipelineBarrier(commandBuffer,
+		barriers.srcStages, barriers.dstStages, 0,
+		0, nullptr,
+		(uint32_t)barriers.buffers.size(), barriers.buffers.data(),
+		(uint32_t)barriers.images.size(), barriers.images.data());
+
+	if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS) {
+		throw std::runtime_error("failed to record command buffer!");
+	}
+	return commandBuffer;
+}
+
+VkResult VulkanBaseApplication::submitFrameGraph(int slot, bool shading, uint32_t imageIndex, VkCommandBuffer displayCommandBuffer) {
+	FrameInFlight & inFlight = frames[slot];
+	if (!shading) {
+		// nothing the light lists depend on changed, the prepass depth and the
+		// lists the slot culled last are still in place
+		uint32_t enabledPasses = (1u << frameGraph.shadePass) | (1u << frameGraph.presentPass);
+		if (frameGraph.frustumsDirty) {
+			enabledPasses |= 1u << frameGraph.frustumPass;
+		}
+		if (!cullingCache.skipCulling || frameGraph.frustumsDirty) {
+			enabledPasses |= (1u << frameGraph.depthPass) | (1u << frameGraph.cullPass);
+			if (bGpuLodSelection) {
+				enabledPasses |= 1u << frameGraph.lodPass;
+			}
+		}
+		frameGraph.frustumsDirty = false;
+		frameGraph.enabledPasses = enabledPasses;
+		inFlight.enabledPasses = enabledPasses;
+	}
+
+	FrameGraph::Compiled & frame = compiledFrameGraph(slot, inFlight.enabledPasses);
+	const std::vector<RenderSubmit> & submits = frame.schedule.submits;
+	std::vector<uint64_t> & signalValues = inFlight.signalValues;
+	VkResult presentResult = VK_SUCCESS;
+
+	if (!shading) {
+		signalValues.assign(submits.size(), 0);
+
+		// the staged uniforms and light edits of the slot, ahead of every pass
+		// that reads them. The culling on the compute queue waits for the depth
+		// pass, submitted after this on the same queue
+		recordUploadCommandBuffer(slot);
+		VkSubmitInfo submitInfo = {};
+		submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+		submitInfo.commandBufferCount = 1;
+		submitInfo.pCommandBuffers = &inFlight.upload;
+		if (vkQueueSubmit(graphicsQueue, 1, &submitInfo, VK_NULL_HANDLE) != VK_SUCCESS) {
+			throw std::runtime_error("failed to submit upload command buffer!");
+		}
+	}
+
+	for (size_t s = 0; s < submits.size(); ++s) {
+		const RenderSubmit & submit = submits[s];
+
+		// the passes before the shade pass cull the frame, the shade pass and the
+		// ones after it shade it one drawFrame later. A submit holding both is
+		// split and its waits, signals and release go with the shading. Only a
+		// schedule without the compute queue merges them, and nothing waits there
+		size_t firstShading = 0;
+		while (firstShading < submit.passes.size() && submit.passes[firstShading].pass < frameGraph.shadePass) {
+			firstShading++;
+		}
+		bool shadingSubmit = submit.present || firstShading < submit.passes.size();
+		if (shading ? !shadingSubmit : (submit.present || firstShading == 0)) {
+			continue;
+		}
+		bool ownsSync = shading || !shadingSubmit;
+
+		if (submit.present) {
+			VkPresentInfoKHR presentInfo = {};
+			VkSwapchainKHR swapChains[] = { swapChain };
+			presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
+			presentInfo.waitSemaphoreCount = (uint32_t)frame.waitSemaphores[s].size();
+			presentInfo.pWaitSemaphores = frame.waitSemaphores[s].data();
+			presentInfo.swapchainCount = 1;
+			presentInfo.pSwapchains = swapChains;
+			presentInfo.pImageIndices = &imageIndex;
+
+			presentResult = vkQueuePresentKHR(presentQueue, &presentInfo);
+			continue;
+		}
+
+		std::vector<VkCommandBuffer> commandBuffers;
+		bool shadePass = false;
+		for (size_t i = shading ? firstShading : 0; i < (shading ? submit.passes.size() : firstShading); ++i) {
+			if (frame.before[s][i] != VK_NULL_HANDLE) {
+				commandBuffers.push_back(frame.before[s][i]);
+			}
+
+			int pass = submit.passes[i].pass;
+			if (pass == frameGraph.frustumPass) {
+				commandBuffers.push_back(inFlight.frustum);
+			} else if (pass == frameGraph.lodPass) {
+				commandBuffers.push_back(inFlight.lodSelection);
+			} else if (pass == frameGraph.depthPass) {
+				commandBuffers.push_back(inFlight.depthPrepass);
+			} else if (pass == frameGraph.cullPass) {
+				commandBuffers.push_back(inFlight.compute);
+			} else if (pass == frameGraph.shadePass) {
+				commandBuffers.push_back(displayCommandBuffer);
+				shadePass = true;
+			}
+		}
+		if (ownsSync && frame.release[s] != VK_NULL_HANDLE) {
+			commandBuffers.push_back(frame.release[s]);
+		}
+
+		std::vector<VkSemaphore> waitSemaphores;
+		std::vector<VkPipelineStageFlags> waitStages;
+		std::vector<uint64_t> waitValues; // ignored for binary semaphores
+		std::vector<VkSemaphore> signalSemaphores;
+		std::vector<uint64_t> signalValueList;
+		if (ownsSync) {
+			if (submit.swapchainWait) {
+				waitSemaphores.push_back(inFlight.imageAvailable);
+				waitStages.push_back(submit.swapchainWait);
+				waitValues.push_back(0);
+			}
+			for (size_t w = 0; w < submit.waits.size(); ++w) {
+				waitSemaphores.push_back(frame.waitSemaphores[s][w]);
+				waitStages.push_back(submit.waits[w].stages);
+				waitValues.push_back(signalValues[submit.waits[w].submit]);
+			}
+
+			signalSemaphores = frame.signalSemaphores[s];
+			signalValueList.resize(signalSemaphores.size(), 0);
+			if (frame.signalTimeline[s]) {
+				signalValues[s] = ++frameGraph.timelineValues[submit.queue];
+				signalSemaphores.push_back(frameGraph.timelines[submit.queue]);
+				signalValueList.push_back(signalValues[s]);
+			}
+		}
+
+		VkSubmitInfo submitInfo = {};
+		submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+		submitInfo.waitSemaphoreCount = (uint32_t)waitSemaphores.size();
+		submitInfo.pWaitSemaphores = waitSemaphores.data();
+		submitInfo.pWaitDstStageMask = waitStages.data();
+		submitInfo.commandBufferCount = (uint32_t)commandBuffers.size();
+		submitInfo.pCommandBuffers = commandBuffers.data();
+		submitInfo.signalSemaphoreCount = (uint32_t)signalSemaphores.size();
+		submitInfo.pSignalSemaphores = signalSemaphores.data();
+
+#ifdef VK_KHR_timeline_semaphore
+		VkTimelineSemaphoreSubmitInfoKHR timelineInfo = {};
+		timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO_KHR;
+		timelineInfo.waitSemaphoreValueCount = (uint32_t)waitValues.size();
+		timelineInfo.pWaitSemaphoreValues = waitValues.data();
+		timelineInfo.signalSemaphoreValueCount = (uint32_t)signalValueList.size();
+		timelineInfo.pSignalSemaphoreValues = signalValueList.data();
+		if (frameGraph.timelineSemaphores) {
+			submitInfo.pNext = &timelineInfo;
+		}
+#endif
+
+		// the culling of the frame finished before its shading started, so the
+		// fence of the shading submit covers the whole slot
+		VkFence fence = VK_NULL_HANDLE;
+		if (shadePass) {
+			fence = inFlight.fence;
+			vkResetFences(device, 1, &fence);
+		}
+
+		VkQueue queue = submit.queue == RENDER_QUEUE_COMPUTE ? computeQueue : graphicsQueue;
+		if (vkQueueSubmit(queue, 1, &submitInfo, fence) != VK_SUCCESS) {
+			throw std::runtime_error("failed to submit draw command buffer!");
+		}
+	}
+
+	return presentResult;
+}
+
+void VulkanBaseApplication::printFrameGraph() {
+	uint32_t cachedFrame = (1u << frameGraph.shadePass) | (1u << frameGraph.presentPass);
+	uint32_t culledFrame = cachedFrame | (1u << frameGraph.depthPass) | (1u << frameGraph.cullPass);
+	if (bGpuLodSelection) {
+		culledFrame |= 1u << frameGraph.lodPass;
+	}
+
+	std::cout
+		<< "=================================================================================\n"
+		<< "Frame graph (" << (asyncCompute ? "compute queue" : "graphics queue only") << ", "
+		<< (frameGraph.timelineSemaphores ? "timeline" : "binary") << " semaphores)\n"
+		<< "culled frame:\n";
+	frameGraph.graph.dump(compiledFrameGraph(currentFrame, culledFrame).schedule, std::cout);
+	std::cout << "cached frame:\n";
+	frameGraph.graph.dump(compiledFrameGraph(currentFrame, cachedFrame).schedule, std::cout);
+	std::cout
+		<< "=================================================================================\n";
+}
 
-	for (int groupId = 0; groupId < meshs.meshGroupScene.indexGroups.size(); ++groupId) {
-		vkCmdBindIndexBuffer(depthPrepass.commandBuffer, meshs.meshGroupScene.indexGroups[groupId].buffer, 0, VK_INDEX_TYPE_UINT32);
-		vkCmdDrawIndexed(depthPrepass.commandBuffer, (uint32_t)meshs.meshGroupScene.indexGroups[groupId].indicesData.size(), 1, 0, 0, 0);
+void VulkanBaseApplication::printRenderTargets() {
+	std::cout
+		<< "=================================================================================\n"
+		<< "Render targets (" << swapChainExtent.width << "x" << swapChainExtent.height << ", last frame ran";
+	for (int p = 0; p < frameGraph.graph.numPasses(); ++p) {
+		if (frameGraph.enabledPasses & (1u << p)) {
+			std::cout << " " << frameGraph.graph.pass(p).name;
+		}
 	}
+	std::cout << ")\n";
+	renderTargets.report(device, frameGraph.graph, frameGraph.enabledPasses, std::cout);
+	std::cout
+		<< "=================================================================================\n";
+}
+
+void VulkanBaseApplication::recordViewport(VkCommandBuffer commandBuffer) {
+	VkViewport viewport = {};
+	viewport.x = 0.0f;
+	viewport.y = 0.0f;
+	viewport.width = (float)swapChainExtent.width;
+	viewport.height = (float)swapChainExtent.height;
+	viewport.minDepth = 0.0f;
+	viewport.maxDepth = 1.0f;
+	vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+
+	VkRect2D scissor = {};
+	scissor.offset = { 0, 0 };
+	scissor.extent = swapChainExtent;
+	vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+}
+
+void VulkanBaseApplication::recordComposite(VkCommandBuffer commandBuffer, int mode) {
+	vkCmdNextSubpass(commandBuffer, VK_SUBPASS_CONTENTS_INLINE);
+	recordViewport(commandBuffer);
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, mode == 0 ? pipelines.composite : pipelines.compositeDebug);
+	vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, compositePipelineLayout, 0, 1, &compositeDescriptorSet, 0, nullptr);
+	vkCmdDraw(commandBuffer, 3, 1, 0, 0);
+}
 
-	vkCmdEndRenderPass(depthPrepass.commandBuffer);
+void VulkanBaseApplication::recordMeshGroupDraws(VkCommandBuffer commandBuffer, MeshGroup & meshGroup, int slot, int groupId) {
+	const glm::uvec2 & range = meshGroup.drawItemRanges[groupId];
+	if (range.y == 0) {
+		return;
+	}
 
-	vkEndCommandBuffer(depthPrepass.commandBuffer);
+	// one indirect command per draw item, written by updateLodSelection or selectLod.comp
+	const uint32_t stride = sizeof(VkDrawIndexedIndirectCommand);
+	vkCmdBindIndexBuffer(commandBuffer, meshGroup.indexGroups[groupId].buffer, 0, VK_INDEX_TYPE_UINT32);
+	if (multiDrawIndirectSupported) {
+		vkCmdDrawIndexedIndirect(commandBuffer, meshGroup.indirectBuffers[slot].buffer, range.x * stride, range.y, stride);
+	}
+	else {
+		for (uint32_t i = 0; i < range.y; ++i) {
+			vkCmdDrawIndexedIndirect(commandBuffer, meshGroup.indirectBuffers[slot].buffer, (range.x + i) * stride, 1, stride);
+		}
+	}
 }
 
 void VulkanBaseApplication::createRenderPass() {
 
-	// color attachment
+	// color attachment, the swap chain image, fully written by the composite subpass
 	VkAttachmentDescription colorAttachment = {};
 	colorAttachment.format = swapChainImageFormat;
 	colorAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
-	colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+	colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
 	colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
 	colorAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
 	colorAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
@@ -1213,53 +3065,109 @@ void VulkanBaseApplication::createRenderPass() {
 	colorAttachmentRef.attachment = 0;
 	colorAttachmentRef.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
 
-	// depth attachment
+	// depth attachment, the depth prepass result is loaded and only tested
+	// (EQUAL, no writes), so every pixel is shaded exactly once
 	VkAttachmentDescription depthAttachment = {};
-	depthAttachment.format = findDepthFormat();
+	depthAttachment.format = VK_FORMAT_D32_SFLOAT;
 	depthAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
-	depthAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+	depthAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
 	depthAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
 	depthAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
 	depthAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-	depthAttachment.initialLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
-	depthAttachment.finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+	depthAttachment.initialLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
+	depthAttachment.finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
 
 	VkAttachmentReference depthAttachmentRef = {};
 	depthAttachmentRef.attachment = 1;
-	depthAttachmentRef.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
-
-	// subpass
-	VkSubpassDescription subPass = {};
-	subPass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
-	subPass.colorAttachmentCount = 1;
-	subPass.pColorAttachments = &colorAttachmentRef;
-	subPass.pDepthStencilAttachment = &depthAttachmentRef;
+	depthAttachmentRef.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
+
+	// scene color attachment, transient: cleared, read by the composite subpass
+	// and never stored, so a tiled gpu keeps it in tile memory
+	VkAttachmentDescription sceneColorAttachment = {};
+	sceneColorAttachment.format = SCENE_COLOR_FORMAT;
+	sceneColorAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
+	sceneColorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+	sceneColorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+	sceneColorAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+	sceneColorAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+	sceneColorAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	sceneColorAttachment.finalLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+	VkAttachmentReference sceneColorAttachmentRef = {};
+	sceneColorAttachmentRef.attachment = 2;
+	sceneColorAttachmentRef.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+
+	VkAttachmentReference sceneColorInputRef = {};
+	sceneColorInputRef.attachment = 2;
+	sceneColorInputRef.layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+	// subpasses: the scene into sceneColor, then the composite into the swap chain
+	std::array<VkSubpassDescription, 2> subPasses = {};
+	subPasses[0].pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+	subPasses[0].colorAttachmentCount = 1;
+	subPasses[0].pColorAttachments = &sceneColorAttachmentRef;
+	subPasses[0].pDepthStencilAttachment = &depthAttachmentRef;
+
+	subPasses[1].pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+	subPasses[1].inputAttachmentCount = 1;
+	subPasses[1].pInputAttachments = &sceneColorInputRef;
+	subPasses[1].colorAttachmentCount = 1;
+	subPasses[1].pColorAttachments = &colorAttachmentRef;
 
 	// dependency
-	VkSubpassDependency dependency = {};
-	dependency.srcSubpass = VK_SUBPASS_EXTERNAL;
-	dependency.dstSubpass = 0;
-	dependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-	dependency.srcAccessMask = 0;
-	dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-	dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+	std::array<VkSubpassDependency, 4> dependencies = {};
+
+	// sceneColor, the composite of the last frame read it before it is cleared
+	dependencies[0].srcSubpass = VK_SUBPASS_EXTERNAL;
+	dependencies[0].dstSubpass = 0;
+	dependencies[0].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+	dependencies[0].srcAccessMask = 0;
+	dependencies[0].dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+	dependencies[0].dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+
+	// prepass depth writes -> depth test
+	dependencies[1].srcSubpass = VK_SUBPASS_EXTERNAL;
+	dependencies[1].dstSubpass = 0;
+	dependencies[1].srcStageMask = VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+	dependencies[1].srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+	dependencies[1].dstStageMask = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
+	dependencies[1].dstAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT;
+	dependencies[1].dependencyFlags = VK_DEPENDENCY_BY_REGION_BIT;
+
+	// scene color writes -> composite input reads, pixel local
+	dependencies[2].srcSubpass = 0;
+	dependencies[2].dstSubpass = 1;
+	dependencies[2].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+	dependencies[2].srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+	dependencies[2].dstStageMask = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+	dependencies[2].dstAccessMask = VK_ACCESS_INPUT_ATTACHMENT_READ_BIT;
+	dependencies[2].dependencyFlags = VK_DEPENDENCY_BY_REGION_BIT;
+
+	// swap chain image, available once the acquire semaphore is signaled
+	dependencies[3].srcSubpass = VK_SUBPASS_EXTERNAL;
+	dependencies[3].dstSubpass = 1;
+	dependencies[3].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+	dependencies[3].srcAccessMask = 0;
+	dependencies[3].dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+	dependencies[3].dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
 
 	// render pass info
-	std::array<VkAttachmentDescription, 2> attachments = { colorAttachment, depthAttachment };
+	std::array<VkAttachmentDescription, 3> attachments = { colorAttachment, depthAttachment, sceneColorAttachment };
 	VkRenderPassCreateInfo renderPassInfo = {};
 	renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
 	renderPassInfo.attachmentCount = (uint32_t)attachments.size();
 	renderPassInfo.pAttachments = attachments.data();
-	renderPassInfo.subpassCount = 1;
-	renderPassInfo.pSubpasses = &subPass;
-	renderPassInfo.dependencyCount = 1;
-	renderPassInfo.pDependencies = &dependency;
+	renderPassInfo.subpassCount = (uint32_t)subPasses.size();
+	renderPassInfo.pSubpasses = subPasses.data();
+	renderPassInfo.dependencyCount = (uint32_t)dependencies.size();
+	renderPassInfo.pDependencies = dependencies.data();
 
 	if (vkCreateRenderPass(device, &renderPassInfo, nullptr, renderPass.replace()) != VK_SUCCESS) {
 		throw std::runtime_error("failed to create render pass!");
 	}
 }
 
+
 void VulkanBaseApplication::createDepthRenderPass() {
 	VkAttachmentDescription attachmentDescription{};
 	attachmentDescription.format = VK_FORMAT_D32_SFLOAT;
@@ -1269,7 +3177,7 @@ void VulkanBaseApplication::createDepthRenderPass() {
 	attachmentDescription.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
 	attachmentDescription.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
 	attachmentDescription.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-	attachmentDescription.finalLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	attachmentDescription.finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL; // sampled by light culling and depth tested by the main pass
 
 	VkAttachmentReference depthReference = {};
 	depthReference.attachment = 0;
@@ -1315,68 +3223,58 @@ void VulkanBaseApplication::createDepthRenderPass() {
 }
 
 void VulkanBaseApplication::createDepthFramebuffer() {
-	VkImageCreateInfo imageCreateInfo = {};
-	imageCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
-	imageCreateInfo.pNext = nullptr;
-	imageCreateInfo.flags = NULL;
-	imageCreateInfo.imageType = VK_IMAGE_TYPE_2D;
-	imageCreateInfo.format = VK_FORMAT_D32_SFLOAT;
-	imageCreateInfo.extent.width = swapChainExtent.width;
-	imageCreateInfo.extent.height = swapChainExtent.height;
-	imageCreateInfo.extent.depth = 1;
-	imageCreateInfo.mipLevels = 1;
-	imageCreateInfo.arrayLayers = 1;
-	imageCreateInfo.samples = VK_SAMPLE_COUNT_1_BIT;
-	imageCreateInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
-	imageCreateInfo.usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
-	imageCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-	imageCreateInfo.queueFamilyIndexCount = NULL;
-	imageCreateInfo.pQueueFamilyIndices = nullptr;
-	imageCreateInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-
-	if (vkCreateImage(device, &imageCreateInfo, nullptr, &depthPrepass.depth.image)
-			!= VK_SUCCESS) {
-		throw std::runtime_error("failed to create depth framebuffer image!");
+	// sampled by culling and the depth debug view and kept for frames that skip
+	// the prepass, so it cannot be transient
+	RenderTargetInfo depthInfo;
+	depthInfo.format = VK_FORMAT_D32_SFLOAT;
+	depthInfo.usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+	depthInfo.aspect = VK_IMAGE_ASPECT_DEPTH_BIT;
+
+	// written by the graphics queue, read by culling on the compute queue
+	if (asyncCompute) {
+		depthInfo.queueFamilies = { graphicsQueueFamily, computeQueueFamily };
 	}
 
-	VkMemoryRequirements memReqs;
-
-	vkGetImageMemoryRequirements(device, depthPrepass.depth.image, &memReqs);
+	if (depthPrepass.depthSampler == VK_NULL_HANDLE) {
+		createDepthSampler();
+	}
 
-	VkMemoryAllocateInfo memAllocInfo = {};
-	memAllocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-	memAllocInfo.pNext = nullptr;
-	memAllocInfo.allocationSize = memReqs.size;
-	memAllocInfo.memoryTypeIndex = findMemoryType(memReqs.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+	// one per frame slot, culling reads the depth of its own frame while the
+	// frame before is shaded with its own. After a resize only the images and
+	// the framebuffers are new
+	for (int slot = 0; slot < MAX_FRAMES_IN_FLIGHT; ++slot) {
+		FrameInFlight & inFlight = frames[slot];
+		if (inFlight.depthTarget < 0) {
+			depthInfo.name = "prepassDepth" + std::to_string(slot);
+			inFlight.depthTarget = renderTargets.createPersistent(device, depthInfo, swapChainExtent);
+		} else {
+			renderTargets.resizePersistent(device, inFlight.depthTarget, swapChainExtent);
+		}
+		inFlight.depth = renderTargets.target(inFlight.depthTarget);
 
-	if (vkAllocateMemory(device, &memAllocInfo, nullptr, &depthPrepass.depth.mem)
-			!= VK_SUCCESS) {
-		throw std::runtime_error("failed to allocate depth framebuffer image memory!");
-	}
+		if (inFlight.depthFramebuffer != VK_NULL_HANDLE) {
+			vkDestroyFramebuffer(device, inFlight.depthFramebuffer, nullptr);
+		}
 
-	if (vkBindImageMemory(device, depthPrepass.depth.image, depthPrepass.depth.mem, 0)
-			!= VK_SUCCESS) {
-		throw std::runtime_error("failed to bind depth framebuffer image memory!");
-	}
-
-	VkImageViewCreateInfo imageViewCreateInfo = {};
-	imageViewCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
-	imageViewCreateInfo.pNext = nullptr;
-	imageViewCreateInfo.flags = NULL;
-	imageViewCreateInfo.image = depthPrepass.depth.image;
-	imageViewCreateInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
-	imageViewCreateInfo.format = VK_FORMAT_D32_SFLOAT;
-	imageViewCreateInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
-	imageViewCreateInfo.subresourceRange.baseMipLevel = 0;
-	imageViewCreateInfo.subresourceRange.levelCount = 1;
-	imageViewCreateInfo.subresourceRange.baseArrayLayer = 0;
-	imageViewCreateInfo.subresourceRange.layerCount = 1;
-
-	if (vkCreateImageView(device, &imageViewCreateInfo, nullptr, &depthPrepass.depth.view)
-			!= VK_SUCCESS) {
-		throw std::runtime_error("failed to bind depth framebuffer imageview!");
+		VkFramebufferCreateInfo fbCreateInfo = {};
+		fbCreateInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+		fbCreateInfo.pNext = nullptr;
+		fbCreateInfo.flags = NULL;
+		fbCreateInfo.renderPass = depthPrepass.renderPass;
+		fbCreateInfo.attachmentCount = 1;
+		fbCreateInfo.pAttachments = &inFlight.depth.view;
+		fbCreateInfo.width = swapChainExtent.width;
+		fbCreateInfo.height = swapChainExtent.height;
+		fbCreateInfo.layers = 1;
+
+		if (vkCreateFramebuffer(device, &fbCreateInfo, nullptr, &inFlight.depthFramebuffer)
+				!= VK_SUCCESS) {
+			throw std::runtime_error("failed to bind depth framebuffer!");
+		}
 	}
+}
 
+void VulkanBaseApplication::createDepthSampler() {
 	VkSamplerCreateInfo samplerCreateInfo = {};
 	samplerCreateInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
 	samplerCreateInfo.pNext = nullptr;
@@ -1400,22 +3298,6 @@ void VulkanBaseApplication::createDepthFramebuffer() {
 			!= VK_SUCCESS) {
 		throw std::runtime_error("failed to bind depth sampler!");
 	}
-
-	VkFramebufferCreateInfo fbCreateInfo = {};
-	fbCreateInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
-	fbCreateInfo.pNext = nullptr;
-	fbCreateInfo.flags = NULL;
-	fbCreateInfo.renderPass = depthPrepass.renderPass;
-	fbCreateInfo.attachmentCount = 1;
-	fbCreateInfo.pAttachments = &depthPrepass.depth.view;
-	fbCreateInfo.width = swapChainExtent.width;
-	fbCreateInfo.height = swapChainExtent.height;
-	fbCreateInfo.layers = 1;
-
-	if (vkCreateFramebuffer(device, &fbCreateInfo, nullptr, &depthPrepass.frameBuffer)
-			!= VK_SUCCESS) {
-		throw std::runtime_error("failed to bind depth framebuffer!");
-	}
 }
 
 void VulkanBaseApplication::createVertexBuffer(std::vector<Vertex> & verticesData, VkBuffer& buffer, VkDeviceMemory& bufferMemory) {
@@ -1478,10 +3360,40 @@ void VulkanBaseApplication::createSemaphores() {
 	VkSemaphoreCreateInfo semaphoreInfo = {};
 	semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
 
-	if (vkCreateSemaphore(device, &semaphoreInfo, nullptr, imageAvailableSemaphore.replace()) != VK_SUCCESS
-			|| vkCreateSemaphore(device, &semaphoreInfo, nullptr, renderFinishedSemaphore.replace()) != VK_SUCCESS) {
-		throw std::runtime_error("failed to create semaphores!");
+	// signaled, nothing ran in the slots yet
+	VkFenceCreateInfo fenceInfo = {};
+	fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+	fenceInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
+
+	for (FrameInFlight & inFlight : frames) {
+		if (vkCreateSemaphore(device, &semaphoreInfo, nullptr, &inFlight.imageAvailable) != VK_SUCCESS
+				|| vkCreateSemaphore(device, &semaphoreInfo, nullptr, &inFlight.renderFinished) != VK_SUCCESS) {
+			throw std::runtime_error("failed to create semaphores!");
+		}
+		if (vkCreateFence(device, &fenceInfo, nullptr, &inFlight.fence) != VK_SUCCESS) {
+			throw std::runtime_error("failed to create fences!");
+		}
+	}
+
+#ifdef VK_KHR_timeline_semaphore
+	if (frameGraph.timelineSemaphores) {
+		VkSemaphoreTypeCreateInfoKHR typeInfo = {};
+		typeInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO_KHR;
+		typeInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE_KHR;
+		typeInfo.initialValue = 0;
+
+		VkSemaphoreCreateInfo timelineInfo = {};
+		timelineInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+		timelineInfo.pNext = &typeInfo;
+
+		for (int queue = 0; queue < NUM_RENDER_QUEUES; ++queue) {
+			if (vkCreateSemaphore(device, &timelineInfo, nullptr, &frameGraph.timelines[queue]) != VK_SUCCESS) {
+				throw std::runtime_error("failed to create timeline semaphores!");
+			}
+			frameGraph.timelineValues[queue] = 0;
+		}
 	}
+#endif
 }
 
 // find queue families
@@ -1496,21 +3408,26 @@ QueueFamilyIndices VulkanBaseApplication::findQueueFamilies(VkPhysicalDevice dev
 
 	int i = 0;
 	for (const auto& queueFamily : queueFamilies) {
-		if (queueFamily.queueCount > 0
-			&& queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT
-			&& queueFamily.queueFlags & VK_QUEUE_COMPUTE_BIT) {
-			indices.graphicsFamily = i;
-		}
+		if (!indices.isComplete()) {
+			if (queueFamily.queueCount > 0
+				&& queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT
+				&& queueFamily.queueFlags & VK_QUEUE_COMPUTE_BIT) {
+				indices.graphicsFamily = i;
+			}
 
-		VkBool32 presentSupport = false;
-		vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface, &presentSupport);
+			VkBool32 presentSupport = false;
+			vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface, &presentSupport);
 
-		if (queueFamily.queueCount > 0 && presentSupport) {
-			indices.presentFamily = i;
+			if (queueFamily.queueCount > 0 && presentSupport) {
+				indices.presentFamily = i;
+			}
 		}
 
-		if (indices.isComplete()) {
-			break;
+		// usually a separate async compute engine, software drivers have none
+		if (indices.computeFamily < 0 && queueFamily.queueCount > 0
+			&& queueFamily.queueFlags & VK_QUEUE_COMPUTE_BIT
+			&& !(queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT)) {
+			indices.computeFamily = i;
 		}
 		i++;
 	}
@@ -1535,6 +3452,24 @@ std::vector<const char*> VulkanBaseApplication::getRequiredExtensions() {
 		extensions.push_back(VK_EXT_DEBUG_REPORT_EXTENSION_NAME);
 	}
 
+	// required by VK_KHR_timeline_semaphore, the instance is 1.0
+	physicalDeviceProperties2 = false;
+#ifdef VK_KHR_timeline_semaphore
+	if (bTimelineSemaphores) {
+		uint32_t extensionCount = 0;
+		vkEnumerateInstanceExtensionProperties(nullptr, &extensionCount, nullptr);
+		std::vector<VkExtensionProperties> availableExtensions(extensionCount);
+		vkEnumerateInstanceExtensionProperties(nullptr, &extensionCount, availableExtensions.data());
+
+		for (const auto & extension : availableExtensions) {
+			if (strcmp(extension.extensionName, VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME) == 0) {
+				physicalDeviceProperties2 = true;
+				extensions.push_back(VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME);
+			}
+		}
+	}
+#endif
+
 	return extensions;
 }
 
@@ -1665,7 +3600,10 @@ VkExtent2D VulkanBaseApplication::chooseSwapExtent(const VkSurfaceCapabilitiesKH
 		return capabilities.currentExtent;
 	}
 	else {
-		VkExtent2D actualExtent = { (uint32_t)WIDTH, (uint32_t)HEIGHT };
+		// the window size in pixels, it can be resized
+		int width, height;
+		glfwGetFramebufferSize(window, &width, &height);
+		VkExtent2D actualExtent = { (uint32_t)width, (uint32_t)height };
 
 		actualExtent.width = std::max(capabilities.minImageExtent.width, std::min(capabilities.maxImageExtent.width, actualExtent.width));
 		actualExtent.height = std::max(capabilities.minImageExtent.height, std::min(capabilities.maxImageExtent.height, actualExtent.height));
@@ -1710,13 +3648,20 @@ uint32_t VulkanBaseApplication::findMemoryType(uint32_t typeFilter, VkMemoryProp
 }
 
 // abstracting buffer creation
-void VulkanBaseApplication::createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer& buffer, VkDeviceMemory& bufferMemory) {
+void VulkanBaseApplication::createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer& buffer, VkDeviceMemory& bufferMemory, bool queueFamilyExclusive) {
 	VkBufferCreateInfo bufferInfo = {};
 	bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
 	bufferInfo.size = size;
 	bufferInfo.usage = usage;
 	bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
 
+	uint32_t queueFamilies[] = { graphicsQueueFamily, computeQueueFamily };
+	if (asyncCompute && !queueFamilyExclusive) {
+		bufferInfo.sharingMode = VK_SHARING_MODE_CONCURRENT;
+		bufferInfo.queueFamilyIndexCount = 2;
+		bufferInfo.pQueueFamilyIndices = queueFamilies;
+	}
+
 	if (vkCreateBuffer(device, &bufferInfo, nullptr, &buffer) != VK_SUCCESS) {
 		throw std::runtime_error("failed to create buffer!");
 	}
@@ -1750,74 +3695,224 @@ void VulkanBaseApplication::copyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, V
 }
 
 void VulkanBaseApplication::createLightInfos() {
-	std::default_random_engine g((unsigned)time(0));
+	lightRandom.seed((unsigned)time(0));
+	lightManager.setCapacity(MAX_NUM_LIGHTS);
+	for (int i = 0; i < NUM_OF_LIGHTS; ++i) {
+		addLight(randomLight());
+	}
+	fpParams.numLights = lightManager.count();
+}
+
+LightDesc VulkanBaseApplication::randomLight() {
+	std::default_random_engine & g = lightRandom;
 	std::uniform_real_distribution<float> u(0.f, 1.f);
-	float scale = 10.0f;
 
 	float dX = 5000.0f;
 	float dY = 500.0f;
 	float dZ = 500.0;
 	float radius = 200.0f;
-	for (int i = 0; i < fpParams.numLights; ++i) {
 
-		float posX = u(g) * dX - dX / 2.0f;
-		float posY = u(g) * dY + 100.0f;
-		float posZ = u(g) * dZ - dZ / 2.0f;
-		float intensity = u(g) * 0.010f;
+	float posX = u(g) * dX - dX / 2.0f;
+	float posY = u(g) * dY + 100.0f;
+	float posZ = u(g) * dZ - dZ / 2.0f;
+	float intensity = u(g) * 0.010f;
+
+	LightDesc light;
+	light.beginPos = glm::vec3(posX, posY, posZ);
+	light.endPos = glm::vec3(posX, u(g) * (-10.0f), posZ);
+	light.radius = u(g) * radius;
+	light.color = glm::vec4(u(g), u(g), u(g), intensity);
+
+	// light type and its shape
+	float typeRand = u(g);
+	light.type = LIGHT_POINT;
+
+	if (typeRand < SPOT_LIGHT_RATIO) {
+		// mostly pointing down, 20 - 45 degrees
+		float outerAngle = glm::radians(20.0f + u(g) * 25.0f);
+		light.type = LIGHT_SPOT;
+		light.direction = glm::vec4(glm::normalize(glm::vec3(u(g) - 0.5f, -1.0f, u(g) - 0.5f)), 0.f);
+		light.shape = glm::vec4(std::cos(outerAngle), std::cos(outerAngle * 0.8f), 0.f, 0.f);
+	}
+	else if (typeRand < SPOT_LIGHT_RATIO + TUBE_LIGHT_RATIO) {
+		// horizontal tube
+		glm::vec3 axis = glm::normalize(glm::vec3(u(g) - 0.5f, 0.0f, u(g) - 0.5f));
+		light.type = LIGHT_TUBE;
+		light.direction = glm::vec4(axis * (10.0f + u(g) * 40.0f), 0.f);
+	}
+	else if (typeRand < SPOT_LIGHT_RATIO + TUBE_LIGHT_RATIO + RECT_LIGHT_RATIO) {
+		// facing down
+		glm::vec3 normal = glm::normalize(glm::vec3(u(g) - 0.5f, -2.0f, u(g) - 0.5f));
+		glm::vec3 tangent = glm::normalize(glm::cross(normal, glm::vec3(0.0f, 0.0f, 1.0f)));
+		light.type = LIGHT_RECT;
+		light.direction = glm::vec4(normal, 0.f);
+		light.shape = glm::vec4(tangent * (10.0f + u(g) * 30.0f), 10.0f + u(g) * 30.0f);
+	}
+	return light;
+}
+
+LightHandle VulkanBaseApplication::addLight(const LightDesc & light) {
+	LightHandle handle = lightManager.add();
+	if (handle.valid()) {
+		writeLight(lightManager.slot(handle), light, nextLightSeed);
+		nextLightSeed += 1.0f;
+	}
+	return handle;
+}
+
+void VulkanBaseApplication::removeLight(LightHandle handle) {
+	uint32_t movedFrom;
+	uint32_t movedTo;
+	if (lightManager.remove(handle, movedFrom, movedTo)) {
+		// the last light fills the hole
+		SBO_lights & lights = sboHostData.lights;
+		lights.beginPos[movedTo] = lights.beginPos[movedFrom];
+		lights.endPos[movedTo] = lights.endPos[movedFrom];
+		lights.color[movedTo] = lights.color[movedFrom];
+		lights.direction[movedTo] = lights.direction[movedFrom];
+		lights.shape[movedTo] = lights.shape[movedFrom];
+		lights.type[movedTo] = lights.type[movedFrom];
+	}
+}
+
+void VulkanBaseApplication::updateLight(LightHandle handle, const LightDesc & light) {
+	int slot = lightManager.slot(handle);
+	if (slot < 0) {
+		return;
+	}
+	writeLight(slot, light, sboHostData.lights.endPos[slot].w);
+	lightManager.markDirty(slot);
+}
+
+void VulkanBaseApplication::writeLight(uint32_t slot, const LightDesc & light, float animationSeed) {
+	SBO_lights & lights = sboHostData.lights;
+	lights.beginPos[slot] = glm::vec4(light.beginPos, light.radius);
+	lights.endPos[slot] = glm::vec4(light.endPos, animationSeed);
+	lights.color[slot] = light.color;
+	lights.direction[slot] = light.direction;
+	lights.shape[slot] = light.shape;
+	lights.type[slot] = light.type;
+}
+
+void VulkanBaseApplication::uploadDirtyLights() {
+	// the frame that used this slot before is done (see waitForFrame), its
+	// staging and copies can be replaced
+	FrameInFlight & inFlight = frames[currentFrame];
+	std::vector<VkBufferCopy> & regions = inFlight.lightCopies;
+	regions.clear();
+
+	std::vector<glm::uvec2> ranges;
+	lightManager.takeDirtyRanges(ranges, LIGHT_UPLOAD_MAX_GAP);
+	int numLights = (int)lightManager.count();
+	if (ranges.empty() && numLights == fpParams.numLights) {
+		return;
+	}
 
-		sboHostData.lights.lights[i].beginPos = glm::vec4(posX, posY, posZ, intensity);
-		sboHostData.lights.lights[i].endPos = sboHostData.lights.lights[i].beginPos;
-		sboHostData.lights.lights[i].endPos.y = u(g) * (-10.0f);
-		sboHostData.lights.lights[i].endPos.w = u(g) * radius; // radius
-		sboHostData.lights.lights[i].color = glm::vec4(u(g), u(g), u(g), 0.f);
+	// stage the dirty ranges of every stream at their offset in SBO_lights,
+	// one copy region per range and stream. recordUploadCommandBuffer copies
+	// them ahead of the light update of this frame. SBO_lights has no copy per
+	// slot: the shading of the frame before is submitted after this copy, so for
+	// one frame an edited light can be shaded with its new values against the
+	// old lists, and its culling on the compute queue may see them as well
+	const SBO_lights & lights = sboHostData.lights;
+	void* data;
+	vkMapMemory(device, inFlight.lightsStaging.memory, 0, inFlight.lightsStaging.allocSize, 0, &data);
+	auto stageStream = [&](const void * stream, VkDeviceSize elementSize) {
+		VkDeviceSize streamOffset = (const char*)stream - (const char*)&lights;
+		for (const glm::uvec2 & range : ranges) {
+			VkBufferCopy region = {};
+			region.srcOffset = streamOffset + range.x * elementSize;
+			region.dstOffset = region.srcOffset;
+			region.size = range.y * elementSize;
+			memcpy((char*)data + region.srcOffset, (const char*)&lights + region.srcOffset, (size_t)region.size);
+			regions.push_back(region);
+		}
+	};
+	stageStream(lights.beginPos, sizeof(glm::vec4));
+	stageStream(lights.endPos, sizeof(glm::vec4));
+	stageStream(lights.color, sizeof(glm::vec4));
+	stageStream(lights.direction, sizeof(glm::vec4));
+	stageStream(lights.shape, sizeof(glm::vec4));
+	stageStream(lights.type, sizeof(int32_t));
+	vkUnmapMemory(device, inFlight.lightsStaging.memory);
+
+	// edits only move their own slots (and the removed ones past the new count),
+	// as long as nothing else moved the lights since a frame slot last culled
+	CullingCache & cache = cullingCache;
+	for (CullingCache::Lists & lists : cache.lists) {
+		bool onlyEdits = cache.lightVersion == lists.culledLightVersion || cache.lightVersion == lists.editedLightVersion;
+		if (onlyEdits) {
+			lists.editedLights.insert(lists.editedLights.end(), ranges.begin(), ranges.end());
+			lists.editedLightVersion = cache.lightVersion + 1;
+		}
+	}
+	cache.lightVersion++;
+
+	// the light count is baked into the dispatch sizes, and the frames in
+	// flight may still run the compute commands
+	if (numLights != fpParams.numLights) {
+		fpParams.numLights = numLights;
+		vkQueueWaitIdle(graphicsQueue);
+		if (asyncCompute) {
+			vkQueueWaitIdle(computeQueue);
+		}
+		for (int slot = 0; slot < MAX_FRAMES_IN_FLIGHT; ++slot) {
+			vkFreeCommandBuffers(device, computeCommandPool, 1, &frames[slot].compute);
+			createComputeCommandBuffer(slot);
+		}
 	}
 }
 
 void VulkanBaseApplication::createUniformBuffer() {
-	// vs scene
-	VkDeviceSize bufferSize = sizeof(UBO_vsParams);
+	// one set per frame slot, written by the host while the other slots are in flight
+	for (FrameInFlight & inFlight : frames) {
+		UniformBuffers & ubo = inFlight.ubo;
 
-	ubo.vsSceneStaging.allocSize = bufferSize;
-	createBuffer(bufferSize,
-		VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-		ubo.vsSceneStaging.buffer, ubo.vsSceneStaging.memory);
+		// vs scene
+		VkDeviceSize bufferSize = sizeof(UBO_vsParams);
 
-	ubo.vsScene.allocSize = bufferSize;
-	createBuffer(bufferSize,
-		VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
-		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-		ubo.vsScene.buffer, ubo.vsScene.memory);
+		ubo.vsSceneStaging.allocSize = bufferSize;
+		createBuffer(bufferSize,
+			VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+			ubo.vsSceneStaging.buffer, ubo.vsSceneStaging.memory);
 
-	// cs params
-	bufferSize = sizeof(UBO_csParams);
+		ubo.vsScene.allocSize = bufferSize;
+		createBuffer(bufferSize,
+			VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+			ubo.vsScene.buffer, ubo.vsScene.memory);
 
-	ubo.csParamsStaging.allocSize = bufferSize;
-	createBuffer(bufferSize,
-		VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-		ubo.csParamsStaging.buffer, ubo.csParamsStaging.memory);
+		// cs params
+		bufferSize = sizeof(UBO_csParams);
 
-	ubo.csParams.allocSize = bufferSize;
-	createBuffer(bufferSize,
-		VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
-		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-		ubo.csParams.buffer, ubo.csParams.memory);
+		ubo.csParamsStaging.allocSize = bufferSize;
+		createBuffer(bufferSize,
+			VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+			ubo.csParamsStaging.buffer, ubo.csParamsStaging.memory);
 
-	// fs params
-	bufferSize = sizeof(UBO_fsParams);
+		ubo.csParams.allocSize = bufferSize;
+		createBuffer(bufferSize,
+			VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+			ubo.csParams.buffer, ubo.csParams.memory);
 
-	ubo.fsParamsStaging.allocSize = bufferSize;
-	createBuffer(bufferSize,
-		VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-		ubo.fsParamsStaging.buffer, ubo.fsParamsStaging.memory);
+		// fs params
+		bufferSize = sizeof(UBO_fsParams);
 
-	ubo.fsParams.allocSize = bufferSize;
-	createBuffer(bufferSize,
-		VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
-		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-		ubo.fsParams.buffer, ubo.fsParams.memory);
+		ubo.fsParamsStaging.allocSize = bufferSize;
+		createBuffer(bufferSize,
+			VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+			ubo.fsParamsStaging.buffer, ubo.fsParamsStaging.memory);
+
+		ubo.fsParams.allocSize = bufferSize;
+		createBuffer(bufferSize,
+			VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+			ubo.fsParams.buffer, ubo.fsParams.memory);
+	}
 }
 
 void VulkanBaseApplication::createStorageBuffer() {
@@ -1830,32 +3925,135 @@ void VulkanBaseApplication::createStorageBuffer() {
 		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
 		sbo.lights.buffer, sbo.lights.memory);
 
+	// node count of the largest tree
+	size_t numBvhNodes = 0;
+	for (size_t count = (MAX_NUM_LIGHTS + LIGHT_BVH_BRANCHING - 1) / LIGHT_BVH_BRANCHING; ; count = (count + LIGHT_BVH_BRANCHING - 1) / LIGHT_BVH_BRANCHING) {
+		numBvhNodes += count;
+		if (count == 1) {
+			break;
+		}
+	}
+
+	// the buffers a frame writes, one set per frame slot
+	for (FrameInFlight & inFlight : frames) {
+		// light edits, staged by uploadDirtyLights
+		bufferSize = sizeof(SBO_lights);
+
+		inFlight.lightsStaging.allocSize = bufferSize;
+		createBuffer(bufferSize,
+			VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+			inFlight.lightsStaging.buffer, inFlight.lightsStaging.memory);
+
+		// animated lights
+		bufferSize = sizeof(SBO_lightInstances);
+
+		inFlight.lightInstances.allocSize = bufferSize;
+		createBuffer(bufferSize,
+			VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+			inFlight.lightInstances.buffer, inFlight.lightInstances.memory);
+
+		// light bvh, written by updateLightBvh for every culling
+		bufferSize = sizeof(int) * MAX_NUM_LIGHTS;
+
+		inFlight.sortedLights.allocSize = bufferSize;
+		createBuffer(bufferSize,
+			VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+			inFlight.sortedLights.buffer, inFlight.sortedLights.memory);
+
+		bufferSize = sizeof(LightBvhNode) * numBvhNodes;
+
+		inFlight.lightBvhNodes.allocSize = bufferSize;
+		createBuffer(bufferSize,
+			VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+			inFlight.lightBvhNodes.buffer, inFlight.lightBvhNodes.memory);
+
+		// culling cache counters, written by updateCullingCache every frame
+		bufferSize = sizeof(SBO_cullingCache);
+
+		inFlight.cullingCache.allocSize = bufferSize;
+		createBuffer(bufferSize,
+			VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+			inFlight.cullingCache.buffer, inFlight.cullingCache.memory);
+
+		void* data;
+		vkMapMemory(device, inFlight.cullingCache.memory, 0, bufferSize, 0, &data);
+			memset(data, 0, (size_t)bufferSize);
+		vkUnmapMemory(device, inFlight.cullingCache.memory);
+	}
+}
+
+void VulkanBaseApplication::createTileBuffers() {
+	// one entry per tile of the current swap chain extent
+	const VkDeviceSize numTiles = (VkDeviceSize)fpParams.numThreads.x * fpParams.numThreads.y;
+
 	// frustums
-	bufferSize = sizeof(SBO_frustums);
+	VkDeviceSize bufferSize = sizeof(sboHostData.frustums.frustums[0]) * numTiles;
 
 	sbo.frustums.allocSize = bufferSize;
 	createBuffer(bufferSize,
-		VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+		VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
 		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
 		sbo.frustums.buffer, sbo.frustums.memory);
 
-	// light index
-	bufferSize = sizeof(int) * MAX_NUM_FRUSTRUMS * MAX_NUM_LIGHTS_PER_TILE;
+	// lists, depths and the grid copy of every frame slot
+	for (FrameInFlight & inFlight : frames) {
+		// light index
+		bufferSize = sizeof(int) * numTiles * MAX_NUM_LIGHTS_PER_TILE;
 
-	sbo.lightIndex.allocSize = bufferSize;
-	createBuffer(bufferSize,
-		VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
-		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-		sbo.lightIndex.buffer, sbo.lightIndex.memory);
+		inFlight.lightIndex.allocSize = bufferSize;
+		createBuffer(bufferSize,
+			VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+			inFlight.lightIndex.buffer, inFlight.lightIndex.memory, true);
 
-	// light grid
-	bufferSize = sizeof(int) * MAX_NUM_FRUSTRUMS;
+		// light grid
+		bufferSize = sizeof(int) * numTiles;
 
-	sbo.lightGrid.allocSize = bufferSize;
-	createBuffer(bufferSize,
-		VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
-		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-		sbo.lightGrid.buffer, sbo.lightGrid.memory);
+		inFlight.lightGrid.allocSize = bufferSize;
+		createBuffer(bufferSize,
+			VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+			inFlight.lightGrid.buffer, inFlight.lightGrid.memory, true);
+
+		// tile depths for the light binning pass
+		bufferSize = sizeof(TileDepthBounds) * numTiles;
+
+		inFlight.tileDepths.allocSize = bufferSize;
+		createBuffer(bufferSize,
+			VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+			inFlight.tileDepths.buffer, inFlight.tileDepths.memory);
+
+		// light grid copy for the list stats
+		bufferSize = sizeof(int) * numTiles;
+
+		inFlight.lightGridReadback.allocSize = bufferSize;
+		createBuffer(bufferSize,
+			VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+			inFlight.lightGridReadback.buffer, inFlight.lightGridReadback.memory);
+
+		// read by the list stats before the first culling at this size
+		void* data;
+		vkMapMemory(device, inFlight.lightGridReadback.memory, 0, bufferSize, 0, &data);
+			memset(data, 0, (size_t)bufferSize);
+		vkUnmapMemory(device, inFlight.lightGridReadback.memory);
+	}
+}
+
+void VulkanBaseApplication::cleanupTileBuffers() {
+	sbo.frustums.cleanup(device);
+	for (FrameInFlight & inFlight : frames) {
+		inFlight.lightIndex.cleanup(device);
+		inFlight.lightGrid.cleanup(device);
+		inFlight.tileDepths.cleanup(device);
+		inFlight.lightGridReadback.cleanup(device);
+	}
 }
 
 void VulkanBaseApplication::initStorageBuffer() {
@@ -1864,24 +4062,23 @@ void VulkanBaseApplication::initStorageBuffer() {
 	void* data;
 	SBO_lights& lights = sboHostData.lights;
 	SBO_frustums& frustums = sboHostData.frustums;
-	VulkanBuffer lightsStaging;
 	VulkanBuffer frustumsStaging;
 
+	// all of them once, through the staging of the first slot. Runtime edits
+	// go through uploadDirtyLights
+	VulkanBuffer & lightsStaging = frames[0].lightsStaging;
 	bufferSize = sbo.lights.allocSize;
-	createBuffer(bufferSize,
-		VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-		lightsStaging.buffer, lightsStaging.memory);
-
 	vkMapMemory(device, lightsStaging.memory, 0, bufferSize, 0, &data);
 		memcpy(data, &lights, bufferSize);
 	vkUnmapMemory(device, lightsStaging.memory);
 
 	copyBuffer(lightsStaging.buffer, sbo.lights.buffer, bufferSize);
-	lightsStaging.cleanup(device);
 
-	// grid frustums
-	bufferSize = sbo.frustums.allocSize;
+	std::vector<glm::uvec2> uploadedRanges;
+	lightManager.takeDirtyRanges(uploadedRanges);
+
+	// grid frustums, computeFrustumGrid overwrites them in the first frame
+	bufferSize = std::min(sbo.frustums.allocSize, (VkDeviceSize)sizeof(SBO_frustums));
 	createBuffer(bufferSize,
 		VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
 		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
@@ -1953,6 +4150,14 @@ void VulkanBaseApplication::createDescriptorSetLayout() {
 	lightsStorageLayoutBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT | VK_SHADER_STAGE_COMPUTE_BIT;
 	lightsStorageLayoutBinding.pImmutableSamplers = nullptr;
 
+	// fs cs animated lights storage
+	VkDescriptorSetLayoutBinding lightInstancesLayoutBinding = {};
+	lightInstancesLayoutBinding.binding = 16;
+	lightInstancesLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	lightInstancesLayoutBinding.descriptorCount = 1;
+	lightInstancesLayoutBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT | VK_SHADER_STAGE_COMPUTE_BIT;
+	lightInstancesLayoutBinding.pImmutableSamplers = nullptr;
+
 	// cs uniform
 	VkDescriptorSetLayoutBinding csParamsLayoutBinding = {};
 	csParamsLayoutBinding.binding = 4;
@@ -1993,12 +4198,60 @@ void VulkanBaseApplication::createDescriptorSetLayout() {
 	lightGridBinding.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT | VK_SHADER_STAGE_FRAGMENT_BIT;
 	lightGridBinding.pImmutableSamplers = nullptr;
 
-	std::array<VkDescriptorSetLayoutBinding, 12> bindings = {
+	// cs lod draw items storage
+	VkDescriptorSetLayoutBinding drawItemsBinding = {};
+	drawItemsBinding.binding = 14;
+	drawItemsBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	drawItemsBinding.descriptorCount = 1;
+	drawItemsBinding.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	drawItemsBinding.pImmutableSamplers = nullptr;
+
+	// cs indirect draw commands storage
+	VkDescriptorSetLayoutBinding indirectDrawsBinding = {};
+	indirectDrawsBinding.binding = 15;
+	indirectDrawsBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	indirectDrawsBinding.descriptorCount = 1;
+	indirectDrawsBinding.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	indirectDrawsBinding.pImmutableSamplers = nullptr;
+
+	// cs light bvh storage
+	VkDescriptorSetLayoutBinding sortedLightsBinding = {};
+	sortedLightsBinding.binding = 17;
+	sortedLightsBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	sortedLightsBinding.descriptorCount = 1;
+	sortedLightsBinding.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	sortedLightsBinding.pImmutableSamplers = nullptr;
+
+	VkDescriptorSetLayoutBinding lightBvhNodesBinding = {};
+	lightBvhNodesBinding.binding = 18;
+	lightBvhNodesBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	lightBvhNodesBinding.descriptorCount = 1;
+	lightBvhNodesBinding.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	lightBvhNodesBinding.pImmutableSamplers = nullptr;
+
+	VkDescriptorSetLayoutBinding tileDepthsBinding = {};
+	tileDepthsBinding.binding = 19;
+	tileDepthsBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	tileDepthsBinding.descriptorCount = 1;
+	tileDepthsBinding.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	tileDepthsBinding.pImmutableSamplers = nullptr;
+
+	VkDescriptorSetLayoutBinding cullingCacheBinding = {};
+	cullingCacheBinding.binding = 20;
+	cullingCacheBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	cullingCacheBinding.descriptorCount = 1;
+	cullingCacheBinding.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	cullingCacheBinding.pImmutableSamplers = nullptr;
+
+	std::array<VkDescriptorSetLayoutBinding, 19> bindings = {
 		uboLayoutBinding, depthLayoutBinding,
 		fsMaterialUniformBinding, samplerLayoutBinding, samplerLayoutBinding2, samplerLayoutBinding3,
-		lightsStorageLayoutBinding, csParamsLayoutBinding,
+		lightsStorageLayoutBinding, lightInstancesLayoutBinding, csParamsLayoutBinding,
 		frustumStorageLayoutBinding, fsParamsLayoutBinding,
-		lightIndexBinding, lightGridBinding
+		lightIndexBinding, lightGridBinding,
+		drawItemsBinding, indirectDrawsBinding,
+		sortedLightsBinding, lightBvhNodesBinding, tileDepthsBinding,
+		cullingCacheBinding
 	};
 
 	VkDescriptorSetLayoutCreateInfo layoutInfo = {};
@@ -2009,24 +4262,41 @@ void VulkanBaseApplication::createDescriptorSetLayout() {
 	if (vkCreateDescriptorSetLayout(device, &layoutInfo, nullptr, descriptorSetLayout.replace()) != VK_SUCCESS) {
 		throw std::runtime_error("failed to create descriptor set layout!");
 	}
+
+	// composite subpass, sceneColor input attachment
+	VkDescriptorSetLayoutBinding sceneColorBinding = {};
+	sceneColorBinding.binding = 0;
+	sceneColorBinding.descriptorType = VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT;
+	sceneColorBinding.descriptorCount = 1;
+	sceneColorBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+	sceneColorBinding.pImmutableSamplers = nullptr;
+
+	layoutInfo.bindingCount = 1;
+	layoutInfo.pBindings = &sceneColorBinding;
+
+	if (vkCreateDescriptorSetLayout(device, &layoutInfo, nullptr, compositeSetLayout.replace()) != VK_SUCCESS) {
+		throw std::runtime_error("failed to create descriptor set layout!");
+	}
 }
 
 
 void VulkanBaseApplication::createDescriptorPool() {
 
-	std::array<VkDescriptorPoolSize, 3> poolSizes = {};
+	std::array<VkDescriptorPoolSize, 4> poolSizes = {};
 	poolSizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
 	poolSizes[0].descriptorCount = 4;
 	poolSizes[1].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
 	poolSizes[1].descriptorCount = 4;
 	poolSizes[2].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
 	poolSizes[2].descriptorCount = 4;
+	poolSizes[3].type = VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT;
+	poolSizes[3].descriptorCount = 1;
 
 	VkDescriptorPoolCreateInfo poolInfo = {};
 	poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
 	poolInfo.poolSizeCount = (uint32_t)poolSizes.size();
 	poolInfo.pPoolSizes = poolSizes.data();
-	poolInfo.maxSets = 100; // number of descriptor sets
+	poolInfo.maxSets = 100 * MAX_FRAMES_IN_FLIGHT; // number of descriptor sets
 
 	if (vkCreateDescriptorPool(device, &poolInfo, nullptr, descriptorPool.replace()) != VK_SUCCESS) {
 		throw std::runtime_error("failed to create descriptor pool!");
@@ -2040,159 +4310,294 @@ void VulkanBaseApplication::createDescriptorSet() {
 	allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
 	allocInfo.descriptorPool = descriptorPool;
 	allocInfo.descriptorSetCount = 1;
-	allocInfo.pSetLayouts = layouts;
 
-	if (vkAllocateDescriptorSets(device, &allocInfo, &descriptorSet) != VK_SUCCESS) {
+	// written by createFrameGraph, once sceneColor has its image
+	allocInfo.pSetLayouts = &compositeSetLayout;
+	if (vkAllocateDescriptorSets(device, &allocInfo, &compositeDescriptorSet) != VK_SUCCESS) {
 		throw std::runtime_error("failed to allocate descriptor set!");
 	}
 
-	VkDescriptorBufferInfo vsParamsDescriptorInfo = {};
-	vsParamsDescriptorInfo.buffer = ubo.vsScene.buffer;
-	vsParamsDescriptorInfo.offset = 0;
-	vsParamsDescriptorInfo.range = ubo.vsScene.allocSize;
-
-	VkDescriptorBufferInfo csParamsDescriptorInfo = {};
-	csParamsDescriptorInfo.buffer = ubo.csParams.buffer;
-	csParamsDescriptorInfo.offset = 0;
-	csParamsDescriptorInfo.range = ubo.csParams.allocSize;
-
-	VkDescriptorBufferInfo fsParamsDescriptorInfo = {};
-	fsParamsDescriptorInfo.buffer = ubo.fsParams.buffer;
-	fsParamsDescriptorInfo.offset = 0;
-	fsParamsDescriptorInfo.range = ubo.fsParams.allocSize;
-
-	VkDescriptorBufferInfo lightsStorageDescriptorInfo = {};
-	lightsStorageDescriptorInfo.buffer = sbo.lights.buffer;
-	lightsStorageDescriptorInfo.offset = 0;
-	lightsStorageDescriptorInfo.range = sbo.lights.allocSize;
-
-	VkDescriptorBufferInfo frustumStorageDescriptorInfo = {};
-	frustumStorageDescriptorInfo.buffer = sbo.frustums.buffer;
-	frustumStorageDescriptorInfo.offset = 0;
-	frustumStorageDescriptorInfo.range = sbo.frustums.allocSize;
-
-	VkDescriptorBufferInfo lightIndexDescriptorInfo = {};
-	lightIndexDescriptorInfo.buffer = sbo.lightIndex.buffer;
-	lightIndexDescriptorInfo.offset = 0;
-	lightIndexDescriptorInfo.range = sbo.lightIndex.allocSize;
-
-	VkDescriptorBufferInfo lightGridDescriptorInfo = {};
-	lightGridDescriptorInfo.buffer = sbo.lightGrid.buffer;
-	lightGridDescriptorInfo.offset = 0;
-	lightGridDescriptorInfo.range = sbo.lightGrid.allocSize;
-
-	std::array<VkDescriptorImageInfo, 3> imageInfo = {};
-	imageInfo[0].imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-	imageInfo[0].imageView = textures[0].imageView; //textureImageViews[0];
-	imageInfo[0].sampler = textures[0].sampler; // textureSamplers[0];
-
-	imageInfo[1].imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-	imageInfo[1].imageView = textures[1].imageView; // textureImageViews[1];
-	imageInfo[1].sampler = textures[1].sampler; // textureSamplers[1];
+	// one set per frame in flight, over that frame's copies of the buffers it writes
+	allocInfo.pSetLayouts = layouts;
+	for (int slot = 0; slot < MAX_FRAMES_IN_FLIGHT; ++slot) {
+		FrameInFlight & inFlight = frames[slot];
+		if (vkAllocateDescriptorSets(device, &allocInfo, &inFlight.descriptorSet) != VK_SUCCESS) {
+			throw std::runtime_error("failed to allocate descriptor set!");
+		}
+		VkDescriptorSet descriptorSet = inFlight.descriptorSet;
+		UniformBuffers & ubo = inFlight.ubo;
+		VkDescriptorBufferInfo vsParamsDescriptorInfo = {};
+		vsParamsDescriptorInfo.buffer = ubo.vsScene.buffer;
+		vsParamsDescriptorInfo.offset = 0;
+		vsParamsDescriptorInfo.range = ubo.vsScene.allocSize;
+
+		VkDescriptorBufferInfo csParamsDescriptorInfo = {};
+		csParamsDescriptorInfo.buffer = ubo.csParams.buffer;
+		csParamsDescriptorInfo.offset = 0;
+		csParamsDescriptorInfo.range = ubo.csParams.allocSize;
+
+		VkDescriptorBufferInfo fsParamsDescriptorInfo = {};
+		fsParamsDescriptorInfo.buffer = ubo.fsParams.buffer;
+		fsParamsDescriptorInfo.offset = 0;
+		fsParamsDescriptorInfo.range = ubo.fsParams.allocSize;
+
+		VkDescriptorBufferInfo lightsStorageDescriptorInfo = {};
+		lightsStorageDescriptorInfo.buffer = sbo.lights.buffer;
+		lightsStorageDescriptorInfo.offset = 0;
+		lightsStorageDescriptorInfo.range = sbo.lights.allocSize;
+
+		VkDescriptorBufferInfo lightInstancesDescriptorInfo = {};
+		lightInstancesDescriptorInfo.buffer = inFlight.lightInstances.buffer;
+		lightInstancesDescriptorInfo.offset = 0;
+		lightInstancesDescriptorInfo.range = inFlight.lightInstances.allocSize;
+
+		VkDescriptorBufferInfo frustumStorageDescriptorInfo = {};
+		frustumStorageDescriptorInfo.buffer = sbo.frustums.buffer;
+		frustumStorageDescriptorInfo.offset = 0;
+		frustumStorageDescriptorInfo.range = sbo.frustums.allocSize;
+
+		VkDescriptorBufferInfo lightIndexDescriptorInfo = {};
+		lightIndexDescriptorInfo.buffer = inFlight.lightIndex.buffer;
+		lightIndexDescriptorInfo.offset = 0;
+		lightIndexDescriptorInfo.range = inFlight.lightIndex.allocSize;
+
+		VkDescriptorBufferInfo lightGridDescriptorInfo = {};
+		lightGridDescriptorInfo.buffer = inFlight.lightGrid.buffer;
+		lightGridDescriptorInfo.offset = 0;
+		lightGridDescriptorInfo.range = inFlight.lightGrid.allocSize;
+
+		VkDescriptorBufferInfo sortedLightsDescriptorInfo = {};
+		sortedLightsDescriptorInfo.buffer = inFlight.sortedLights.buffer;
+		sortedLightsDescriptorInfo.offset = 0;
+		sortedLightsDescriptorInfo.range = inFlight.sortedLights.allocSize;
+
+		VkDescriptorBufferInfo lightBvhNodesDescriptorInfo = {};
+		lightBvhNodesDescriptorInfo.buffer = inFlight.lightBvhNodes.buffer;
+		lightBvhNodesDescriptorInfo.offset = 0;
+		lightBvhNodesDescriptorInfo.range = inFlight.lightBvhNodes.allocSize;
+
+		VkDescriptorBufferInfo tileDepthsDescriptorInfo = {};
+		tileDepthsDescriptorInfo.buffer = inFlight.tileDepths.buffer;
+		tileDepthsDescriptorInfo.offset = 0;
+		tileDepthsDescriptorInfo.range = inFlight.tileDepths.allocSize;
+
+		VkDescriptorBufferInfo cullingCacheDescriptorInfo = {};
+		cullingCacheDescriptorInfo.buffer = inFlight.cullingCache.buffer;
+		cullingCacheDescriptorInfo.offset = 0;
+		cullingCacheDescriptorInfo.range = inFlight.cullingCache.allocSize;
+
+		std::array<VkDescriptorImageInfo, 3> imageInfo = {};
+		imageInfo[0].imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+		imageInfo[0].imageView = textures[0].imageView; //textureImageViews[0];
+		imageInfo[0].sampler = textures[0].sampler; // textureSamplers[0];
+
+		imageInfo[1].imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+		imageInfo[1].imageView = textures[1].imageView; // textureImageViews[1];
+		imageInfo[1].sampler = textures[1].sampler; // textureSamplers[1];
+
+		imageInfo[2].imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+		imageInfo[2].imageView = textures[1].imageView; // textureImageViews[1];
+		imageInfo[2].sampler = textures[1].sampler; // textureSamplers[1];
+
+		VkDescriptorImageInfo depthImageInfo = {};
+
+		depthImageInfo.imageLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
+		depthImageInfo.imageView = inFlight.depth.view;
+		depthImageInfo.sampler = depthPrepass.depthSampler;
+
+		std::array<VkWriteDescriptorSet, 14> descriptorWrites = {};
+
+		descriptorWrites[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		descriptorWrites[0].dstSet = descriptorSet;
+		descriptorWrites[0].dstBinding = 0;
+		descriptorWrites[0].dstArrayElement = 0;
+		descriptorWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+		descriptorWrites[0].descriptorCount = 1;
+		descriptorWrites[0].pBufferInfo = &vsParamsDescriptorInfo;
+
+		descriptorWrites[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		descriptorWrites[1].dstSet = descriptorSet;
+		descriptorWrites[1].dstBinding = 11; // image samplers starts from binding = 10
+		descriptorWrites[1].dstArrayElement = 0;
+		descriptorWrites[1].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+		descriptorWrites[1].descriptorCount = imageInfo.size();
+		descriptorWrites[1].pImageInfo = imageInfo.data();
+
+		//descriptorWrites[2].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		//descriptorWrites[2].dstSet = descriptorSet;
+		//descriptorWrites[2].dstBinding = 11;
+		//descriptorWrites[2].dstArrayElement = 0;
+		//descriptorWrites[2].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+		//descriptorWrites[2].descriptorCount = 1;
+		//descriptorWrites[2].pImageInfo = &imageInfo[1];
+
+		descriptorWrites[3].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		descriptorWrites[3].dstSet = descriptorSet;
+		descriptorWrites[3].dstBinding = 3;
+		descriptorWrites[3].dstArrayElement = 0;
+		descriptorWrites[3].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		descriptorWrites[3].descriptorCount = 1;
+		descriptorWrites[3].pBufferInfo = &lightsStorageDescriptorInfo;
+
+		descriptorWrites[4].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		descriptorWrites[4].dstSet = descriptorSet;
+		descriptorWrites[4].dstBinding = 4;
+		descriptorWrites[4].dstArrayElement = 0;
+		descriptorWrites[4].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+		descriptorWrites[4].descriptorCount = 1;
+		descriptorWrites[4].pBufferInfo = &csParamsDescriptorInfo;
+
+		descriptorWrites[5].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		descriptorWrites[5].dstSet = descriptorSet;
+		descriptorWrites[5].dstBinding = 5;
+		descriptorWrites[5].dstArrayElement = 0;
+		descriptorWrites[5].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		descriptorWrites[5].descriptorCount = 1;
+		descriptorWrites[5].pBufferInfo = &frustumStorageDescriptorInfo;
+
+		descriptorWrites[6].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		descriptorWrites[6].dstSet = descriptorSet;
+		descriptorWrites[6].dstBinding = 6;
+		descriptorWrites[6].dstArrayElement = 0;
+		descriptorWrites[6].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+		descriptorWrites[6].descriptorCount = 1;
+		descriptorWrites[6].pBufferInfo = &fsParamsDescriptorInfo;
+
+		descriptorWrites[7].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		descriptorWrites[7].dstSet = descriptorSet;
+		descriptorWrites[7].dstBinding = 7;
+		descriptorWrites[7].dstArrayElement = 0;
+		descriptorWrites[7].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		descriptorWrites[7].descriptorCount = 1;
+		descriptorWrites[7].pBufferInfo = &lightIndexDescriptorInfo;
+
+		descriptorWrites[2].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		descriptorWrites[2].dstSet = descriptorSet;
+		descriptorWrites[2].dstBinding = 8;
+		descriptorWrites[2].dstArrayElement = 0;
+		descriptorWrites[2].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		descriptorWrites[2].descriptorCount = 1;
+		descriptorWrites[2].pBufferInfo = &lightGridDescriptorInfo;
+
+		descriptorWrites[8].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		descriptorWrites[8].dstSet = descriptorSet;
+		descriptorWrites[8].dstBinding = 1; // image samplers starts from binding = 10
+		descriptorWrites[8].dstArrayElement = 0;
+		descriptorWrites[8].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+		descriptorWrites[8].descriptorCount = 1;
+		descriptorWrites[8].pImageInfo = &depthImageInfo;
+
+		descriptorWrites[9].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		descriptorWrites[9].dstSet = descriptorSet;
+		descriptorWrites[9].dstBinding = 16;
+		descriptorWrites[9].dstArrayElement = 0;
+		descriptorWrites[9].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		descriptorWrites[9].descriptorCount = 1;
+		descriptorWrites[9].pBufferInfo = &lightInstancesDescriptorInfo;
+
+		descriptorWrites[10].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		descriptorWrites[10].dstSet = descriptorSet;
+		descriptorWrites[10].dstBinding = 17;
+		descriptorWrites[10].dstArrayElement = 0;
+		descriptorWrites[10].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		descriptorWrites[10].descriptorCount = 1;
+		descriptorWrites[10].pBufferInfo = &sortedLightsDescriptorInfo;
+
+		descriptorWrites[11].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		descriptorWrites[11].dstSet = descriptorSet;
+		descriptorWrites[11].dstBinding = 18;
+		descriptorWrites[11].dstArrayElement = 0;
+		descriptorWrites[11].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		descriptorWrites[11].descriptorCount = 1;
+		descriptorWrites[11].pBufferInfo = &lightBvhNodesDescriptorInfo;
+
+		descriptorWrites[12].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		descriptorWrites[12].dstSet = descriptorSet;
+		descriptorWrites[12].dstBinding = 19;
+		descriptorWrites[12].dstArrayElement = 0;
+		descriptorWrites[12].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		descriptorWrites[12].descriptorCount = 1;
+		descriptorWrites[12].pBufferInfo = &tileDepthsDescriptorInfo;
+
+		descriptorWrites[13].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		descriptorWrites[13].dstSet = descriptorSet;
+		descriptorWrites[13].dstBinding = 20;
+		descriptorWrites[13].dstArrayElement = 0;
+		descriptorWrites[13].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		descriptorWrites[13].descriptorCount = 1;
+		descriptorWrites[13].pBufferInfo = &cullingCacheDescriptorInfo;
+
+		vkUpdateDescriptorSets(device, (uint32_t)descriptorWrites.size(), descriptorWrites.data(), 0, nullptr);
+	}
+}
 
-	imageInfo[2].imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-	imageInfo[2].imageView = textures[1].imageView; // textureImageViews[1];
-	imageInfo[2].sampler = textures[1].sampler; // textureSamplers[1];
+void VulkanBaseApplication::updateCompositeDescriptorSet() {
+	VkDescriptorImageInfo sceneColorInfo = {};
+	sceneColorInfo.imageView = renderTargets.transient(frameGraph.sceneColor).view;
+	sceneColorInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+	VkWriteDescriptorSet descriptorWrite = {};
+	descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+	descriptorWrite.dstSet = compositeDescriptorSet;
+	descriptorWrite.dstBinding = 0;
+	descriptorWrite.dstArrayElement = 0;
+	descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT;
+	descriptorWrite.descriptorCount = 1;
+	descriptorWrite.pImageInfo = &sceneColorInfo;
+
+	vkUpdateDescriptorSets(device, 1, &descriptorWrite, 0, nullptr);
+}
 
+void VulkanBaseApplication::updateTileDescriptors(VkDescriptorSet set, int slot) {
 	VkDescriptorImageInfo depthImageInfo = {};
-
-	depthImageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-	depthImageInfo.imageView = depthPrepass.depth.view;
+	depthImageInfo.imageLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
+	depthImageInfo.imageView = frames[slot].depth.view;
 	depthImageInfo.sampler = depthPrepass.depthSampler;
 
-	std::array<VkWriteDescriptorSet, 9> descriptorWrites = {};
-
-	descriptorWrites[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-	descriptorWrites[0].dstSet = descriptorSet;
-	descriptorWrites[0].dstBinding = 0;
-	descriptorWrites[0].dstArrayElement = 0;
-	descriptorWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-	descriptorWrites[0].descriptorCount = 1;
-	descriptorWrites[0].pBufferInfo = &vsParamsDescriptorInfo;
-
-	descriptorWrites[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-	descriptorWrites[1].dstSet = descriptorSet;
-	descriptorWrites[1].dstBinding = 11; // image samplers starts from binding = 10
-	descriptorWrites[1].dstArrayElement = 0;
-	descriptorWrites[1].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-	descriptorWrites[1].descriptorCount = imageInfo.size();
-	descriptorWrites[1].pImageInfo = imageInfo.data();
-
-	//descriptorWrites[2].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-	//descriptorWrites[2].dstSet = descriptorSet;
-	//descriptorWrites[2].dstBinding = 11;
-	//descriptorWrites[2].dstArrayElement = 0;
-	//descriptorWrites[2].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-	//descriptorWrites[2].descriptorCount = 1;
-	//descriptorWrites[2].pImageInfo = &imageInfo[1];
-
-	descriptorWrites[3].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-	descriptorWrites[3].dstSet = descriptorSet;
-	descriptorWrites[3].dstBinding = 3;
-	descriptorWrites[3].dstArrayElement = 0;
-	descriptorWrites[3].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-	descriptorWrites[3].descriptorCount = 1;
-	descriptorWrites[3].pBufferInfo = &lightsStorageDescriptorInfo;
-
-	descriptorWrites[4].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-	descriptorWrites[4].dstSet = descriptorSet;
-	descriptorWrites[4].dstBinding = 4;
-	descriptorWrites[4].dstArrayElement = 0;
-	descriptorWrites[4].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-	descriptorWrites[4].descriptorCount = 1;
-	descriptorWrites[4].pBufferInfo = &csParamsDescriptorInfo;
-
-	descriptorWrites[5].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-	descriptorWrites[5].dstSet = descriptorSet;
-	descriptorWrites[5].dstBinding = 5;
-	descriptorWrites[5].dstArrayElement = 0;
-	descriptorWrites[5].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-	descriptorWrites[5].descriptorCount = 1;
-	descriptorWrites[5].pBufferInfo = &frustumStorageDescriptorInfo;
-
-	descriptorWrites[6].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-	descriptorWrites[6].dstSet = descriptorSet;
-	descriptorWrites[6].dstBinding = 6;
-	descriptorWrites[6].dstArrayElement = 0;
-	descriptorWrites[6].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-	descriptorWrites[6].descriptorCount = 1;
-	descriptorWrites[6].pBufferInfo = &fsParamsDescriptorInfo;
-
-	descriptorWrites[7].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-	descriptorWrites[7].dstSet = descriptorSet;
-	descriptorWrites[7].dstBinding = 7;
-	descriptorWrites[7].dstArrayElement = 0;
-	descriptorWrites[7].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-	descriptorWrites[7].descriptorCount = 1;
-	descriptorWrites[7].pBufferInfo = &lightIndexDescriptorInfo;
-
-	descriptorWrites[2].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-	descriptorWrites[2].dstSet = descriptorSet;
-	descriptorWrites[2].dstBinding = 8;
-	descriptorWrites[2].dstArrayElement = 0;
-	descriptorWrites[2].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-	descriptorWrites[2].descriptorCount = 1;
-	descriptorWrites[2].pBufferInfo = &lightGridDescriptorInfo;
-
-	descriptorWrites[8].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-	descriptorWrites[8].dstSet = descriptorSet;
-	descriptorWrites[8].dstBinding = 1; // image samplers starts from binding = 10
-	descriptorWrites[8].dstArrayElement = 0;
-	descriptorWrites[8].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-	descriptorWrites[8].descriptorCount = 1;
-	descriptorWrites[8].pImageInfo = &depthImageInfo;
+	// binding and buffer, same bindings as createDescriptorSet
+	const uint32_t bindings[] = { 5, 7, 8, 19 };
+	const VulkanBuffer * buffers[] = { &sbo.frustums, &frames[slot].lightIndex, &frames[slot].lightGrid, &frames[slot].tileDepths };
+
+	std::array<VkDescriptorBufferInfo, 4> bufferInfos = {};
+	std::array<VkWriteDescriptorSet, 5> descriptorWrites = {};
+	for (size_t i = 0; i < bufferInfos.size(); ++i) {
+		bufferInfos[i].buffer = buffers[i]->buffer;
+		bufferInfos[i].offset = 0;
+		bufferInfos[i].range = buffers[i]->allocSize;
+
+		descriptorWrites[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		descriptorWrites[i].dstSet = set;
+		descriptorWrites[i].dstBinding = bindings[i];
+		descriptorWrites[i].dstArrayElement = 0;
+		descriptorWrites[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		descriptorWrites[i].descriptorCount = 1;
+		descriptorWrites[i].pBufferInfo = &bufferInfos[i];
+	}
+
+	descriptorWrites[4].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+	descriptorWrites[4].dstSet = set;
+	descriptorWrites[4].dstBinding = 1;
+	descriptorWrites[4].dstArrayElement = 0;
+	descriptorWrites[4].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	descriptorWrites[4].descriptorCount = 1;
+	descriptorWrites[4].pImageInfo = &depthImageInfo;
 
 	vkUpdateDescriptorSets(device, (uint32_t)descriptorWrites.size(), descriptorWrites.data(), 0, nullptr);
 }
 
 void VulkanBaseApplication::createTextureImage(const std::string& texFilename, VkImage & texImage, VkDeviceMemory & texImageMemory) {
+	DecodedImage image;
+	decodeImage(texFilename, image);
+	createTextureImage(image, texImage, texImageMemory);
+}
+
+void VulkanBaseApplication::createTextureImage(const DecodedImage & image, VkImage & texImage, VkDeviceMemory & texImageMemory) {
 
-	int texWidth, texHeight, texChannels;
-	stbi_uc* pixels = stbi_load(texFilename.c_str(), &texWidth, &texHeight, &texChannels, STBI_rgb_alpha);
+	int texWidth = image.width;
+	int texHeight = image.height;
 	VkDeviceSize imageSize = texWidth * texHeight * 4;
 
-	if (!pixels) {
-		std::cout << texFilename.c_str() << " doesn't exist!" << std::endl;
+	if (image.pixels.empty()) {
 		throw std::runtime_error("failed to load texture image!");
 	}
 
@@ -2207,11 +4612,9 @@ void VulkanBaseApplication::createTextureImage(const std::string& texFilename, V
 
 	void* data;
 	vkMapMemory(device, stagingImageMemory, 0, imageSize, 0, &data);
-		memcpy(data, pixels, (size_t)imageSize);
+		memcpy(data, image.pixels.data(), (size_t)imageSize);
 	vkUnmapMemory(device, stagingImageMemory);
 
-	stbi_image_free(pixels);
-
 	createImage(
 		texWidth, texHeight,
 		VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_TILING_OPTIMAL,
@@ -2449,15 +4852,6 @@ bool VulkanBaseApplication::hasStencilComponent(VkFormat format) {
 }
 
 
-void VulkanBaseApplication::createDepthResources() {
-	VkFormat depthFormat = findDepthFormat();
-
-	createImage(swapChainExtent.width, swapChainExtent.height, depthFormat, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, depth.image, depth.mem);
-	createImageView(depth.image, depthFormat, VK_IMAGE_ASPECT_DEPTH_BIT, depth.view);
-
-	transitionImageLayout(depth.image, depthFormat, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL);
-}
-
 void VulkanBaseApplication::prepareTextures() {
 	/*createTextureImage();
 	createTextureImageView();
@@ -2471,9 +4865,10 @@ void VulkanBaseApplication::prepareTextures() {
 
 }
 
-void VulkanBaseApplication::prepareTexture(std::string & texturePath, Texture & texture) {
+void VulkanBaseApplication::prepareTexture(const DecodedImage & image, Texture & texture) {
 
-	createTextureImage(texturePath, texture.image, texture.imageMemory);
+	createTextureImage(image, texture.image, texture.imageMemory);
+	texture.hasAlphaCutout = image.hasAlphaCutout;
 	createTextureImageView(texture.image, texture.imageView);
 	createTextureSampler(texture.sampler);
 
@@ -2481,138 +4876,37 @@ void VulkanBaseApplication::prepareTexture(std::string & texturePath, Texture &
 
 void VulkanBaseApplication::loadModel(std::vector<Vertex> & vertices, std::vector<uint32_t> & indices, const std::string & modelFilename, const std::string & modelBaseDir, float scale) {
 
-	tinyobj::attrib_t attrib;
-	std::vector<tinyobj::shape_t> shapes;
+	MeshData mesh;
 	std::vector<tinyobj::material_t> materials;
-	std::string err;
-
-	if (!tinyobj::LoadObj(&attrib, &shapes, &materials, &err, modelFilename.c_str(), modelBaseDir.c_str())) {
-		throw std::runtime_error(err);
-	}
-
-	std::unordered_map<Vertex, int> uniqueVertices = {};
-
-	for (const auto& shape : shapes) {
-		//for (const auto& index : shape.mesh.indices) {
-		for (int i = 0; i < shape.mesh.indices.size(); i++) {
-			auto& index = shape.mesh.indices[i];
-			Vertex vertex = {};
-
-			vertex.pos = {
-				scale * attrib.vertices[3 * index.vertex_index + 0],
-				scale * attrib.vertices[3 * index.vertex_index + 1],
-				scale * attrib.vertices[3 * index.vertex_index + 2]
-			};
-
-			vertex.texCoord = {
-				attrib.texcoords[2 * index.texcoord_index + 0],
-				1.0f - attrib.texcoords[2 * index.texcoord_index + 1]
-			};
-
-			vertex.color = { 1.0f, 1.0f, 1.0f };
-
-			if (uniqueVertices.count(vertex) == 0) {
-				uniqueVertices[vertex] = (uint32_t)vertices.size();
-				vertices.push_back(vertex);
-			}
-
-			indices.push_back(uniqueVertices[vertex]);
-		}
-	}
-
-
-	// compute triangle normal here
-	for (int i = 0; i < indices.size(); i += 3) {
-		glm::vec3 P1 = vertices[indices[i + 0]].pos;
-		glm::vec3 P2 = vertices[indices[i + 1]].pos;
-		glm::vec3 P3 = vertices[indices[i + 2]].pos;
-
-		glm::vec3 V = P2 - P1;
-		glm::vec3 W = P3 - P1;
+	loadMeshData(mesh, materials, modelFilename, modelBaseDir, scale);
 
-		glm::vec3 N = glm::cross(V, W);
+	uint32_t baseVertex = (uint32_t)vertices.size();
+	std::vector<Vertex> packed;
+	packVertices(mesh, packed);
+	vertices.insert(vertices.end(), packed.begin(), packed.end());
 
-		N = glm::normalize(N);
-		vertices[indices[i + 0]].normal = N;
-		vertices[indices[i + 1]].normal = N;
-		vertices[indices[i + 2]].normal = N;
+	for (uint32_t index : mesh.indices) {
+		indices.push_back(baseVertex + index);
 	}
 }
 
 void VulkanBaseApplication::loadModel(MeshGroup & meshGroup, const std::string & modelFilename, const std::string & modelBaseDir, float scale) {
 
-	tinyobj::attrib_t attrib;
-	std::vector<tinyobj::shape_t> shapes;
-	std::vector<tinyobj::material_t> materials;
-	std::string err;
-
-	if (!tinyobj::LoadObj(&attrib, &shapes, &materials, &err, modelFilename.c_str(), modelBaseDir.c_str())) {
-		throw std::runtime_error(err);
-	}
-
-	std::vector<Vertex> & vertices = meshGroup.vertices.verticesData;
-	std::vector<uint32_t> indices;
-
-	std::unordered_map<Vertex, int> uniqueVertices = {};
-	bool hasNormals = false;
-
-	for (const auto& shape : shapes) {
-		//for (const auto& index : shape.mesh.indices) {
-		for (int i = 0; i < shape.mesh.indices.size(); i++) {
-			auto& index = shape.mesh.indices[i];
-			Vertex vertex = {};
-
-			vertex.pos = {
-				scale * attrib.vertices[3 * index.vertex_index + 0],
-				scale * attrib.vertices[3 * index.vertex_index + 1],
-				scale * attrib.vertices[3 * index.vertex_index + 2]
-			};
-
-			vertex.texCoord = {
-				attrib.texcoords[2 * index.texcoord_index + 0],
-				1.0f - attrib.texcoords[2 * index.texcoord_index + 1]
-			};
-
-			vertex.color = { 1.0f, 1.0f, 1.0f };
-
-			if (!attrib.normals.empty()) {
-				vertex.normal = {
-					attrib.normals[3 * index.normal_index + 0],
-					attrib.normals[3 * index.normal_index + 1],
-					attrib.normals[3 * index.normal_index + 2]
-				};
-				hasNormals = true;
-			}
-
-			if (uniqueVertices.count(vertex) == 0) {
-				uniqueVertices[vertex] = (uint32_t)vertices.size();
-				vertices.push_back(vertex);
-			}
-
-
-			indices.push_back(uniqueVertices[vertex]);
-		}
-	}
-
-
-	// compute triangle normal here
-	if (!hasNormals) {
-		for (int i = 0; i < indices.size(); i += 3) {
-			glm::vec3 P1 = vertices[indices[i + 0]].pos;
-			glm::vec3 P2 = vertices[indices[i + 1]].pos;
-			glm::vec3 P3 = vertices[indices[i + 2]].pos;
+	ModelAssets assets;
+	assets.baseDir = modelBaseDir;
+	loadMeshData(assets.mesh, assets.materials, modelFilename, modelBaseDir, scale);
+	decodeModelTextures(assets);
+	createModel(meshGroup, assets);
+}
 
-			glm::vec3 V = P2 - P1;
-			glm::vec3 W = P3 - P1;
+void VulkanBaseApplication::createModel(MeshGroup & meshGroup, const ModelAssets & assets) {
 
-			glm::vec3 N = glm::cross(V, W);
+	const MeshData & mesh = assets.mesh;
+	const std::vector<tinyobj::material_t> & materials = assets.materials;
 
-			N = glm::normalize(N);
-			vertices[indices[i + 0]].normal = N;
-			vertices[indices[i + 1]].normal = N;
-			vertices[indices[i + 2]].normal = N;
-		}
-	}
+	std::vector<Vertex> & vertices = meshGroup.vertices.verticesData;
+	const std::vector<uint32_t> & indices = mesh.indices;
+	packVertices(mesh, vertices);
 
 
 	// assign material
@@ -2633,8 +4927,7 @@ void VulkanBaseApplication::loadModel(MeshGroup & meshGroup, const std::string &
 			meshMaterials[i].useTextureMap = -1;
 		}
 		else {
-			std::string texMapPath = MODEL_BASE_DIR + texMapName;
-			prepareTexture(texMapPath, meshGroup.textureMaps[i]);
+			prepareTexture(assets.images.at(assets.baseDir + texMapName), meshGroup.textureMaps[i]);
 			meshMaterials[i].useTextureMap = 1;
 		}
 
@@ -2643,8 +4936,7 @@ void VulkanBaseApplication::loadModel(MeshGroup & meshGroup, const std::string &
 			meshMaterials[i].useNormMap = -1;
 		}
 		else {
-			std::string normTexPath = MODEL_BASE_DIR + normTexName;
-			prepareTexture(normTexPath, meshGroup.normalMaps[i]);
+			prepareTexture(assets.images.at(assets.baseDir + normTexName), meshGroup.normalMaps[i]);
 			meshMaterials[i].useNormMap = 1;
 		}
 
@@ -2653,26 +4945,41 @@ void VulkanBaseApplication::loadModel(MeshGroup & meshGroup, const std::string &
 			meshMaterials[i].useSpecMap = -1;
 		}
 		else {
-			std::string specTexPath = MODEL_BASE_DIR + specTexName;
-			prepareTexture(specTexPath, meshGroup.specMaps[i]);
+			prepareTexture(assets.images.at(assets.baseDir + specTexName), meshGroup.specMaps[i]);
 			meshMaterials[i].useSpecMap = 1;
 		}
 
+		// alpha only comes from the diffuse map, see final_shading.frag
+		if (meshMaterials[i].useTextureMap > 0 && meshGroup.textureMaps[i].hasAlphaCutout) {
+			meshGroup.alphaTestedGroups.push_back(i);
+		}
+		else {
+			meshGroup.opaqueGroups.push_back(i);
+		}
 	}
 
-	// group indices by material type
+	// group lod indices by material type, draw items are sorted by material
 	std::vector<IndexBuffer> & indexGroups = meshGroup.indexGroups;
 	indexGroups.resize(materials.size());
+	meshGroup.drawItems = mesh.drawItems;
+	meshGroup.drawItemRanges.assign(materials.size(), glm::uvec2(0));
+	meshGroup.numTriangles = uint32_t(indices.size() / 3);
 
-	int indexCount = 0;
-	for (const auto& shape : shapes) {
-		for (int i = 0; i < shape.mesh.material_ids.size(); ++i) {
+	size_t lodIndexCount = 0;
+	for (uint32_t i = 0; i < mesh.drawItems.size(); ++i) {
+		const MeshDrawItem & item = mesh.drawItems[i];
+
+		glm::uvec2 & range = meshGroup.drawItemRanges[item.materialId];
+		if (range.y == 0) {
+			range.x = i;
+		}
+		range.y++;
 
-			int materialId = shape.mesh.material_ids[i];
-			indexGroups[materialId].indicesData.push_back(indices[indexCount * 3 + 0]);
-			indexGroups[materialId].indicesData.push_back(indices[indexCount * 3 + 1]);
-			indexGroups[materialId].indicesData.push_back(indices[indexCount * 3 + 2]);
-			indexCount++;
+		std::vector<uint32_t> & groupIndices = indexGroups[item.materialId].indicesData;
+		for (uint32_t level = 0; level < item.lodCount; ++level) {
+			auto lodBegin = mesh.lodIndices.begin() + lodIndexCount;
+			groupIndices.insert(groupIndices.end(), lodBegin, lodBegin + item.indexCount[level]);
+			lodIndexCount += item.indexCount[level];
 		}
 	}
 
@@ -2684,6 +4991,7 @@ void VulkanBaseApplication::loadModel(MeshGroup & meshGroup, const std::string &
 	for (auto & index : indexGroups) {
 		createIndexBuffer(index.indicesData, index.buffer, index.mem);
 	}
+	createLodBuffers(meshGroup);
 
 	// create material uniform buffers
 	meshGroup.materialBuffers.resize(materials.size());
@@ -2717,13 +5025,15 @@ void VulkanBaseApplication::loadModel(MeshGroup & meshGroup, const std::string &
 
 
 	// create descriptor sets for different material
-	meshGroup.descriptorSets.resize(materials.size());
-	for (int i = 0; i < meshGroup.descriptorSets.size(); ++i) {
-		createDescriptorSetsForMeshGroup(
-			meshGroup.descriptorSets[i], meshGroup.materialBuffers[i],
-			meshGroup.materials[i].useTextureMap, meshGroup.textureMaps[i],
-			meshGroup.materials[i].useNormMap, meshGroup.normalMaps[i],
-			meshGroup.materials[i].useSpecMap, meshGroup.specMaps[i] );
+	for (int slot = 0; slot < MAX_FRAMES_IN_FLIGHT; ++slot) {
+		meshGroup.descriptorSets[slot].resize(materials.size());
+		for (int i = 0; i < meshGroup.descriptorSets[slot].size(); ++i) {
+			createDescriptorSetsForMeshGroup(slot,
+				meshGroup.descriptorSets[slot][i], meshGroup.materialBuffers[i],
+				meshGroup.materials[i].useTextureMap, meshGroup.textureMaps[i],
+				meshGroup.materials[i].useNormMap, meshGroup.normalMaps[i],
+				meshGroup.materials[i].useSpecMap, meshGroup.specMaps[i] );
+		}
 	}
 
 
@@ -2733,12 +5043,687 @@ void VulkanBaseApplication::loadModel(MeshGroup & meshGroup, const std::string &
 		<< "Model informations: \n"
 		<< "unique vertices count = " << vertices.size() << std::endl
 		<< "triangles count = " << indices.size() / 3 << std::endl
+		<< "draw items count = " << meshGroup.drawItems.size() << std::endl
+		<< "lod indices count = " << mesh.lodIndices.size() << std::endl
 		<< "materials count = " << meshGroup.materials.size() << std::endl
-		<< "objects count = " << shapes.size() << std::endl
+		<< "alpha-tested materials count = " << meshGroup.alphaTestedGroups.size() << std::endl
+		<< "objects count = " << mesh.objectCount << std::endl
 		<< "=================================================================================\n" ;
 }
 
-void VulkanBaseApplication::createDescriptorSetsForMeshGroup(VkDescriptorSet & descriptorSet, VulkanBuffer & buffer, int useTex, Texture & texMap, int useNorm, Texture & norMap, int useSpec, Texture & specMap) {
+void VulkanBaseApplication::createLodBuffers(MeshGroup & meshGroup) {
+	// draw items, static
+	VkDeviceSize bufferSize = sizeof(MeshDrawItem) * std::max<size_t>(meshGroup.drawItems.size(), 1);
+	VulkanBuffer staging;
+	void* data;
+
+	createBuffer(bufferSize,
+		VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+		staging.buffer, staging.memory);
+
+	vkMapMemory(device, staging.memory, 0, bufferSize, 0, &data);
+		memcpy(data, meshGroup.drawItems.data(), sizeof(MeshDrawItem) * meshGroup.drawItems.size());
+	vkUnmapMemory(device, staging.memory);
+
+	meshGroup.drawItemBuffer.allocSize = bufferSize;
+	createBuffer(bufferSize,
+		VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+		meshGroup.drawItemBuffer.buffer, meshGroup.drawItemBuffer.memory);
+
+	copyBuffer(staging.buffer, meshGroup.drawItemBuffer.buffer, bufferSize);
+	staging.cleanup(device);
+
+	// indirect draws, one per frame in flight, host visible so the cpu selector
+	// can write them and the triangle count can be read back when the gpu selects
+	bufferSize = sizeof(VkDrawIndexedIndirectCommand) * std::max<size_t>(meshGroup.drawItems.size(), 1);
+	for (int slot = 0; slot < MAX_FRAMES_IN_FLIGHT; ++slot) {
+		VulkanBuffer & indirectBuffer = meshGroup.indirectBuffers[slot];
+		indirectBuffer.allocSize = bufferSize;
+		createBuffer(bufferSize,
+			VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+			indirectBuffer.buffer, indirectBuffer.memory);
+
+		// start with full detail
+		vkMapMemory(device, indirectBuffer.memory, 0, bufferSize, 0, &data);
+		VkDrawIndexedIndirectCommand * draws = (VkDrawIndexedIndirectCommand*)data;
+		for (size_t i = 0; i < meshGroup.drawItems.size(); ++i) {
+			draws[i] = { meshGroup.drawItems[i].indexCount[0], 1, meshGroup.drawItems[i].firstIndex[0], 0, 0 };
+		}
+		vkUnmapMemory(device, indirectBuffer.memory);
+	}
+
+	// bind to every frame's global descriptor set for selectLod.comp
+	VkDescriptorBufferInfo drawItemsDescriptorInfo = {};
+	drawItemsDescriptorInfo.buffer = meshGroup.drawItemBuffer.buffer;
+	drawItemsDescriptorInfo.offset = 0;
+	drawItemsDescriptorInfo.range = meshGroup.drawItemBuffer.allocSize;
+
+	for (int slot = 0; slot < MAX_FRAMES_IN_FLIGHT; ++slot) {
+		FrameInFlight & inFlight = frames[slot];
+
+		VkDescriptorBufferInfo indirectDrawsDescriptorInfo = {};
+		indirectDrawsDescriptorInfo.buffer = meshGroup.indirectBuffers[slot].buffer;
+		indirectDrawsDescriptorInfo.offset = 0;
+		indirectDrawsDescriptorInfo.range = meshGroup.indirectBuffers[slot].allocSize;
+
+		std::array<VkWriteDescriptorSet, 2> descriptorWrites = {};
+
+		descriptorWrites[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		descriptorWrites[0].dstSet = inFlight.descriptorSet;
+		descriptorWrites[0].dstBinding = 14;
+		descriptorWrites[0].dstArrayElement = 0;
+		descriptorWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		descriptorWrites[0].descriptorCount = 1;
+		descriptorWrites[0].pBufferInfo = &drawItemsDescriptorInfo;
+
+		descriptorWrites[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		descriptorWrites[1].dstSet = inFlight.descriptorSet;
+		descriptorWrites[1].dstBinding = 15;
+		descriptorWrites[1].dstArrayElement = 0;
+		descriptorWrites[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		descriptorWrites[1].descriptorCount = 1;
+		descriptorWrites[1].pBufferInfo = &indirectDrawsDescriptorInfo;
+
+		vkUpdateDescriptorSets(device, (uint32_t)descriptorWrites.size(), descriptorWrites.data(), 0, nullptr);
+	}
+}
+
+void VulkanBaseApplication::updateLodSelection() {
+	MeshGroup & meshGroup = meshs.meshGroupScene;
+	const UBO_vsParams & vsParams = uboHostData.vsParams;
+	const UBO_csParams & csParams = uboHostData.csParams;
+
+	// the frame that used this slot before is done (see waitForFrame), the
+	// frames still in flight draw from the buffers of their own slots
+	VulkanBuffer & indirectBuffer = meshGroup.indirectBuffers[currentFrame];
+	void* data;
+	vkMapMemory(device, indirectBuffer.memory, 0, indirectBuffer.allocSize, 0, &data);
+	VkDrawIndexedIndirectCommand * draws = (VkDrawIndexedIndirectCommand*)data;
+
+	if (!bGpuLodSelection) {
+		glm::mat4 modelView = vsParams.view * vsParams.model;
+		std::atomic<bool> changed(false);
+		MeshTools::parallelFor(meshGroup.drawItems.size(), [&](size_t begin, size_t end) {
+			for (size_t i = begin; i < end; ++i) {
+				const MeshDrawItem & item = meshGroup.drawItems[i];
+				uint32_t lod = MeshTools::selectLod(item, modelView, csParams.lodProjScale, csParams.lodPixelError);
+				if (draws[i].firstIndex != item.firstIndex[lod]) {
+					changed = true;
+				}
+				draws[i].indexCount = item.indexCount[lod];
+				draws[i].firstIndex = item.firstIndex[lod];
+			}
+		}, 256);
+		lodSelectionChanged = changed;
+	} else {
+		// selectLod.comp only depends on the view
+		lodSelectionChanged = false;
+	}
+
+	// the other path drew the last frames, the prepass depth of every slot is stale
+	if (bGpuLodSelection != lodSelectedOnGpu) {
+		lodSelectionChanged = true;
+		lodSelectedOnGpu = bGpuLodSelection;
+	}
+
+	// triangle count of what gets drawn this frame (a few frames behind for the gpu path)
+	uint32_t numIndices = 0;
+	for (size_t i = 0; i < meshGroup.drawItems.size(); ++i) {
+		numIndices += draws[i].indexCount;
+	}
+	numTrianglesDrawn = numIndices / 3;
+
+	vkUnmapMemory(device, indirectBuffer.memory);
+}
+
+void VulkanBaseApplication::verifyLodSelection() {
+	MeshGroup & meshGroup = meshs.meshGroupScene;
+
+	// gpu selection of the frame shaded last, see verifyLightCulling
+	vkDeviceWaitIdle(device);
+	int slot = (pendingFrame + MAX_FRAMES_IN_FLIGHT - 1) % MAX_FRAMES_IN_FLIGHT;
+	if (pendingFrame < 0 || !(frames[slot].enabledPasses & (1u << frameGraph.lodPass))) {
+		std::cout << "the frame shaded last did not select lods on the gpu, move the view and press V again" << std::endl;
+		return;
+	}
+	FrameInFlight & inFlight = frames[slot];
+
+	// the params that frame selected with
+	UBO_vsParams vsParams;
+	UBO_csParams csParams;
+	void* data;
+	vkMapMemory(device, inFlight.ubo.vsSceneStaging.memory, 0, sizeof(vsParams), 0, &data);
+		memcpy(&vsParams, data, sizeof(vsParams));
+	vkUnmapMemory(device, inFlight.ubo.vsSceneStaging.memory);
+	vkMapMemory(device, inFlight.ubo.csParamsStaging.memory, 0, sizeof(csParams), 0, &data);
+		memcpy(&csParams, data, sizeof(csParams));
+	vkUnmapMemory(device, inFlight.ubo.csParamsStaging.memory);
+
+	std::vector<VkDrawIndexedIndirectCommand> draws(meshGroup.drawItems.size());
+	const VulkanBuffer & indirectBuffer = meshGroup.indirectBuffers[slot];
+	vkMapMemory(device, indirectBuffer.memory, 0, indirectBuffer.allocSize, 0, &data);
+		memcpy(draws.data(), data, sizeof(VkDrawIndexedIndirectCommand) * draws.size());
+	vkUnmapMemory(device, indirectBuffer.memory);
+
+	// same selection on the cpu, items on a threshold may round the other way
+	glm::mat4 modelView = vsParams.view * vsParams.model;
+	int mismatchedItems = 0;
+	int maxLodDiff = 0;
+	for (size_t i = 0; i < meshGroup.drawItems.size(); ++i) {
+		const MeshDrawItem & item = meshGroup.drawItems[i];
+		uint32_t cpuLod = MeshTools::selectLod(item, modelView, csParams.lodProjScale, csParams.lodPixelError);
+		uint32_t gpuLod = 0;
+		while (gpuLod + 1 < item.lodCount && item.firstIndex[gpuLod] != draws[i].firstIndex) {
+			gpuLod++;
+		}
+		if (draws[i].firstIndex != item.firstIndex[cpuLod] || draws[i].indexCount != item.indexCount[cpuLod]) {
+			mismatchedItems++;
+			maxLodDiff = std::max(maxLodDiff, std::abs(int(gpuLod) - int(cpuLod)));
+		}
+	}
+
+	std::cout
+		<< "=================================================================================\n"
+		<< "Lod selection verification (pixel error = " << csParams.lodPixelError << "): \n"
+		<< "draw items = " << meshGroup.drawItems.size() << std::endl
+		<< "mismatched items = " << mismatchedItems << " (max lod difference = " << maxLodDiff << ")" << std::endl
+		<< "=================================================================================\n";
+}
+
+void VulkanBaseApplication::printOverdrawEstimate() {
+	MeshGroup & meshGroup = meshs.meshGroupScene;
+	const UBO_vsParams & vsParams = uboHostData.vsParams;
+
+	std::vector<glm::vec3> positions(meshGroup.vertices.verticesData.size());
+	for (size_t i = 0; i < positions.size(); ++i) {
+		positions[i] = meshGroup.vertices.verticesData[i].pos;
+	}
+
+	// the lods selected for the frame just submitted, in draw order. The gpu
+	// selection may still be writing them
+	vkDeviceWaitIdle(device);
+	const VulkanBuffer & indirectBuffer = meshGroup.indirectBuffers[(currentFrame + MAX_FRAMES_IN_FLIGHT - 1) % MAX_FRAMES_IN_FLIGHT];
+	std::vector<uint32_t> indices;
+	void* data;
+	vkMapMemory(device, indirectBuffer.memory, 0, indirectBuffer.allocSize, 0, &data);
+	const VkDrawIndexedIndirectCommand * draws = (const VkDrawIndexedIndirectCommand*)data;
+	for (uint32_t groupId = 0; groupId < meshGroup.indexGroups.size(); ++groupId) {
+		const glm::uvec2 & range = meshGroup.drawItemRanges[groupId];
+		const std::vector<uint32_t> & groupIndices = meshGroup.indexGroups[groupId].indicesData;
+		for (uint32_t i = range.x; i < range.x + range.y; ++i) {
+			auto begin = groupIndices.begin() + draws[i].firstIndex;
+			indices.insert(indices.end(), begin, begin + draws[i].indexCount);
+		}
+	}
+	vkUnmapMemory(device, indirectBuffer.memory);
+
+	auto startTime = std::chrono::high_resolution_clock::now();
+	glm::mat4 mvp = vsParams.proj * vsParams.view * vsParams.model;
+	OverdrawStats stats = MeshTools::estimateOverdraw(positions, indices, mvp, swapChainExtent.width, swapChainExtent.height);
+	float ms = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - startTime).count();
+
+	float pixels = float(std::max<uint64_t>(stats.coveredPixels, 1));
+	std::cout
+		<< "=================================================================================\n"
+		<< "Overdraw estimate (" << ms << " ms): \n"
+		<< "covered pixels = " << stats.coveredPixels << std::endl
+		<< "rasterized fragments = " << stats.rasterized << " (" << stats.rasterized / pixels << "x)" << std::endl
+		<< "shaded, depth LESS = " << stats.shadedLess << " (" << stats.shadedLess / pixels << "x)" << std::endl
+		<< "shaded, prepass depth EQUAL = " << stats.shadedEqual << " (" << stats.shadedEqual / pixels << "x)" << std::endl
+		<< "fragment invocations saved = " << stats.shadedLess - std::min(stats.shadedLess, stats.shadedEqual) << std::endl
+		<< "=================================================================================\n";
+}
+
+void VulkanBaseApplication::createTimestampQueryPool() {
+	uint32_t queueFamilyCount = 0;
+	vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, nullptr);
+	std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
+	vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, queueFamilies.data());
+
+	VkPhysicalDeviceProperties properties;
+	vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+
+	// written by the compute and the display command buffers
+	if (queueFamilies[computeQueueFamily].timestampValidBits == 0 || queueFamilies[graphicsQueueFamily].timestampValidBits == 0
+		|| properties.limits.timestampPeriod <= 0.0f) {
+		std::cout << "gpu timestamps are not supported, no gpu timings" << std::endl;
+		return;
+	}
+
+	// FrameTimestamp for every frame in flight
+	VkQueryPoolCreateInfo queryPoolInfo = {};
+	queryPoolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+	queryPoolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+	queryPoolInfo.queryCount = NUM_FRAME_TIMESTAMPS * MAX_FRAMES_IN_FLIGHT;
+
+	if (vkCreateQueryPool(device, &queryPoolInfo, nullptr, timestampQueryPool.replace()) != VK_SUCCESS) {
+		throw std::runtime_error("failed to create timestamp query pool!");
+	}
+	timestampPeriod = properties.limits.timestampPeriod;
+}
+
+void VulkanBaseApplication::updateGpuTimings() {
+	// the frame that used this slot before is done (see waitForFrame)
+	const FrameInFlight & inFlight = frames[currentFrame];
+	if (timestampPeriod <= 0.0f || inFlight.enabledPasses == 0) {
+		// nothing written yet, or the frame was dropped
+		gpuTimings.lastShadingBegin = gpuTimings.lastShadingEnd = 0;
+		return;
+	}
+
+	const uint32_t firstQuery = currentFrame * NUM_FRAME_TIMESTAMPS;
+	const float msPerTick = timestampPeriod / 1000000.0f;
+	uint64_t shading[2];
+	if (vkGetQueryPoolResults(device, timestampQueryPool, firstQuery + TIMESTAMP_SHADING, 2, sizeof(shading), shading,
+			sizeof(uint64_t), VK_QUERY_RESULT_64_BIT) != VK_SUCCESS) {
+		return;
+	}
+	gpuTimings.shading = float(shading[1] - shading[0]) * msPerTick;
+
+	// the culling of this frame was submitted before the shading of the frame
+	// read back last, the overlap is how much of it ran at the same time. Both
+	// queues are assumed to count in the same time domain, true for the queues
+	// of one device on the drivers we tried
+	gpuTimings.cullShadeOverlap = 0.0f;
+	if (inFlight.enabledPasses & (1u << frameGraph.cullPass)) {
+		uint64_t culling[3];
+		if (vkGetQueryPoolResults(device, timestampQueryPool, firstQuery + TIMESTAMP_LIGHT_UPDATE, 3, sizeof(culling), culling,
+				sizeof(uint64_t), VK_QUERY_RESULT_64_BIT) == VK_SUCCESS) {
+			gpuTimings.lightUpdate = float(culling[TIMESTAMP_CULLING] - culling[TIMESTAMP_LIGHT_UPDATE]) * msPerTick;
+			gpuTimings.lightCulling = float(culling[TIMESTAMP_CULLING_END] - culling[TIMESTAMP_CULLING]) * msPerTick;
+
+			uint64_t begin = std::max(culling[TIMESTAMP_LIGHT_UPDATE], gpuTimings.lastShadingBegin);
+			uint64_t end = std::min(culling[TIMESTAMP_CULLING_END], gpuTimings.lastShadingEnd);
+			if (gpuTimings.lastShadingEnd != 0 && end > begin) {
+				gpuTimings.cullShadeOverlap = float(end - begin) * msPerTick;
+			}
+		}
+	}
+
+	gpuTimings.lastShadingBegin = shading[0];
+	gpuTimings.lastShadingEnd = shading[1];
+}
+
+void VulkanBaseApplication::updateCullingCache() {
+	const UBO_csParams & csParams = uboHostData.csParams;
+	CullingCache & cache = cullingCache;
+	CullingCache::Lists & lists = cache.lists[currentFrame];
+	FrameInFlight & inFlight = frames[currentFrame];
+
+	// the prepass depth also changes under the same view when the geometry
+	// does: a new lod selection, or a new lod pixel error for the gpu selection
+	if (csParams.viewMat != cache.lastViewMat || lodSelectionChanged || csParams.lodPixelError != cache.lastLodPixelError) {
+		cache.depthGeneration++;
+	}
+	if (csParams.time != cache.lastLightTime) {
+		cache.lightVersion++;
+	}
+	cache.lastViewMat = csParams.viewMat;
+	cache.lastLightTime = csParams.time;
+	cache.lastLodPixelError = csParams.lodPixelError;
+
+	bool sameView = csParams.viewMat == lists.culledViewMat;
+	bool sameLights = cache.lightVersion == lists.culledLightVersion;
+	bool sameDepth = cache.depthGeneration == lists.culledDepthGeneration;
+
+	// the frame that used this slot before is done (see waitForFrame)
+	void* data;
+	vkMapMemory(device, inFlight.cullingCache.memory, 0, inFlight.cullingCache.allocSize, 0, &data);
+	SBO_cullingCache * counters = (SBO_cullingCache*)data;
+	cache.recomputedTiles = (inFlight.enabledPasses & (1u << frameGraph.cullPass)) ? counters->recomputedTiles : 0;
+
+	cache.skipCulling = bCacheLightCulling && sameView && sameLights && sameDepth;
+
+	// the lights only moved by edits of a few slots
+	uint32_t numEdited = 0;
+	for (const glm::uvec2 & range : lists.editedLights) {
+		numEdited += range.y;
+	}
+	bool fewEdits = lists.editedLightVersion == cache.lightVersion
+		&& lists.editedLights.size() <= MAX_MOVED_LIGHT_RANGES && numEdited <= MAX_MOVED_LIGHTS;
+
+	// same view: tiles with the same depth bounds keep their list, unless an
+	// edited light was in it or touches the tile now. The cooperative and
+	// binning kernels always rebuild every tile
+	counters->recomputedTiles = 0;
+	counters->reuseTileLists = bCacheLightCulling && sameView && (sameLights || fewEdits) && !frameGraph.frustumsDirty
+		&& LIGHT_CULL_MODE != LIGHT_CULL_COOPERATIVE && LIGHT_CULL_MODE != LIGHT_CULL_BINNING ? 1 : 0;
+	counters->numMovedRanges = 0;
+	if (!sameLights && fewEdits) {
+		for (const glm::uvec2 & range : lists.editedLights) {
+			counters->movedRanges[counters->numMovedRanges++] = glm::ivec2(range);
+		}
+	}
+	vkUnmapMemory(device, inFlight.cullingCache.memory);
+	lists.editedLights.clear();
+
+	lists.culledViewMat = csParams.viewMat;
+	lists.culledLightVersion = cache.lightVersion;
+	lists.culledDepthGeneration = cache.depthGeneration;
+}
+
+void VulkanBaseApplication::updateLightListStats() {
+	// the frame that used this slot before is done (see waitForFrame)
+	const FrameInFlight & inFlight = frames[currentFrame];
+	if (inFlight.enabledPasses == 0) {
+		// nothing written yet, or the frame was dropped
+		return;
+	}
+
+	if (!lightListStatsJob.done()) {
+		// still busy, skip this frame
+		return;
+	}
+	lightListStats = pendingLightListStats;
+
+	std::vector<int> lightGrid(fpParams.numThreads.x * fpParams.numThreads.y);
+	void* data;
+	vkMapMemory(device, inFlight.lightGridReadback.memory, 0, inFlight.lightGridReadback.allocSize, 0, &data);
+		memcpy(lightGrid.data(), data, sizeof(int) * lightGrid.size());
+	vkUnmapMemory(device, inFlight.lightGridReadback.memory);
+
+	jobs.run("light list stats", [this, lightGrid = std::move(lightGrid)]() {
+		pendingLightListStats = LightCulling::computeListStats(lightGrid, MAX_NUM_LIGHTS_PER_TILE);
+	}, &lightListStatsJob);
+}
+
+void VulkanBaseApplication::toggleFrameStats() {
+	if (frameStatsFile.is_open()) {
+		frameStatsFile.close();
+		std::cout << "Stopped writing " << FRAME_STATS_PATH << std::endl;
+		return;
+	}
+
+	frameStatsFile.open(FRAME_STATS_PATH, std::ios::trunc);
+	if (!frameStatsFile.is_open()) {
+		std::cout << "failed to open " << FRAME_STATS_PATH << "!" << std::endl;
+		return;
+	}
+
+	frameStatsFile << "frame,frame_ms,gpu_light_update_ms,gpu_light_culling_ms,gpu_shading_ms,gpu_cull_shade_overlap_ms,pixels_per_tile,num_lights,"
+		<< "recomputed_tiles,lights_per_tile_mean,lights_per_tile_max,full_tiles,light_index_used,light_index_capacity";
+	int binWidth = MAX_NUM_LIGHTS_PER_TILE / (LIGHT_LIST_HISTOGRAM_BINS - 1);
+	for (int bin = 0; bin < LIGHT_LIST_HISTOGRAM_BINS - 1; ++bin) {
+		frameStatsFile << ",tiles_" << bin * binWidth << "_" << (bin + 1) * binWidth - 1;
+	}
+	frameStatsFile << ",tiles_full" << std::endl;
+	std::cout << "Writing " << FRAME_STATS_PATH << ", press C again to stop" << std::endl;
+}
+
+void VulkanBaseApplication::exportFrameStats(int frameCount, float elapsedTime) {
+	const LightListStats & stats = lightListStats;
+	frameStatsFile << frameCount << "," << elapsedTime << ","
+		<< gpuTimings.lightUpdate << "," << gpuTimings.lightCulling << ","
+		<< gpuTimings.shading << "," << gpuTimings.cullShadeOverlap << ","
+		<< PIXELS_PER_TILE << "," << fpParams.numLights << ","
+		<< cullingCache.recomputedTiles << ","
+		<< stats.meanLights << "," << stats.maxLights << "," << stats.fullTiles << ","
+		<< stats.usedIndices << "," << stats.indexCapacity;
+	for (int count : stats.histogram) {
+		frameStatsFile << "," << count;
+	}
+	frameStatsFile << "\n";
+}
+
+void VulkanBaseApplication::updateLightBvh() {
+	if (LIGHT_CULL_MODE != LIGHT_CULL_BVH || cullingCache.skipCulling) {
+		return;
+	}
+
+	const UBO_csParams & csParams = uboHostData.csParams;
+	const SBO_lights & lights = sboHostData.lights;
+
+	// world space bounds of this frame's lights, same animation as updateLights.comp.
+	// The gpu animates them again, the spheres grow by the worst case difference
+	auto startTime = std::chrono::high_resolution_clock::now();
+	std::vector<glm::vec4> worldSpheres(fpParams.numLights);
+	MeshTools::parallelFor(worldSpheres.size(), [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; ++i) {
+			glm::vec3 beginPos = glm::vec3(lights.beginPos[i]);
+			glm::vec3 endPos = glm::vec3(lights.endPos[i]);
+			glm::vec3 position = LightCulling::animatedPosition(beginPos, endPos, csParams.time, lights.endPos[i].w);
+			worldSpheres[i] = LightCulling::computeCullShape(lights.type[i], position, lights.beginPos[i].w,
+				lights.direction[i], lights.shape[i], glm::mat4(1.0f)).sphere;
+			worldSpheres[i].w += LightCulling::animatedPositionError(beginPos, endPos, csParams.time, lights.endPos[i].w);
+		}
+	});
+	FrameInFlight & inFlight = frames[currentFrame];
+	LightCulling::buildLightBvh(worldSpheres, csParams.viewMat, inFlight.lightBvh);
+	lightBvhBuildTime = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - startTime).count();
+
+	// the frame that used this slot before is done (see waitForFrame)
+	void* data;
+	vkMapMemory(device, inFlight.sortedLights.memory, 0, inFlight.sortedLights.allocSize, 0, &data);
+		memcpy(data, inFlight.lightBvh.sortedLights.data(), sizeof(int) * inFlight.lightBvh.sortedLights.size());
+	vkUnmapMemory(device, inFlight.sortedLights.memory);
+
+	vkMapMemory(device, inFlight.lightBvhNodes.memory, 0, inFlight.lightBvhNodes.allocSize, 0, &data);
+		memcpy(data, inFlight.lightBvh.nodes.data(), sizeof(LightBvhNode) * inFlight.lightBvh.nodes.size());
+	vkUnmapMemory(device, inFlight.lightBvhNodes.memory);
+}
+
+void VulkanBaseApplication::verifyLightCulling() {
+	// gpu results of the frame shaded last. The pending frame is culled but
+	// with async compute its lists are still owned by the compute queue
+	vkDeviceWaitIdle(device);
+	int slot = (pendingFrame + MAX_FRAMES_IN_FLIGHT - 1) % MAX_FRAMES_IN_FLIGHT;
+	if (pendingFrame < 0 || frames[slot].enabledPasses == 0) {
+		std::cout << "no frame shaded since the last resize, nothing to verify" << std::endl;
+		return;
+	}
+	FrameInFlight & inFlight = frames[slot];
+
+	// the params that frame culled with
+	UBO_csParams csParams;
+	void* data;
+	vkMapMemory(device, inFlight.ubo.csParamsStaging.memory, 0, sizeof(csParams), 0, &data);
+		memcpy(&csParams, data, sizeof(csParams));
+	vkUnmapMemory(device, inFlight.ubo.csParamsStaging.memory);
+
+	const SBO_lights & lights = sboHostData.lights;
+	int width = swapChainExtent.width;
+	int height = swapChainExtent.height;
+	int numTiles = fpParams.numThreads.x * fpParams.numThreads.y;
+
+	std::vector<float> depth;
+	readBackDepth(depth, slot);
+
+	std::vector<TileFrustum> frustums(numTiles);
+	std::vector<int> gpuLightGrid(numTiles);
+	std::vector<int> gpuLightIndex(numTiles * MAX_NUM_LIGHTS_PER_TILE);
+	readBackBuffer(sbo.frustums.buffer, sizeof(TileFrustum) * numTiles, frustums.data());
+	readBackBuffer(inFlight.lightGrid.buffer, sizeof(int) * numTiles, gpuLightGrid.data());
+	readBackBuffer(inFlight.lightIndex.buffer, sizeof(int) * gpuLightIndex.size(), gpuLightIndex.data());
+
+	// cpu reference with the same params
+	auto startTime = std::chrono::high_resolution_clock::now();
+	std::vector<LightCullShape> cullShapes(fpParams.numLights);
+	for (int i = 0; i < fpParams.numLights; ++i) {
+		glm::vec3 position = LightCulling::animatedPosition(glm::vec3(lights.beginPos[i]), glm::vec3(lights.endPos[i]), csParams.time, lights.endPos[i].w);
+		cullShapes[i] = LightCulling::computeCullShape(lights.type[i], position, lights.beginPos[i].w,
+			lights.direction[i], lights.shape[i], csParams.viewMat);
+	}
+
+	std::vector<glm::vec2> depthRanges;
+	std::vector<TileDepthMask> depthMasks;
+	const std::vector<TileDepthMask> * masks = bDepthMaskCulling ? &depthMasks : nullptr;
+	LightCulling::computeTileDepthRanges(depth, width, height, csParams.inverseProj, fpParams.numThreads, PIXELS_PER_TILE, depthRanges, &depthMasks);
+
+	std::vector<int> cpuLightGrid;
+	std::vector<int> cpuLightIndex;
+	if (LIGHT_CULL_MODE == LIGHT_CULL_BVH) {
+		LightCulling::cullTilesBvh(cullShapes, inFlight.lightBvh, frustums, depthRanges, MAX_NUM_LIGHTS_PER_TILE, cpuLightIndex, cpuLightGrid, masks);
+	} else if (LIGHT_CULL_MODE == LIGHT_CULL_SUPERTILE) {
+		LightCulling::cullTilesSupertile(cullShapes, frustums, depthRanges, fpParams.numThreads, TILES_PER_THREADGROUP, MAX_NUM_LIGHTS_PER_TILE, cpuLightIndex, cpuLightGrid, masks);
+	} else if (LIGHT_CULL_MODE == LIGHT_CULL_BINNING) {
+		LightCulling::cullTilesBinned(cullShapes, frustums, depthRanges, csParams.inverseProj, glm::vec2(width, height), fpParams.numThreads, PIXELS_PER_TILE, MAX_NUM_LIGHTS_PER_TILE, cpuLightIndex, cpuLightGrid, masks);
+	} else {
+		LightCulling::cullTiles(cullShapes, frustums, depthRanges, MAX_NUM_LIGHTS_PER_TILE, cpuLightIndex, cpuLightGrid, masks);
+	}
+	float ms = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - startTime).count();
+
+	// the other cpu cullers on the same input, for comparison
+	std::vector<int> benchLightIndex;
+	std::vector<int> benchLightGrid;
+	startTime = std::chrono::high_resolution_clock::now();
+	LightCulling::cullTiles(cullShapes, frustums, depthRanges, MAX_NUM_LIGHTS_PER_TILE, benchLightIndex, benchLightGrid, masks);
+	float linearMs = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - startTime).count();
+	uint64_t planeTotal = 0;
+	for (int count : benchLightGrid) {
+		planeTotal += count;
+	}
+
+	startTime = std::chrono::high_resolution_clock::now();
+	LightCulling::cullTilesBinned(cullShapes, frustums, depthRanges, csParams.inverseProj, glm::vec2(width, height), fpParams.numThreads, PIXELS_PER_TILE, MAX_NUM_LIGHTS_PER_TILE, benchLightIndex, benchLightGrid, masks);
+	float binningMs = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - startTime).count();
+	uint64_t rectTotal = 0;
+	for (int count : benchLightGrid) {
+		rectTotal += count;
+	}
+
+	startTime = std::chrono::high_resolution_clock::now();
+	LightCulling::cullTilesSupertile(cullShapes, frustums, depthRanges, fpParams.numThreads, TILES_PER_THREADGROUP, MAX_NUM_LIGHTS_PER_TILE, benchLightIndex, benchLightGrid, masks);
+	float supertileMs = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - startTime).count();
+
+	// min / max depth only and with the depth masks, for the 2.5D culling gain
+	uint64_t minMaxTotal = 0;
+	uint64_t depthMaskTotal = 0;
+	LightCulling::cullTiles(cullShapes, frustums, depthRanges, MAX_NUM_LIGHTS_PER_TILE, benchLightIndex, benchLightGrid);
+	for (int count : benchLightGrid) {
+		minMaxTotal += count;
+	}
+	LightCulling::cullTiles(cullShapes, frustums, depthRanges, MAX_NUM_LIGHTS_PER_TILE, benchLightIndex, benchLightGrid, &depthMasks);
+	for (int count : benchLightGrid) {
+		depthMaskTotal += count;
+	}
+
+	// compare the lists tile by tile
+	int mismatchedTiles = 0;
+	int maxCountDiff = 0;
+	uint64_t gpuTotal = 0;
+	uint64_t cpuTotal = 0;
+	for (int tile = 0; tile < numTiles; ++tile) {
+		gpuTotal += gpuLightGrid[tile];
+		cpuTotal += cpuLightGrid[tile];
+		maxCountDiff = std::max(maxCountDiff, std::abs(gpuLightGrid[tile] - cpuLightGrid[tile]));
+
+		auto gpuBegin = gpuLightIndex.begin() + tile * MAX_NUM_LIGHTS_PER_TILE;
+		auto cpuBegin = cpuLightIndex.begin() + tile * MAX_NUM_LIGHTS_PER_TILE;
+		bool unordered = LIGHT_CULL_MODE == LIGHT_CULL_COOPERATIVE || LIGHT_CULL_MODE == LIGHT_CULL_BINNING;
+		if (unordered && gpuLightGrid[tile] < MAX_NUM_LIGHTS_PER_TILE) {
+			// appended with atomics, any order
+			std::sort(gpuBegin, gpuBegin + gpuLightGrid[tile]);
+		}
+		if (unordered && gpuLightGrid[tile] >= MAX_NUM_LIGHTS_PER_TILE) {
+			// a full list can be any subset, only the count is comparable
+			if (gpuLightGrid[tile] != cpuLightGrid[tile]) {
+				mismatchedTiles++;
+			}
+		} else if (gpuLightGrid[tile] != cpuLightGrid[tile] || !std::equal(gpuBegin, gpuBegin + gpuLightGrid[tile], cpuBegin)) {
+			mismatchedTiles++;
+		}
+	}
+
+	int lightTypeCounts[4] = { 0, 0, 0, 0 };
+	for (int i = 0; i < fpParams.numLights; ++i) {
+		lightTypeCounts[lights.type[i]]++;
+	}
+
+	const char * cullModeNames[] = { "linear", "bvh", "supertile", "cooperative", "binning" };
+	std::cout
+		<< "=================================================================================\n"
+		<< "Light culling verification (" << cullModeNames[LIGHT_CULL_MODE] << (bDepthMaskCulling ? ", depth mask" : "") << "): \n"
+		<< "lights (point/spot/tube/rect) = " << lightTypeCounts[LIGHT_POINT] << "/" << lightTypeCounts[LIGHT_SPOT]
+			<< "/" << lightTypeCounts[LIGHT_TUBE] << "/" << lightTypeCounts[LIGHT_RECT] << std::endl
+		<< "tiles = " << numTiles << std::endl
+		<< "average lights per tile (gpu) = " << float(gpuTotal) / numTiles << std::endl
+		<< "average lights per tile (cpu) = " << float(cpuTotal) / numTiles << std::endl
+		<< "average lights per tile min/max depth / depth mask = " << float(minMaxTotal) / numTiles << " / " << float(depthMaskTotal) / numTiles
+			<< " (" << 100.0f * (1.0f - float(depthMaskTotal) / float(std::max<uint64_t>(minMaxTotal, 1))) << "% fewer)" << std::endl
+		<< "average lights per tile plane tests / screen rect = " << float(planeTotal) / numTiles << " / " << float(rectTotal) / numTiles << std::endl
+		<< "mismatched tiles = " << mismatchedTiles << " (max count difference = " << maxCountDiff << ")" << std::endl
+		<< "cpu reference culling time = " << ms << " ms" << std::endl
+		<< "cpu linear / supertile / binning culling time = " << linearMs << " / " << supertileMs << " / " << binningMs << " ms" << std::endl
+		<< "gpu light update / culling time = " << gpuTimings.lightUpdate << " / " << gpuTimings.lightCulling
+			<< " ms (" << PIXELS_PER_TILE << "*" << PIXELS_PER_TILE << " pixels per tile)" << std::endl
+		<< "=================================================================================\n";
+}
+
+void VulkanBaseApplication::readBackBuffer(VkBuffer buffer, VkDeviceSize size, void * dst) {
+	VulkanBuffer staging;
+	createBuffer(size,
+		VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+		staging.buffer, staging.memory);
+
+	copyBuffer(buffer, staging.buffer, size);
+
+	void* data;
+	vkMapMemory(device, staging.memory, 0, size, 0, &data);
+		memcpy(dst, data, (size_t)size);
+	vkUnmapMemory(device, staging.memory);
+
+	staging.cleanup(device);
+}
+
+void VulkanBaseApplication::readBackDepth(std::vector<float> & depth, int slot) {
+	VkDeviceSize size = sizeof(float) * swapChainExtent.width * swapChainExtent.height;
+	VulkanBuffer staging;
+	createBuffer(size,
+		VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+		staging.buffer, staging.memory);
+
+	VkCommandBuffer commandBuffer = beginSingleTimeCommands();
+
+	VkImageMemoryBarrier barrier = {};
+	barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+	barrier.srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+	barrier.oldLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
+	barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+	barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.image = frames[slot].depth.image;
+	barrier.subresourceRange = { VK_IMAGE_ASPECT_DEPTH_BIT, 0, 1, 0, 1 };
+
+	vkCmdPipelineBarrier(commandBuffer,
+		VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+		0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+	VkBufferImageCopy region = {};
+	region.bufferOffset = 0;
+	region.bufferRowLength = 0;
+	region.bufferImageHeight = 0;
+	region.imageSubresource = { VK_IMAGE_ASPECT_DEPTH_BIT, 0, 0, 1 };
+	region.imageOffset = { 0, 0, 0 };
+	region.imageExtent = { swapChainExtent.width, swapChainExtent.height, 1 };
+	vkCmdCopyImageToBuffer(commandBuffer, frames[slot].depth.image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, staging.buffer, 1, &region);
+
+	// back to the layout the passes expect
+	barrier.srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+	barrier.dstAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT;
+	barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+	barrier.newLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
+	vkCmdPipelineBarrier(commandBuffer,
+		VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT,
+		0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+	endSingleTimeCommands(commandBuffer);
+
+	depth.resize(swapChainExtent.width * swapChainExtent.height);
+	void* data;
+	vkMapMemory(device, staging.memory, 0, size, 0, &data);
+		memcpy(depth.data(), data, (size_t)size);
+	vkUnmapMemory(device, staging.memory);
+
+	staging.cleanup(device);
+}
+
+void VulkanBaseApplication::createDescriptorSetsForMeshGroup(int slot, VkDescriptorSet & descriptorSet, VulkanBuffer & buffer, int useTex, Texture & texMap, int useNorm, Texture & norMap, int useSpec, Texture & specMap) {
 	VkDescriptorSetLayout layouts[] = { descriptorSetLayout };
 	VkDescriptorSetAllocateInfo allocInfo = {};
 	allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
@@ -2750,6 +5735,9 @@ void VulkanBaseApplication::createDescriptorSetsForMeshGroup(VkDescriptorSet & d
 		throw std::runtime_error("failed to allocate descriptor set!");
 	}
 
+	FrameInFlight & inFlight = frames[slot];
+	UniformBuffers & ubo = inFlight.ubo;
+
 	VkDescriptorBufferInfo vsParamsDescriptorInfo = {};
 	vsParamsDescriptorInfo.buffer = ubo.vsScene.buffer;
 	vsParamsDescriptorInfo.offset = 0;
@@ -2775,20 +5763,25 @@ void VulkanBaseApplication::createDescriptorSetsForMeshGroup(VkDescriptorSet & d
 	lightsStorageDescriptorInfo.offset = 0;
 	lightsStorageDescriptorInfo.range = sbo.lights.allocSize;
 
+	VkDescriptorBufferInfo lightInstancesDescriptorInfo = {};
+	lightInstancesDescriptorInfo.buffer = inFlight.lightInstances.buffer;
+	lightInstancesDescriptorInfo.offset = 0;
+	lightInstancesDescriptorInfo.range = inFlight.lightInstances.allocSize;
+
 	VkDescriptorBufferInfo frustumStorageDescriptorInfo = {};
 	frustumStorageDescriptorInfo.buffer = sbo.frustums.buffer;
 	frustumStorageDescriptorInfo.offset = 0;
 	frustumStorageDescriptorInfo.range = sbo.frustums.allocSize;
 
 	VkDescriptorBufferInfo lightIndexDescriptorInfo = {};
-	lightIndexDescriptorInfo.buffer = sbo.lightIndex.buffer;
+	lightIndexDescriptorInfo.buffer = inFlight.lightIndex.buffer;
 	lightIndexDescriptorInfo.offset = 0;
-	lightIndexDescriptorInfo.range = sbo.lightIndex.allocSize;
+	lightIndexDescriptorInfo.range = inFlight.lightIndex.allocSize;
 
 	VkDescriptorBufferInfo lightGridDescriptorInfo = {};
-	lightGridDescriptorInfo.buffer = sbo.lightGrid.buffer;
+	lightGridDescriptorInfo.buffer = inFlight.lightGrid.buffer;
 	lightGridDescriptorInfo.offset = 0;
-	lightGridDescriptorInfo.range = sbo.lightGrid.allocSize;
+	lightGridDescriptorInfo.range = inFlight.lightGrid.allocSize;
 
 	std::array<VkDescriptorImageInfo, 3> imageInfo = {};
 	imageInfo[0].imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
@@ -2804,11 +5797,11 @@ void VulkanBaseApplication::createDescriptorSetsForMeshGroup(VkDescriptorSet & d
 	imageInfo[2].sampler = useSpec > 0 ? specMap.sampler : textures[1].sampler; // normal map;
 
 	VkDescriptorImageInfo depthImageInfo = {};
-	depthImageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-	depthImageInfo.imageView = depthPrepass.depth.view;
+	depthImageInfo.imageLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
+	depthImageInfo.imageView = inFlight.depth.view;
 	depthImageInfo.sampler = depthPrepass.depthSampler;
 
-	std::array<VkWriteDescriptorSet, 10> descriptorWrites = {};
+	std::array<VkWriteDescriptorSet, 11> descriptorWrites = {};
 
 	descriptorWrites[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
 	descriptorWrites[0].dstSet = descriptorSet;
@@ -2890,6 +5883,14 @@ void VulkanBaseApplication::createDescriptorSetsForMeshGroup(VkDescriptorSet & d
 	descriptorWrites[9].descriptorCount = 1;
 	descriptorWrites[9].pImageInfo = &depthImageInfo;
 
+	descriptorWrites[10].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+	descriptorWrites[10].dstSet = descriptorSet;
+	descriptorWrites[10].dstBinding = 16;
+	descriptorWrites[10].dstArrayElement = 0;
+	descriptorWrites[10].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	descriptorWrites[10].descriptorCount = 1;
+	descriptorWrites[10].pBufferInfo = &lightInstancesDescriptorInfo;
+
 	vkUpdateDescriptorSets(device, (uint32_t)descriptorWrites.size(), descriptorWrites.data(), 0, nullptr);
 }
 
@@ -2900,20 +5901,20 @@ void VulkanBaseApplication::loadAxisInfo() {
 	const float axisDelta = 0.1f;
 	meshs.axis.vertices.verticesData = {
 
-		{ { 0.0f, 0.0f, 0.0f },{ 1.0f, 0.0f, 0.0f },{ 0.0f, 0.0f } },
-		{ { axisLen, 0.0f, 0.0f },{ 1.0f, 0.0f, 0.0f },{ 0.0f, 0.0f } },
-		{ { axisLen - axisDelta, -axisDelta / 2.0f, 0.0f },{ 1.0f, 0.0f, 0.0f },{ 0.0f, 0.0f } },
-		{ { axisLen - axisDelta, axisDelta / 2.0f, 0.0f },{ 1.0f, 0.0f, 0.0f },{ 0.0f, 0.0f } },
+		{ { 0.0f, 0.0f, 0.0f },{ 255, 0, 0, 255 },{ 0.0f, 0.0f } },
+		{ { axisLen, 0.0f, 0.0f },{ 255, 0, 0, 255 },{ 0.0f, 0.0f } },
+		{ { axisLen - axisDelta, -axisDelta / 2.0f, 0.0f },{ 255, 0, 0, 255 },{ 0.0f, 0.0f } },
+		{ { axisLen - axisDelta, axisDelta / 2.0f, 0.0f },{ 255, 0, 0, 255 },{ 0.0f, 0.0f } },
 
-		{ { 0.0f, 0.0f, 0.0f },{ 0.0f, 1.0f, 0.0f },{ 0.0f, 0.0f } },
-		{ { 0.0f, axisLen, 0.0f },{ 0.0f, 1.0f, 0.0f },{ 0.0f, 0.0f } },
-		{ { -axisDelta / 2.0f, axisLen - axisDelta, 0.0f },{ 0.0f, 1.0f, 0.0f },{ 0.0f, 0.0f } },
-		{ { axisDelta / 2.0f, axisLen - axisDelta, 0.0f },{ 0.0f, 1.0f, 0.0f },{ 0.0f, 0.0f } },
+		{ { 0.0f, 0.0f, 0.0f },{ 0, 255, 0, 255 },{ 0.0f, 0.0f } },
+		{ { 0.0f, axisLen, 0.0f },{ 0, 255, 0, 255 },{ 0.0f, 0.0f } },
+		{ { -axisDelta / 2.0f, axisLen - axisDelta, 0.0f },{ 0, 255, 0, 255 },{ 0.0f, 0.0f } },
+		{ { axisDelta / 2.0f, axisLen - axisDelta, 0.0f },{ 0, 255, 0, 255 },{ 0.0f, 0.0f } },
 
-		{ { 0.0f, 0.0f, 0.0f },{ 0.0f, 0.0f, 1.0f },{ 0.0f, 0.0f } },
-		{ { 0.0f, 0.0f, axisLen },{ 0.0f, 0.0f, 1.0f },{ 0.0f, 0.0f } },
-		{ { 0.0f, -axisDelta / 2.0f, axisLen - axisDelta },{ 0.0f, 0.0f, 1.0f },{ 0.0f, 0.0f } },
-		{ { 0.0f, axisDelta / 2.0f, axisLen - axisDelta },{ 0.0f, 0.0f, 1.0f },{ 0.0f, 0.0f } }
+		{ { 0.0f, 0.0f, 0.0f },{ 0, 0, 255, 255 },{ 0.0f, 0.0f } },
+		{ { 0.0f, 0.0f, axisLen },{ 0, 0, 255, 255 },{ 0.0f, 0.0f } },
+		{ { 0.0f, -axisDelta / 2.0f, axisLen - axisDelta },{ 0, 0, 255, 255 },{ 0.0f, 0.0f } },
+		{ { 0.0f, axisDelta / 2.0f, axisLen - axisDelta },{ 0, 0, 255, 255 },{ 0.0f, 0.0f } }
 	};
 
 	meshs.axis.indices.indicesData = {
@@ -2946,10 +5947,10 @@ void VulkanBaseApplication::loadTextureQuad() {
 	const float axisDelta = 0.1f;
 	meshs.quad.vertices.verticesData = {
 
-		{ { 0, 0.25f, 1.5f },{ 1.0f, 0.0f, 0.0f },{ 0.0f, 0.0f } },
-		{ { 0, -0.25f, 1.50f },{ 0.0f, 1.0f, 0.0f },{ 1.0f, 0.0f } },
-		{ { 0, -0.25f, 1.0f },{ 0.0f, 0.0f, 1.0f },{ 1.0f, 1.0f } },
-		{ { 0, 0.25f, 1.0f },{ 1.0f, 1.0f, 1.0f },{ 0.0f, 1.0f } },
+		{ { 0, 0.25f, 1.5f },{ 255, 0, 0, 255 },{ 0.0f, 0.0f } },
+		{ { 0, -0.25f, 1.50f },{ 0, 255, 0, 255 },{ 1.0f, 0.0f } },
+		{ { 0, -0.25f, 1.0f },{ 0, 0, 255, 255 },{ 1.0f, 1.0f } },
+		{ { 0, 0.25f, 1.0f },{ 255, 255, 255, 255 },{ 0.0f, 1.0f } },
 
 	};
 
@@ -3032,6 +6033,42 @@ void keyCallback(GLFWwindow* window, int key, int scancode, int action, int mods
 		}
 		else if (key >= GLFW_KEY_A && key <= GLFW_KEY_Z) {
 			keyboardMapping[key - GLFW_KEY_A] = true;
+			if (key == GLFW_KEY_O) {
+				bEstimateOverdraw = true;
+			}
+			else if (key == GLFW_KEY_V) {
+				bVerifyLightCulling = true;
+			}
+			else if (key == GLFW_KEY_C) {
+				bToggleFrameStats = true;
+			}
+			else if (key == GLFW_KEY_J) {
+				bPrintJobProfile = true;
+			}
+			else if (key == GLFW_KEY_T) {
+				bBenchmarkRecording = true;
+			}
+			else if (key == GLFW_KEY_G) {
+				bPrintFrameGraph = true;
+			}
+			else if (key == GLFW_KEY_R) {
+				bPrintRenderTargets = true;
+			}
+			else if (key == GLFW_KEY_P) {
+				bPauseLights = !bPauseLights;
+			}
+			else if (key == GLFW_KEY_L) {
+				lodPixelError = lodPixelError >= 16.0f * LOD_PIXEL_ERROR ? LOD_PIXEL_ERROR : lodPixelError * 4.0f;
+			}
+			else if (key == GLFW_KEY_K) {
+				bGpuLodSelection = !bGpuLodSelection;
+			}
+			else if (key == GLFW_KEY_N) {
+				bAddLights = true;
+			}
+			else if (key == GLFW_KEY_M) {
+				bRemoveLights = true;
+			}
 		}
 		else {
 			switch (key)
@@ -3063,3 +6100,7 @@ void scrollCallback(GLFWwindow* window, double xoffset, double yoffset) {
 //#endif
 //	}
 }
+
+void framebufferSizeCallback(GLFWwindow* /*window*/, int /*width*/, int /*height*/) {
+	bFramebufferResized = true;
+}
@@ -10,6 +10,8 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtx/hash.hpp>
+#include <glm/gtc/packing.hpp>
+#include <glm/gtc/type_precision.hpp>
 
 #include <iostream>
 #include <vector>
@@ -20,9 +22,19 @@
 #include <chrono>
 #include <unordered_map>
 #include <random>
+#include <mutex>
+#include <thread>
+#include <map>
 
 #include "VDeleter.h"
 #include "camera.h"
+#include "MeshTools.h"
+#include "LightCulling.h"
+#include "LightManager.h"
+#include "ShaderCompiler.h"
+#include "JobSystem.h"
+#include "RenderGraph.h"
+#include "RenderTargets.h"
 
 // debug validation layers
 #ifdef NDEBUG
@@ -40,6 +52,10 @@ void DestroyDebugReportCallbackEXT(VkInstance instance, VkDebugReportCallbackEXT
 extern const int WIDTH;
 extern const int HEIGHT;
 
+// frame i uses slot i % MAX_FRAMES_IN_FLIGHT. While the host prepares frame i
+// the gpu culls frame i - 1 and shades frame i - 2
+const int MAX_FRAMES_IN_FLIGHT = 3;
+
 #define SIBENIK 0
 #define SPONZA 0
 #define CRYTEC_SPONZA 1
@@ -73,6 +89,7 @@ const std::vector<const char*> deviceExtensions = {
 struct QueueFamilyIndices {
 	int graphicsFamily = -1;
 	int presentFamily = -1;
+	int computeFamily = -1; // compute without graphics, -1 when there is none
 
 	bool isComplete() {
 		return graphicsFamily >= 0 && presentFamily >= 0;
@@ -86,11 +103,13 @@ struct SwapChainSupportDetails {
 	std::vector<VkPresentModeKHR> presentModes;
 };
 
+// packed vertex, 40 bytes
 struct Vertex {
 	glm::vec3 pos;
-	glm::vec3 color;
+	glm::u8vec4 color; // unorm8
 	glm::vec2 texCoord;
-	glm::vec3 normal;
+	glm::i16vec4 normal; // snorm16, w unused
+	glm::i16vec4 tangent; // snorm16, w = bitangent sign
 
 	static VkVertexInputBindingDescription getBindingDescription() {
 		VkVertexInputBindingDescription bindingDescription = {};
@@ -101,8 +120,8 @@ struct Vertex {
 		return bindingDescription;
 	}
 
-	static std::array<VkVertexInputAttributeDescription, 4> getAttributeDescriptions() {
-		std::array<VkVertexInputAttributeDescription, 4> attributeDescriptions = {};
+	static std::array<VkVertexInputAttributeDescription, 5> getAttributeDescriptions() {
+		std::array<VkVertexInputAttributeDescription, 5> attributeDescriptions = {};
 		attributeDescriptions[0].binding = 0;
 		attributeDescriptions[0].location = 0;
 		attributeDescriptions[0].format = VK_FORMAT_R32G32B32_SFLOAT;
@@ -110,7 +129,7 @@ struct Vertex {
 
 		attributeDescriptions[1].binding = 0;
 		attributeDescriptions[1].location = 1;
-		attributeDescriptions[1].format = VK_FORMAT_R32G32B32_SFLOAT;
+		attributeDescriptions[1].format = VK_FORMAT_R8G8B8A8_UNORM;
 		attributeDescriptions[1].offset = offsetof(Vertex, color);
 
 		attributeDescriptions[2].binding = 0;
@@ -120,18 +139,32 @@ struct Vertex {
 
 		attributeDescriptions[3].binding = 0;
 		attributeDescriptions[3].location = 3;
-		attributeDescriptions[3].format = VK_FORMAT_R32G32B32_SFLOAT;
+		attributeDescriptions[3].format = VK_FORMAT_R16G16B16A16_SNORM;
 		attributeDescriptions[3].offset = offsetof(Vertex, normal);
+
+		attributeDescriptions[4].binding = 0;
+		attributeDescriptions[4].location = 4;
+		attributeDescriptions[4].format = VK_FORMAT_R16G16B16A16_SNORM;
+		attributeDescriptions[4].offset = offsetof(Vertex, tangent);
 		return attributeDescriptions;
 	}
 
-	bool operator==(const Vertex& other) const {
-		return pos == other.pos && color == other.color && texCoord == other.texCoord && normal == other.normal;
+	static Vertex pack(const glm::vec3 & pos, const glm::vec2 & texCoord, const glm::vec3 & normal, const glm::vec4 & tangent) {
+		Vertex vertex = {};
+		vertex.pos = pos;
+		vertex.color = glm::u8vec4(255);
+		vertex.texCoord = texCoord;
+		vertex.normal = glm::packSnorm<glm::int16>(glm::vec4(normal, 0.0f));
+		vertex.tangent = glm::packSnorm<glm::int16>(tangent);
+		return vertex;
 	}
-
 };
 
 
+// cpu side of textures and models, loaded on worker threads at startup
+struct DecodedImage;
+struct ModelAssets;
+
 /************************************************************/
 //			Base Class for Vulkan Application
 /************************************************************/
@@ -139,6 +172,11 @@ class VulkanBaseApplication {
 public:
 	void run();
 
+	// runtime light edits, uploaded before the next frame
+	LightHandle addLight(const LightDesc & light);
+	void removeLight(LightHandle handle);
+	void updateLight(LightHandle handle, const LightDesc & light);
+
 	// clean up resources
 	~VulkanBaseApplication();
 
@@ -155,6 +193,20 @@ private:
 	VkQueue graphicsQueue;
 	VkQueue presentQueue;
 
+	// light update and culling, graphicsQueue unless the gpu has a compute only
+	// family. lightIndex / lightGrid then change owner between the two families
+	// every culled frame, every other buffer is shared by both
+	VkQueue computeQueue;
+	uint32_t graphicsQueueFamily = 0;
+	uint32_t computeQueueFamily = 0;
+	bool asyncCompute = false;
+
+	// optional device features
+	bool multiDrawIndirectSupported = false;
+	// VK_KHR_get_physical_device_properties2 is enabled on the instance, device
+	// extensions like VK_KHR_timeline_semaphore need it on a 1.0 instance
+	bool physicalDeviceProperties2 = false;
+
 	// Swap chain related
 	VDeleter<VkSwapchainKHR> swapChain{ device, vkDestroySwapchainKHR };
 	std::vector<VkImage> swapChainImages;
@@ -162,42 +214,170 @@ private:
 	VkExtent2D swapChainExtent;
 	// swap chain image views
 	std::vector<VkImageView> swapChainImageViews;
-	// swap chian frame buffers
-	std::vector<VDeleter<VkFramebuffer>> swapChainFramebuffers;
 
 	// Pipeline layout
 	VDeleter<VkPipelineLayout> pipelineLayout{ device, vkDestroyPipelineLayout };
 	VDeleter<VkPipelineLayout> computePipelineLayout = {device, vkDestroyPipelineLayout};
+	VDeleter<VkPipelineLayout> compositePipelineLayout{ device, vkDestroyPipelineLayout };
 
 	// Descriptor pool
 	VDeleter<VkDescriptorPool> descriptorPool{ device, vkDestroyDescriptorPool };
 
 	// Descriptor set layout and descriptor set
 	VDeleter<VkDescriptorSetLayout> descriptorSetLayout{ device, vkDestroyDescriptorSetLayout };
-	VkDescriptorSet descriptorSet;
+
+	// sceneColor input attachment of the composite subpass
+	VDeleter<VkDescriptorSetLayout> compositeSetLayout{ device, vkDestroyDescriptorSetLayout };
+	VkDescriptorSet compositeDescriptorSet;
 
 	// Render pass
 	VDeleter<VkRenderPass> renderPass{ device, vkDestroyRenderPass };
 
 	// Command pool
 	VDeleter<VkCommandPool> commandPool{ device, vkDestroyCommandPool };
+	VDeleter<VkCommandPool> computeCommandPool{ device, vkDestroyCommandPool }; // computeQueueFamily
+
+	// gpu timestamps of every frame slot, see FrameTimestamp
+	VDeleter<VkQueryPool> timestampQueryPool{ device, vkDestroyQueryPool };
+	float timestampPeriod = 0.0f; // ns per tick, 0 when timestamps are not supported
+
+	// shared by all pipeline creation, PIPELINE_CACHE_PATH between runs
+	VDeleter<VkPipelineCache> pipelineCache{ device, vkDestroyPipelineCache };
+	size_t pipelineCacheLoadedSize = 0; // bytes of initial data, 0 on a cold start
+
+	// cpu work of startup and of every frame runs as jobs, profiled per frame
+	JobSystem & jobs = JobSystem::shared();
 
-	// Semaphores
-	VDeleter<VkSemaphore> imageAvailableSemaphore{ device, vkDestroySemaphore };
-	VDeleter<VkSemaphore> renderFinishedSemaphore{ device, vkDestroySemaphore };
 
-	// fence
-	VDeleter<VkFence> fence {device, vkDestroyFence};
+	// gpu time of the last frame read back, ms
+	struct GpuTimings {
+		float lightUpdate = 0.0f;
+		float lightCulling = 0.0f;
+		float shading = 0.0f; // display render pass
+		float cullShadeOverlap = 0.0f; // culling of the frame while the gpu shaded the one before
+		uint64_t lastShadingBegin = 0; // ticks, frame read back before
+		uint64_t lastShadingEnd = 0;
+	} gpuTimings;
 
 	// shader modules
 	std::vector<VDeleter<VkShaderModule>> shaderModules;
 
-	// Command buffers
-	struct CommandBuffers {
-		std::vector<VkCommandBuffer> display;
-		VkCommandBuffer compute;
-		VkCommandBuffer frustum;
-	} cmdBuffers;
+	// glsl source of every shader module, compiled at runtime or loaded from <path>.spv
+	struct ShaderFile {
+		std::string path;
+		VkShaderStageFlagBits stage;
+		VkPipelineShaderStageCreateInfo * stageInfo;
+	};
+	std::vector<ShaderFile> shaderFiles;
+	std::vector<int64_t> shaderSourceTimes; // last write time of every source, for hot reload
+	ShaderCompiler shaderCompiler{ "shader_cache" };
+
+	// passes of a frame and the resources they share. Barriers between passes,
+	// queue family transfers, submits and semaphores come from the schedule
+	// compiled for the passes that run, see createFrameGraph
+	struct FrameGraph {
+		// one combination of enabled passes, its barriers recorded once
+		struct Compiled {
+			RenderSchedule schedule;
+			std::vector<VkCommandPool> pools; // [submit], pool of the queue it runs on
+			std::vector<std::vector<VkCommandBuffer>> before; // [submit][pass], VK_NULL_HANDLE without barriers
+			std::vector<VkCommandBuffer> release; // [submit]
+			std::vector<std::vector<VkSemaphore>> waitSemaphores; // [submit][wait]
+			std::vector<std::vector<VkSemaphore>> signalSemaphores; // [submit], binary
+			std::vector<bool> signalTimeline; // [submit], a later submit waits on its timeline value
+			std::vector<VkSemaphore> semaphores; // binary semaphores owned by this schedule
+		};
+
+		RenderGraph graph;
+		int frustumPass = -1;
+		int lodPass = -1;
+		int depthPass = -1;
+		int cullPass = -1;
+		int shadePass = -1;
+		int presentPass = -1;
+		int sceneColor = -1; // renderTargets.transient index
+		// resources with one buffer / image per frame slot, bound before compiling
+		int lightInstances = -1;
+		int lightIndex = -1;
+		int lightGrid = -1;
+		int indirectDraws = -1;
+		int prepassDepth = -1;
+		std::map<uint32_t, Compiled> compiled[MAX_FRAMES_IN_FLIGHT]; // [frame slot], by enabled passes
+		bool frustumsDirty = true; // the tile frustums are computed by the next frame
+		uint32_t enabledPasses = 0; // of the last frame
+
+		// VK_KHR_timeline_semaphore: one semaphore per queue counting its submits,
+		// a submit waits for the value of the submit it depends on. Binary
+		// semaphores per dependency otherwise
+		bool timelineSemaphores = false;
+		VkSemaphore timelines[NUM_RENDER_QUEUES] = {};
+		uint64_t timelineValues[NUM_RENDER_QUEUES] = {};
+
+		void clearCompiled(VkDevice device) {
+			for (auto & slot : compiled) {
+				for (auto & entry : slot) {
+					Compiled & frame = entry.second;
+					for (size_t s = 0; s < frame.pools.size(); ++s) {
+						for (VkCommandBuffer commandBuffer : frame.before[s]) {
+							if (commandBuffer != VK_NULL_HANDLE) {
+								vkFreeCommandBuffers(device, frame.pools[s], 1, &commandBuffer);
+							}
+						}
+						if (frame.release[s] != VK_NULL_HANDLE) {
+							vkFreeCommandBuffers(device, frame.pools[s], 1, &frame.release[s]);
+						}
+					}
+					for (VkSemaphore semaphore : frame.semaphores) {
+						vkDestroySemaphore(device, semaphore, nullptr);
+					}
+				}
+				slot.clear();
+			}
+		}
+
+		void cleanup(VkDevice device) {
+			clearCompiled(device);
+			for (VkSemaphore & timeline : timelines) {
+				if (timeline != VK_NULL_HANDLE) {
+					vkDestroySemaphore(device, timeline, nullptr);
+					timeline = VK_NULL_HANDLE;
+				}
+			}
+		}
+	} frameGraph;
+
+	// images the passes render to, the prepass depth is persistent. Transient
+	// targets (sceneColor) are declared with the frame graph and get their memory there
+	RenderTargetPool renderTargets;
+
+	// display pass recorded every frame: the material groups are split into
+	// ranges recorded as jobs, each into a secondary command buffer from its own
+	// pool, and the primary executes them in draw order. One pool per frame slot,
+	// reset once the frame that used the slot before finished
+	struct FrameRecording {
+		struct Worker {
+			VkCommandPool pool[MAX_FRAMES_IN_FLIGHT] = {};
+			VkCommandBuffer secondary[MAX_FRAMES_IN_FLIGHT] = {};
+			int firstGroup = 0; // range of the ordered material groups
+			int endGroup = 0;
+			float recordMs = 0.0f; // recording time on this thread, last frame
+		};
+		std::vector<Worker> workers;
+		VkCommandPool primaryPool[MAX_FRAMES_IN_FLIGHT] = {};
+		VkCommandBuffer primary[MAX_FRAMES_IN_FLIGHT] = {};
+		std::vector<int> groups; // opaque groups, then alpha tested ones
+		int numThreads = 0; // threads used for the last frame
+		float recordMs = 0.0f; // wall time of the last frame, primary included
+
+		void cleanup(VkDevice device) {
+			for (int slot = 0; slot < MAX_FRAMES_IN_FLIGHT; ++slot) {
+				for (auto & worker : workers) {
+					vkDestroyCommandPool(device, worker.pool[slot], nullptr);
+				}
+				vkDestroyCommandPool(device, primaryPool[slot], nullptr);
+			}
+		}
+	} frameRecording;
 
 	struct ShaderStages {
 		VkPipelineShaderStageCreateInfo vs;
@@ -207,6 +387,13 @@ private:
 		VkPipelineShaderStageCreateInfo fs_quad;
 		VkPipelineShaderStageCreateInfo csFrustum;
 		VkPipelineShaderStageCreateInfo csLightList;
+		VkPipelineShaderStageCreateInfo csLod;
+		VkPipelineShaderStageCreateInfo fs_depthAlphaTest;
+		VkPipelineShaderStageCreateInfo csLightUpdate;
+		VkPipelineShaderStageCreateInfo csLightListCooperative;
+		VkPipelineShaderStageCreateInfo csLightBinning;
+		VkPipelineShaderStageCreateInfo vs_composite;
+		VkPipelineShaderStageCreateInfo fs_composite;
 	} shaderStage;
 
 
@@ -217,15 +404,36 @@ private:
 		VkPipeline quad; // quad pipeline
 		VkPipeline computeLightList; // compute light list pipeline
 		VkPipeline computeFrustumGrid; // compute Frustum Grid pipeline
+		VkPipeline computeLod; // lod selection pipeline
+		VkPipeline computeLightUpdate; // light animation pipeline
+		VkPipeline computeLightListCooperative; // one workgroup per tile light list pipeline
+		VkPipeline computeLightBinning; // scatter lights into tiles pipeline
 		VkPipeline depth;
+		VkPipeline depthAlphaTest; // depth prepass for alpha-tested materials
+		VkPipeline composite; // sceneColor to the swap chain, gamma corrected
+		VkPipeline compositeDebug; // sceneColor to the swap chain, debug views as they are
+
+		// final_shading.frag specialized per material map set and debug mode,
+		// derived from graphics, see shadingVariantIndex
+		std::vector<VkPipeline> shadingVariants;
 
 		void cleanup(VkDevice device) {
+			for (VkPipeline variant : shadingVariants) {
+				vkDestroyPipeline(device, variant, nullptr);
+			}
 			vkDestroyPipeline(device, graphics, nullptr);
 			vkDestroyPipeline(device, axis, nullptr);
 			vkDestroyPipeline(device, quad, nullptr);
 			vkDestroyPipeline(device, computeLightList, nullptr);
 			vkDestroyPipeline(device, computeFrustumGrid, nullptr);
+			vkDestroyPipeline(device, computeLod, nullptr);
+			vkDestroyPipeline(device, computeLightUpdate, nullptr);
+			vkDestroyPipeline(device, computeLightListCooperative, nullptr);
+			vkDestroyPipeline(device, computeLightBinning, nullptr);
 			vkDestroyPipeline(device, depth, nullptr);
+			vkDestroyPipeline(device, depthAlphaTest, nullptr);
+			vkDestroyPipeline(device, composite, nullptr);
+			vkDestroyPipeline(device, compositeDebug, nullptr);
 		}
 
 	} pipelines;
@@ -236,6 +444,7 @@ private:
 		VkImageView imageView;
 		VkDeviceMemory imageMemory;
 		VkSampler sampler;
+		bool hasAlphaCutout = false; // some texels fail the alpha test
 
 		void cleanup(VkDevice device) {
 			vkDestroyImageView(device, imageView, nullptr);
@@ -300,16 +509,32 @@ private:
 		VertexBuffer vertices;
 		std::vector<IndexBuffer> indexGroups;
 		std::vector<Material> materials;
-		std::vector<VkDescriptorSet> descriptorSets;
+		std::vector<VkDescriptorSet> descriptorSets[MAX_FRAMES_IN_FLIGHT]; // [frame slot][material]
 		std::vector<VulkanBuffer> materialBuffers;
 		std::vector<Texture> textureMaps;
 		std::vector<Texture> normalMaps;
 		std::vector<Texture> specMaps;
 
+		// lod draw items, grouped by material
+		std::vector<MeshDrawItem> drawItems;
+		std::vector<glm::uvec2> drawItemRanges; // per material, x = first item, y = count
+		VulkanBuffer drawItemBuffer;
+		VulkanBuffer indirectBuffers[MAX_FRAMES_IN_FLIGHT]; // [frame slot], VkDrawIndexedIndirectCommand per draw item
+		uint32_t numTriangles; // full detail
+
+		// material ids, opaque ones are drawn first in both passes
+		std::vector<int> opaqueGroups;
+		std::vector<int> alphaTestedGroups;
+
 		void cleanup(VkDevice device) {
 			vkDestroyBuffer(device, vertices.buffer, nullptr);
 			vkFreeMemory(device, vertices.mem, nullptr);
 
+			drawItemBuffer.cleanup(device);
+			for (VulkanBuffer & indirectBuffer : indirectBuffers) {
+				indirectBuffer.cleanup(device);
+			}
+
 			for (auto & indexBuffer : indexGroups) {
 				vkDestroyBuffer(device, indexBuffer.buffer, nullptr);
 				vkFreeMemory(device, indexBuffer.mem, nullptr);
@@ -365,20 +590,16 @@ private:
 			fsParams.cleanup(device);
 			fsParamsStaging.cleanup(device);
 		}
-	} ubo;
+	};
 
-	// storage buffers
+	// storage buffers shared by all frame slots, the per frame ones are in FrameInFlight
 	struct StorageBuffers {
 		VulkanBuffer lights;
-		VulkanBuffer frustums;
-		VulkanBuffer lightIndex;
-		VulkanBuffer lightGrid;
+		VulkanBuffer frustums; // rewritten only with the swap chain or the pipelines, see frustumsDirty
 
 		void cleanup(VkDevice device) {
 			lights.cleanup(device);
 			frustums.cleanup(device);
-			lightIndex.cleanup(device);
-			lightGrid.cleanup(device);
 		}
 	} sbo;
 
@@ -405,6 +626,11 @@ private:
 		glm::ivec2 numThreads;
 		int numLights;
 		float time;
+		float lodProjScale; // proj[1][1] * screen height / 2
+		float lodPixelError;
+		int numDrawItems;
+		int lightCullMode; // LightCullMode
+		int useDepthMask;
 	};
 
 	// fs uniform layout
@@ -425,17 +651,27 @@ private:
 	} uboHostData;
 
 	// storage buffer object to store lights
-	#define MAX_NUM_LIGHTS 5000
+	#define MAX_NUM_LIGHTS 100000
 	#define MAX_NUM_LIGHTS_PER_TILE 128
+	// light information, structure of arrays (one stream per attribute)
 	struct SBO_lights {
-		// light information
-		struct {
-			glm::vec4 beginPos; // beginPos.w = intensity
-			glm::vec4 endPos; // endPos.w = radius
-			glm::vec4 color; // color.w = t
-		} lights[MAX_NUM_LIGHTS];;
+		glm::vec4 beginPos[MAX_NUM_LIGHTS]; // beginPos.w = radius
+		glm::vec4 endPos[MAX_NUM_LIGHTS];
+		glm::vec4 color[MAX_NUM_LIGHTS]; // shading stream, color.w = intensity
+		glm::vec4 direction[MAX_NUM_LIGHTS]; // spot axis, tube half segment, rect normal
+		glm::vec4 shape[MAX_NUM_LIGHTS]; // spot (cos outer, cos inner), rect (half width tangent, half height)
+		int32_t type[MAX_NUM_LIGHTS]; // LightType
 	};
 
+	// animated lights, written by updateLights.comp every frame
+	struct SBO_lightInstances {
+		glm::vec4 cullSpheres[MAX_NUM_LIGHTS]; // cull stream, view space bounding sphere
+		glm::vec4 positions[MAX_NUM_LIGHTS]; // shading stream, world space center + radius
+		glm::vec4 cullAxes[MAX_NUM_LIGHTS]; // cull stream for non point lights, see LightCullShape
+		glm::vec4 cullExtents[MAX_NUM_LIGHTS];
+	};
+
+	// host copy for the first upload, the device buffer is sized to the tile count
 	#define MAX_NUM_FRUSTRUMS 20000
 	struct SBO_frustums {
 		// frustum definition
@@ -446,6 +682,17 @@ private:
 		} frustums[MAX_NUM_FRUSTRUMS]; // 800*600 -> 50*40
 	};
 
+	// culling cache counters, written by the host and the light list shaders
+	#define MAX_MOVED_LIGHT_RANGES 32
+	#define MAX_MOVED_LIGHTS 256
+	struct SBO_cullingCache {
+		int recomputedTiles; // tiles whose list was rebuilt
+		int reuseTileLists; // same view, tiles with the same depth and no moved light keep their list
+		int numMovedRanges;
+		int pad;
+		glm::ivec2 movedRanges[MAX_MOVED_LIGHT_RANGES]; // first, count of the lights edited since the last culling
+	};
+
 	// storage buffer host data
 	struct {
 		SBO_lights lights;
@@ -453,29 +700,71 @@ private:
 	} sboHostData;
 
 
-	// Frame buffer attachment struct
-	struct FrameBufferAttachment {
-		VkImage image;
-		VkDeviceMemory mem;
-		VkImageView view;
-
-		void cleanup(VkDevice device) {
-			vkDestroyImageView(device, view, nullptr);
-			vkDestroyImage(device, image, nullptr);
-			vkFreeMemory(device, mem, nullptr);
-		}
-	} depth;
-
-	// Depth prepass
+	// Depth prepass, its depth target is per frame slot
 	struct DepthPrepass {
-		FrameBufferAttachment depth;
-		VkFramebuffer frameBuffer;
 		VkRenderPass renderPass;
-		VkSampler depthSampler;
-		VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
-		VkSemaphore semaphore = VK_NULL_HANDLE;
+		VkSampler depthSampler = VK_NULL_HANDLE;
 	} depthPrepass;
 
+	// everything one frame writes while the frames before it are still on the
+	// gpu. The host waits for the fence of the frame that used the slot before,
+	// then writes the slot without further waits
+	struct FrameInFlight {
+		VkFence fence = VK_NULL_HANDLE; // signaled by the shading submit, created signaled
+		VkSemaphore imageAvailable = VK_NULL_HANDLE;
+		VkSemaphore renderFinished = VK_NULL_HANDLE;
+		uint32_t enabledPasses = 0; // of the frame in the slot, 0 when it was dropped or never ran
+		std::vector<uint64_t> signalValues; // [submit] timeline values, from the culling to the shading submits
+
+		UniformBuffers ubo;
+		VulkanBuffer lightsStaging; // host visible, same layout as SBO_lights
+		std::vector<VkBufferCopy> lightCopies; // dirty ranges staged for the frame, lightsStaging -> lights
+		VulkanBuffer lightInstances; // animated lights, written by updateLights.comp
+		VulkanBuffer lightIndex;
+		VulkanBuffer lightGrid;
+		VulkanBuffer tileDepths; // LIGHT_CULL_BINNING only, depth pass -> binLights.comp
+		VulkanBuffer lightGridReadback; // host visible copy of the light grid, written by every culling
+		VulkanBuffer cullingCache; // host visible SBO_cullingCache
+		VulkanBuffer sortedLights; // light bvh, host visible, rebuilt by every culling
+		VulkanBuffer lightBvhNodes;
+		LightBvh lightBvh; // cpu copy of sortedLights / lightBvhNodes
+
+		RenderTarget depth; // prepass depth, owned by renderTargets
+		int depthTarget = -1; // index of depth in renderTargets, resized with the swap chain
+		VkFramebuffer depthFramebuffer = VK_NULL_HANDLE;
+		std::vector<VDeleter<VkFramebuffer>> framebuffers; // [swap chain image]
+		VkDescriptorSet descriptorSet = VK_NULL_HANDLE;
+
+		VkCommandPool uploadPool = VK_NULL_HANDLE; // transient, reset by every recordUploadCommandBuffer
+		VkCommandBuffer upload = VK_NULL_HANDLE; // staged uniforms and lights of the frame, first on the gpu
+		VkCommandBuffer frustum = VK_NULL_HANDLE;
+		VkCommandBuffer lodSelection = VK_NULL_HANDLE; // selectLod.comp
+		VkCommandBuffer compute = VK_NULL_HANDLE; // computeCommandPool
+		VkCommandBuffer depthPrepass = VK_NULL_HANDLE;
+		std::vector<VkCommandBuffer> display; // [swap chain image]
+
+		void cleanup(VkDevice device) {
+			vkDestroyFence(device, fence, nullptr);
+			vkDestroySemaphore(device, imageAvailable, nullptr);
+			vkDestroySemaphore(device, renderFinished, nullptr);
+			vkDestroyFramebuffer(device, depthFramebuffer, nullptr);
+			vkDestroyCommandPool(device, uploadPool, nullptr);
+			ubo.cleanup(device);
+			lightsStaging.cleanup(device);
+			lightInstances.cleanup(device);
+			lightIndex.cleanup(device);
+			lightGrid.cleanup(device);
+			tileDepths.cleanup(device);
+			lightGridReadback.cleanup(device);
+			cullingCache.cleanup(device);
+			sortedLights.cleanup(device);
+			lightBvhNodes.cleanup(device);
+		}
+	};
+	std::array<FrameInFlight, MAX_FRAMES_IN_FLIGHT> frames;
+	int currentFrame = 0; // slot of the frame the host prepares
+	int pendingFrame = -1; // slot culled by the last drawFrame and shaded by the next one, -1 for none
+
 	/************************************************************/
 	//					Function Declaration
 	/************************************************************/
@@ -483,12 +772,19 @@ private:
 
 	void initForwardPlusParams();
 
+	// tile and thread group counts of the swap chain extent
+	void updateTileCounts();
+
 	void initVulkan();
 
 	void mainLoop();
 
+	// wait until the frame that used the current slot before finished
+	void waitForFrame();
+
 	void updateUniformBuffer();
 
+	// submit the culling of this frame, then shade the frame culled before
 	void drawFrame();
 
 	// Create Vulkan instance
@@ -508,28 +804,89 @@ private:
 
 	void createShaders();
 
+	// load PIPELINE_CACHE_PATH when it was written by this gpu and driver
+	void createPipelineCache();
+
+	void savePipelineCache();
+
 	void createGraphicsPipeline();
 
 	void createComputePipeline();
 
+	// display framebuffers of every frame slot
 	void createFramebuffers();
 
 	void createCommandPool();
 
-	void createCommandBuffers();
+	// command buffers of one frame slot
+	void createCommandBuffers(int slot);
+
+	void createUploadCommandBuffer(int slot);
+
+	// copy the staged uniforms and light edits of the frame in the slot
+	void recordUploadCommandBuffer(int slot);
+
+	void createFrustumCommandBuffer(int slot);
+
+	void createComputeCommandBuffer(int slot);
+
+	void createDepthCommandBuffer(int slot);
+
+	void createLodCommandBuffer(int slot);
+
+	// declare the passes and resources of a frame, drops the compiled schedules
+	void createFrameGraph();
 
-	void createFrustumCommandBuffer();
+	// schedule of the enabled passes with the resources of a frame slot,
+	// compiled and its barriers recorded on first use
+	FrameGraph::Compiled & compiledFrameGraph(int slot, uint32_t enabledPasses);
 
-	void createComputeCommandBuffer();
+	// barriers in a command buffer of pool, VK_NULL_HANDLE when there are none
+	VkCommandBuffer recordRenderBarriers(const RenderBarriers & barriers, VkCommandPool pool);
 
-	void createDepthCommandBuffer();
+	// submit the passes of a frame slot before the shade pass (the culling), or
+	// the shade pass and the rest and present the image. Returns the present result
+	VkResult submitFrameGraph(int slot, bool shading, uint32_t imageIndex, VkCommandBuffer displayCommandBuffer);
+
+	// compiled schedules of a culled and a cached frame (key G)
+	void printFrameGraph();
+
+	void printRenderTargets();
+
+	// pools and command buffers of the per frame display recording
+	void createFrameRecording();
+
+	// record the display pass of a frame slot and swap chain image on numThreads workers
+	void recordFrameCommandBuffer(int slot, uint32_t imageIndex, int numThreads);
+
+	// recording time for 1, 2, 4 .. all workers (key T)
+	void benchmarkFrameRecording();
+
+	// viewport and scissor of the swap chain extent, dynamic in every graphics pipeline
+	void recordViewport(VkCommandBuffer commandBuffer);
+
+	// record the lod indirect draws of one material group, from the indirect buffer of the slot
+	void recordMeshGroupDraws(VkCommandBuffer commandBuffer, MeshGroup & meshGroup, int slot, int groupId);
+
+	// shading variants of the base pipeline: every material map set without
+	// debug code, then one variant per debug mode with the maps read at runtime
+	void createShadingVariants(VkGraphicsPipelineCreateInfo pipelineInfo);
+
+	VkPipeline shadingPipeline(const Material & material, int debugMode) const;
+
+	// debug mode baked into the display command buffers
+	int recordedDebugMode = 0;
 
 	void createRenderPass();
 
 	void createDepthRenderPass();
 
+	// prepass depth of every frame slot at the swap chain extent and its
+	// framebuffer, called again on resize
 	void createDepthFramebuffer();
 
+	void createDepthSampler();
+
 	void createVertexBuffer(std::vector<Vertex> & verticesData, VkBuffer& buffer, VkDeviceMemory& bufferMemory);
 
 	void createIndexBuffer(std::vector<uint32_t> &indicesData, VkBuffer& buffer, VkDeviceMemory& bufferMemory);
@@ -570,7 +927,8 @@ private:
 	uint32_t findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties);
 
 	// abstracting buffer creation
-	void createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer& buffer, VkDeviceMemory& bufferMemory);
+	// shared by the graphics and compute queue families unless queueFamilyExclusive
+	void createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer& buffer, VkDeviceMemory& bufferMemory, bool queueFamilyExclusive = false);
 
 	// copy buffer from srcBuffer to dstBuffer
 	void copyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size);
@@ -580,20 +938,47 @@ private:
 
 	void createLightInfos();
 
+	// random light in the demo volume
+	LightDesc randomLight();
+
+	// write a light to the host copy of SBO_lights
+	void writeLight(uint32_t slot, const LightDesc & light, float animationSeed);
+
+	// stage the dirty light ranges of every stream for the upload of this frame,
+	// one vkCmdCopyBuffer. Re-records the compute commands when the count changed
+	void uploadDirtyLights();
+
 	void createUniformBuffer();
 
 	void createStorageBuffer();
 
+	// frustums, and the light lists, tile depths and light grid readback of
+	// every frame slot, sized to the tile count of the swap chain extent
+	void createTileBuffers();
+	void cleanupTileBuffers();
+
 	void initStorageBuffer();
 
 	void createDescriptorPool();
 
 	void createDescriptorSet();
 
-	void createDescriptorSetsForMeshGroup(VkDescriptorSet & descriptorSet, VulkanBuffer & buffer, int useTex, Texture & texMap, int useNorm, Texture & norMap, int useSpec, Texture & specMap);
+	// point the prepass depth and tile buffer bindings of set at the ones of a frame slot
+	void updateTileDescriptors(VkDescriptorSet set, int slot);
+
+	// point the composite input attachment at the current sceneColor target
+	void updateCompositeDescriptorSet();
+
+	// second subpass of the display render pass, recorded inline after the scene
+	void recordComposite(VkCommandBuffer commandBuffer, int mode);
+
+	void createDescriptorSetsForMeshGroup(int slot, VkDescriptorSet & descriptorSet, VulkanBuffer & buffer, int useTex, Texture & texMap, int useNorm, Texture & norMap, int useSpec, Texture & specMap);
 
 	void createTextureImage(const std::string& texFilename, VkImage & texImage, VkDeviceMemory & texImageMemory);
 
+	// upload of pixels decoded on the cpu, see decodeImage
+	void createTextureImage(const DecodedImage & image, VkImage & texImage, VkDeviceMemory & texImageMemory);
+
 	void createImage(uint32_t width, uint32_t height, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage, VkMemoryPropertyFlags properties, VkImage & image, VkDeviceMemory & imageMemory);
 
 	void transitionImageLayout(VkImage image, VkFormat format, VkImageLayout oldLayout, VkImageLayout newLayout);
@@ -612,12 +997,51 @@ private:
 
 	bool hasStencilComponent(VkFormat format);
 
-	void createDepthResources();
-
 	void loadModel(std::vector<Vertex> & vertices, std::vector<uint32_t> & indices, const std::string & modelFilename, const std::string & modelBaseDir, float scale = 1.0f);
 
 	void loadModel(MeshGroup & meshGroup, const std::string & modelFilename, const std::string & modelBaseDir, float scale = 1.0f);
 
+	// device side of loadModel: buffers, textures and descriptor sets of loaded assets
+	void createModel(MeshGroup & meshGroup, const ModelAssets & assets);
+
+	// lod draw item / indirect buffers, bound to the global descriptor set
+	void createLodBuffers(MeshGroup & meshGroup);
+
+	// per frame lod selection on the cpu, or read back of the gpu selection
+	void updateLodSelection();
+
+	// read back the gpu lod selection of the frame shaded last and compare it with MeshTools::selectLod
+	void verifyLodSelection();
+
+	// cpu estimate of the fragment invocations with and without the prepass depth
+	void printOverdrawEstimate();
+
+	void createTimestampQueryPool();
+
+	// read back the timestamps of the frame that used the current slot before
+	void updateGpuTimings();
+
+	// rebuild the light bvh for the current frame and upload it
+	void updateLightBvh();
+
+	// read back the light lists of the frame shaded last and compare them with LightCulling
+	void verifyLightCulling();
+
+	// decide whether this frame has to cull the lights again, see CullingCache
+	void updateCullingCache();
+
+	// hand the light grid of the current slot to a worker for LightListStats,
+	// picks up the result of the previous job without waiting
+	void updateLightListStats();
+
+	// start / stop writing one csv row per frame (key C)
+	void toggleFrameStats();
+	void exportFrameStats(int frameCount, float elapsedTime);
+
+	// copy a device local buffer / the prepass depth to host memory, waits idle
+	void readBackBuffer(VkBuffer buffer, VkDeviceSize size, void * dst);
+	void readBackDepth(std::vector<float> & depth, int slot);
+
 	// load axis info
 	void loadAxisInfo();
 
@@ -629,7 +1053,8 @@ private:
 
 	void prepareTextures();
 
-	void prepareTexture(std::string & texturePath, Texture & texture);
+	void prepareTexture(const DecodedImage & image, Texture & texture);
+
 
 
 	// tools
@@ -638,22 +1063,83 @@ private:
 	VkBufferMemoryBarrier createBufferMemoryBarrier(
 		VkAccessFlags srcAccessMask,
 		VkAccessFlags dstAccessMask,
-		VkBuffer buffer, VkDeviceSize bufferSize);
+		VkBuffer buffer, VkDeviceSize bufferSize,
+		uint32_t srcQueueFamily = VK_QUEUE_FAMILY_IGNORED,
+		uint32_t dstQueueFamily = VK_QUEUE_FAMILY_IGNORED);
 
 	void createShaderModule(
 		const std::vector<char> & code,
 		VDeleter<VkShaderModule> & shaderModule);
 
+	// fileName is the glsl source, <fileName>.spv is used when it can not be compiled
 	VkPipelineShaderStageCreateInfo loadShader(
 		std::string fileName, VkShaderStageFlagBits stage,
 		int shaderModuleIndex);
 
+	// recompile the shaders whose source changed and swap them in, a source
+	// that does not compile keeps the running pipelines
+	void reloadChangedShaders();
+
+	// new pipelines from the current shader modules, command buffers re-recorded
+	void recreatePipelines();
+
+	// free and record the display, frustum, compute and depth command buffers of every frame slot
+	void recreateCommandBuffers();
+
+	// swap chain, prepass depth, tile buffers and frame graph at the new window
+	// size, assets and pipelines are kept. Prints the time of each step
+	void recreateSwapChain();
+
 	VkCommandBuffer beginSingleTimeCommands();
 
 	void endSingleTimeCommands(VkCommandBuffer commandBuffer);
 
 	void resetTitleAndTiming();
 
+	// triangles submitted last frame after lod selection
+	uint32_t numTrianglesDrawn = 0;
+	bool lodSelectionChanged = true; // the draws differ from the last frame
+	bool lodSelectedOnGpu = false; // path of the last updateLodSelection
+
+	// light culling cache. The light lists only depend on the view, the prepass
+	// depth and the lights, culling (and the prepass) is skipped while they stay
+	// the same. Every frame slot keeps the lists it culled last
+	struct CullingCache {
+		uint64_t depthGeneration = 1; // bumped whenever the prepass depth can change
+		uint64_t lightVersion = 1; // bumped whenever the lights move
+		glm::mat4 lastViewMat;
+		float lastLightTime = -1.0f;
+		float lastLodPixelError = -1.0f;
+
+		struct Lists {
+			// light slots edited by uploadDirtyLights since the slot culled, only
+			// valid while editedLightVersion == lightVersion (no other light changes)
+			std::vector<glm::uvec2> editedLights;
+			uint64_t editedLightVersion = 0;
+
+			// inputs of the light lists of the slot
+			glm::mat4 culledViewMat;
+			uint64_t culledDepthGeneration = 0;
+			uint64_t culledLightVersion = 0;
+		} lists[MAX_FRAMES_IN_FLIGHT];
+
+		bool skipCulling = false; // this frame keeps the lists of its slot as they are
+		int recomputedTiles = 0; // tiles rebuilt by the frame read back last
+	} cullingCache;
+
+	float lightBvhBuildTime = 0.0f; // ms
+
+	// light slots and handles, SBO_lights is packed in slot order
+	LightManager lightManager;
+	std::default_random_engine lightRandom;
+	float nextLightSeed = 0.0f; // animation phase of the next light, kept when it changes slot
+
+	// light list stats, a frame or two behind the current frame
+	LightListStats lightListStats;
+	JobSystem::Counter lightListStatsJob;
+	LightListStats pendingLightListStats;
+	std::ofstream frameStatsFile;
+
 };
 
 // callbacks
@@ -662,3 +1148,4 @@ void cursorPosCallback(GLFWwindow* window, double xPos, double yPos);
 void mouseButtonCallback(GLFWwindow* window, int button, int action, int mods);
 void keyCallback(GLFWwindow* window, int key, int scancode, int action, int mods);
 void scrollCallback(GLFWwindow* window, double xoffset, double yoffset);
+void framebufferSizeCallback(GLFWwindow* window, int width, int height);
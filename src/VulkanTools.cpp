@@ -3,18 +3,19 @@
 VkBufferMemoryBarrier VulkanBaseApplication::createBufferMemoryBarrier(
 	VkAccessFlags srcAccessMask,
 	VkAccessFlags dstAccessMask,
-	VkBuffer buffer, VkDeviceSize bufferSize) {
+	VkBuffer buffer, VkDeviceSize bufferSize,
+	uint32_t srcQueueFamily, uint32_t dstQueueFamily) {
 
 	VkBufferMemoryBarrier barrier = {};
 	barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
 	barrier.pNext = nullptr;
 	barrier.srcAccessMask = srcAccessMask;
 	barrier.dstAccessMask = dstAccessMask;
-	barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-	barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-	barrier.buffer = sbo.lightGrid.buffer;
+	barrier.srcQueueFamilyIndex = srcQueueFamily;
+	barrier.dstQueueFamilyIndex = dstQueueFamily;
+	barrier.buffer = buffer;
 	barrier.offset = 0;
-	barrier.size = sbo.lightGrid.allocSize;
+	barrier.size = bufferSize;
 
 	return barrier;
 }
@@ -39,7 +40,15 @@ VkPipelineShaderStageCreateInfo VulkanBaseApplication::loadShader(
 	int shaderModuleIndex) {
 
 	VkPipelineShaderStageCreateInfo shaderStage = {};
-	std::vector<char> codes = readFile(fileName);
+	std::vector<char> codes;
+	std::string log;
+	if (!shaderCompiler.compile(fileName, stage, ShaderDefines(), codes, log)) {
+		// compiled by the build
+		if (!log.empty()) {
+			std::cout << "failed to compile " << fileName << ", using the prebuilt spir-v:\n" << log << std::endl;
+		}
+		codes = readFile(fileName + ".spv");
+	}
 	createShaderModule(codes, shaderModules[shaderModuleIndex]);
 
 	shaderStage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
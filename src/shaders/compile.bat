@@ -6,4 +6,11 @@ glslangvalidator -V axis.frag -o axis.frag.spv
 glslangvalidator -V quad.frag -o quad.frag.spv
 glslangvalidator -V computeLightList.comp -o computeLightList.comp.spv
 glslangvalidator -V computeFrustumGrid.comp -o computeFrustumGrid.comp.spv
+glslangvalidator -V selectLod.comp -o selectLod.comp.spv
+glslangvalidator -V depth_alpha.frag -o depth_alpha.frag.spv
+glslangvalidator -V updateLights.comp -o updateLights.comp.spv
+glslangvalidator -V computeLightListCooperative.comp -o computeLightListCooperative.comp.spv
+glslangvalidator -V binLights.comp -o binLights.comp.spv
+glslangvalidator -V composite.vert -o composite.vert.spv
+glslangvalidator -V composite.frag -o composite.frag.spv
 pause
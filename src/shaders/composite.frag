@@ -0,0 +1,21 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+// 1 for the lit scene, 0 for the debug views, which are shown as they are
+layout(constant_id = 0) const int COLOR_CORRECTION = 1;
+
+// scene color of the first subpass, only the same pixel can be read
+layout(input_attachment_index = 0, binding = 0) uniform subpassInput sceneColor;
+
+layout(location = 0) out vec4 outColor;
+
+
+void main() {
+    vec3 color = subpassLoad(sceneColor).rgb;
+
+    //gama correction
+    if (COLOR_CORRECTION != 0) {
+        color = sqrt(pow(color * color, vec3(1.0 / 1.6)));
+    }
+    outColor = vec4(color, 1.0);
+}
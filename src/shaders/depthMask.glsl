@@ -0,0 +1,23 @@
+// 2.5D culling shared by the light culling kernels, the unexpanded depth range
+// of a tile [maskFar, maskNear] split into DEPTH_MASK_BINS bins.
+// Same as TileDepthMask / LightCulling::lightDepthMask
+
+#define DEPTH_MASK_BINS 32
+
+int DepthMaskBin(float z, float maskFar, float maskScale) {
+	return clamp(int((z - maskFar) * maskScale), 0, DEPTH_MASK_BINS - 1);
+}
+
+// bins covered by the depth extent of the bounding sphere, 0 outside the range
+uint LightDepthMask(vec4 sphere, float maskFar, float maskNear, float maskScale) {
+	float lightFar = sphere.z - sphere.w;
+	float lightNear = sphere.z + sphere.w;
+	if (lightNear < maskFar || lightFar > maskNear) {
+		return 0u;
+	}
+
+	int first = DepthMaskBin(lightFar, maskFar, maskScale);
+	int last = DepthMaskBin(lightNear, maskFar, maskScale);
+	uint upTo = last == DEPTH_MASK_BINS - 1 ? 0xFFFFFFFFu : (1u << (last + 1)) - 1u;
+	return upTo & ~((1u << first) - 1u);
+}
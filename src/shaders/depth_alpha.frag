@@ -0,0 +1,14 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+#extension GL_ARB_shading_language_420pack : enable
+
+// depth prepass for alpha-tested materials, only the diffuse alpha matters
+layout(binding = 11) uniform sampler2D texColorSampler;
+
+layout(location = 1) in vec2 fragTexCoord;
+
+void main() {
+    // same threshold as final_shading.frag
+    if(texture(texColorSampler, fragTexCoord).w < 0.1)
+        discard;
+}
@@ -5,13 +5,22 @@
 #define PIXELS_PER_TILE 16
 
 
+#define MAX_NUM_LIGHTS 100000
 #define MAX_NUM_LIGHTS_PER_TILE 128
 
-struct Light {
-	vec4 beginPos; // beginPos.w is intensity
-	vec4 endPos; // endPos.w is radius
-	vec4 color; // color.w is t
-};
+// keep in sync with LightType in LightCulling.h
+#define LIGHT_POINT 0
+#define LIGHT_SPOT 1
+#define LIGHT_TUBE 2
+#define LIGHT_RECT 3
+
+// shading variant, see VulkanBaseApplication::createShadingVariants.
+// Material maps are 1 = on, 0 = off, -1 = read the flag from the material,
+// branches on the constants are folded when the pipeline is created
+layout(constant_id = 0) const int USE_TEXTURE_MAP = -1;
+layout(constant_id = 1) const int USE_NORM_MAP = -1;
+layout(constant_id = 2) const int USE_SPEC_MAP = -1;
+layout(constant_id = 3) const int DEBUG_MODE = 0;
 
 struct Frustum {
     vec4 planes[4];
@@ -40,9 +49,21 @@ layout(binding = 11) uniform sampler2D texColorSampler;
 layout(binding = 12) uniform sampler2D texNormalSampler;
 layout(binding = 13) uniform sampler2D texSpecularSampler;
 
-layout(binding = 3) buffer Lights {
-    Light lights[];
-};
+// light shading streams, color.w is intensity
+layout(std430, binding = 3) readonly buffer Lights {
+    vec4 beginPos[MAX_NUM_LIGHTS];
+    vec4 endPos[MAX_NUM_LIGHTS];
+    vec4 color[MAX_NUM_LIGHTS];
+    vec4 direction[MAX_NUM_LIGHTS]; // spot axis, tube half segment, rect normal
+    vec4 shape[MAX_NUM_LIGHTS]; // spot (cos outer, cos inner), rect (half width tangent, half height)
+    int type[MAX_NUM_LIGHTS];
+} lights;
+
+// animated lights, positions.w is radius
+layout(std430, binding = 16) readonly buffer LightInstances {
+    vec4 cullSpheres[MAX_NUM_LIGHTS];
+    vec4 positions[MAX_NUM_LIGHTS];
+} lightInstances;
 
 layout(binding = 5) buffer Frustums {
     Frustum frustums[];
@@ -72,14 +93,17 @@ layout(location = 2) in vec3 fragNormal;
 layout(location = 3) in vec3 fragPosWorldSpace;
 layout(location = 4) in vec3 fragPosViewSpace;
 layout(location = 5) in vec3 cameraPosWorldSpace;
-layout(location = 6) in mat3 TBN;
+layout(location = 6) in vec4 fragTangent;
 
 layout(location = 0) out vec4 outColor;
 
-// apply normal map
-vec3 applyNormalMap(mat3 TBN, vec3 normap) {
+// apply normal map, TBN from the interpolated vertex tangent frame
+vec3 applyNormalMap(vec3 N, vec4 T, vec3 normap) {
+    N = normalize(N);
+    vec3 tangent = normalize(T.xyz - N * dot(N, T.xyz));
+    vec3 bitangent = cross(N, tangent) * T.w;
     normap = normap * 2.0 - 1.0;
-    vec3 mappedNor = TBN * normap;
+    vec3 mappedNor = mat3(tangent, bitangent, N) * normap;
     return normalize(mappedNor);
 }
 
@@ -97,7 +121,11 @@ void main() {
 
     vec3 diffuseColor = ubo_mat.material.diffuse.xyz;
     float alpha = 1.0f;
-    if(ubo_mat.material.useTextureMap > 0)
+    bool useTextureMap = USE_TEXTURE_MAP < 0 ? ubo_mat.material.useTextureMap > 0 : USE_TEXTURE_MAP > 0;
+    bool useNormMap = USE_NORM_MAP < 0 ? ubo_mat.material.useNormMap > 0 : USE_NORM_MAP > 0;
+    bool useSpecMap = USE_SPEC_MAP < 0 ? ubo_mat.material.useSpecMap > 0 : USE_SPEC_MAP > 0;
+
+    if(useTextureMap)
     {
         vec4 tex4 = texture(texColorSampler, fragTexCoord);
         alpha = tex4.w;
@@ -106,13 +134,13 @@ void main() {
 
     vec3 normal = fragNormal;
     vec3 normalMap = vec3(0,0,0);
-    if(ubo_mat.material.useNormMap > 0) {
+    if(useNormMap) {
         normalMap = texture(texNormalSampler, fragTexCoord).xyz;
-        normal = applyNormalMap(TBN, normalMap);
+        normal = applyNormalMap(fragNormal, fragTangent, normalMap);
     }
 
     vec3 specularColor = vec3(0,0,0);
-    if(ubo_mat.material.useSpecMap > 0)
+    if(useSpecMap)
         specularColor = texture(texSpecularSampler, fragTexCoord).xyz;
 
     vec3 ambientColor = ubo_mat.material.ambient.xyz * diffuseColor;
@@ -125,21 +153,44 @@ void main() {
     for(int i = 0; i < lightNum; ++i) {
         int lightIndex = lightIndices[i + lightIndexBegin];
 
-        Light currentLight = lights[lightIndex];
+        vec4 lightPosRadius = lightInstances.positions[lightIndex];
+        vec4 lightColorIntensity = lights.color[lightIndex];
+
+        vec3 lightPos = lightPosRadius.xyz;
+        vec3 lightColor = lightColorIntensity.xyz;
+        float lightIntensity = lightColorIntensity.w;
+        float lightRadius = lightPosRadius.w;
+
+        // area lights are shaded from their closest point (representative point)
+        int lightType = lights.type[lightIndex];
+        if (lightType == LIGHT_TUBE) {
+            vec3 halfSegment = lights.direction[lightIndex].xyz;
+            float h = clamp(dot(fragPosWorldSpace - lightPos, halfSegment) / dot(halfSegment, halfSegment), -1.0, 1.0);
+            lightPos += h * halfSegment;
+        }
+        else if (lightType == LIGHT_RECT) {
+            vec3 rectNormal = lights.direction[lightIndex].xyz;
+            vec4 rectShape = lights.shape[lightIndex];
+            vec3 toFrag = fragPosWorldSpace - lightPos;
+            if (dot(toFrag, rectNormal) <= 0.0) {
+                continue; // one sided
+            }
+            float halfWidth = length(rectShape.xyz);
+            vec3 tangent = rectShape.xyz / halfWidth;
+            vec3 bitangent = cross(rectNormal, tangent);
+            lightPos += clamp(dot(toFrag, tangent), -halfWidth, halfWidth) * tangent
+                + clamp(dot(toFrag, bitangent), -rectShape.w, rectShape.w) * bitangent;
+        }
 
-		vec3 beginPos = currentLight.beginPos.xyz;
-		vec3 endPos = currentLight.endPos.xyz;
-		float t = sin(params.time * lightIndex * .001f);
-        
-        vec3 lightPos = (1 - t) * beginPos + t * endPos;
-        vec3 lightColor = currentLight.color.xyz;
         vec3 lightDir = lightPos - fragPosWorldSpace;
-        float lightIntensity = currentLight.beginPos.w;
-        float lightRadius = currentLight.endPos.w;
-
         float dist = length(lightDir);
         lightDir = lightDir/dist;
 
+        if (lightType == LIGHT_SPOT) {
+            vec2 spotCos = lights.shape[lightIndex].xy;
+            lightIntensity *= smoothstep(spotCos.x, spotCos.y, dot(-lightDir, lights.direction[lightIndex].xyz));
+        }
+
         float NdotL = max(0, dot(normal, lightDir));
 
         vec3 halfDir = normalize(lightDir + viewDir);
@@ -156,13 +207,10 @@ void main() {
     finalColor += ambientColor * 0.5;
     //outColor = vec4(finalColor, 1.0);
 
-    //gama correction
-    vec3 correctedColor = finalColor * finalColor;
-    correctedColor = sqrt(pow(correctedColor, vec3(1.0 / 1.6)));
-
-    switch(params.debugMode){
+    // linear, the composite subpass does the gamma correction (composite.frag)
+    switch(DEBUG_MODE){
         case 0: // basic lighting
-            outColor = vec4(correctedColor, 1.0);
+            outColor = vec4(finalColor, 1.0);
             break;
 
         case 1: // texture map
@@ -210,7 +258,7 @@ void main() {
             break;
 
         default:
-            outColor = vec4(correctedColor, 1.0);
+            outColor = vec4(finalColor, 1.0);
             break;
 
     }
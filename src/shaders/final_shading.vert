@@ -12,6 +12,7 @@ layout(location = 0) in vec3 inPosition;
 layout(location = 1) in vec3 inColor;
 layout(location = 2) in vec2 inTexCoord;
 layout(location = 3) in vec3 inNormal;
+layout(location = 4) in vec4 inTangent; // w = bitangent sign
 
 layout(location = 0) out vec3 fragColor;
 layout(location = 1) out vec2 fragTexCoord;
@@ -19,20 +20,15 @@ layout(location = 2) out vec3 fragNormal;
 layout(location = 3) out vec3 fragPosWorldSpace;
 layout(location = 4) out vec3 fragPosViewSpace;
 layout(location = 5) out vec3 cameraPosWorldSpace;
-layout(location = 6) out mat3 TBN;
+layout(location = 6) out vec4 fragTangent;
 
 
 out gl_PerVertex {
     vec4 gl_Position;
 };
 
-mat3 getTBN(vec3 geomnor)
-{
-    vec3 up = vec3(0.001, 1.0, 0.001);
-    vec3 tangent = normalize(cross(geomnor, up));
-    vec3 bitangent = cross(geomnor, tangent);
-    return mat3(tangent, bitangent, geomnor);
-}
+// the shading pass depth tests EQUAL against the prepass
+invariant gl_Position;
 
 void main() {
    
@@ -51,5 +47,6 @@ void main() {
 
     cameraPosWorldSpace = ubo.cameraPos.xyz;
 
-    TBN = getTBN(inNormal);
+    // tangent frame is precomputed at load time
+    fragTangent = inTangent;
 }
\ No newline at end of file
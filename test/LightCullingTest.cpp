@@ -0,0 +1,354 @@
+#include "LightCulling.h"
+#include "MeshTools.h"
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <vector>
+#include <algorithm>
+#include <iostream>
+#include <cmath>
+#include <cstdint>
+
+/************************************************************/
+//			Checks of the CPU culling paths on fixed inputs
+/************************************************************/
+
+namespace {
+
+	const int WIDTH = 640;
+	const int HEIGHT = 360;
+	const int PIXELS_PER_TILE = 16;
+	const int MAX_LIGHTS_PER_TILE = 1024;
+	const int TILES_PER_SUPERTILE = 16;
+	const int NUM_LIGHTS = 512;
+
+	int failures = 0;
+
+	void check(bool condition, const char * what) {
+		if (!condition) {
+			std::cout << "FAILED: " << what << std::endl;
+			failures++;
+		}
+	}
+
+	// fixed sequence on every platform, unlike the std distributions
+	struct Random {
+		uint32_t state;
+
+		explicit Random(uint32_t seed) : state(seed) {}
+
+		float next() {
+			state = state * 1664525u + 1013904223u;
+			return float(state >> 8) / float(1 << 24);
+		}
+
+		float range(float lo, float hi) {
+			return lo + (hi - lo) * next();
+		}
+	};
+
+	// same projection as the application, vulkan flips y
+	glm::mat4 projection() {
+		glm::mat4 proj = glm::perspective(glm::radians(45.0f), WIDTH / float(HEIGHT), 50.0f, 3000.0f);
+		proj[1][1] *= -1;
+		return proj;
+	}
+
+	glm::ivec2 tileCounts() {
+		return glm::ivec2((WIDTH + PIXELS_PER_TILE - 1) / PIXELS_PER_TILE, (HEIGHT + PIXELS_PER_TILE - 1) / PIXELS_PER_TILE);
+	}
+
+	// far wall with a band of near pillars, so some tiles have a depth gap for the masks
+	std::vector<float> makeDepth(const glm::mat4 & proj) {
+		std::vector<float> depth(WIDTH * HEIGHT);
+		for (int y = 0; y < HEIGHT; ++y) {
+			for (int x = 0; x < WIDTH; ++x) {
+				float viewDepth = 600.0f + 2000.0f * y / float(HEIGHT);
+				if ((x / 24) % 4 == 0) {
+					viewDepth = 300.0f;
+				}
+				glm::vec4 clip = proj * glm::vec4(0.0f, 0.0f, -viewDepth, 1.0f);
+				depth[y * WIDTH + x] = clip.z / clip.w;
+			}
+		}
+		return depth;
+	}
+
+	// lights of every type directly in view space (identity view), bounding spheres
+	// fully in front of the eye. The supertile pre-cull differs from the flat loop for
+	// spheres that reach behind the eye plane, which is covered by the gpu comparison only
+	std::vector<LightCullShape> makeLights(std::vector<glm::vec4> & worldSpheres) {
+		Random random(1234);
+		std::vector<LightCullShape> lights;
+		while ((int)lights.size() < NUM_LIGHTS) {
+			glm::vec3 position(random.range(-1200.0f, 1200.0f), random.range(-700.0f, 700.0f), random.range(-2800.0f, -150.0f));
+			float radius = random.range(50.0f, 300.0f);
+			float kind = random.next();
+			int type = LIGHT_POINT;
+			glm::vec4 direction(0.0f);
+			glm::vec4 shape(0.0f);
+			if (kind < 0.25f) {
+				float outer = glm::radians(random.range(20.0f, 45.0f));
+				type = LIGHT_SPOT;
+				direction = glm::vec4(glm::normalize(glm::vec3(random.range(-0.5f, 0.5f), -1.0f, random.range(-0.5f, 0.5f))), 0.0f);
+				shape = glm::vec4(std::cos(outer), std::cos(outer * 0.8f), 0.0f, 0.0f);
+			} else if (kind < 0.35f) {
+				type = LIGHT_TUBE;
+				direction = glm::vec4(glm::normalize(glm::vec3(random.range(-0.5f, 0.5f), 0.0f, random.range(-0.5f, 0.5f))) * random.range(10.0f, 50.0f), 0.0f);
+			} else if (kind < 0.45f) {
+				glm::vec3 normal = glm::normalize(glm::vec3(random.range(-0.5f, 0.5f), -2.0f, random.range(-0.5f, 0.5f)));
+				glm::vec3 tangent = glm::normalize(glm::cross(normal, glm::vec3(0.0f, 0.0f, 1.0f)));
+				type = LIGHT_RECT;
+				direction = glm::vec4(normal, 0.0f);
+				shape = glm::vec4(tangent * random.range(10.0f, 40.0f), random.range(10.0f, 40.0f));
+			}
+
+			LightCullShape light = LightCulling::computeCullShape(type, position, radius, direction, shape, glm::mat4(1.0f));
+			if (light.sphere.z + light.sphere.w >= 0.0f) {
+				continue;
+			}
+			lights.push_back(light);
+			worldSpheres.push_back(light.sphere);
+		}
+		return lights;
+	}
+
+	// sorted light list of a tile, the cullers differ in the order
+	std::vector<int> tileList(const std::vector<int> & lightIndex, const std::vector<int> & lightGrid, size_t tile) {
+		std::vector<int> list(lightIndex.begin() + tile * MAX_LIGHTS_PER_TILE, lightIndex.begin() + tile * MAX_LIGHTS_PER_TILE + lightGrid[tile]);
+		std::sort(list.begin(), list.end());
+		return list;
+	}
+
+	struct Lists {
+		std::vector<int> lightIndex;
+		std::vector<int> lightGrid;
+
+		uint64_t entries() const {
+			uint64_t sum = 0;
+			for (int count : lightGrid) {
+				sum += count;
+			}
+			return sum;
+		}
+	};
+
+	bool sameLists(const Lists & a, const Lists & b) {
+		for (size_t tile = 0; tile < a.lightGrid.size(); ++tile) {
+			if (tileList(a.lightIndex, a.lightGrid, tile) != tileList(b.lightIndex, b.lightGrid, tile)) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	bool containsLists(const Lists & outer, const Lists & inner) {
+		for (size_t tile = 0; tile < inner.lightGrid.size(); ++tile) {
+			std::vector<int> o = tileList(outer.lightIndex, outer.lightGrid, tile);
+			std::vector<int> i = tileList(inner.lightIndex, inner.lightGrid, tile);
+			if (!std::includes(o.begin(), o.end(), i.begin(), i.end())) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	void testFrustumWinding() {
+		glm::mat4 inverseProj = glm::inverse(projection());
+		glm::ivec2 numTiles = tileCounts();
+		std::vector<TileFrustum> frustums;
+		LightCulling::computeTileFrustums(inverseProj, glm::vec2(WIDTH, HEIGHT), numTiles, PIXELS_PER_TILE, frustums);
+
+		// the view ray through a tile center is inside all planes of its tile and
+		// outside one plane of every neighbour
+		int inside = 0;
+		int outsideNeighbours = 0;
+		int neighbours = 0;
+		for (int y = 0; y < numTiles.y; ++y) {
+			for (int x = 0; x < numTiles.x; ++x) {
+				glm::vec2 texcoord = (glm::vec2(x, y) + 0.5f) * float(PIXELS_PER_TILE) / glm::vec2(WIDTH, HEIGHT);
+				glm::vec4 view = inverseProj * glm::vec4(texcoord.x * 2.0f - 1.0f, (1.0f - texcoord.y) * 2.0f - 1.0f, 0.5f, 1.0f);
+				glm::vec3 point = glm::vec3(view) / view.w;
+
+				auto insideTile = [&](int tx, int ty) {
+					const TileFrustum & frustum = frustums[ty * numTiles.x + tx];
+					for (int i = 0; i < 4; ++i) {
+						if (glm::dot(glm::vec3(frustum.planes[i]), point) - frustum.planes[i].w < 0.0f) {
+							return false;
+						}
+					}
+					return true;
+				};
+				inside += insideTile(x, y);
+
+				const glm::ivec2 offsets[4] = { { -1, 0 }, { 1, 0 }, { 0, -1 }, { 0, 1 } };
+				for (const glm::ivec2 & offset : offsets) {
+					glm::ivec2 n = glm::ivec2(x, y) + offset;
+					if (n.x >= 0 && n.y >= 0 && n.x < numTiles.x && n.y < numTiles.y) {
+						neighbours++;
+						outsideNeighbours += !insideTile(n.x, n.y);
+					}
+				}
+			}
+		}
+		check(inside == numTiles.x * numTiles.y, "tile centers are inside their tile frustum");
+		check(outsideNeighbours == neighbours, "tile centers are outside the neighbouring tile frustums");
+	}
+
+	void testProjectSphereToTiles() {
+		glm::mat4 inverseProj = glm::inverse(projection());
+		glm::ivec2 numTiles = tileCounts();
+		glm::vec2 screen(WIDTH, HEIGHT);
+		glm::ivec4 rect;
+
+		// centered sphere, symmetric rect around the middle of the screen
+		bool onScreen = LightCulling::projectSphereToTiles(glm::vec4(0.0f, 0.0f, -1000.0f, 100.0f), inverseProj, screen, numTiles, PIXELS_PER_TILE, rect);
+		check(onScreen, "centered sphere is on screen");
+		check(rect.x + rect.z == numTiles.x - 1 && rect.x > 0, "centered sphere rect is symmetric in x");
+		check(rect.y <= numTiles.y / 2 && rect.w >= (numTiles.y - 1) / 2 && rect.y > 0, "centered sphere rect covers the middle rows");
+
+		// sphere containing the eye covers the whole screen
+		onScreen = LightCulling::projectSphereToTiles(glm::vec4(0.0f, 0.0f, -10.0f, 50.0f), inverseProj, screen, numTiles, PIXELS_PER_TILE, rect);
+		check(onScreen && rect == glm::ivec4(0, 0, numTiles.x - 1, numTiles.y - 1), "sphere around the eye covers every tile");
+
+		// far to the side
+		onScreen = LightCulling::projectSphereToTiles(glm::vec4(5000.0f, 0.0f, -1000.0f, 100.0f), inverseProj, screen, numTiles, PIXELS_PER_TILE, rect);
+		check(!onScreen, "sphere outside the view is off screen");
+
+		// above the center, rows count from the bottom
+		onScreen = LightCulling::projectSphereToTiles(glm::vec4(0.0f, 300.0f, -1000.0f, 50.0f), inverseProj, screen, numTiles, PIXELS_PER_TILE, rect);
+		check(onScreen && rect.y > numTiles.y / 2, "sphere above the center maps to the upper rows");
+
+		// every tile whose frustum touches a sphere is inside its rect
+		std::vector<TileFrustum> frustums;
+		LightCulling::computeTileFrustums(inverseProj, screen, numTiles, PIXELS_PER_TILE, frustums);
+		std::vector<glm::vec2> fullRange(frustums.size(), glm::vec2(0.0f, -1000000.0f));
+		Random random(99);
+		int missed = 0;
+		for (int i = 0; i < 200; ++i) {
+			LightCullShape light;
+			light.type = LIGHT_POINT;
+			light.sphere = glm::vec4(random.range(-1500.0f, 1500.0f), random.range(-900.0f, 900.0f), random.range(-2500.0f, -100.0f), random.range(10.0f, 300.0f));
+			bool visible = LightCulling::projectSphereToTiles(light.sphere, inverseProj, screen, numTiles, PIXELS_PER_TILE, rect);
+			for (int y = 0; y < numTiles.y; ++y) {
+				for (int x = 0; x < numTiles.x; ++x) {
+					size_t tile = y * numTiles.x + x;
+					if (LightCulling::lightInsideFrustum(light, frustums[tile], fullRange[tile].x, fullRange[tile].y)
+						&& (!visible || x < rect.x || x > rect.z || y < rect.y || y > rect.w)) {
+						missed++;
+					}
+				}
+			}
+		}
+		check(missed == 0, "sphere rects contain every tile the frustum test accepts");
+	}
+
+	void testCullers() {
+		glm::mat4 proj = projection();
+		glm::mat4 inverseProj = glm::inverse(proj);
+		glm::ivec2 numTiles = tileCounts();
+		glm::vec2 screen(WIDTH, HEIGHT);
+
+		std::vector<TileFrustum> frustums;
+		LightCulling::computeTileFrustums(inverseProj, screen, numTiles, PIXELS_PER_TILE, frustums);
+		std::vector<glm::vec2> depthRanges;
+		std::vector<TileDepthMask> depthMasks;
+		LightCulling::computeTileDepthRanges(makeDepth(proj), WIDTH, HEIGHT, inverseProj, numTiles, PIXELS_PER_TILE, depthRanges, &depthMasks);
+
+		std::vector<glm::vec4> worldSpheres;
+		std::vector<LightCullShape> lights = makeLights(worldSpheres);
+		LightBvh bvh;
+		LightCulling::buildLightBvh(worldSpheres, glm::mat4(1.0f), bvh);
+
+		for (int masked = 0; masked < 2; ++masked) {
+			const std::vector<TileDepthMask> * masks = masked ? &depthMasks : nullptr;
+			Lists linear, bvhLists, supertile, binned;
+			LightCulling::cullTiles(lights, frustums, depthRanges, MAX_LIGHTS_PER_TILE, linear.lightIndex, linear.lightGrid, masks);
+			LightCulling::cullTilesBvh(lights, bvh, frustums, depthRanges, MAX_LIGHTS_PER_TILE, bvhLists.lightIndex, bvhLists.lightGrid, masks);
+			LightCulling::cullTilesSupertile(lights, frustums, depthRanges, numTiles, TILES_PER_SUPERTILE, MAX_LIGHTS_PER_TILE, supertile.lightIndex, supertile.lightGrid, masks);
+			LightCulling::cullTilesBinned(lights, frustums, depthRanges, inverseProj, screen, numTiles, PIXELS_PER_TILE, MAX_LIGHTS_PER_TILE, binned.lightIndex, binned.lightGrid, masks);
+
+			std::cout << (masked ? "with depth masks" : "min/max depth") << ": linear " << linear.entries() << ", bvh " << bvhLists.entries()
+				<< ", supertile " << supertile.entries() << ", binned " << binned.entries() << " light entries" << std::endl;
+
+			check(linear.entries() > 0, "the scene puts lights into tiles");
+			check(sameLists(bvhLists, linear), masked ? "bvh lists match linear with masks" : "bvh lists match linear");
+			check(sameLists(supertile, linear), masked ? "supertile lists match linear with masks" : "supertile lists match linear");
+			// the screen rect is looser than the 4 planes, never tighter
+			check(containsLists(binned, linear), masked ? "binned lists contain linear with masks" : "binned lists contain linear");
+		}
+
+		Lists unmasked, masked;
+		LightCulling::cullTiles(lights, frustums, depthRanges, MAX_LIGHTS_PER_TILE, unmasked.lightIndex, unmasked.lightGrid);
+		LightCulling::cullTiles(lights, frustums, depthRanges, MAX_LIGHTS_PER_TILE, masked.lightIndex, masked.lightGrid, &depthMasks);
+		check(containsLists(unmasked, masked) && masked.entries() < unmasked.entries(), "depth masks only remove lights");
+	}
+
+	void testAnimatedPositionError() {
+		// float animation against a double precision reference, for long run times and high seeds
+		Random random(7);
+		int outside = 0;
+		for (int i = 0; i < 1000; ++i) {
+			glm::vec3 beginPos(random.range(-2500.0f, 2500.0f), random.range(100.0f, 600.0f), random.range(-250.0f, 250.0f));
+			glm::vec3 endPos(beginPos.x, random.range(-10.0f, 0.0f), beginPos.z);
+			float time = random.range(0.0f, 36000.0f);
+			float seed = float(int(random.range(0.0f, 100000.0f)));
+
+			double t = std::sin(double(time) * double(seed) * 0.001);
+			glm::dvec3 reference = (1.0 - t) * glm::dvec3(beginPos) + t * glm::dvec3(endPos);
+			double distance = glm::length(glm::dvec3(LightCulling::animatedPosition(beginPos, endPos, time, seed)) - reference);
+			outside += distance > LightCulling::animatedPositionError(beginPos, endPos, time, seed);
+		}
+		check(outside == 0, "animated positions stay within the error bound");
+	}
+
+	void testEstimateOverdraw() {
+		const int width = 32;
+		const int height = 16;
+		const uint64_t pixels = width * height;
+
+		// two screen covering triangles at different depths, front facing in vulkan
+		auto screenTriangle = [](float z, std::vector<glm::vec3> & positions) {
+			positions.push_back(glm::vec3(-1.0f, -1.0f, z));
+			positions.push_back(glm::vec3(-1.0f, 3.0f, z));
+			positions.push_back(glm::vec3(3.0f, -1.0f, z));
+		};
+		std::vector<glm::vec3> backToFront;
+		screenTriangle(0.75f, backToFront);
+		screenTriangle(0.25f, backToFront);
+		std::vector<glm::vec3> frontToBack;
+		screenTriangle(0.25f, frontToBack);
+		screenTriangle(0.75f, frontToBack);
+		std::vector<uint32_t> indices = { 0, 1, 2, 3, 4, 5 };
+
+		OverdrawStats stats = MeshTools::estimateOverdraw(backToFront, indices, glm::mat4(1.0f), width, height);
+		check(stats.rasterized == 2 * pixels, "back to front rasterizes both layers");
+		check(stats.shadedLess == 2 * pixels, "back to front shades both layers without a prepass");
+		check(stats.shadedEqual == pixels, "the prepass shades every pixel once");
+		check(stats.coveredPixels == pixels, "the triangles cover the screen");
+
+		stats = MeshTools::estimateOverdraw(frontToBack, indices, glm::mat4(1.0f), width, height);
+		check(stats.shadedLess == pixels, "front to back shades every pixel once");
+		check(stats.shadedEqual == pixels, "the prepass does not depend on the order");
+
+		// reversed winding is culled
+		std::vector<uint32_t> backFacing = { 0, 2, 1 };
+		stats = MeshTools::estimateOverdraw(backToFront, backFacing, glm::mat4(1.0f), width, height);
+		check(stats.rasterized == 0, "back facing triangles are culled");
+	}
+}
+
+int main() {
+	testFrustumWinding();
+	testProjectSphereToTiles();
+	testCullers();
+	testAnimatedPositionError();
+	testEstimateOverdraw();
+
+	if (failures > 0) {
+		std::cout << failures << " checks failed" << std::endl;
+		return 1;
+	}
+	std::cout << "all checks passed" << std::endl;
+	return 0;
+}